@@ -37,7 +37,7 @@
  *  @param  proto  the desired protocol
  *  @return length of the encoded APDU
  */
-static size_t sc_apdu_get_length(const sc_apdu_t *apdu, unsigned int proto)
+size_t sc_apdu_get_length(const sc_apdu_t *apdu, unsigned int proto)
 {
 	size_t ret = 4;
 
@@ -172,7 +172,12 @@ static int sc_apdu2bytes(sc_context_t *ctx, const sc_apdu_t *apdu,
 void sc_apdu_log(sc_context_t *ctx, int level, const u8 *data, size_t len, int is_out)
 {
 	size_t blen = len * 5 + 128;
-	char   *buf = malloc(blen);
+	char   *buf;
+
+	/* don't allocate the hex dump buffer for nothing */
+	if (ctx == NULL || ctx->debug < level)
+		return;
+	buf = malloc(blen);
 	if (buf == NULL)
 		return;
 
@@ -203,14 +208,101 @@ int sc_apdu_get_octets(sc_context_t *ctx, const sc_apdu_t *apdu, u8 **buf,
 	if (nbuf == NULL)
 		return SC_ERROR_OUT_OF_MEMORY;
 	/* encode the APDU in the buffer */
-	if (sc_apdu2bytes(ctx, apdu, proto, nbuf, nlen) != SC_SUCCESS)
+	if (sc_apdu2bytes(ctx, apdu, proto, nbuf, nlen) != SC_SUCCESS) {
+		free(nbuf);
 		return SC_ERROR_INTERNAL;
+	}
 	*buf = nbuf;
 	*len = nlen;
 
 	return SC_SUCCESS;
 }
 
+int sc_apdu_get_octets_buf(sc_context_t *ctx, const sc_apdu_t *apdu, u8 *buf,
+	size_t buflen, size_t *len, unsigned int proto)
+{
+	size_t	nlen;
+
+	if (apdu == NULL || buf == NULL || len == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	nlen = sc_apdu_get_length(apdu, proto);
+	if (nlen == 0)
+		return SC_ERROR_INTERNAL;
+	if (nlen > buflen)
+		return SC_ERROR_BUFFER_TOO_SMALL;
+	if (sc_apdu2bytes(ctx, apdu, proto, buf, buflen) != SC_SUCCESS)
+		return SC_ERROR_INTERNAL;
+	*len = nlen;
+
+	return SC_SUCCESS;
+}
+
+int sc_reader_get_buffers(sc_reader_t *reader, size_t ssize, size_t rsize,
+	u8 **sbuf, u8 **rbuf)
+{
+	int r;
+
+	if (reader == NULL || sbuf == NULL || rbuf == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	r = sc_mutex_lock(reader->ctx, reader->buf_mutex);
+	if (r != SC_SUCCESS)
+		return r;
+
+	if (reader->buf == NULL || ssize > reader->buf_send_len || rsize > reader->buf_recv_len) {
+		size_t slen, rlen;
+		u8 *p;
+
+		/* size the buffers for the largest APDU the reader driver
+		 * accepts, they only grow for extended APDUs beyond that */
+		slen = SC_MAX_APDU_BUFFER_SIZE;
+		if (reader->driver && reader->driver->max_send_size + 9 > slen)
+			slen = reader->driver->max_send_size + 9;
+		rlen = SC_MAX_APDU_BUFFER_SIZE;
+		if (reader->driver && reader->driver->max_recv_size + 2 > rlen)
+			rlen = reader->driver->max_recv_size + 2;
+		if (slen < reader->buf_send_len)
+			slen = reader->buf_send_len;
+		if (rlen < reader->buf_recv_len)
+			rlen = reader->buf_recv_len;
+		if (slen < ssize)
+			slen = ssize;
+		if (rlen < rsize)
+			rlen = rsize;
+
+		p = malloc(slen + rlen);
+		if (p == NULL) {
+			sc_mutex_unlock(reader->ctx, reader->buf_mutex);
+			return SC_ERROR_OUT_OF_MEMORY;
+		}
+		/* the old buffers were wiped after each use */
+		free(reader->buf);
+		reader->buf = p;
+		reader->buf_send_len = slen;
+		reader->buf_recv_len = rlen;
+	}
+
+	*sbuf = reader->buf;
+	*rbuf = reader->buf + reader->buf_send_len;
+	return SC_SUCCESS;
+}
+
+void sc_reader_put_buffers(sc_reader_t *reader, size_t sused, size_t rused)
+{
+	if (reader == NULL || reader->buf == NULL)
+		return;
+
+	if (sused > reader->buf_send_len)
+		sused = reader->buf_send_len;
+	if (rused > reader->buf_recv_len)
+		rused = reader->buf_recv_len;
+	sc_mem_clear(reader->buf, sused);
+	sc_mem_clear(reader->buf + reader->buf_send_len, rused);
+
+	sc_mutex_unlock(reader->ctx, reader->buf_mutex);
+}
+
 int sc_apdu_set_resp(sc_context_t *ctx, sc_apdu_t *apdu, const u8 *buf,
 	size_t len)
 {
@@ -371,6 +463,173 @@ sc_detect_apdu_cse(const sc_card_t *card, sc_apdu_t *apdu)
 }
 
 
+/*********************************************************************/
+/*   APDU statistics                                                 */
+/*********************************************************************/
+
+#define SC_APDU_STATS_KEYS	512
+
+/* returns the statistics entry of the APDU CLA/INS, or NULL if out of memory;
+ * the caller holds card->mutex */
+static struct sc_apdu_stats *
+sc_apdu_stats_entry(struct sc_card *card, const struct sc_apdu *apdu)
+{
+	unsigned int key = ((apdu->cla & 0x80) ? 0x100 : 0) | apdu->ins;
+	struct sc_apdu_stats *st;
+
+	if (card->apdu_stats == NULL)   {
+		card->apdu_stats = calloc(SC_APDU_STATS_KEYS, sizeof(struct sc_apdu_stats *));
+		if (card->apdu_stats == NULL)
+			return NULL;
+	}
+
+	st = card->apdu_stats[key];
+	if (st == NULL)   {
+		st = calloc(1, sizeof(struct sc_apdu_stats));
+		if (st == NULL)
+			return NULL;
+		st->cla = apdu->cla & 0x80;
+		st->ins = apdu->ins;
+		card->apdu_stats[key] = st;
+	}
+	return st;
+}
+
+
+static int
+sc_apdu_stats_sw_class(unsigned int sw1)
+{
+	switch (sw1)   {
+	case 0x90:
+		return SC_APDU_STATS_SW_OK;
+	case 0x61:
+		return SC_APDU_STATS_SW_MORE_DATA;
+	case 0x6C:
+		return SC_APDU_STATS_SW_WRONG_LE;
+	case 0x62:
+	case 0x63:
+		return SC_APDU_STATS_SW_WARNING;
+	}
+	if ((sw1 & 0xF0) == 0x60)
+		return SC_APDU_STATS_SW_ERROR;
+	return SC_APDU_STATS_SW_OTHER;
+}
+
+
+void
+sc_apdu_stats_round_trip(struct sc_card *card, const struct sc_apdu *apdu,
+		const struct sc_apdu *wire, int rv)
+{
+	struct sc_reader *reader = card->reader;
+	struct sc_apdu_stats *st;
+	unsigned long long sent, received;
+
+	if (wire == NULL)
+		wire = apdu;
+	sent = sc_apdu_get_length(wire, reader->active_protocol);
+	received = rv == SC_SUCCESS ? wire->resplen + 2 : 0;
+
+	sc_mutex_lock(card->ctx, card->mutex);
+	st = sc_apdu_stats_entry(card, apdu);
+	if (st != NULL)   {
+		st->round_trips++;
+		st->bytes_sent += sent;
+		st->bytes_received += received;
+		if (wire != apdu)
+			st->sm_wrapped++;
+	}
+	reader->apdu_stats.round_trips++;
+	reader->apdu_stats.bytes_sent += sent;
+	reader->apdu_stats.bytes_received += received;
+	if (wire != apdu)
+		reader->apdu_stats.sm_wrapped++;
+	sc_mutex_unlock(card->ctx, card->mutex);
+}
+
+
+static void
+sc_apdu_stats_add(struct sc_apdu_stats *st, unsigned long long us, int sw_class)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < SC_APDU_STATS_HIST_SIZE - 1 && (us >> (bucket + 1)) != 0)
+		bucket++;
+
+	st->count++;
+	st->time_us += us;
+	if (us > st->max_time_us)
+		st->max_time_us = us;
+	st->sw[sw_class]++;
+	st->hist[bucket]++;
+}
+
+
+/* accounts a command completed by sc_transmit() */
+static void
+sc_apdu_stats_command(struct sc_card *card, const struct sc_apdu *apdu,
+		unsigned long long start_us, int rv)
+{
+	unsigned long long end_us = sc_get_time_us();
+	unsigned long long us = end_us > start_us ? end_us - start_us : 0;
+	int sw_class = rv < 0 ? SC_APDU_STATS_SW_FAILED : sc_apdu_stats_sw_class(apdu->sw1);
+	struct sc_apdu_stats *st;
+
+	sc_mutex_lock(card->ctx, card->mutex);
+	st = sc_apdu_stats_entry(card, apdu);
+	if (st != NULL)
+		sc_apdu_stats_add(st, us, sw_class);
+	sc_apdu_stats_add(&card->reader->apdu_stats, us, sw_class);
+	sc_mutex_unlock(card->ctx, card->mutex);
+}
+
+
+int
+sc_get_apdu_stats(struct sc_card *card, struct sc_apdu_stats *stats, size_t *count)
+{
+	size_t ii, nn = 0;
+	int r = SC_SUCCESS;
+
+	if (card == NULL || count == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	sc_mutex_lock(card->ctx, card->mutex);
+	for (ii = 0; card->apdu_stats && ii < SC_APDU_STATS_KEYS; ii++)   {
+		if (card->apdu_stats[ii] == NULL)
+			continue;
+		if (stats != NULL)   {
+			if (nn >= *count)   {
+				r = SC_ERROR_BUFFER_TOO_SMALL;
+				break;
+			}
+			stats[nn] = *card->apdu_stats[ii];
+		}
+		nn++;
+	}
+	if (r == SC_SUCCESS)
+		*count = nn;
+	sc_mutex_unlock(card->ctx, card->mutex);
+
+	return r;
+}
+
+
+void
+sc_reset_apdu_stats(struct sc_card *card)
+{
+	size_t ii;
+
+	if (card == NULL)
+		return;
+
+	sc_mutex_lock(card->ctx, card->mutex);
+	for (ii = 0; card->apdu_stats && ii < SC_APDU_STATS_KEYS; ii++)   {
+		free(card->apdu_stats[ii]);
+		card->apdu_stats[ii] = NULL;
+	}
+	sc_mutex_unlock(card->ctx, card->mutex);
+}
+
+
 static int
 sc_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 {
@@ -381,6 +640,11 @@ sc_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 	if (card->reader->ops->transmit == NULL)
 		LOG_TEST_RET(card->ctx, SC_ERROR_NOT_SUPPORTED, "cannot transmit APDU");
 
+	if (card->cancel_count != ctx->cancel_count)
+		LOG_TEST_RET(ctx, SC_ERROR_OPERATION_CANCELLED, "operation cancelled");
+	if (card->deadline && sc_get_monotonic_time_us() >= card->deadline)
+		LOG_TEST_RET(ctx, SC_ERROR_OPERATION_TIMEOUT, "operation deadline passed");
+
 	sc_log(ctx, "CLA:%X, INS:%X, P1:%X, P2:%X, data(%i) %p",
 			apdu->cla, apdu->ins, apdu->p1, apdu->p2, apdu->datalen, apdu->data);
 #ifdef ENABLE_SM
@@ -390,6 +654,7 @@ sc_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 
 	/* send APDU to the reader driver */
 	rv = card->reader->ops->transmit(card->reader, apdu);
+	sc_apdu_stats_round_trip(card, apdu, NULL, rv);
 	LOG_TEST_RET(ctx, rv, "unable to transmit APDU");
 
 	LOG_FUNC_RETURN(ctx, rv);
@@ -514,13 +779,13 @@ sc_get_response(struct sc_card *card, struct sc_apdu *apdu, size_t olen)
 /** Sends a single APDU to the card reader and calls GET RESPONSE to get the return data if necessary.
  *  @param  card  sc_card_t object for the smartcard
  *  @param  apdu  APDU to be sent
+ *  @param  olen  size of the response buffer
  *  @return SC_SUCCESS on success and an error value otherwise
  */
 static int
-sc_transmit(sc_card_t *card, sc_apdu_t *apdu)
+sc_transmit_exchange(sc_card_t *card, sc_apdu_t *apdu, size_t olen)
 {
 	struct sc_context *ctx  = card->ctx;
-	size_t       olen  = apdu->resplen;
 	int          r;
 
 	LOG_FUNC_CALLED(ctx);
@@ -549,28 +814,35 @@ sc_transmit(sc_card_t *card, sc_apdu_t *apdu)
 }
 
 
-int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
+/** Sends a single APDU like sc_transmit_exchange() and accounts it in the APDU statistics.
+ *  @param  card  sc_card_t object for the smartcard
+ *  @param  apdu  APDU to be sent
+ *  @return SC_SUCCESS on success and an error value otherwise
+ */
+static int
+sc_transmit(sc_card_t *card, sc_apdu_t *apdu)
 {
-	int r = SC_SUCCESS;
+	struct sc_context *ctx  = card->ctx;
+	size_t       olen  = apdu->resplen;
+	unsigned long long start_us = sc_get_time_us();
+	int          r;
 
-	if (card == NULL || apdu == NULL)
-		return SC_ERROR_INVALID_ARGUMENTS;
+	LOG_FUNC_CALLED(ctx);
 
-	LOG_FUNC_CALLED(card->ctx);
+	r = sc_transmit_exchange(card, apdu, olen);
+	sc_apdu_stats_command(card, apdu, start_us, r);
 
-	/* determine the APDU type if necessary, i.e. to use
-	 * short or extended APDUs  */
-	sc_detect_apdu_cse(card, apdu);
-	/* basic APDU consistency check */
-	r = sc_check_apdu(card, apdu);
-	if (r != SC_SUCCESS)
-		return SC_ERROR_INVALID_ARGUMENTS;
+	LOG_FUNC_RETURN(ctx, r);
+}
 
-	r = sc_lock(card);	/* acquire card lock*/
-	if (r != SC_SUCCESS) {
-		sc_log(card->ctx, "unable to acquire lock");
-		return r;
-	}
+
+/** Sends an already checked APDU, using command chaining if requested.
+ *  The caller has to hold the card lock.
+ */
+static int
+sc_transmit_locked(sc_card_t *card, sc_apdu_t *apdu)
+{
+	int r = SC_SUCCESS;
 
 	if ((apdu->flags & SC_APDU_FLAGS_CHAINING) != 0) {
 		/* divide et impera: transmit APDU in chunks with Lc <= max_send_size
@@ -635,6 +907,36 @@ int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
 	} else
 		/* transmit single APDU */
 		r = sc_transmit(card, apdu);
+
+	return r;
+}
+
+
+int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
+{
+	int r = SC_SUCCESS;
+
+	if (card == NULL || apdu == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	LOG_FUNC_CALLED(card->ctx);
+
+	/* determine the APDU type if necessary, i.e. to use
+	 * short or extended APDUs  */
+	sc_detect_apdu_cse(card, apdu);
+	/* basic APDU consistency check */
+	r = sc_check_apdu(card, apdu);
+	if (r != SC_SUCCESS)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	r = sc_lock(card);	/* acquire card lock*/
+	if (r != SC_SUCCESS) {
+		sc_log(card->ctx, "unable to acquire lock");
+		return r;
+	}
+
+	r = sc_transmit_locked(card, apdu);
+
 	/* all done => release lock */
 	if (sc_unlock(card) != SC_SUCCESS)
 		sc_log(card->ctx, "sc_unlock failed");
@@ -643,6 +945,135 @@ int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
 }
 
 
+static int
+sc_apdu_list_check_sw(sc_card_t *card, const struct sc_apdu_list_entry *entry)
+{
+	const sc_apdu_t *apdu = entry->apdu;
+	unsigned int sw = (apdu->sw1 << 8) | apdu->sw2;
+	int r;
+
+	if (entry->flags & SC_APDU_LIST_FLAG_NO_SW_CHECK)
+		return SC_SUCCESS;
+	if (entry->sw_mask == 0)
+		return sc_check_sw(card, apdu->sw1, apdu->sw2);
+
+	if ((sw & entry->sw_mask) == (entry->sw & entry->sw_mask))
+		return SC_SUCCESS;
+	/* unexpected status: prefer the card specific error code */
+	r = sc_check_sw(card, apdu->sw1, apdu->sw2);
+	return r != SC_SUCCESS ? r : SC_ERROR_CARD_CMD_FAILED;
+}
+
+
+int
+sc_transmit_apdus(sc_card_t *card, struct sc_apdu_list_entry *entries,
+		size_t count, size_t *done)
+{
+	struct sc_context *ctx;
+	size_t ii, nn = 0;
+	int r = SC_SUCCESS;
+
+	if (done)
+		*done = 0;
+	if (card == NULL || (entries == NULL && count))
+		return SC_ERROR_INVALID_ARGUMENTS;
+	ctx = card->ctx;
+
+	LOG_FUNC_CALLED(ctx);
+	sc_log(ctx, "%lu APDUs to transmit", (unsigned long)count);
+
+	/* check the whole list before anything is sent to the card,
+	 * so that an inconsistent entry does not abort the sequence halfway */
+	for (ii = 0; ii < count; ii++)   {
+		if (entries[ii].apdu == NULL)
+			LOG_TEST_RET(ctx, SC_ERROR_INVALID_ARGUMENTS, "APDU list entry without APDU");
+		sc_detect_apdu_cse(card, entries[ii].apdu);
+		r = sc_check_apdu(card, entries[ii].apdu);
+		if (r != SC_SUCCESS)   {
+			sc_log(ctx, "inconsistent APDU in the list entry %lu", (unsigned long)ii);
+			LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
+		}
+		entries[ii].rv = SC_SUCCESS;
+	}
+
+	/* one lock, and so one reader transaction, for the whole list;
+	 * the reader scratch buffers stay allocated from one entry to the next */
+	r = sc_lock(card);
+	LOG_TEST_RET(ctx, r, "unable to acquire lock");
+
+	for (ii = 0; ii < count; ii++)   {
+		struct sc_apdu_list_entry *entry = &entries[ii];
+
+		entry->rv = sc_transmit_locked(card, entry->apdu);
+		nn++;
+		if (entry->rv != SC_SUCCESS)   {
+			/* no status word to judge: the exchange itself failed */
+			sc_log(ctx, "APDU list entry %lu (INS 0x%02X) transmit failed: %s",
+					(unsigned long)ii, entry->apdu->ins, sc_strerror(entry->rv));
+			r = entry->rv;
+			break;
+		}
+
+		entry->rv = sc_apdu_list_check_sw(card, entry);
+		if (entry->rv != SC_SUCCESS)   {
+			sc_log(ctx, "APDU list entry %lu (INS 0x%02X) failed: %s", (unsigned long)ii,
+					entry->apdu->ins, sc_strerror(entry->rv));
+			if (!(entry->flags & SC_APDU_LIST_FLAG_NOT_FATAL))   {
+				r = entry->rv;
+				break;
+			}
+		}
+	}
+
+	if (sc_unlock(card) != SC_SUCCESS)
+		sc_log(ctx, "sc_unlock failed");
+
+	if (done)
+		*done = nn;
+	sc_log(ctx, "%lu of %lu APDUs transmitted", (unsigned long)nn, (unsigned long)count);
+	LOG_FUNC_RETURN(ctx, r);
+}
+
+
+int
+sc_transmit_remote_data(sc_card_t *card, struct sc_remote_data *rdata)
+{
+	struct sc_context *ctx;
+	struct sc_apdu_list_entry *entries = NULL;
+	struct sc_remote_apdu *rapdu;
+	size_t count = 0, done = 0;
+	int r;
+
+	if (card == NULL || rdata == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	ctx = card->ctx;
+
+	LOG_FUNC_CALLED(ctx);
+	for (rapdu = rdata->data; rapdu && rapdu->apdu.ins; rapdu = rapdu->next)
+		count++;
+	if (!count)
+		LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+
+	entries = calloc(count, sizeof(struct sc_apdu_list_entry));
+	if (!entries)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+
+	for (count = 0, rapdu = rdata->data; rapdu && rapdu->apdu.ins; rapdu = rapdu->next, count++)   {
+		entries[count].apdu = &rapdu->apdu;
+		if (rapdu->flags & SC_REMOTE_APDU_FLAG_NOT_FATAL)
+			entries[count].flags |= SC_APDU_LIST_FLAG_NOT_FATAL;
+	}
+
+	r = sc_transmit_apdus(card, entries, count, &done);
+	/* as when the APDUs were sent one by one: the status error of a
+	 * non fatal APDU is the result when it is the last one */
+	if (r == SC_SUCCESS && done > 0)
+		r = entries[done - 1].rv;
+	free(entries);
+	LOG_FUNC_RETURN(ctx, r);
+}
+
+
 int
 sc_bytes2apdu(sc_context_t *ctx, const u8 *buf, size_t len, sc_apdu_t *apdu)
 {
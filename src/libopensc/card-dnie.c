@@ -57,6 +57,9 @@ extern int dnie_read_file(
 /* default user consent program (if required) */
 #define USER_CONSENT_CMD "/usr/bin/pinentry"
 
+/* default number of files kept uncompressed for read_binary() */
+#define DNIE_FILE_CACHE_SIZE 8
+
 /**
  * SW internal apdu response table.
  *
@@ -169,29 +172,32 @@ static sc_card_driver_t dnie_driver = {
 /**
  * Parse configuration file for dnie parameters.
  *
- * DNIe card driver has two main paramaters:
+ * DNIe card driver has three main paramaters:
  * - The name of the user consent Application to be used in Linux. This application shoud be any of pinentry-xxx family
  * - A flag to indicate if user consent is to be used in this driver. If false, the user won't be prompted for confirmation on signature operations
+ * - The number of files whose uncompressed content is kept for read_binary()
  *
  * @See ../../etc/opensc.conf for details
  * @param card Pointer to card structure
- * @param ui_context Pointer to ui_context structure to store data into
+ * @param priv Pointer to driver private data to store data into
  * @return SC_SUCCESS (should return no errors)
  *
  * TODO: Code should be revised in order to store user consent info
  * in a card-independent way at configuration file
  */
-#ifdef ENABLE_DNIE_UI
 static int dnie_get_environment(
 	sc_card_t * card, 
-	ui_context_t * ui_context)
+	dnie_private_data_t * priv)
 {
 	int i;
 	scconf_block **blocks, *blk;
 	sc_context_t *ctx;
 	/* set default values */
-	ui_context->user_consent_app = USER_CONSENT_CMD;
-	ui_context->user_consent_enabled = 1;
+	priv->cache_size = DNIE_FILE_CACHE_SIZE;
+#ifdef ENABLE_DNIE_UI
+	priv->ui_ctx.user_consent_app = USER_CONSENT_CMD;
+	priv->ui_ctx.user_consent_enabled = 1;
+#endif
 	/* look for sc block in opensc.conf */
 	ctx = card->ctx;
 	for (i = 0; ctx->conf_blocks[i]; i++) {
@@ -205,15 +211,19 @@ static int dnie_get_environment(
 		if (blk == NULL)
 			continue;
 		/* fill private data with configuration parameters */
-		ui_context->user_consent_app =	/* def user consent app is "pinentry" */
+		priv->cache_size =	/* number of files kept in read_binary() cache */
+		    scconf_get_int(blk, "file_cache_size",
+				   DNIE_FILE_CACHE_SIZE);
+#ifdef ENABLE_DNIE_UI
+		priv->ui_ctx.user_consent_app =	/* def user consent app is "pinentry" */
 		    (char *)scconf_get_str(blk, "user_consent_app",
 					   USER_CONSENT_CMD);
-		ui_context->user_consent_enabled =	/* user consent is enabled by default */
+		priv->ui_ctx.user_consent_enabled =	/* user consent is enabled by default */
 		    scconf_get_bool(blk, "user_consent_enabled", 1);
+#endif
 	}
 	return SC_SUCCESS;
 }
-#endif
 
 /************************** cardctl defined operations *******************/
 
@@ -464,13 +474,95 @@ static int dnie_get_serialnr(sc_card_t * card, sc_serial_number_t * serial)
 	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
 }
 
-static void dnie_clear_cache(dnie_private_data_t * data)
+/**
+ * Drop every file kept in the read_binary() cache.
+ *
+ * Cached content belongs to the card session it was read in: this is
+ * called on logout, when the secure channel is (re)created, which
+ * involves a card reset, and on finish.
+ *
+ * @param data DNIe private data
+ */
+void dnie_clear_cache(dnie_private_data_t * data)
 {
+	dnie_cache_entry_t *entry, *next;
 	if (data == NULL) return;
-	if (data->cache != NULL)
-		free(data->cache);
+	for (entry = data->cache; entry != NULL; entry = next) {
+		next = entry->next;
+		if (entry->data != NULL)
+			free(entry->data);
+		free(entry);
+	}
 	data->cache = NULL;
-	data->cachelen = 0;
+	data->current = NULL;
+}
+
+/**
+ * Look up the cached content of a file and mark it most recently used.
+ *
+ * @param data DNIe private data
+ * @param path absolute path of the file
+ * @return cache entry, or NULL if the file is not cached or path is unknown
+ */
+static dnie_cache_entry_t *dnie_find_cache(dnie_private_data_t * data,
+					   const sc_path_t * path)
+{
+	dnie_cache_entry_t *entry, **prev;
+	if (data == NULL || path->len == 0)
+		return NULL;
+	for (prev = &data->cache; (entry = *prev) != NULL; prev = &entry->next) {
+		if (!sc_compare_path(&entry->path, path))
+			continue;
+		/* move to front */
+		*prev = entry->next;
+		entry->next = data->cache;
+		data->cache = entry;
+		return entry;
+	}
+	return NULL;
+}
+
+/**
+ * Store the content of a file as most recently used cache entry.
+ *
+ * Least recently used entries beyond the configured cache size are
+ * dropped. Content of a file whose path is unknown is kept only until
+ * the next file is read.
+ *
+ * @param data DNIe private data
+ * @param path absolute path of the file, or empty path
+ * @param buf file content. Ownership goes to the cache
+ * @param len file content length
+ * @return new cache entry, or NULL on memory allocation failure
+ */
+static dnie_cache_entry_t *dnie_store_cache(dnie_private_data_t * data,
+					    const sc_path_t * path,
+					    u8 * buf, size_t len)
+{
+	dnie_cache_entry_t *entry, **prev;
+	int count = 0;
+	entry = calloc(1, sizeof(dnie_cache_entry_t));
+	if (entry == NULL)
+		return NULL;
+	entry->path = *path;
+	entry->data = buf;
+	entry->len = len;
+	entry->next = data->cache;
+	data->cache = entry;
+	/* drop entries for the same file and beyond the cache size */
+	for (prev = &entry->next; *prev != NULL;) {
+		dnie_cache_entry_t *old = *prev;
+		if (old->path.len == 0 || sc_compare_path(&old->path, path)
+		    || ++count >= data->cache_size) {
+			*prev = old->next;
+			if (old->data != NULL)
+				free(old->data);
+			free(old);
+			continue;
+		}
+		prev = &old->next;
+	}
+	return entry;
 }
 
 static inline void init_flags(struct sc_card *card)
@@ -561,14 +653,12 @@ static int dnie_init(struct sc_card *card)
 	if (card->drv_data == NULL)
 	    LOG_TEST_RET(card->ctx, SC_ERROR_OUT_OF_MEMORY, "Could not allocate DNIe private data.");
 
-#ifdef ENABLE_DNIE_UI
 	/* read environment from configuration file */
-	res = dnie_get_environment(card, &(GET_DNIE_UI_CTX(card)));
+	res = dnie_get_environment(card, GET_DNIE_PRIV_DATA(card));
 	if (res != SC_SUCCESS) {
 		free(card->drv_data);
 		LOG_TEST_RET(card->ctx, res, "Failure reading DNIe environment.");
 	}
-#endif
 
 	GET_DNIE_PRIV_DATA(card)->cwa_provider = provider;
 
@@ -651,18 +741,13 @@ static u8 *dnie_uncompress(sc_card_t * card, u8 * from, size_t *len)
 		goto compress_exit;
 
 	sc_log(card->ctx, "Data seems to be compressed. calling uncompress");
-	/* ok: data seems to be compressed */
-	upt = calloc(uncompressed, sizeof(u8));
-	if (!upt) {
-		sc_log(card->ctx, "alloc() for uncompressed buffer failed");
-		return NULL;
-	}
-	res = sc_decompress(upt,	/* try to uncompress by calling sc_xx routine */
-			    (size_t *) & uncompressed,
-			    from + 8, (size_t) compressed, COMPRESSION_ZLIB);
-	/* TODO: check that returned uncompressed size matches expected */
+	/* ok: data seems to be compressed. header tells output size */
+	res = sc_decompress_alloc_ex(card->ctx, &upt,	/* try to uncompress by calling sc_xx routine */
+			    &uncompressed, from + 8, compressed,
+			    COMPRESSION_ZLIB, uncompressed);
 	if (res != SC_SUCCESS) {
 		sc_log(card->ctx, "Uncompress() failed or data not compressed");
+		upt = from;
 		goto compress_exit;	/* assume not need uncompression */
 	}
 	/* Done; update buffer len and return pt to uncompressed data */
@@ -716,9 +801,6 @@ static int dnie_fill_cache(sc_card_t * card)
 
 	LOG_FUNC_CALLED(ctx);
 
-	/* mark cache empty */
-	dnie_clear_cache(GET_DNIE_PRIV_DATA(card));
-
 	/* initialize apdu */
 	sc_format_apdu(card, &apdu, SC_APDU_CASE_2_SHORT, 0xB0, 0x00, 0x00);
 
@@ -779,8 +861,14 @@ static int dnie_fill_cache(sc_card_t * card)
 			free(buffer);
 
 	/* ok: as final step, set correct cache data into dnie_priv structures */
-	GET_DNIE_PRIV_DATA(card)->cache = pt;
-	GET_DNIE_PRIV_DATA(card)->cachelen = len;
+	GET_DNIE_PRIV_DATA(card)->current =
+	    dnie_store_cache(GET_DNIE_PRIV_DATA(card),
+			     &GET_DNIE_PRIV_DATA(card)->current_path, pt, len);
+	if (GET_DNIE_PRIV_DATA(card)->current == NULL) {
+		if (pt)
+			free(pt);
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+	}
 	sc_log(ctx, "fill_cache() done. length '%d' bytes", len);
 	LOG_FUNC_RETURN(ctx,len);
 }
@@ -789,7 +877,8 @@ static int dnie_fill_cache(sc_card_t * card)
  * OpenDNIe implementation of read_binary().
  *
  * Reads a binary stream from card by mean of READ BINARY iso command
- * Creates and handle a cache to allow data uncompression
+ * Creates and handle a cache to allow data uncompression. Files
+ * selected by path are served from cache while they stay in it
  *
  * @param card pointer to sc_card_t structure
  * @param idx offset from card file to ask data for
@@ -804,14 +893,16 @@ static int dnie_read_binary(struct sc_card *card,
 {
 	int res = 0;
 	sc_context_t *ctx = NULL;
+	dnie_cache_entry_t *entry = NULL;
 	/* preliminary checks */
 	if (!card || !card->ctx || !buf || (count <= 0))
 		return SC_ERROR_INVALID_ARGUMENTS;
 	ctx = card->ctx;
 
 	LOG_FUNC_CALLED(ctx);
-	if (idx == 0 || GET_DNIE_PRIV_DATA(card)->cache == NULL) {
-		/* on first block or no cache, try to fill */
+	entry = GET_DNIE_PRIV_DATA(card)->current;
+	if (entry == NULL || (idx == 0 && entry->path.len == 0)) {
+		/* on no cache, or first block of a file with unknown path, try to fill */
 		res = dnie_fill_cache(card);
 		if (res < 0) {
 			sc_log(ctx,
@@ -819,11 +910,12 @@ static int dnie_read_binary(struct sc_card *card,
 			return iso_ops->read_binary(card, idx, buf, count,
 						    flags);
 		}
+		entry = GET_DNIE_PRIV_DATA(card)->current;
 	}
-	if (idx >= GET_DNIE_PRIV_DATA(card)->cachelen)
+	if (idx >= entry->len)
 		return 0;	/* at eof */
-	res = MIN(count, GET_DNIE_PRIV_DATA(card)->cachelen - idx);	/* eval how many bytes to read */
-	memcpy(buf, GET_DNIE_PRIV_DATA(card)->cache + idx, res);	/* copy data from buffer */
+	res = MIN(count, entry->len - idx);	/* eval how many bytes to read */
+	memcpy(buf, entry->data + idx, res);	/* copy data from buffer */
 	sc_log(ctx, "dnie_read_binary() '%d' bytes", res);
 	LOG_FUNC_RETURN(ctx, res);
 }
@@ -907,6 +999,36 @@ static int dnie_check_path(sc_card_t *card, u8 **pathptr, size_t *pathlen,
 	return 1;
 }
 
+/**
+ * Evaluate absolute path of the file about to be selected.
+ *
+ * Only EF's selected by file ID from a known current DF, with FCI
+ * requested, get a path; that path is the key for the read_binary()
+ * cache. Any other selection leaves no file cached as current.
+ *
+ * @param card card pointer structure
+ * @param in_path path passed to select_file()
+ * @param need_info set if process_fci is needed
+ */
+static void dnie_set_current_path(sc_card_t *card, const sc_path_t *in_path,
+				  int need_info)
+{
+	sc_path_t *cur = &GET_DNIE_PRIV_DATA(card)->current_path;
+	size_t cachelen = card->cache.current_path.len;
+	GET_DNIE_PRIV_DATA(card)->current = NULL;
+	memset(cur, 0, sizeof(*cur));
+	if (!need_info || in_path->type != SC_PATH_TYPE_FILE_ID)
+		return;
+	if (card->cache.valid == 0 || cachelen < 2
+	    || cachelen + 2 > sizeof(cur->value))
+		return;
+	memcpy(cur->value, card->cache.current_path.value, cachelen);
+	memcpy(cur->value + cachelen, in_path->value, 2);
+	cur->len = cachelen + 2;
+	cur->type = SC_PATH_TYPE_PATH;
+	cur->count = -1;
+}
+
 /**
  * OpenDNIe implementation of Select_File().
  *
@@ -1054,6 +1176,7 @@ static int dnie_select_file(struct sc_card *card,
 		break;
 	}
 	/* Arriving here means need to compose and send apdu */
+	dnie_set_current_path(card, in_path, file_out != NULL);
 	apdu.p2 = 0;		/* first record, return FCI */
 	apdu.lc = pathlen;
 	apdu.data = path;
@@ -1072,6 +1195,9 @@ static int dnie_select_file(struct sc_card *card,
 		dnie_invalidate_path(card); /* failed: invalidate cache */
 	LOG_TEST_RET(ctx, res, "SelectFile() APDU transmit failed");
 	if (file_out == NULL) {
+		/* file type is unknown: it may have changed current DF */
+		if (in_path->type == SC_PATH_TYPE_FILE_ID)
+			dnie_invalidate_path(card);
 		if (apdu.sw1 == 0x61)
 			SC_FUNC_RETURN(ctx, SC_LOG_DEBUG_VERBOSE, 0);
 		SC_FUNC_RETURN(ctx, SC_LOG_DEBUG_VERBOSE,
@@ -1098,9 +1224,14 @@ static int dnie_select_file(struct sc_card *card,
 	res = card->ops->process_fci(card, file, apdu.resp + 2, apdu.resp[1]);
 	*file_out = file;
         /* if file is a DF, store it into DF cache */
-	if (file->type==SC_FILE_TYPE_DF) dnie_cache_path(card,file);
-	/* as last step clear data cache and return */
-	dnie_clear_cache(GET_DNIE_PRIV_DATA(card));
+	if (file->type==SC_FILE_TYPE_DF) {
+		dnie_cache_path(card,file);
+		GET_DNIE_PRIV_DATA(card)->current_path.len = 0;
+	}
+	/* as last step point data cache to selected file and return */
+	GET_DNIE_PRIV_DATA(card)->current =
+	    dnie_find_cache(GET_DNIE_PRIV_DATA(card),
+			    &GET_DNIE_PRIV_DATA(card)->current_path);
 	LOG_FUNC_RETURN(ctx, res);
 }
 
@@ -1187,6 +1318,8 @@ static int dnie_logout(struct sc_card *card)
 	result =
 	    cwa_create_secure_channel(card, GET_DNIE_PRIV_DATA(card)->cwa_provider, CWA_SM_OFF);
 #endif
+	/* access rights are gone: forget files read with them */
+	dnie_clear_cache(GET_DNIE_PRIV_DATA(card));
 	/* TODO: _logout() see comments.txt on what to do here */
 	LOG_FUNC_RETURN(card->ctx, result);
 }
@@ -1833,8 +1966,12 @@ static int dnie_process_fci(struct sc_card *card,
 	case 0x24:		/* EF for compressed certificates */
 		file->type = SC_FILE_TYPE_WORKING_EF;
 		file->ef_structure = SC_FILE_EF_TRANSPARENT;
-		/* evaluate real length by reading first 8 bytes from file */
-		res = dnie_read_header(card);
+		/* evaluate real length from cache, or by reading first 8 bytes from file */
+		if (dnie_find_cache(GET_DNIE_PRIV_DATA(card),
+				    &GET_DNIE_PRIV_DATA(card)->current_path))
+			res = (int)(0x7FFF & GET_DNIE_PRIV_DATA(card)->cache->len);
+		else
+			res = dnie_read_header(card);
 		/* Hey!, we need pin to read certificates... */
 		if (res == SC_ERROR_SECURITY_STATUS_NOT_SATISFIED)
 			goto dnie_process_fci_end;
@@ -1951,6 +2088,7 @@ static int dnie_pin_change(struct sc_card *card, struct sc_pin_cmd_data * data)
 	LOG_FUNC_CALLED(card->ctx);
 #ifdef ENABLE_SM
     /* Ensure that secure channel is established from reset */
+    dnie_clear_cache(GET_DNIE_PRIV_DATA(card));
     res = cwa_create_secure_channel(card, GET_DNIE_PRIV_DATA(card)->cwa_provider, CWA_SM_COLD);
     LOG_TEST_RET(card->ctx, res, "Establish SM failed");
 #endif
@@ -1980,6 +2118,7 @@ static int dnie_pin_verify(struct sc_card *card,
 
 	LOG_FUNC_CALLED(card->ctx);
 	/* ensure that secure channel is established from reset */
+	dnie_clear_cache(GET_DNIE_PRIV_DATA(card));
 	res = cwa_create_secure_channel(card, GET_DNIE_PRIV_DATA(card)->cwa_provider, CWA_SM_COLD);
 	LOG_TEST_RET(card->ctx, res, "Establish SM failed");
 
@@ -52,17 +52,164 @@ static struct sc_atr_table muscle_atrs[] = {
 
 #define MUSCLE_DATA(card) ( (muscle_private_t*)card->drv_data )
 #define MUSCLE_FS(card) ( ((muscle_private_t*)card->drv_data)->fs )
+#define MUSCLE_STATUS_MAX 16
 typedef struct muscle_private {
 	sc_security_env_t env;
 	unsigned short verifiedPins;
 	mscfs_t *fs;
 	int rsa_key_ref;
+	/* applet status when the card was connected, see muscle_keep_listing() */
+	u8 status[MUSCLE_STATUS_MAX];
+	size_t status_len;
+	int persistent_listing;
+	int modified;
 	
 } muscle_private_t;
 
+/* Object listings of the recently disconnected cards, kept per context
+ * with sc_ctx_set_driver_data(). A listing is reused by the next
+ * connection in the same reader when the ATR and the applet status
+ * (object and key memory, PINs and keys in use) are unchanged */
+#define MUSCLE_LISTINGS 4
+struct muscle_listing {
+	char *reader;
+	struct sc_atr atr;
+	u8 status[MUSCLE_STATUS_MAX];
+	size_t status_len;
+	mscfs_cache_t cache;
+};
+typedef struct muscle_listings {
+	struct muscle_listing entries[MUSCLE_LISTINGS];
+	unsigned int next;
+} muscle_listings_t;
+
+/* The last two bytes of the status (logged identities) change with PIN
+ * verification, see muscle_same_status() */
+#define MUSCLE_STATUS_IDENTITIES 2
+
+static int muscle_get_status(sc_card_t *card, u8 *status, size_t *len)
+{
+	sc_apdu_t apdu;
+	u8 response[MUSCLE_STATUS_MAX];
+	int r;
+
+	sc_format_apdu(card, &apdu, SC_APDU_CASE_2, 0x3C, 0x00, 0x00);
+	apdu.cla = 0xB0;
+	apdu.le = sizeof(response);
+	apdu.resplen = sizeof(response);
+	apdu.resp = response;
+	r = sc_transmit_apdu(card, &apdu);
+	if (r == SC_SUCCESS)
+		r = sc_check_sw(card, apdu.sw1, apdu.sw2);
+	if (r != SC_SUCCESS)
+		return r;
+	if (apdu.resplen <= 2)
+		return SC_ERROR_UNKNOWN_DATA_RECEIVED;
+	*len = apdu.resplen - 2;
+	memcpy(status, response, *len);
+	return SC_SUCCESS;
+}
+
+static void muscle_free_listings(void *data)
+{
+	muscle_listings_t *listings = data;
+	int i;
+
+	for (i = 0; i < MUSCLE_LISTINGS; i++) {
+		free(listings->entries[i].reader);
+		mscfs_free_cache(&listings->entries[i].cache);
+	}
+	free(listings);
+}
+
+/* Compares two applet statuses, but for the logged identities */
+static int muscle_same_status(const u8 *a, size_t alen, const u8 *b, size_t blen)
+{
+	if (alen != blen || alen <= MUSCLE_STATUS_IDENTITIES)
+		return 0;
+	return !memcmp(a, b, alen - MUSCLE_STATUS_IDENTITIES);
+}
+
+/* Called with ctx->mutex held */
+static struct muscle_listing *muscle_find_listing(sc_card_t *card)
+{
+	muscle_listings_t *listings = sc_ctx_get_driver_data(card->ctx, "muscle");
+	int i;
+
+	if (listings == NULL)
+		return NULL;
+	for (i = 0; i < MUSCLE_LISTINGS; i++) {
+		struct muscle_listing *l = &listings->entries[i];
+
+		if (l->reader != NULL && !strcmp(l->reader, card->reader->name)
+				&& l->atr.len == card->atr.len
+				&& !memcmp(l->atr.value, card->atr.value, card->atr.len))
+			return l;
+	}
+	return NULL;
+}
+
+static void muscle_load_listing(sc_card_t *card)
+{
+	muscle_private_t *priv = MUSCLE_DATA(card);
+	struct muscle_listing *l;
+
+	sc_mutex_lock(card->ctx, card->ctx->mutex);
+	l = muscle_find_listing(card);
+	if (l != NULL && muscle_same_status(l->status, l->status_len, priv->status, priv->status_len)
+			&& mscfs_copy_cache(&priv->fs->cache, &l->cache) == 0)
+		sc_log(card->ctx, "reusing the listing of %i objects", l->cache.size);
+	sc_mutex_unlock(card->ctx, card->ctx->mutex);
+}
+
+static void muscle_keep_listing(sc_card_t *card)
+{
+	muscle_private_t *priv = MUSCLE_DATA(card);
+	muscle_listings_t *listings;
+	struct muscle_listing *l;
+
+	if (!priv->persistent_listing || !priv->fs->cache.valid)
+		return;
+	/* the memory figures have changed; if the card is gone, so is
+	 * the listing */
+	if (priv->modified && muscle_get_status(card, priv->status, &priv->status_len) != SC_SUCCESS)
+		return;
+
+	sc_mutex_lock(card->ctx, card->ctx->mutex);
+	listings = sc_ctx_get_driver_data(card->ctx, "muscle");
+	if (listings == NULL) {
+		listings = calloc(1, sizeof(muscle_listings_t));
+		if (listings == NULL || sc_ctx_set_driver_data(card->ctx, "muscle",
+				listings, muscle_free_listings) != SC_SUCCESS) {
+			free(listings);
+			sc_mutex_unlock(card->ctx, card->ctx->mutex);
+			return;
+		}
+	}
+	l = muscle_find_listing(card);
+	if (l == NULL) {
+		l = &listings->entries[listings->next];
+		listings->next = (listings->next + 1) % MUSCLE_LISTINGS;
+		free(l->reader);
+		l->reader = strdup(card->reader->name);
+	}
+	mscfs_free_cache(&l->cache);
+	if (l->reader == NULL || mscfs_copy_cache(&l->cache, &priv->fs->cache) != 0) {
+		free(l->reader);
+		l->reader = NULL;
+	}
+	else {
+		l->atr = card->atr;
+		memcpy(l->status, priv->status, priv->status_len);
+		l->status_len = priv->status_len;
+	}
+	sc_mutex_unlock(card->ctx, card->ctx->mutex);
+}
+
 static int muscle_finish(sc_card_t *card)
 {
 	muscle_private_t *priv = MUSCLE_DATA(card);
+	muscle_keep_listing(card);
 	mscfs_free(priv->fs);
 	free(priv);
 	return 0;
@@ -161,8 +308,10 @@ static int muscle_create_directory(sc_card_t *card, sc_file_t *file)
 	
 	muscle_parse_acls(file, &read_perm, &write_perm, &delete_perm);
 	r = msc_create_object(card, objectId, objectSize, read_perm, write_perm, delete_perm);
+	MUSCLE_DATA(card)->modified = 1;
+	if(r >= 0)
+		return mscfs_add_object(fs, &objectId, objectSize, read_perm, write_perm, delete_perm);
 	mscfs_clear_cache(fs);
-	if(r >= 0) return 0;
 	return r;
 }
 
@@ -185,8 +334,10 @@ static int muscle_create_file(sc_card_t *card, sc_file_t *file)
 	
 	mscfs_lookup_local(fs, file->id, &objectId);
 	r = msc_create_object(card, objectId, objectSize, read_perm, write_perm, delete_perm);
+	MUSCLE_DATA(card)->modified = 1;
+	if(r >= 0)
+		return mscfs_add_object(fs, &objectId, objectSize, read_perm, write_perm, delete_perm);
 	mscfs_clear_cache(fs);
-	if(r >= 0) return 0;
 	return r;
 }
 
@@ -200,6 +351,8 @@ static int muscle_read_binary(sc_card_t *card, unsigned int idx, u8* buf, size_t
 	
 	r = mscfs_check_selection(fs, -1);
 	if(r < 0) SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, r);
+	if(fs->currentFileIndex < 0 || fs->currentFileIndex >= fs->cache.size)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_FILE_NOT_FOUND);
 	file = &fs->cache.array[fs->currentFileIndex];
 	objectId = file->objectId;
 	/* memcpy(objectId.id, file->objectId.id, 4); */
@@ -222,6 +375,8 @@ static int muscle_update_binary(sc_card_t *card, unsigned int idx, const u8* buf
 
 	r = mscfs_check_selection(fs, -1);
 	if(r < 0) SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, r);
+	if(fs->currentFileIndex < 0 || fs->currentFileIndex >= fs->cache.size)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_FILE_NOT_FOUND);
 	file = &fs->cache.array[fs->currentFileIndex];
 	
 	objectId = file->objectId;
@@ -239,15 +394,21 @@ static int muscle_update_binary(sc_card_t *card, unsigned int idx, const u8* buf
 		r = msc_read_object(card, objectId, 0, buffer, file->size);
 		/* TODO: RETREIVE ACLS */
 		if(r < 0) goto update_bin_free_buffer;
+		MUSCLE_DATA(card)->modified = 1;
 		r = msc_delete_object(card, objectId, 0);
 		if(r < 0) goto update_bin_free_buffer;
 		r = msc_create_object(card, objectId, newFileSize, 0,0,0);
 		if(r < 0) goto update_bin_free_buffer;
+		file->read = file->write = file->delete = 0;
 		memcpy(buffer + idx, buf, count);
 		r = msc_update_object(card, objectId, 0, buffer, newFileSize);
 		if(r < 0) goto update_bin_free_buffer;
 		file->size = newFileSize;
+		/* bytes of the caller's buffer written */
+		r = count;
 update_bin_free_buffer:
+		if(r < 0)
+			mscfs_clear_cache(fs);
 		free(buffer);
 		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, r);
 	} else {
@@ -315,13 +476,22 @@ static int muscle_delete_file(sc_card_t *card, const sc_path_t *path_in)
 {
 	mscfs_t *fs = MUSCLE_FS(card);
 	mscfs_file_t *file_data = NULL;
+	msc_id objectId;
+	int ef;
 	int r = 0;
 
 	r = mscfs_loadFileInfo(fs, path_in->value, path_in->len, &file_data, NULL);
 	if(r < 0) SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE,r);
+	objectId = file_data->objectId;
+	ef = file_data->ef;
+	MUSCLE_DATA(card)->modified = 1;
 	r = muscle_delete_mscfs_file(card, file_data);
-	mscfs_clear_cache(fs);
-	if(r < 0) SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE,r);
+	if(r < 0) {
+		/* some of the children may be gone */
+		mscfs_clear_cache(fs);
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE,r);
+	}
+	mscfs_remove_object(fs, &objectId, ef);
 	return 0;
 }
 
@@ -449,6 +619,7 @@ static int _listFile(mscfs_file_t *file, int reset, void *udata)
 static int muscle_init(sc_card_t *card)
 {
 	muscle_private_t *priv;
+	int i;
 	
 	card->name = "MuscleApplet";
 	card->drv_data = malloc(sizeof(muscle_private_t));
@@ -466,6 +637,18 @@ static int muscle_init(sc_card_t *card)
 	priv->fs->udata = card;
 	priv->fs->listFile = _listFile;
 
+	priv->persistent_listing = 1;
+	for (i = 0; card->ctx->conf_blocks[i]; i++) {
+		scconf_block **blocks = scconf_find_blocks(card->ctx->conf,
+				card->ctx->conf_blocks[i], "card_driver", "muscle");
+		if (!blocks)
+			continue;
+		if (blocks[0])
+			priv->persistent_listing = scconf_get_bool(blocks[0],
+					"persistent_listing", priv->persistent_listing);
+		free(blocks);
+	}
+
 	card->cla = 0xB0;
 	
 	card->flags |= SC_CARD_FLAG_RNG;
@@ -480,6 +663,15 @@ static int muscle_init(sc_card_t *card)
 		card->caps |= SC_CARD_CAP_APDU_EXT;
 	}
 
+	if (muscle_get_status(card, priv->status, &priv->status_len) != SC_SUCCESS) {
+		priv->status_len = 0;
+		priv->persistent_listing = 0;
+	}
+	if (msc_negotiate_transfer_units(card, priv->status, priv->status_len) != SC_SUCCESS)
+		sc_log(card->ctx, "reader limits too small, keeping the default transfer units");
+	if (priv->persistent_listing)
+		muscle_load_listing(card);
+
 
 	/* FIXME: Card type detection */
 	if (1) {
@@ -122,6 +122,7 @@ struct blob {
 	unsigned char *	data;
 	unsigned int	len;
 	struct blob *	files;	/* pointer to 1st child */
+	struct blob *	hnext;	/* next blob in the same tag index bucket */
 };
 
 struct do_info {
@@ -146,6 +147,7 @@ static int		pgp_get_blob(sc_card_t *card, struct blob *blob,
 				 unsigned int id, struct blob **ret);
 static struct blob *	pgp_new_blob(sc_card_t *, struct blob *, unsigned int, sc_file_t *);
 static void		pgp_free_blob(struct blob *);
+static int		pgp_prefetch_blob(sc_card_t *, unsigned int);
 static int		pgp_get_pubkey(sc_card_t *, unsigned int,
 				u8 *, size_t);
 static int		pgp_get_pubkey_pem(sc_card_t *, unsigned int,
@@ -264,10 +266,21 @@ static struct do_info		pgp2_objects[] = {	/* OpenPGP card spec 2.0 */
  * We should notice this when building fake file system later. */
 #define DO_CERT		0x7f21
 
+/* Buffer for reading a DO: start with the size the card usually needs
+ * and grow when the response fills it, up to the largest extended Le. */
+#define PGP_DO_BUFSIZE		2048
+#define PGP_DO_MAXSIZE		0xFFFF
+
+/* Every blob in the tree is also hashed by its tag, so that lookups
+ * don't have to walk the sibling lists. */
+#define PGP_INDEX_BITS		6
+#define PGP_INDEX_SIZE		(1 << PGP_INDEX_BITS)
+
 #define DRVDATA(card)        ((struct pgp_priv_data *) ((card)->drv_data))
 struct pgp_priv_data {
 	struct blob *		mf;
 	struct blob *		current;	/* currently selected file */
+	struct blob *		index[PGP_INDEX_SIZE];	/* blobs by tag */
 
 	enum _version		bcd_version;
 	struct do_info		*pgp_objects;
@@ -366,6 +379,12 @@ pgp_init(sc_card_t *card)
 		}
 	}
 
+	/* Application Related Data and Cardholder Related Data hold most of
+	 * the DOs needed later on: read each with a single GET DATA now and
+	 * fill their children from it */
+	pgp_prefetch_blob(card, 0x006e);
+	pgp_prefetch_blob(card, 0x0065);
+
 	/* get card_features from ATR & DOs */
 	pgp_get_card_features(card);
 
@@ -398,8 +417,11 @@ pgp_get_card_features(sc_card_t *card)
 			priv->ext_caps |= EXT_CAP_CHAINING;
 	}
 	if (priv->bcd_version >= OPENPGP_CARD_2_0) {
-		/* get card capabilities from "historical bytes" DO */
-		if ((pgp_get_blob(card, priv->mf, 0x5f52, &blob) >= 0) &&
+		/* get card capabilities from "historical bytes" DO,
+		 * preferably from its copy in the Application Related Data */
+		if (((pgp_get_blob(card, priv->mf, 0x006e, &blob6e) >= 0 &&
+		      pgp_get_blob(card, blob6e, 0x5f52, &blob) >= 0) ||
+		     pgp_get_blob(card, priv->mf, 0x5f52, &blob) >= 0) &&
 		    (blob->data != NULL) && (blob->data[0] == 0x00)) {
 			while ((i < blob->len) && (blob->data[i] != 0x73))
 				i++;
@@ -609,6 +631,55 @@ pgp_attach_acl(sc_card_t *card, sc_file_t *file, struct do_info *info)
 	}
 }
 
+/* internal: bucket of the tag index for a DO tag */
+static unsigned int
+pgp_index_hash(unsigned int id)
+{
+	return ((id * 2654435761U) & 0xFFFFFFFFU) >> (32 - PGP_INDEX_BITS);
+}
+
+
+/* internal: add a blob to the tag index; blobs are only ever removed
+ * together with the whole tree in pgp_finish() */
+static void
+pgp_index_add(struct pgp_priv_data *priv, struct blob *blob)
+{
+	struct blob **p;
+
+	for (p = &priv->index[pgp_index_hash(blob->id)]; *p != NULL; p = &(*p)->hnext)
+		;
+	*p = blob;
+}
+
+
+/* internal: look up a blob by tag below 'root'.
+ * If the tag occurs more than once, the one closest to 'root' wins. */
+static struct blob *
+pgp_index_find(struct pgp_priv_data *priv, struct blob *root, unsigned int id)
+{
+	struct blob *blob, *best = NULL;
+	int best_depth = 0;
+
+	for (blob = priv->index[pgp_index_hash(id)]; blob != NULL; blob = blob->hnext) {
+		struct blob *p;
+		int depth = 0;
+
+		if (blob->id != id)
+			continue;
+		for (p = blob->parent; p != NULL && p != root; p = p->parent)
+			depth++;
+		if (p == NULL)
+			continue;
+		if (best == NULL || depth < best_depth) {
+			best = blob;
+			best_depth = depth;
+		}
+	}
+
+	return best;
+}
+
+
 /* internal: append a blob to the list of children of a given parent blob */
 static struct blob *
 pgp_new_blob(sc_card_t *card, struct blob *parent, unsigned int file_id,
@@ -653,6 +724,7 @@ pgp_new_blob(sc_card_t *card, struct blob *parent, unsigned int file_id,
 			 * string */
 			sc_format_path((char *) ushort2bebytes(id_str, file_id), &blob->file->path);
 		}
+		pgp_index_add(priv, blob);
 
 		/* find matching DO info: set file type depending on it */
 		for (info = priv->pgp_objects; (info != NULL) && (info->id > 0); info++) {
@@ -723,17 +795,42 @@ pgp_read_blob(sc_card_t *card, struct blob *blob)
 		return blob->status;
 
 	if (blob->info->get_fn) {	/* readable, top-level DO */
-		u8 	buffer[2048];
-		size_t	buf_len = (card->caps & SC_CARD_CAP_APDU_EXT)
-				  ? sizeof(buffer) : 256;
-		int	r = blob->info->get_fn(card, blob->id, buffer, buf_len);
+		struct pgp_priv_data *priv = DRVDATA(card);
+		u8	*buffer = NULL;
+		size_t	buf_len = PGP_DO_BUFSIZE;
+		int	r;
+
+		/* the certificate DO announces its capacity */
+		if (blob->id == DO_CERT && priv->max_cert_size > buf_len)
+			buf_len = MIN(priv->max_cert_size, PGP_DO_MAXSIZE);
+
+		for (;;) {
+			u8 *tmp = realloc(buffer, buf_len);
+
+			if (tmp == NULL) {
+				free(buffer);
+				return SC_ERROR_OUT_OF_MEMORY;
+			}
+			buffer = tmp;
+
+			/* without extended APDUs, get_fn reads the DO in
+			 * 256 byte pieces through GET RESPONSE */
+			r = blob->info->get_fn(card, blob->id, buffer, buf_len);
+			/* a full buffer may hold a truncated DO: retry larger */
+			if (r < 0 || (size_t) r < buf_len || buf_len >= PGP_DO_MAXSIZE)
+				break;
+			buf_len = MIN(buf_len * 2, PGP_DO_MAXSIZE);
+		}
 
 		if (r < 0) {	/* an error occurred */
+			free(buffer);
 			blob->status = r;
 			return r;
 		}
 
-		return pgp_set_blob(blob, buffer, r);
+		r = pgp_set_blob(blob, buffer, r);
+		free(buffer);
+		return r;
 	}
 	else {		/* un-readable DO or part of a constructed DO */
 		return SC_SUCCESS;
@@ -802,8 +899,8 @@ pgp_get_blob(sc_card_t *card, struct blob *blob, unsigned int id,
 	if ((r = pgp_enumerate_blob(card, blob)) < 0)
 		return r;
 
-	for (child = blob->files; child; child = child->next) {
-		if (child->id == id) {
+	for (child = DRVDATA(card)->index[pgp_index_hash(id)]; child; child = child->hnext) {
+		if (child->id == id && child->parent == blob) {
 			(void) pgp_read_blob(card, child);
 			*ret = child;
 			return SC_SUCCESS;
@@ -821,6 +918,13 @@ pgp_seek_blob(sc_card_t *card, struct blob *root, unsigned int id,
 	struct blob	*child;
 	int			r;
 
+	/* Anything enumerated so far is in the tag index */
+	if ((child = pgp_index_find(DRVDATA(card), root, id)) != NULL) {
+		(void) pgp_read_blob(card, child);
+		*ret = child;
+		return SC_SUCCESS;
+	}
+
 	if ((r = pgp_get_blob(card, root, id, ret)) == 0)
 		/* The sought blob is right under root */
 		return r;
@@ -839,6 +943,44 @@ pgp_seek_blob(sc_card_t *card, struct blob *root, unsigned int id,
 	return SC_ERROR_FILE_NOT_FOUND;
 }
 
+/* internal: enumerate a constructed blob and, from its data, all
+ * constructed DOs nested in it */
+static int
+pgp_enumerate_tree(sc_card_t *card, struct blob *blob)
+{
+	struct blob	*child;
+	int		r;
+
+	if ((r = pgp_enumerate_blob(card, blob)) < 0)
+		return r;
+
+	for (child = blob->files; child; child = child->next) {
+		if (child->info == NULL || child->info->type != CONSTRUCTED
+		    || child->info->get_fn != NULL || child->id == DO_CERT)
+			continue;
+		pgp_enumerate_tree(card, child);
+	}
+
+	return SC_SUCCESS;
+}
+
+/* internal: read a top-level constructed DO and index everything in it */
+static int
+pgp_prefetch_blob(sc_card_t *card, unsigned int id)
+{
+	struct pgp_priv_data *priv = DRVDATA(card);
+	struct blob	*blob;
+	int		r;
+
+	if ((r = pgp_get_blob(card, priv->mf, id, &blob)) < 0)
+		return r;
+
+	r = pgp_enumerate_tree(card, blob);
+	if (r < 0)
+		sc_log(card->ctx, "Failed to prefetch DO %04X. Error %d.", id, r);
+	return r;
+}
+
 /* internal: find a blob by tag - pgp_seek_blob with optimizations */
 static struct blob *
 pgp_find_blob(sc_card_t *card, unsigned int tag)
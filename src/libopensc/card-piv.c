@@ -1050,7 +1050,7 @@ static int piv_cache_internal_data(sc_card_t *card, int enumtag)
 #ifdef ENABLE_ZLIB
 			size_t len;
 			u8* newBuf = NULL;
-			if(SC_SUCCESS != sc_decompress_alloc(&newBuf, &len, tag, taglen, COMPRESSION_AUTO)) {
+			if(SC_SUCCESS != sc_decompress_alloc_ex(card->ctx, &newBuf, &len, tag, taglen, COMPRESSION_AUTO, 0)) {
 				SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_OBJECT_NOT_VALID);
 			}
 			priv->obj_cache[enumtag].internal_obj_data = newBuf;
@@ -2073,6 +2073,63 @@ static int piv_is_object_present(sc_card_t *card, u8 *ptr)
 	SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, r);
 }
 
+/*
+ * Get the first bytes of an object: its tag and length and, for a
+ * certificate, the certificate serial number. This is one GET DATA
+ * exchange instead of reading the whole object, unless it is in the
+ * object cache already.
+ */
+static int piv_get_object_head(sc_card_t *card, sc_cardctl_piv_object_head_t *head)
+{
+	piv_private_data_t * priv = PIV_DATA(card);
+	int r;
+	int enumtag;
+	u8 tagbuf[8];
+	u8 *p, *rbuf;
+	size_t tag_len, rbuflen;
+
+	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
+
+	if (head == NULL || head->path == NULL || head->buf == NULL || head->len == 0)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_INVALID_ARGUMENTS);
+
+	enumtag = piv_find_obj_by_containerid(card, head->path->value);
+	if (enumtag < 0)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_FILE_NOT_FOUND);
+
+	if (priv->obj_cache[enumtag].flags & PIV_OBJ_CACHE_NOT_PRESENT)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_FILE_NOT_FOUND);
+
+	if (priv->obj_cache[enumtag].flags & PIV_OBJ_CACHE_VALID) {
+		if (priv->obj_cache[enumtag].obj_len == 0)
+			SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_ERROR_FILE_NOT_FOUND);
+		if (head->len > priv->obj_cache[enumtag].obj_len)
+			head->len = priv->obj_cache[enumtag].obj_len;
+		memcpy(head->buf, priv->obj_cache[enumtag].obj_data, head->len);
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_SUCCESS);
+	}
+
+	tag_len = piv_objects[enumtag].tag_len;
+	p = tagbuf;
+	put_tag_and_len(0x5c, tag_len, &p);
+	memcpy(p, piv_objects[enumtag].tag_value, tag_len);
+	p += tag_len;
+
+	/* piv_general_io() returns the length of the whole object, but
+	 * stops reading once the buffer is full */
+	rbuf = head->buf;
+	rbuflen = head->len;
+	r = piv_general_io(card, 0xCB, 0x3F, 0xFF, tagbuf, p - tagbuf, &rbuf, &rbuflen);
+	if (r == 0)
+		r = SC_ERROR_FILE_NOT_FOUND;
+	if (r < 0)
+		SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, r);
+
+	if (head->len > (size_t) r)
+		head->len = r;
+	SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_NORMAL, SC_SUCCESS);
+}
+
 /*
  * NIST 800-73-3 allows the default pin to be the PIV application 0x80
  * or the global pin for the card 0x00. Look at Discovery object to get this.
@@ -2124,6 +2181,9 @@ static int piv_card_ctl(sc_card_t *card, unsigned long cmd, void *ptr)
 		case SC_CARDCTL_PIV_OBJECT_PRESENT:
 			return piv_is_object_present(card, ptr);
 			break;
+		case SC_CARDCTL_PIV_OBJECT_HEAD:
+			return piv_get_object_head(card, (sc_cardctl_piv_object_head_t *) ptr);
+			break;
 	}
 
 	LOG_FUNC_RETURN(card->ctx, SC_ERROR_NOT_SUPPORTED);
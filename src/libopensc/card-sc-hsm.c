@@ -266,6 +266,19 @@ static int sc_hsm_read_binary(sc_card_t *card,
 
 
 
+/*
+ * Content read by the PKCS#15 emulator may no longer match the card
+ */
+static void sc_hsm_invalidate_descriptors(sc_card_t *card)
+{
+	sc_hsm_private_data_t *priv = (sc_hsm_private_data_t *) card->drv_data;
+
+	sc_pkcs15emu_sc_hsm_free_descriptors(priv);
+	priv->descriptors_modified = 1;
+}
+
+
+
 static int sc_hsm_write_ef(sc_card_t *card,
 			       int fid,
 			       unsigned int idx, const u8 *buf, size_t count)
@@ -322,6 +335,8 @@ static int sc_hsm_write_ef(sc_card_t *card,
 	r =  sc_check_sw(card, apdu.sw1, apdu.sw2);
 	LOG_TEST_RET(ctx, r, "Check SW error");
 
+	sc_hsm_invalidate_descriptors(card);
+
 	LOG_FUNC_RETURN(ctx, count);
 }
 
@@ -407,6 +422,8 @@ static int sc_hsm_delete_file(sc_card_t *card, const sc_path_t *path)
 	r =  sc_check_sw(card, apdu.sw1, apdu.sw2);
 	LOG_TEST_RET(ctx, r, "Check SW error");
 
+	sc_hsm_invalidate_descriptors(card);
+
 	LOG_FUNC_RETURN(ctx, SC_SUCCESS);
 }
 
@@ -1065,6 +1082,7 @@ static int sc_hsm_finish(sc_card_t * card)
 	if (priv->serialno) {
 		free(priv->serialno);
 	}
+	sc_pkcs15emu_sc_hsm_free_descriptors(priv);
 	free(priv);
 	return SC_SUCCESS;
 }
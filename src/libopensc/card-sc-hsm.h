@@ -50,6 +50,15 @@
 #define ID_USER_PIN				0x81		/* User PIN identifier */
 #define ID_SO_PIN				0x88		/* Security officer PIN identifier */
 
+/* Leading content of a descriptor or certificate EF read by the PKCS#15 emulator */
+struct sc_hsm_descriptor {
+	struct sc_hsm_descriptor *next;
+	u8 fid[2];
+	int complete;						// Content is the whole EF
+	u8 *data;
+	size_t len;
+};
+
 /* Information the driver maintains between calls */
 typedef struct sc_hsm_private_data {
 	const sc_security_env_t *env;
@@ -57,6 +66,9 @@ typedef struct sc_hsm_private_data {
 	int noExtLength;
 	char *serialno;
 	u8 sopin[8];
+	struct sc_hsm_descriptor *descriptors;
+	u8 filelist_hash[8];
+	int descriptors_modified;
 } sc_hsm_private_data_t;
 
 
@@ -115,6 +127,7 @@ int sc_pkcs15emu_sc_hsm_encode_cvc(sc_pkcs15_card_t * p15card,
 		sc_cvc_t *cvc,
 		u8 ** buf, size_t *buflen);
 void sc_pkcs15emu_sc_hsm_free_cvc(sc_cvc_t *cvc);
+void sc_pkcs15emu_sc_hsm_free_descriptors(sc_hsm_private_data_t *priv);
 int sc_pkcs15emu_sc_hsm_get_curve(struct ec_curve **curve, u8 *oid, size_t oidlen);
 int sc_pkcs15emu_sc_hsm_get_public_key(struct sc_context *ctx, sc_cvc_t *cvc, struct sc_pkcs15_pubkey *pubkey);
 
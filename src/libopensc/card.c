@@ -103,6 +103,10 @@ static void sc_card_free(sc_card_t *card)
 		sc_file_free(card->cache.current_ef);
 	if (card->cache.current_df)
 		sc_file_free(card->cache.current_df);
+	if (card->apdu_stats != NULL) {
+		sc_reset_apdu_stats(card);
+		free(card->apdu_stats);
+	}
 	if (card->mutex != NULL) {
 		int r = sc_mutex_destroy(card->ctx, card->mutex);
 		if (r != SC_SUCCESS)
@@ -144,6 +148,7 @@ int sc_connect_card(sc_reader_t *reader, sc_card_t **card_out)
 	/* See if the ATR matches any ATR specified in the config file */
 	if ((driver = ctx->forced_driver) == NULL) {
 		sc_log(ctx, "matching configured ATRs");
+		_sc_ctx_load_card_atrs(ctx);
 		for (i = 0; ctx->card_drivers[i] != NULL; i++) {
 			driver = ctx->card_drivers[i];
 
@@ -155,7 +160,15 @@ int sc_connect_card(sc_reader_t *reader, sc_card_t **card_out)
 			sc_log(ctx, "trying driver '%s'", driver->short_name);
 			idx = _sc_match_atr(card, driver->atr_map, NULL);
 			if (idx >= 0) {
-				struct sc_atr_table *src = &driver->atr_map[idx];
+				struct sc_atr_table *src;
+
+				/* external module is loaded on its first match */
+				driver = _sc_ctx_load_card_driver(ctx, i);
+				if (driver->ops == NULL) {
+					driver = NULL;
+					continue;
+				}
+				src = &driver->atr_map[idx];
 
 				sc_log(ctx, "matched driver '%s'", driver->name);
 				/* It's up to card driver to notice these correctly */
@@ -184,7 +197,7 @@ int sc_connect_card(sc_reader_t *reader, sc_card_t **card_out)
 	else {
 		sc_log(ctx, "matching built-in ATRs");
 		for (i = 0; ctx->card_drivers[i] != NULL; i++) {
-			struct sc_card_driver *drv = ctx->card_drivers[i];
+			struct sc_card_driver *drv = _sc_ctx_load_card_driver(ctx, i);
 			const struct sc_card_operations *ops = drv->ops;
 
 			sc_log(ctx, "trying driver '%s'", drv->short_name);
@@ -340,8 +353,8 @@ int sc_lock(sc_card_t *card)
 		if (r == 0)
 			card->cache.valid = 1;
 	}
-	if (r == 0)
-		card->lock_count++;
+	if (r == 0 && card->lock_count++ == 0)
+		card->cancel_count = card->ctx->cancel_count;
 	r2 = sc_mutex_unlock(card->ctx, card->mutex);
 	if (r2 != SC_SUCCESS) {
 		sc_log(card->ctx, "unable to release lock");
@@ -351,6 +364,17 @@ int sc_lock(sc_card_t *card)
 	return r;
 }
 
+
+void sc_set_card_deadline(sc_card_t *card, unsigned long timeout_ms)
+{
+	if (card == NULL)
+		return;
+	/* a cancel seen before the deadline is cleared still counts */
+	if (timeout_ms)
+		card->cancel_count = card->ctx->cancel_count;
+	card->deadline = timeout_ms ? sc_get_monotonic_time_us() + (unsigned long long)timeout_ms * 1000 : 0;
+}
+
 int sc_unlock(sc_card_t *card)
 {
 	int r, r2;
@@ -945,6 +969,7 @@ scconf_block *_sc_match_atr_block(sc_context_t *ctx, struct sc_card_driver *driv
 
 	if (ctx == NULL)
 		return NULL;
+	_sc_ctx_load_card_atrs(ctx);
 	if (driver) {
 		drv = driver;
 		table = drv->atr_map;
@@ -209,6 +209,7 @@ enum {
 	SC_CARDCTL_PIV_GENERATE_KEY,
 	SC_CARDCTL_PIV_PIN_PREFERENCE,
 	SC_CARDCTL_PIV_OBJECT_PRESENT,
+	SC_CARDCTL_PIV_OBJECT_HEAD,
 
         /*
 	 * AuthentIC v3
@@ -887,6 +888,13 @@ typedef struct sc_cardctl_piv_genkey_info_st {
 
 } sc_cardctl_piv_genkey_info_t;
 
+/* First bytes of a data object, SC_ERROR_FILE_NOT_FOUND if it is absent */
+typedef struct sc_cardctl_piv_object_head_st {
+	const sc_path_t	*path;
+	u8		*buf;
+	size_t		len;		/* in: size of buf, out: bytes stored */
+} sc_cardctl_piv_object_head_t;
+
 /*
  * OpenPGP
  */
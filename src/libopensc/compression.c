@@ -109,77 +109,159 @@ int sc_decompress(u8* out, size_t* outLen, const u8* in, size_t inLen, int metho
 	}
 }
 
-static int sc_decompress_zlib_alloc(u8** out, size_t* outLen, const u8* in, size_t inLen, int gzip) {
-	/* Since uncompress does not offer a way to make it uncompress gzip... manually set it up */
-	z_stream gz;
-	int err;
-	int window_size = 15;
-	const int startSize = inLen < 1024 ? 2048 : inLen * 2;
-	const int blockSize = inLen < 1024 ? 512 : inLen / 2;
-	int bufferSize = startSize;
-	if(gzip)
-		window_size += 0x20;
-	memset(&gz, 0, sizeof(gz));
-	
-	gz.next_in = (u8*)in;
-	gz.avail_in = inLen;
+/* An expected size above this is not trusted: the output buffer is grown instead */
+#define MAX_EXPECTED_SIZE	(16 * 1024 * 1024)
+/* zlib or gzip header, detected by inflate() */
+#define AUTO_WINDOW_BITS	(15 + 0x20)
 
-	err = inflateInit2(&gz, window_size);
-	if(err != Z_OK) return zerr_to_opensc(err);
+/* Uncompressed size modulo 2^32 from the gzip trailer, 0 if unknown */
+static size_t gzip_isize(const u8* in, size_t inLen) {
+	if(inLen < 18) /* 10 bytes header, 8 bytes trailer */
+		return 0;
+	in += inLen - 4;
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((size_t)in[3] << 24);
+}
 
-	*outLen = 0;
+/* The inflate stream kept in the context between calls, see
+ * sc_ctx_set_driver_data() */
+#define INFLATE_STATE	"compression"
+struct inflate_state {
+	z_stream *gz;
+};
 
-	while(1) {
-		/* Setup buffer... */
-		int num;
-		u8* buf = realloc(*out, bufferSize);
-		if(!buf) {
-			if(*out)
-				free(*out);
-			*out = NULL;
-			return Z_MEM_ERROR;
-		}
-		*out = buf;
-		gz.next_out = buf + *outLen;
-		gz.avail_out = bufferSize - *outLen;
-
-		err = inflate(&gz, Z_FULL_FLUSH);
-		if(err != Z_STREAM_END && err != Z_OK) {
-			if(*out)
-				free(*out);
-			*out = NULL;
-			break;
-		}
-		num = bufferSize - *outLen - gz.avail_out;
-		if(num > 0) {
-			*outLen += num;
-			bufferSize += num + blockSize;
+static void free_inflate_state(void *data) {
+	struct inflate_state *state = data;
+
+	if(state->gz) {
+		inflateEnd(state->gz);
+		free(state->gz);
+	}
+	free(state);
+}
+
+/* Take the inflate stream kept in the context, or set up a new one */
+static z_stream *get_stream(sc_context_t *ctx) {
+	struct inflate_state *state;
+	z_stream *gz = NULL;
+
+	if(ctx && sc_mutex_lock(ctx, ctx->mutex) == SC_SUCCESS) {
+		state = sc_ctx_get_driver_data(ctx, INFLATE_STATE);
+		if(state) {
+			gz = state->gz;
+			state->gz = NULL;
 		}
-		if(err == Z_STREAM_END) {
-			buf = realloc(buf, *outLen); /* Shrink it down, if it fails, just use old data */
-			if(buf) {
-				*out = buf;
+		sc_mutex_unlock(ctx, ctx->mutex);
+	}
+	if(gz) {
+		if(inflateReset(gz) == Z_OK)
+			return gz;
+		inflateEnd(gz);
+		free(gz);
+	}
+	gz = calloc(1, sizeof(z_stream));
+	if(!gz)
+		return NULL;
+	if(inflateInit2(gz, AUTO_WINDOW_BITS) != Z_OK) {
+		free(gz);
+		return NULL;
+	}
+	return gz;
+}
+
+/* Give the inflate stream back to the context for the next call */
+static void put_stream(sc_context_t *ctx, z_stream *gz) {
+	struct inflate_state *state;
+
+	if(ctx && sc_mutex_lock(ctx, ctx->mutex) == SC_SUCCESS) {
+		state = sc_ctx_get_driver_data(ctx, INFLATE_STATE);
+		if(!state) {
+			state = calloc(1, sizeof(*state));
+			if(state && sc_ctx_set_driver_data(ctx, INFLATE_STATE, state,
+					free_inflate_state) != SC_SUCCESS) {
+				free(state);
+				state = NULL;
 			}
-			break;
 		}
+		if(state && !state->gz) {
+			state->gz = gz;
+			gz = NULL;
+		}
+		sc_mutex_unlock(ctx, ctx->mutex);
+	}
+	if(gz) {
+		inflateEnd(gz);
+		free(gz);
 	}
-	inflateEnd(&gz);
-	return zerr_to_opensc(err);
 }
-int sc_decompress_alloc(u8** out, size_t* outLen, const u8* in, size_t inLen, int method) {
+
+int sc_decompress_alloc_ex(sc_context_t *ctx, u8** out, size_t* outLen, const u8* in, size_t inLen, int method, size_t expected) {
+	z_stream *gz;
+	u8 *buf = NULL, *tmp;
+	size_t bufferSize;
+	int err;
+
 	if(method == COMPRESSION_AUTO) {
 		method = detect_method(in, inLen);
 		if(method == COMPRESSION_UNKNOWN) {
 			return SC_ERROR_UNKNOWN_DATA_RECEIVED;
 		}
 	}
-	switch(method) {
-	case COMPRESSION_ZLIB:
-		return sc_decompress_zlib_alloc(out, outLen, in, inLen, 0);
-	case COMPRESSION_GZIP:
-		return sc_decompress_zlib_alloc(out, outLen, in, inLen, 1);
-	default:
+	if(method != COMPRESSION_ZLIB && method != COMPRESSION_GZIP)
 		return SC_ERROR_INVALID_ARGUMENTS;
+
+	if(expected == 0 && method == COMPRESSION_GZIP)
+		expected = gzip_isize(in, inLen);
+	if(expected > MAX_EXPECTED_SIZE)
+		expected = 0;
+	/* With a right guess the output fits exactly and one inflate() call does it all */
+	bufferSize = expected ? expected : (inLen < 1024 ? 2048 : inLen * 2);
+
+	gz = get_stream(ctx);
+	if(!gz)
+		return SC_ERROR_OUT_OF_MEMORY;
+	gz->next_in = (u8*)in;
+	gz->avail_in = inLen;
+
+	while(1) {
+		tmp = realloc(buf, bufferSize);
+		if(!tmp) {
+			err = Z_MEM_ERROR;
+			break;
+		}
+		buf = tmp;
+		gz->next_out = buf + gz->total_out;
+		gz->avail_out = bufferSize - gz->total_out;
+
+		err = inflate(gz, Z_FINISH);
+		if(err == Z_STREAM_END)
+			break;
+		/* Anything else than a full output buffer is an error */
+		if((err != Z_OK && err != Z_BUF_ERROR) || gz->avail_out != 0) {
+			if(err == Z_OK || err == Z_BUF_ERROR)
+				err = Z_DATA_ERROR; /* truncated input */
+			break;
+		}
+		bufferSize *= 2;
+	}
+
+	if(err == Z_STREAM_END) {
+		*outLen = gz->total_out;
+		if(*outLen < bufferSize) {
+			tmp = realloc(buf, *outLen ? *outLen : 1); /* Shrink it down, if it fails, just use old data */
+			if(tmp)
+				buf = tmp;
+		}
+		*out = buf;
+	} else {
+		free(buf);
+		*out = NULL;
+		*outLen = 0;
 	}
+	put_stream(ctx, gz);
+	return zerr_to_opensc(err);
+}
+
+int sc_decompress_alloc(u8** out, size_t* outLen, const u8* in, size_t inLen, int method) {
+	return sc_decompress_alloc_ex(NULL, out, outLen, in, inLen, method, 0);
 }
 #endif /* ENABLE_ZLIB */
@@ -31,5 +31,15 @@
 int sc_decompress_alloc(u8** out, size_t* outLen, const u8* in, size_t inLen, int method);
 int sc_decompress(u8* out, size_t* outLen, const u8* in, size_t inLen, int method);
 
+/*
+ * Like sc_decompress_alloc(), with the expected uncompressed size when the
+ * caller knows it (0 if not; for gzip data it is then read from the
+ * trailer). The output buffer is allocated once at that size, growing it
+ * only if the data turns out larger. With a context, the inflate state
+ * is kept in it for the next call, until sc_release_context().
+ */
+int sc_decompress_alloc_ex(sc_context_t *ctx, u8** out, size_t* outLen, const u8* in, size_t inLen,
+		int method, size_t expected);
+
 #endif
 
@@ -27,6 +27,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -38,8 +39,13 @@
 
 int _sc_add_reader(sc_context_t *ctx, sc_reader_t *reader)
 {
+	int r;
+
 	assert(reader != NULL);
 	reader->ctx = ctx;
+	r = sc_mutex_create(ctx, &reader->buf_mutex);
+	if (r != SC_SUCCESS)
+		return r;
 	list_append(&ctx->readers, reader);
 	return SC_SUCCESS;
 }
@@ -51,11 +57,65 @@ int _sc_delete_reader(sc_context_t *ctx, sc_reader_t *reader)
 			reader->ops->release(reader);
 	if (reader->name)
 		free(reader->name);
+	if (reader->buf) {
+		sc_mem_clear(reader->buf, reader->buf_send_len + reader->buf_recv_len);
+		free(reader->buf);
+	}
+	sc_mutex_destroy(ctx, reader->buf_mutex);
 	list_delete(&ctx->readers, reader);
 	free(reader);
 	return SC_SUCCESS;
 }
 
+/* Data a driver keeps for the lifetime of the context */
+struct sc_ctx_driver_data {
+	const char *name;
+	void *data;
+	void (*free_data)(void *data);
+	struct sc_ctx_driver_data *next;
+};
+
+void *sc_ctx_get_driver_data(sc_context_t *ctx, const char *name)
+{
+	struct sc_ctx_driver_data *dd;
+
+	for (dd = ctx->driver_data; dd != NULL; dd = dd->next)
+		if (!strcmp(dd->name, name))
+			return dd->data;
+	return NULL;
+}
+
+int sc_ctx_set_driver_data(sc_context_t *ctx, const char *name, void *data,
+		void (*free_data)(void *data))
+{
+	struct sc_ctx_driver_data *dd;
+
+	for (dd = ctx->driver_data; dd != NULL; dd = dd->next)
+		if (!strcmp(dd->name, name))
+			return SC_ERROR_INVALID_ARGUMENTS;
+	dd = calloc(1, sizeof(*dd));
+	if (dd == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	dd->name = name;
+	dd->data = data;
+	dd->free_data = free_data;
+	dd->next = ctx->driver_data;
+	ctx->driver_data = dd;
+	return SC_SUCCESS;
+}
+
+static void sc_ctx_free_driver_data(sc_context_t *ctx)
+{
+	while (ctx->driver_data != NULL) {
+		struct sc_ctx_driver_data *dd = ctx->driver_data;
+
+		ctx->driver_data = dd->next;
+		if (dd->free_data != NULL)
+			dd->free_data(dd->data);
+		free(dd);
+	}
+}
+
 struct _sc_driver_entry {
 	const char *name;
 	void *(*func)(void);
@@ -260,6 +320,9 @@ load_parameters(sc_context_t *ctx, scconf_block *block, struct _sc_ctx_options *
 	ctx->enable_default_driver = scconf_get_bool (block, "enable_default_driver",
 			ctx->enable_default_driver);
 
+	ctx->conf_reload_interval = scconf_get_int(block, "config_reload_interval",
+			ctx->conf_reload_interval);
+
 	val = scconf_get_str(block, "force_card_driver", NULL);
 	if (val) {
 		if (opts->forced_card_driver)
@@ -401,6 +464,92 @@ static int load_card_driver_options(sc_context_t *ctx,
 	return SC_SUCCESS;
 }
 
+/* Operations of the placeholder of an external card driver whose module
+ * has not been loaded yet; it matches no card until resolved with
+ * _sc_ctx_load_card_driver() */
+static struct sc_card_operations driver_stub_ops;
+
+static int is_driver_stub(sc_context_t *ctx, const struct sc_card_driver *drv)
+{
+	return ctx->driver_stubs != NULL && drv >= ctx->driver_stubs
+		&& drv < ctx->driver_stubs + SC_MAX_CARD_DRIVERS;
+}
+
+static struct sc_card_driver *new_driver_stub(sc_context_t *ctx, const char *name)
+{
+	struct sc_card_driver *stub;
+	int i;
+
+	if (ctx->driver_stubs == NULL) {
+		ctx->driver_stubs = calloc(SC_MAX_CARD_DRIVERS, sizeof(struct sc_card_driver));
+		if (ctx->driver_stubs == NULL)
+			return NULL;
+	}
+	for (i = 0; i < SC_MAX_CARD_DRIVERS && ctx->driver_stubs[i].short_name; i++)
+		;
+	if (i == SC_MAX_CARD_DRIVERS)
+		return NULL;
+
+	stub = &ctx->driver_stubs[i];
+	stub->short_name = strdup(name);
+	if (stub->short_name == NULL)
+		return NULL;
+	stub->name = stub->short_name;
+	stub->ops = &driver_stub_ops;
+	return stub;
+}
+
+/* the caller holds ctx->mutex */
+static struct sc_card_driver *load_card_driver(sc_context_t *ctx, unsigned int idx)
+{
+	struct sc_card_driver *stub = ctx->card_drivers[idx], *drv = NULL;
+	struct sc_card_driver *(*func)(void) = NULL;
+	struct sc_card_driver *(**tfunc)(void) = &func;
+	unsigned long long start;
+	void *dll = NULL;
+
+	if (stub == NULL || stub->ops != &driver_stub_ops)
+		return stub;
+
+	start = sc_get_time_us();
+	*(void **)(tfunc) = load_dynamic_driver(ctx, &dll, stub->short_name);
+	if (func != NULL)
+		drv = func();
+	if (drv == NULL) {
+		sc_log(ctx, "Unable to load '%s'.", stub->short_name);
+		if (dll)
+			sc_dlclose(dll);
+		/* keep the stub as an inert entry: it matches nothing */
+		stub->ops = NULL;
+		_sc_free_atr(ctx, stub);
+		drv = stub;
+	}
+	else {
+		drv->dll = dll;
+		/* 'card_atr' entries already assigned to the stub */
+		drv->atr_map = stub->atr_map;
+		drv->natrs = stub->natrs;
+		stub->atr_map = NULL;
+		stub->natrs = 0;
+		load_card_driver_options(ctx, drv);
+		ctx->card_drivers[idx] = drv;
+	}
+	ctx->timing.driver_loads += (unsigned long)(sc_get_time_us() - start);
+
+	return drv;
+}
+
+struct sc_card_driver *_sc_ctx_load_card_driver(sc_context_t *ctx, unsigned int idx)
+{
+	struct sc_card_driver *drv;
+
+	sc_mutex_lock(ctx, ctx->mutex);
+	drv = load_card_driver(ctx, idx);
+	sc_mutex_unlock(ctx, ctx->mutex);
+
+	return drv;
+}
+
 static int load_card_drivers(sc_context_t *ctx,
 			     struct _sc_ctx_options *opts)
 {
@@ -413,8 +562,6 @@ static int load_card_drivers(sc_context_t *ctx,
 
 	for (i = 0; i < opts->ccount; i++) {
 		struct sc_card_driver *(*func)(void) = NULL;
-		struct sc_card_driver *(**tfunc)(void) = &func;
-		void *dll = NULL;
 		int  j;
 
 		if (drv_count >= SC_MAX_CARD_DRIVERS - 1)   {
@@ -428,19 +575,24 @@ static int load_card_drivers(sc_context_t *ctx,
 				func = (struct sc_card_driver *(*)(void)) internal_card_drivers[j].func;
 				break;
 			}
-		/* if not initialized assume external module */
-		if (func == NULL)
-			*(void **)(tfunc) = load_dynamic_driver(ctx, &dll, ent->name);
-		/* if still null, assume driver not found */
+		/* if not initialized assume external module: it is loaded
+		 * when the driver is needed for the first time */
 		if (func == NULL) {
-			sc_log(ctx, "Unable to load '%s'.", ent->name);
-			if (dll)
-				sc_dlclose(dll);
+			struct sc_card_driver *stub = new_driver_stub(ctx, ent->name);
+
+			if (stub == NULL) {
+				sc_log(ctx, "Unable to register '%s'.", ent->name);
+				continue;
+			}
+			sc_log(ctx, "card driver '%s' will be loaded on demand", ent->name);
+			ctx->card_drivers[drv_count] = stub;
+			ctx->card_drivers[drv_count + 1] = NULL;
+			drv_count++;
 			continue;
 		}
 
 		ctx->card_drivers[drv_count] = func();
-		ctx->card_drivers[drv_count]->dll = dll;
+		ctx->card_drivers[drv_count]->dll = NULL;
 
 		ctx->card_drivers[drv_count]->atr_map = NULL;
 		ctx->card_drivers[drv_count]->natrs = 0;
@@ -455,6 +607,22 @@ static int load_card_drivers(sc_context_t *ctx,
 	return SC_SUCCESS;
 }
 
+static int load_card_atrs(sc_context_t *ctx);
+
+void _sc_ctx_load_card_atrs(sc_context_t *ctx)
+{
+	unsigned long long start;
+
+	sc_mutex_lock(ctx, ctx->mutex);
+	if (!ctx->card_atrs_loaded) {
+		ctx->card_atrs_loaded = 1;
+		start = sc_get_time_us();
+		load_card_atrs(ctx);
+		ctx->timing.card_atrs = (unsigned long)(sc_get_time_us() - start);
+	}
+	sc_mutex_unlock(ctx, ctx->mutex);
+}
+
 static int load_card_atrs(sc_context_t *ctx)
 {
 	struct sc_card_driver *driver;
@@ -529,10 +697,224 @@ static int load_card_atrs(sc_context_t *ctx)
 	return SC_SUCCESS;
 }
 
-static void process_config_file(sc_context_t *ctx, struct _sc_ctx_options *opts)
+/* Finds the 'app <app_name>' and 'app default' blocks of a parsed configuration */
+static void find_app_blocks(sc_context_t *ctx, scconf_context *conf, scconf_block **conf_blocks)
+{
+	scconf_block **blocks;
+	int count = 0;
+
+	memset(conf_blocks, 0, 3 * sizeof(scconf_block *));
+	blocks = scconf_find_blocks(conf, NULL, "app", ctx->app_name);
+	if (blocks[0])
+		conf_blocks[count++] = blocks[0];
+	free(blocks);
+	if (strcmp(ctx->app_name, "default") != 0) {
+		blocks = scconf_find_blocks(conf, NULL, "app", "default");
+		if (blocks[0])
+			conf_blocks[count] = blocks[0];
+		free(blocks);
+	}
+}
+
+/* Same as sc_get_conf_block() with priority, for any configuration tree */
+static scconf_block *conf_find_block(scconf_context *conf, scconf_block **conf_blocks,
+		const char *name1, const char *name2)
+{
+	scconf_block *block = NULL, **blocks;
+	int i;
+
+	for (i = 0; conf_blocks[i] != NULL && block == NULL; i++) {
+		blocks = scconf_find_blocks(conf, conf_blocks[i], name1, name2);
+		if (blocks != NULL) {
+			block = blocks[0];
+			free(blocks);
+		}
+	}
+	return block;
+}
+
+static void conf_snapshot_free(struct sc_conf_snapshot *snap)
+{
+	size_t i;
+
+	if (snap == NULL)
+		return;
+	for (i = 0; i < snap->pkcs15.application_count; i++)
+		free(snap->pkcs15.applications[i].type);
+	free(snap->pkcs15.applications);
+	free(snap->pkcs15.builtin_emulators);
+	free(snap->pkcs15.emulate_blocks);
+	free(snap->atrs);
+	free(snap->path);
+	if (snap->conf != NULL)
+		scconf_free(snap->conf);
+	free(snap);
+}
+
+static int conf_compile_atrs(scconf_context *conf, scconf_block **conf_blocks,
+		struct sc_conf_snapshot *snap)
 {
-	int i, r, count = 0;
 	scconf_block **blocks;
+	int i, j;
+
+	for (i = 0; conf_blocks[i] != NULL; i++) {
+		blocks = scconf_find_blocks(conf, conf_blocks[i], "card_atr", NULL);
+		for (j = 0; blocks && blocks[j] != NULL; j++) {
+			struct sc_conf_atr *atr, *tmp;
+			const char *mask;
+			size_t len, mask_len;
+
+			tmp = realloc(snap->atrs, (snap->atr_count + 1) * sizeof(struct sc_conf_atr));
+			if (tmp == NULL) {
+				free(blocks);
+				return SC_ERROR_OUT_OF_MEMORY;
+			}
+			snap->atrs = tmp;
+			atr = &snap->atrs[snap->atr_count];
+			memset(atr, 0, sizeof(*atr));
+
+			len = sizeof(atr->atr);
+			if (sc_hex_to_bin(blocks[j]->name->data, atr->atr, &len) || len < 2)
+				continue;
+			memset(atr->mask, 0xFF, len);
+			mask = scconf_get_str(blocks[j], "atrmask", NULL);
+			mask_len = sizeof(atr->mask);
+			if (mask && (sc_hex_to_bin(mask, atr->mask, &mask_len) || mask_len != len))
+				continue;
+			atr->len = len;
+			atr->pkcs11_enable_init_token = scconf_get_bool(blocks[j], "pkcs11_enable_InitToken", 0);
+			atr->block = blocks[j];
+			snap->atr_count++;
+		}
+		free(blocks);
+	}
+	return SC_SUCCESS;
+}
+
+static int conf_compile_pkcs15(scconf_context *conf, scconf_block **conf_blocks,
+		struct sc_conf_pkcs15 *p15)
+{
+	const scconf_list *list, *item;
+	scconf_block **blocks;
+	size_t count;
+	int i;
+
+	p15->use_file_cache = 0;
+	p15->use_pin_cache = 1;
+	p15->pin_cache_counter = 10;
+	p15->pin_cache_ignore_user_consent = 0;
+	p15->enable_emulation = 1;
+	p15->try_emulation_first = 0;
+	p15->enable_builtin_emulation = 1;
+
+	if (conf == NULL)
+		return SC_SUCCESS;
+	p15->block = conf_find_block(conf, conf_blocks, "framework", "pkcs15");
+	if (p15->block == NULL)
+		return SC_SUCCESS;
+
+	p15->use_file_cache = scconf_get_bool(p15->block, "use_file_caching", p15->use_file_cache);
+	p15->use_pin_cache = scconf_get_bool(p15->block, "use_pin_caching", p15->use_pin_cache);
+	p15->pin_cache_counter = scconf_get_int(p15->block, "pin_cache_counter", p15->pin_cache_counter);
+	p15->pin_cache_ignore_user_consent = scconf_get_bool(p15->block, "pin_cache_ignore_user_consent",
+			p15->pin_cache_ignore_user_consent);
+	p15->enable_emulation = scconf_get_bool(p15->block, "enable_pkcs15_emulation", 1);
+	p15->try_emulation_first = scconf_get_bool(p15->block, "try_emulation_first", 0);
+	p15->enable_builtin_emulation = scconf_get_bool(p15->block, "enable_builtin_emulation", 1);
+
+	list = scconf_find_list(p15->block, "builtin_emulators");
+	if (list != NULL) {
+		for (count = 0, item = list; item; item = item->next)
+			count++;
+		p15->builtin_emulators = calloc(count + 1, sizeof(int));
+		if (p15->builtin_emulators == NULL)
+			return SC_ERROR_OUT_OF_MEMORY;
+		for (count = 0, item = list; item; item = item->next) {
+			int idx = item->data ? sc_pkcs15emu_get_builtin_index(item->data) : -1;
+			if (idx >= 0)
+				p15->builtin_emulators[count++] = idx;
+		}
+		p15->builtin_emulators[count] = -1;
+	}
+
+	blocks = scconf_find_blocks(conf, p15->block, "emulate", NULL);
+	if (blocks != NULL && blocks[0] != NULL)
+		p15->emulate_blocks = blocks;
+	else
+		free(blocks);
+
+	blocks = scconf_find_blocks(conf, p15->block, "application", NULL);
+	for (count = 0; blocks && blocks[count]; count++)
+		;
+	if (count) {
+		p15->applications = calloc(count, sizeof(struct sc_conf_application));
+		if (p15->applications == NULL) {
+			free(blocks);
+			return SC_ERROR_OUT_OF_MEMORY;
+		}
+	}
+	for (i = 0; blocks && blocks[i]; i++) {
+		struct sc_conf_application *app = &p15->applications[p15->application_count];
+		const char *type = scconf_get_str(blocks[i], "type", NULL);
+
+		app->aid.len = sizeof(app->aid.value);
+		if (sc_hex_to_bin(blocks[i]->name->data, app->aid.value, &app->aid.len))
+			continue;
+		if (type) {
+			app->type = strdup(type);
+			if (app->type == NULL) {
+				free(blocks);
+				return SC_ERROR_OUT_OF_MEMORY;
+			}
+		}
+		p15->application_count++;
+	}
+	free(blocks);
+
+	return SC_SUCCESS;
+}
+
+/* Compiles the snapshot of a parsed configuration (conf may be NULL) */
+static struct sc_conf_snapshot *conf_compile(sc_context_t *ctx, scconf_context *conf,
+		scconf_block **conf_blocks, const char *path)
+{
+	struct sc_conf_snapshot *snap;
+	struct stat st;
+	int r;
+
+	snap = calloc(1, sizeof(struct sc_conf_snapshot));
+	if (snap == NULL)
+		return NULL;
+	snap->refs = 1;
+	if (path) {
+		snap->path = strdup(path);
+		if (snap->path == NULL) {
+			free(snap);
+			return NULL;
+		}
+		if (stat(path, &st) == 0) {
+			snap->mtime = (long)st.st_mtime;
+			snap->size = (long)st.st_size;
+		}
+	}
+
+	r = conf ? conf_compile_atrs(conf, conf_blocks, snap) : SC_SUCCESS;
+	if (r == SC_SUCCESS)
+		r = conf_compile_pkcs15(conf, conf_blocks, &snap->pkcs15);
+	if (r != SC_SUCCESS) {
+		sc_log(ctx, "cannot compile configuration: %s", sc_strerror(r));
+		conf_snapshot_free(snap);
+		return NULL;
+	}
+
+	sc_log(ctx, "configuration compiled: %lu card_atr entries, %lu applications",
+			(unsigned long)snap->atr_count, (unsigned long)snap->pkcs15.application_count);
+	return snap;
+}
+
+static void process_config_file(sc_context_t *ctx, struct _sc_ctx_options *opts)
+{
+	int i, r;
 	const char *conf_path = NULL;
 	const char *debug = NULL;
 #ifdef _WIN32
@@ -574,7 +956,7 @@ static void process_config_file(sc_context_t *ctx, struct _sc_ctx_options *opts)
 
 	if (!conf_path) {
 		sc_log(ctx, "process_config_file doesn't find opensc config file. Please set the registry key.");
-		return;
+		goto compile;
 	}
 
 #else
@@ -584,7 +966,7 @@ static void process_config_file(sc_context_t *ctx, struct _sc_ctx_options *opts)
 #endif
 	ctx->conf = scconf_new(conf_path);
 	if (ctx->conf == NULL)
-		return;
+		goto compile;
 	r = scconf_parse(ctx->conf);
 #ifdef OPENSC_CONFIG_STRING
 	/* Parse the string if config file didn't exist */
@@ -601,56 +983,208 @@ static void process_config_file(sc_context_t *ctx, struct _sc_ctx_options *opts)
 			sc_log(ctx, "scconf_parse failed: %s", ctx->conf->errmsg);
 		scconf_free(ctx->conf);
 		ctx->conf = NULL;
-		return;
-	}
-	blocks = scconf_find_blocks(ctx->conf, NULL, "app", ctx->app_name);
-	if (blocks[0])
-		ctx->conf_blocks[count++] = blocks[0];
-	free(blocks);
-	if (strcmp(ctx->app_name, "default") != 0) {
-		blocks = scconf_find_blocks(ctx->conf, NULL, "app", "default");
-		if (blocks[0])
-			ctx->conf_blocks[count] = blocks[0];
-		free(blocks);
+		goto compile;
 	}
-	/* Above we add 2 blocks at most, but conf_blocks has 3 elements,
+	/* Adds 2 blocks at most, but conf_blocks has 3 elements,
 	 * so at least one is NULL */
+	find_app_blocks(ctx, ctx->conf, ctx->conf_blocks);
 	for (i = 0; ctx->conf_blocks[i]; i++)
 		load_parameters(ctx, ctx->conf_blocks[i], opts);
+
+compile:
+	/* the values used on the detection and bind paths are read once here;
+	 * the first snapshot uses the scconf tree of the context */
+	ctx->conf_snapshot = conf_compile(ctx, ctx->conf, ctx->conf_blocks, conf_path);
+	ctx->conf_checked = (long)time(NULL);
 }
 
-int sc_ctx_detect_readers(sc_context_t *ctx)
+
+struct sc_conf_snapshot *sc_ctx_get_conf(sc_context_t *ctx)
 {
-	int r = 0;
-	const struct sc_reader_driver *drv = ctx->reader_driver;
+	struct sc_conf_snapshot *snap;
+	int reload = 0;
+
+	assert(ctx != NULL);
+	if (ctx->conf_reload_interval) {
+		long now = (long)time(NULL);
+
+		sc_mutex_lock(ctx, ctx->mutex);
+		if (now - ctx->conf_checked >= (long)ctx->conf_reload_interval) {
+			struct stat st;
+
+			ctx->conf_checked = now;
+			snap = ctx->conf_snapshot;
+			if (snap->path && stat(snap->path, &st) == 0
+					&& ((long)st.st_mtime != snap->mtime || (long)st.st_size != snap->size))
+				reload = 1;
+		}
+		sc_mutex_unlock(ctx, ctx->mutex);
+		if (reload)
+			sc_ctx_reload_conf(ctx);
+	}
+
+	sc_mutex_lock(ctx, ctx->mutex);
+	snap = ctx->conf_snapshot;
+	snap->refs++;
+	sc_mutex_unlock(ctx, ctx->mutex);
+
+	return snap;
+}
+
+
+void sc_ctx_put_conf(sc_context_t *ctx, struct sc_conf_snapshot *snap)
+{
+	int release;
+
+	if (ctx == NULL || snap == NULL)
+		return;
+
+	sc_mutex_lock(ctx, ctx->mutex);
+	release = --snap->refs == 0;
+	sc_mutex_unlock(ctx, ctx->mutex);
+
+	if (release)
+		conf_snapshot_free(snap);
+}
+
+
+int sc_ctx_reload_conf(sc_context_t *ctx)
+{
+	struct sc_conf_snapshot *snap, *old;
+	scconf_context *conf;
+	scconf_block *conf_blocks[3];
+	char *path;
+	int r;
 
+	if (ctx == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	LOG_FUNC_CALLED(ctx);
 	sc_mutex_lock(ctx, ctx->mutex);
+	path = ctx->conf_snapshot->path ? strdup(ctx->conf_snapshot->path) : NULL;
+	sc_mutex_unlock(ctx, ctx->mutex);
+	if (path == NULL)
+		LOG_TEST_RET(ctx, SC_ERROR_FILE_NOT_FOUND, "no configuration file to reload");
+
+	/* parse and compile outside of the lock: the current snapshot stays
+	 * in use until the new one is complete */
+	conf = scconf_new(path);
+	if (conf == NULL) {
+		free(path);
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+	}
+	r = scconf_parse(conf);
+	if (r < 1) {
+		sc_log(ctx, "reload: scconf_parse failed: %s", conf->errmsg);
+		scconf_free(conf);
+		free(path);
+		LOG_FUNC_RETURN(ctx, SC_ERROR_INCONSISTENT_CONFIGURATION);
+	}
+	find_app_blocks(ctx, conf, conf_blocks);
+	snap = conf_compile(ctx, conf, conf_blocks, path);
+	free(path);
+	if (snap == NULL) {
+		scconf_free(conf);
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+	}
+	snap->conf = conf;
+
+	sc_mutex_lock(ctx, ctx->mutex);
+	old = ctx->conf_snapshot;
+	ctx->conf_snapshot = snap;
+	ctx->conf_checked = (long)time(NULL);
+	sc_mutex_unlock(ctx, ctx->mutex);
+
+	/* drop the reference of the context */
+	sc_ctx_put_conf(ctx, old);
+	sc_log(ctx, "configuration reloaded");
+	LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+}
+
+
+const struct sc_conf_atr *sc_conf_match_atr(const struct sc_conf_snapshot *snap,
+		const struct sc_atr *atr)
+{
+	size_t i, j;
+
+	if (snap == NULL || atr == NULL)
+		return NULL;
+
+	for (i = 0; i < snap->atr_count; i++) {
+		const struct sc_conf_atr *entry = &snap->atrs[i];
+
+		if (entry->len != atr->len)
+			continue;
+		for (j = 0; j < entry->len; j++)
+			if ((atr->value[j] & entry->mask[j]) != (entry->atr[j] & entry->mask[j]))
+				break;
+		if (j == entry->len)
+			return entry;
+	}
+	return NULL;
+}
+
+/* Called with ctx->mutex held. The reader driver must walk ctx->readers
+ * directly: the sc_ctx_get_reader*() functions take ctx->mutex */
+static int detect_readers_locked(sc_context_t *ctx)
+{
+	int r = 0;
+	const struct sc_reader_driver *drv = ctx->reader_driver;
+	unsigned long long start;
 
+	start = sc_get_time_us();
 	if (drv->ops->detect_readers != NULL)
 		r = drv->ops->detect_readers(ctx);
+	ctx->timing.detect_readers = (unsigned long)(sc_get_time_us() - start);
+	/* a failed detection is tried again on the next use */
+	if (r == SC_SUCCESS)
+		ctx->readers_detected = 1;
+	return r;
+}
 
+int sc_ctx_detect_readers(sc_context_t *ctx)
+{
+	int r;
+
+	sc_mutex_lock(ctx, ctx->mutex);
+	r = detect_readers_locked(ctx);
 	sc_mutex_unlock(ctx, ctx->mutex);
 
 	return r;
 }
 
+/* Readers are enumerated on first use rather than in sc_context_create().
+ * The check is made under ctx->mutex, so that no thread gets the list
+ * while another one is still building it */
+static void detect_readers_once(sc_context_t *ctx)
+{
+	sc_mutex_lock(ctx, ctx->mutex);
+	if (!ctx->readers_detected)
+		detect_readers_locked(ctx);
+	sc_mutex_unlock(ctx, ctx->mutex);
+}
+
 sc_reader_t *sc_ctx_get_reader(sc_context_t *ctx, unsigned int i)
 {
+	detect_readers_once(ctx);
 	return list_get_at(&ctx->readers, i);
 }
 
 sc_reader_t *sc_ctx_get_reader_by_id(sc_context_t *ctx, unsigned int id)
 {
+	detect_readers_once(ctx);
 	return list_get_at(&ctx->readers, id);
 }
 
 sc_reader_t *sc_ctx_get_reader_by_name(sc_context_t *ctx, const char * name)
 {
+	detect_readers_once(ctx);
 	return list_seek(&ctx->readers, name);
 }
 
 unsigned int sc_ctx_get_reader_count(sc_context_t *ctx)
 {
+	detect_readers_once(ctx);
 	return list_size(&ctx->readers);
 }
 
@@ -686,11 +1220,14 @@ int sc_context_create(sc_context_t **ctx_out, const sc_context_param_t *parm)
 {
 	sc_context_t		*ctx;
 	struct _sc_ctx_options	opts;
+	unsigned long long	start, t;
 	int			r;
 
 	if (ctx_out == NULL || parm == NULL)
 		return SC_ERROR_INVALID_ARGUMENTS;
 
+	start = sc_get_time_us();
+
 	ctx = calloc(1, sizeof(sc_context_t));
 	if (ctx == NULL)
 		return SC_ERROR_OUT_OF_MEMORY;
@@ -719,6 +1256,14 @@ int sc_context_create(sc_context_t **ctx_out, const sc_context_param_t *parm)
 	}
 
 	process_config_file(ctx, &opts);
+	t = sc_get_time_us();
+	ctx->timing.config = (unsigned long)(t - start);
+	if (ctx->conf_snapshot == NULL) {
+		del_drvs(&opts);
+		free(opts.forced_card_driver);
+		sc_release_context(ctx);
+		return SC_ERROR_OUT_OF_MEMORY;
+	}
 	sc_log(ctx, "==================================="); /* first thing in the log */
 	sc_log(ctx, "opensc version: %s", sc_get_version());
 
@@ -741,16 +1286,23 @@ int sc_context_create(sc_context_t **ctx_out, const sc_context_param_t *parm)
 		sc_release_context(ctx);
 		return r;
 	}
+	ctx->timing.reader_driver = (unsigned long)(sc_get_time_us() - t);
 
+	/* External driver modules are loaded, 'card_atr' blocks parsed and
+	 * readers enumerated when they are first needed */
+	t = sc_get_time_us();
 	load_card_drivers(ctx, &opts);
-	load_card_atrs(ctx);
 	if (opts.forced_card_driver) {
 		/* FIXME: check return value? */
 		sc_set_card_driver(ctx, opts.forced_card_driver);
 		free(opts.forced_card_driver);
 	}
 	del_drvs(&opts);
-	sc_ctx_detect_readers(ctx);
+	ctx->timing.card_drivers = (unsigned long)(sc_get_time_us() - t);
+	ctx->timing.create = (unsigned long)(sc_get_time_us() - start);
+	sc_log(ctx, "context created in %lu us (config %lu, reader driver %lu, card drivers %lu)",
+			ctx->timing.create, ctx->timing.config,
+			ctx->timing.reader_driver, ctx->timing.card_drivers);
 	*ctx_out = ctx;
 
 	return SC_SUCCESS;
@@ -770,6 +1322,7 @@ int sc_ctx_use_reader(sc_context_t *ctx, void *pcsc_context_handle, void *pcsc_c
 int sc_cancel(sc_context_t *ctx)
 {
 	SC_FUNC_CALLED(ctx, SC_LOG_DEBUG_NORMAL);
+	ctx->cancel_count++;
 	if (ctx->reader_driver->ops->cancel != NULL)
 		return ctx->reader_driver->ops->cancel(ctx);
 
@@ -800,15 +1353,25 @@ int sc_release_context(sc_context_t *ctx)
 
 	if (ctx->reader_driver->ops->finish != NULL)
 		ctx->reader_driver->ops->finish(ctx);
+	/* before the driver modules are unloaded */
+	sc_ctx_free_driver_data(ctx);
 
 	for (i = 0; ctx->card_drivers[i]; i++) {
 		struct sc_card_driver *drv = ctx->card_drivers[i];
 
 		if (drv->atr_map)
 			_sc_free_atr(ctx, drv);
-		if (drv->dll)
+		if (drv->dll && !is_driver_stub(ctx, drv))
 			sc_dlclose(drv->dll);
 	}
+	if (ctx->driver_stubs != NULL) {
+		for (i = 0; i < SC_MAX_CARD_DRIVERS; i++) {
+			if (ctx->driver_stubs[i].atr_map)
+				_sc_free_atr(ctx, &ctx->driver_stubs[i]);
+			free((char *)ctx->driver_stubs[i].short_name);
+		}
+		free(ctx->driver_stubs);
+	}
 	if (ctx->preferred_language != NULL)
 		free(ctx->preferred_language);
 	if (ctx->mutex != NULL) {
@@ -818,6 +1381,8 @@ int sc_release_context(sc_context_t *ctx)
 			return r;
 		}
 	}
+	if (ctx->conf_snapshot != NULL)
+		conf_snapshot_free(ctx->conf_snapshot);
 	if (ctx->conf != NULL)
 		scconf_free(ctx->conf);
 	if (ctx->debug_file && (ctx->debug_file != stdout && ctx->debug_file != stderr))
@@ -844,6 +1409,9 @@ int sc_set_card_driver(sc_context_t *ctx, const char *short_name)
 		struct sc_card_driver *drv = ctx->card_drivers[i];
 
 		if (strcmp(short_name, drv->short_name) == 0) {
+			drv = load_card_driver(ctx, i);
+			if (drv->ops == NULL)
+				break;
 			ctx->forced_driver = drv;
 			match = 1;
 			break;
@@ -851,6 +851,7 @@ static int dnie_wrap_apdu(sc_card_t * card, sc_apdu_t * apdu)
 					continue;
 				/* SM was active: force restart SM and retry */
 				case CWA_SM_ACTIVE:
+					dnie_clear_cache(GET_DNIE_PRIV_DATA(card));
 					res=cwa_create_secure_channel(card, provider, CWA_SM_COLD);
 					LOG_TEST_RET(ctx,res,"Cannot re-enable SM");
 					continue;
@@ -31,6 +31,16 @@
 #include "user-interface.h"
 #endif
 
+/**
+  * Uncompressed content of a file read by read_binary()
+  */
+ typedef struct dnie_cache_entry_st {
+     struct dnie_cache_entry_st *next;
+     sc_path_t path;     /**< Absolute path of the file; empty if unknown */
+     u8 *data;           /**< File content, uncompressed */
+     size_t len;         /**< length of file content */
+ } dnie_cache_entry_t;
+
 /**
   * OpenDNIe private data declaration
   *
@@ -39,8 +49,10 @@
  typedef struct dnie_private_data_st {
  /*  sc_serial_number_t *serialnumber; < Cached copy of card serial number NOT USED AT THE MOMENT */
      int rsa_key_ref;    /**< Key id reference being used in sec operation */
-     u8 *cache;      /**< Cache buffer for read_binary() operation */
-     size_t cachelen;    /**< length of cache buffer */
+     dnie_cache_entry_t *cache;  /**< read_binary() file cache, most recently used first */
+     dnie_cache_entry_t *current;    /**< cache entry of the selected file, if any */
+     sc_path_t current_path;     /**< Absolute path of the selected EF; empty if unknown */
+     int cache_size;     /**< max number of files kept in cache */
      cwa_provider_t *cwa_provider;
 #ifdef ENABLE_DNIE_UI
 	 struct ui_context ui_ctx;
@@ -54,6 +66,7 @@
 #define GET_DNIE_UI_CTX(card) (((dnie_private_data_t *) ((card)->drv_data))->ui_ctx)
 
 int dnie_transmit_apdu(sc_card_t * card, sc_apdu_t * apdu);
+void dnie_clear_cache(dnie_private_data_t * data);
 
 #endif
 
@@ -45,7 +45,9 @@ const char *sc_strerror(int error)
 		"Unresponsive card (correctly inserted?)",
 		"Reader detached (hotplug device?)",
 		"Reader reattached (hotplug device?)",
-		"Reader in use by another application"
+		"Reader in use by another application",
+		"Operation timed out",
+		"Operation cancelled"
 	};
 	const int rdr_base = -SC_ERROR_READER;
 
@@ -45,6 +45,8 @@ extern "C" {
 #define SC_ERROR_READER_DETACHED		-1114
 #define SC_ERROR_READER_REATTACHED		-1115
 #define SC_ERROR_READER_LOCKED			-1116
+#define SC_ERROR_OPERATION_TIMEOUT		-1117
+#define SC_ERROR_OPERATION_CANCELLED		-1118
 
 /* Resulting from a card command or related to the card*/
 #define SC_ERROR_CARD_CMD_FAILED		-1200
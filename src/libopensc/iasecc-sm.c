@@ -85,20 +85,16 @@ iasecc_sm_transmit_apdus(struct sc_card *card, struct sc_remote_data *rdata,
 		unsigned char *out, size_t *out_len)
 {
 	struct sc_context *ctx = card->ctx;
-	struct sc_remote_apdu *rapdu = rdata->data;
+	struct sc_remote_apdu *rapdu;
 	int rv = SC_SUCCESS, offs = 0;
 
 	LOG_FUNC_CALLED(ctx);
 	sc_log(ctx, "iasecc_sm_transmit_apdus() rdata-length %i", rdata->length);
 
-	while (rapdu)   {
-		sc_log(ctx, "iasecc_sm_transmit_apdus() rAPDU flags 0x%X", rapdu->apdu.flags);
-		rv = sc_transmit_apdu(card, &rapdu->apdu);
-		LOG_TEST_RET(ctx, rv, "iasecc_sm_transmit_apdus() failed to execute r-APDU");
-		rv = sc_check_sw(card, rapdu->apdu.sw1, rapdu->apdu.sw2);
-		if (rv < 0 && !(rapdu->flags & SC_REMOTE_APDU_FLAG_NOT_FATAL))
-			LOG_TEST_RET(ctx, rv, "iasecc_sm_transmit_apdus() fatal error %i");
+	rv = sc_transmit_remote_data(card, rdata);
+	LOG_TEST_RET(ctx, rv, "iasecc_sm_transmit_apdus() failed to execute r-APDU");
 
+	for (rapdu = rdata->data; rapdu && rapdu->apdu.ins; rapdu = rapdu->next)   {
 		if (out && out_len && (rapdu->flags & SC_REMOTE_APDU_FLAG_RETURN_ANSWER))   {
 			int len = rapdu->apdu.resplen > (*out_len - offs) ? (*out_len - offs) : rapdu->apdu.resplen;
 
@@ -106,8 +102,6 @@ iasecc_sm_transmit_apdus(struct sc_card *card, struct sc_remote_data *rdata,
 			offs += len;
 			/* TODO: decode and gather data answers */
 		}
-
-		rapdu = rapdu->next;
 	}
 
 	if (out_len)
@@ -356,7 +350,6 @@ iasecc_sm_cmd(struct sc_card *card, struct sc_remote_data *rdata)
 	struct sc_context *ctx = card->ctx;
 	struct sm_info *sm_info = &card->sm_ctx.info;
 	struct sm_cwa_session *session = &sm_info->session.cwa;
-	struct sc_remote_apdu *rapdu = NULL;
 	int rv;
 
 	LOG_FUNC_CALLED(ctx);
@@ -367,25 +360,9 @@ iasecc_sm_cmd(struct sc_card *card, struct sc_remote_data *rdata)
 	LOG_TEST_RET(ctx, rv, "iasecc_sm_cmd() 'GET APDUS' failed");
 
 	sc_log(ctx, "iasecc_sm_cmd() %i remote APDUs to transmit", rdata->length);
-	for (rapdu = rdata->data; rapdu; rapdu = rapdu->next)   {
-		struct sc_apdu *apdu = &rapdu->apdu;
-
-		sc_log(ctx, "iasecc_sm_cmd() apdu->ins:0x%X, resplen %i", apdu->ins, apdu->resplen);
-		if (!apdu->ins)
-			break;
-		rv = sc_transmit_apdu(card, apdu);
-		if (rv < 0)   {
-			sc_log(ctx, "iasecc_sm_cmd() APDU transmit error rv:%i", rv);
-			break;
-		}
-
-		rv = sc_check_sw(card, apdu->sw1, apdu->sw2);
-		if (rv < 0 && !(rapdu->flags & SC_REMOTE_APDU_FLAG_NOT_FATAL))   {
-			sc_log(ctx, "iasecc_sm_cmd() APDU error rv:%i", rv);
-			break;
-		}
-		sc_log(ctx, "iasecc_sm_cmd() apdu->resplen %i", apdu->resplen);
-	}
+	rv = sc_transmit_remote_data(card, rdata);
+	if (rv < 0)
+		sc_log(ctx, "iasecc_sm_cmd() APDU error rv:%i", rv);
 
 	LOG_FUNC_RETURN(ctx, rv);
 }
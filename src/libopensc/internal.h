@@ -77,6 +77,13 @@ int _sc_add_reader(struct sc_context *ctx, struct sc_reader *reader);
 int _sc_delete_reader(struct sc_context *ctx, struct sc_reader *reader);
 int _sc_parse_atr(struct sc_reader *reader);
 
+/* Data a driver or module keeps per context, looked up by name and
+ * freed with 'free_data' by sc_release_context(). Call with ctx->mutex
+ * held */
+void *sc_ctx_get_driver_data(struct sc_context *ctx, const char *name);
+int sc_ctx_set_driver_data(struct sc_context *ctx, const char *name, void *data,
+		void (*free_data)(void *data));
+
 /* Add an ATR to the card driver's struct sc_atr_table */
 int _sc_add_atr(struct sc_context *ctx, struct sc_card_driver *driver, struct sc_atr_table *src);
 int _sc_free_atr(struct sc_context *ctx, struct sc_card_driver *driver);
@@ -117,6 +124,23 @@ scconf_block *_sc_match_atr_block(sc_context_t *ctx, struct sc_card_driver *driv
  * be null terminated. */
 int _sc_match_atr(struct sc_card *card, struct sc_atr_table *table, int *type_out);
 
+/* Monotonic enough clock for timing measurements, in microseconds */
+unsigned long long sc_get_time_us(void);
+
+/* Clock that is not affected by changes of the system time, in
+ * microseconds; used for the card deadlines */
+unsigned long long sc_get_monotonic_time_us(void);
+
+/* Load the external module behind the card driver entry at 'idx' if it
+ * has not been loaded yet; returns the entry, whose ops are NULL when the
+ * module could not be loaded */
+struct sc_card_driver *_sc_ctx_load_card_driver(sc_context_t *ctx, unsigned int idx);
+/* Parse the 'card_atr' configuration blocks, once */
+void _sc_ctx_load_card_atrs(sc_context_t *ctx);
+
+/* Returns the index of a builtin PKCS#15 emulator in its table, -1 if unknown */
+int sc_pkcs15emu_get_builtin_index(const char *name);
+
 int _sc_card_add_algorithm(struct sc_card *card, const struct sc_algorithm_info *info);
 int _sc_card_add_rsa_alg(struct sc_card *card, unsigned int key_length,
 			 unsigned long flags, unsigned long exponent);
@@ -221,6 +245,54 @@ unsigned long sc_thread_id(const sc_context_t *ctx);
  */
 int sc_apdu_get_octets(sc_context_t *ctx, const sc_apdu_t *apdu, u8 **buf,
 	size_t *len, unsigned int proto);
+/**
+ * Returns the length of the encoded APDU.
+ * @param  apdu    sc_apdu_t object
+ * @param  proto   protocol to be used
+ * @return length in octets, 0 if the APDU case is invalid
+ */
+size_t sc_apdu_get_length(const sc_apdu_t *apdu, unsigned int proto);
+/**
+ * Encodes the APDU in a buffer provided by the caller.
+ * @param  ctx     sc_context_t object
+ * @param  apdu    sc_apdu_t object with the APDU to encode
+ * @param  buf     output buffer
+ * @param  buflen  size of the output buffer
+ * @param  len     length of the encoded APDU
+ * @param  proto   protocol to be used
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_apdu_get_octets_buf(sc_context_t *ctx, const sc_apdu_t *apdu, u8 *buf,
+	size_t buflen, size_t *len, unsigned int proto);
+/**
+ * Locks and returns the scratch buffers of the reader for an encoded
+ * command of ssize octets and a response of up to rsize octets. The
+ * buffers are allocated once and only grow when needed.
+ * @param  reader  sc_reader_t object
+ * @param  ssize   size needed for the command
+ * @param  rsize   size needed for the response
+ * @param  sbuf    command buffer
+ * @param  rbuf    response buffer
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_reader_get_buffers(sc_reader_t *reader, size_t ssize, size_t rsize,
+	u8 **sbuf, u8 **rbuf);
+/**
+ * Wipes the used part of the reader scratch buffers and unlocks them.
+ * @param  reader  sc_reader_t object
+ * @param  sused   octets of the command buffer to wipe
+ * @param  rused   octets of the response buffer to wipe
+ */
+void sc_reader_put_buffers(sc_reader_t *reader, size_t sused, size_t rused);
+/**
+ * Accounts one exchange with the reader in the APDU statistics of the card.
+ * @param  card  sc_card_t object
+ * @param  apdu  the command as issued by the caller (gives CLA/INS)
+ * @param  wire  the command actually sent, e.g. SM wrapped, or NULL if same
+ * @param  rv    result of the reader transmit operation
+ */
+void sc_apdu_stats_round_trip(sc_card_t *card, const sc_apdu_t *apdu,
+	const sc_apdu_t *wire, int rv);
 /**
  * Sets the status bytes and return data in the APDU
  * @param  ctx     sc_context_t object
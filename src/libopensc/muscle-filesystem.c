@@ -41,24 +41,99 @@ static const u8* ignoredFiles[] = {
 };
 
 mscfs_t *mscfs_new(void) {
-	mscfs_t *fs = malloc(sizeof(mscfs_t));
-	memset(fs, 0, sizeof(mscfs_t));
+	mscfs_t *fs = calloc(1, sizeof(mscfs_t));
+	if(!fs)
+		return NULL;
 	memcpy(fs->currentPath, "\x3F\x00", 2);
 	return fs;
 }
 
 void mscfs_free(mscfs_t *fs) {
 	mscfs_clear_cache(fs);
+	free(fs);
+}
+
+void mscfs_free_cache(mscfs_cache_t *cache) {
+	if(cache->array)
+		free(cache->array);
+	if(cache->index)
+		free(cache->index);
+	memset(cache, 0, sizeof(*cache));
 }
 
 void mscfs_clear_cache(mscfs_t* fs) {
-	if(!fs->cache.array) {
-		return;
+	mscfs_free_cache(&fs->cache);
+}
+
+static unsigned int mscfs_hash(const msc_id *objectId, int indexSize)
+{
+	const u8 *id = objectId->id;
+	unsigned int key = (id[0] << 24) | (id[1] << 16) | (id[2] << 8) | id[3];
+	/* Fibonacci hashing, indexSize is a power of 2 */
+	return (key * 2654435761U) & (indexSize - 1);
+}
+
+static void mscfs_index_insert(mscfs_cache_t *cache, int x)
+{
+	unsigned int slot = mscfs_hash(&cache->array[x].objectId, cache->indexSize);
+	while(cache->index[slot])
+		slot = (slot + 1) & (cache->indexSize - 1);
+	cache->index[slot] = x + 1;
+}
+
+/* The index is kept at most half full */
+static int mscfs_index_rebuild(mscfs_cache_t *cache)
+{
+	int length = 16, x;
+	while(length < 2 * cache->totalSize)
+		length <<= 1;
+	if(length != cache->indexSize) {
+		int *index = realloc(cache->index, sizeof(int) * length);
+		if(!index)
+			return MSCFS_NO_MEMORY;
+		cache->index = index;
+		cache->indexSize = length;
 	}
-	free(fs->cache.array);
-	fs->cache.array = NULL;
-	fs->cache.totalSize = 0;
-	fs->cache.size = 0;
+	memset(cache->index, 0, sizeof(int) * cache->indexSize);
+	for(x = 0; x < cache->size; x++)
+		mscfs_index_insert(cache, x);
+	return 0;
+}
+
+int mscfs_find_object(mscfs_t* fs, const msc_id *objectId)
+{
+	mscfs_cache_t *cache = &fs->cache;
+	unsigned int slot;
+	if(!cache->index)
+		return -1;
+	slot = mscfs_hash(objectId, cache->indexSize);
+	while(cache->index[slot]) {
+		int x = cache->index[slot] - 1;
+		if(0 == memcmp(cache->array[x].objectId.id, objectId->id, 4))
+			return x;
+		slot = (slot + 1) & (cache->indexSize - 1);
+	}
+	return -1;
+}
+
+int mscfs_copy_cache(mscfs_cache_t *dst, const mscfs_cache_t *src)
+{
+	memset(dst, 0, sizeof(*dst));
+	if(src->totalSize) {
+		dst->array = malloc(sizeof(mscfs_file_t) * src->totalSize);
+		dst->index = malloc(sizeof(int) * src->indexSize);
+		if(!dst->array || !dst->index) {
+			mscfs_free_cache(dst);
+			return MSCFS_NO_MEMORY;
+		}
+		memcpy(dst->array, src->array, sizeof(mscfs_file_t) * src->size);
+		memcpy(dst->index, src->index, sizeof(int) * src->indexSize);
+	}
+	dst->size = src->size;
+	dst->totalSize = src->totalSize;
+	dst->indexSize = src->indexSize;
+	dst->valid = src->valid;
+	return 0;
 }
 
 static int mscfs_is_ignored(mscfs_t* fs, msc_id objectId)
@@ -78,63 +153,143 @@ int mscfs_push_file(mscfs_t* fs, mscfs_file_t *file)
 	mscfs_cache_t *cache = &fs->cache;
 	if(!cache->array || cache->size == cache->totalSize) {
 		int length = cache->totalSize + MSCFS_CACHE_INCREMENT;
-		mscfs_file_t *oldArray;
-		cache->totalSize = length;
-		oldArray = cache->array;
-		cache->array = malloc(sizeof(mscfs_file_t) * length);
-		if(!cache->array)
+		mscfs_file_t *array = realloc(cache->array, sizeof(mscfs_file_t) * length);
+		if(!array)
 			return MSCFS_NO_MEMORY;
-		if(oldArray) {
-			memcpy(cache->array, oldArray, sizeof(mscfs_file_t) * cache->size);
-			free(oldArray);
-		}
+		cache->array = array;
+		cache->totalSize = length;
+		cache->array[cache->size] = *file;
+		cache->size++;
+		return mscfs_index_rebuild(cache);
 	}
 	cache->array[cache->size] = *file;
 	cache->size++;
+	mscfs_index_insert(cache, cache->size - 1);
 	return 0;
 }
 
+/* Directories in the root are listed by the applet as XXXX0000 */
+static void mscfs_normalize_file(mscfs_file_t *file)
+{
+	u8* oid = file->objectId.id;
+	if(oid[2] == 0 && oid[3] == 0) {
+		oid[2] = oid[0];
+		oid[3] = oid[1];
+		oid[0] = 0x3F;
+		oid[1] = 0x00;
+		file->ef = 0;
+	} else  {
+		file->ef = 1; /* File is a working elementary file */
+	}
+}
+
 int mscfs_update_cache(mscfs_t* fs) {
 	mscfs_file_t file;
 	int r;
 	mscfs_clear_cache(fs);
 	r = fs->listFile(&file, 1, fs->udata);
-	if(r == 0)
-		return 0;
-	else if(r < 0)
+	if(r < 0)
 		return r;
-	while(1) {
+	while(r > 0) {
 		if(!mscfs_is_ignored(fs, file.objectId)) {
-			/* Check if its a directory in the root */
-			u8* oid = file.objectId.id;
-			if(oid[2] == 0 && oid[3] == 0) {
-				oid[2] = oid[0];
-				oid[3] = oid[1];
-				oid[0] = 0x3F;
-				oid[1] = 0x00;
-				file.ef = 0;
-			} else  {
-				file.ef = 1; /* File is a working elementary file */
+			mscfs_normalize_file(&file);
+			r = mscfs_push_file(fs, &file);
+			if(r < 0) {
+				mscfs_clear_cache(fs);
+				return r;
 			}
-			
-			mscfs_push_file(fs, &file);
 		}
 		r = fs->listFile(&file, 0, fs->udata);
-		if(r == 0)
-			break;
-		else if(r < 0)
+		if(r < 0) {
+			mscfs_clear_cache(fs);
 			return r;
+		}
 	}
+	fs->cache.valid = 1;
 	return fs->cache.size;
 }
 
 void mscfs_check_cache(mscfs_t* fs)
 {
-	if(!fs->cache.array) {
+	if(!fs->cache.valid) {
 		mscfs_update_cache(fs);
 	}
 }
 
+int mscfs_add_object(mscfs_t* fs, const msc_id *objectId, size_t size,
+		unsigned short read, unsigned short write, unsigned short delete)
+{
+	mscfs_file_t file;
+	int r;
+
+	/* Not listed yet: it will be listed with the others */
+	if(!fs->cache.valid || mscfs_is_ignored(fs, *objectId))
+		return 0;
+	memset(&file, 0, sizeof(file));
+	file.objectId = *objectId;
+	file.size = size;
+	file.read = read;
+	file.write = write;
+	file.delete = delete;
+	mscfs_normalize_file(&file);
+	if(mscfs_find_object(fs, &file.objectId) >= 0)
+		return 0;
+	r = mscfs_push_file(fs, &file);
+	if(r < 0)
+		mscfs_clear_cache(fs);
+	return r;
+}
+
+static void mscfs_remove_index(mscfs_t* fs, int x)
+{
+	mscfs_cache_t *cache = &fs->cache;
+	memmove(&cache->array[x], &cache->array[x + 1],
+		sizeof(mscfs_file_t) * (cache->size - x - 1));
+	cache->size--;
+	if(fs->currentFileIndex == x) {
+		fs->currentFile[0] = fs->currentFile[1] = 0;
+		fs->currentFileIndex = -1;
+	} else if(fs->currentFileIndex > x) {
+		fs->currentFileIndex--;
+	}
+}
+
+static void mscfs_remove_entries(mscfs_t* fs, const msc_id *objectId, int ef)
+{
+	mscfs_cache_t *cache = &fs->cache;
+	int x;
+
+	for(x = 0; x < cache->size; ) {
+		mscfs_file_t *child = &cache->array[x];
+		if(!ef && 0 == memcmp(child->objectId.id, objectId->id + 2, 2)
+			&& 0 != memcmp(child->objectId.id, objectId->id, 4)) {
+			if(!child->ef) {
+				msc_id childId = child->objectId;
+				mscfs_remove_entries(fs, &childId, 0);
+				x = 0;
+				continue;
+			}
+			mscfs_remove_index(fs, x);
+			continue;
+		}
+		if(0 == memcmp(child->objectId.id, objectId->id, 4)) {
+			mscfs_remove_index(fs, x);
+			continue;
+		}
+		x++;
+	}
+}
+
+/* Removes the object, and for a directory, everything below it */
+void mscfs_remove_object(mscfs_t* fs, const msc_id *objectId, int ef)
+{
+	if(!fs->cache.valid)
+		return;
+	mscfs_remove_entries(fs, objectId, ef);
+	if(mscfs_index_rebuild(&fs->cache) < 0)
+		mscfs_clear_cache(fs);
+}
+
 int mscfs_lookup_path(mscfs_t* fs, const u8 *path, int pathlen, msc_id* objectId, int isDirectory)
 {
 	u8* oid = objectId->id;
@@ -209,17 +364,11 @@ int mscfs_loadFileInfo(mscfs_t* fs, const u8 *path, int pathlen, mscfs_file_t **
 	
 	/* Obtain file information while checking if it exists */
 	mscfs_check_cache(fs);
-	if(idx) *idx = -1;
-	for(x = 0; x < fs->cache.size; x++) {
-		msc_id objectId;
+	*file_data = NULL;
+	x = mscfs_find_object(fs, &fullPath);
+	if(idx) *idx = x;
+	if(x >= 0)
 		*file_data = &fs->cache.array[x];
-		objectId = (*file_data)->objectId;
-		if(0 == memcmp(objectId.id, fullPath.id, 4)) {
-			if(idx) *idx = x;
-			break;
-		}
-		*file_data = NULL;
-	}
 	if(*file_data == NULL && (0 == memcmp("\x3F\x00\x00\x00", fullPath.id, 4) || 0 == memcmp("\x3F\x00\x3F\x00", fullPath.id, 4 ))) {
 		static mscfs_file_t ROOT_FILE;
 		ROOT_FILE.ef = 0;
@@ -40,6 +40,11 @@ typedef struct mscfs_cache {
 	int size;
 	int totalSize;
 	mscfs_file_t *array;
+	/* open addressing hash of the object IDs: slot holds array index + 1 */
+	int *index;
+	int indexSize;
+	/* set once the directory has been listed, even if it is empty */
+	int valid;
 } mscfs_cache_t;
 
 typedef struct mscsfs {
@@ -56,6 +61,16 @@ void mscfs_free(mscfs_t *fs);
 void mscfs_clear_cache(mscfs_t* fs);
 int mscfs_push_file(mscfs_t* fs, mscfs_file_t *file);
 int mscfs_update_cache(mscfs_t* fs);
+int mscfs_copy_cache(mscfs_cache_t *dst, const mscfs_cache_t *src);
+void mscfs_free_cache(mscfs_cache_t *cache);
+
+/* Incremental maintenance of the cached directory after the card has
+ * created or deleted an object. mscfs_add_object() takes the ID sent to
+ * the applet, mscfs_remove_object() the ID of the cached entry */
+int mscfs_add_object(mscfs_t* fs, const msc_id *objectId, size_t size,
+		unsigned short read, unsigned short write, unsigned short delete);
+void mscfs_remove_object(mscfs_t* fs, const msc_id *objectId, int ef);
+int mscfs_find_object(mscfs_t* fs, const msc_id *objectId);
 
 void mscfs_check_cache(mscfs_t* fs);
 
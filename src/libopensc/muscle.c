@@ -68,55 +68,165 @@ int msc_list_objects(sc_card_t* card, u8 next, mscfs_file_t* file) {
 	return 1;
 }
 
-int msc_partial_read_object(sc_card_t *card, msc_id objectId, int offset, u8 *data, size_t dataLength)
+/*
+ * Pick the ReadObject and WriteObject chunk sizes for this card from the
+ * applet status (protocol and applet versions), the reader limits and the
+ * extended APDU support, and store them in max_recv_size/max_send_size.
+ */
+int msc_negotiate_transfer_units(sc_card_t *card, const u8 *status, size_t statusLength)
 {
-	u8 buffer[9];
-	sc_apdu_t apdu;
-	int r;
-	
-	sc_format_apdu(card, &apdu, SC_APDU_CASE_4_SHORT, 0x56, 0x00, 0x00);
-	
-	sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL,
-		"READ: Offset: %x\tLength: %i\n", offset, dataLength);
-	memcpy(buffer, objectId.id, 4);
-	ulong2bebytes(buffer + 4, offset);
-	buffer[8] = (u8)dataLength;
-	apdu.data = buffer;
-	apdu.datalen = 9;
-	apdu.lc = 9;
-	apdu.le = dataLength;
-	apdu.resplen = dataLength;
-	apdu.resp = data; 
-	r = sc_transmit_apdu(card, &apdu);
-	SC_TEST_RET(card->ctx, SC_LOG_DEBUG_NORMAL, r, "APDU transmit failed");
-	if(apdu.sw1 == 0x90 && apdu.sw2 == 0x00)
+	size_t read_unit = MSC_MAX_CHUNK;
+	size_t send_unit = MSC_MAX_CHUNK;
+	size_t reader_recv = card->reader->driver->max_recv_size;
+	size_t reader_send = card->reader->driver->max_send_size;
+
+	if (statusLength >= 4)
+		sc_log(card->ctx, "MuscleCard protocol %i.%i, applet %i.%i",
+			status[0], status[1], status[2], status[3]);
+
+	/* A whole chunk plus the 9 bytes of object ID, offset and length only
+	 * fit in a command APDU when extended APDUs are available */
+	if (card->caps & SC_CARD_CAP_APDU_EXT)
+		send_unit = MSC_MAX_CHUNK + 9;
+
+	if (card->max_recv_size > 0 && card->max_recv_size < read_unit)
+		read_unit = card->max_recv_size;
+	if (reader_recv > 0 && reader_recv < read_unit)
+		read_unit = reader_recv;
+	if (card->max_send_size > 0 && card->max_send_size < send_unit)
+		send_unit = card->max_send_size;
+	if (reader_send > 0 && reader_send < send_unit)
+		send_unit = reader_send;
+	if (read_unit < 16 || send_unit < 16)
+		return SC_ERROR_NOT_SUPPORTED;
+
+	card->max_recv_size = read_unit;
+	card->max_send_size = send_unit;
+	sc_log(card->ctx, "transfer units: read %lu, write %lu bytes per APDU",
+		(unsigned long)read_unit, (unsigned long)(send_unit - 9));
+	return SC_SUCCESS;
+}
+
+static int msc_read_object_sw(sc_card_t *card, const sc_apdu_t *apdu, size_t dataLength)
+{
+	if(apdu->sw1 == 0x90 && apdu->sw2 == 0x00)
 		return dataLength;
-	if(apdu.sw1 == 0x9C) {
-		if(apdu.sw2 == 0x07) {
+	if(apdu->sw1 == 0x9C) {
+		if(apdu->sw2 == 0x07) {
 			SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_ERROR_FILE_NOT_FOUND);
-		} else if(apdu.sw2 == 0x06) {
+		} else if(apdu->sw2 == 0x06) {
 			SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_ERROR_NOT_ALLOWED);
-		} else if(apdu.sw2 == 0x0F) {
+		} else if(apdu->sw2 == 0x0F) {
 			/* GUESSED */
 			SC_FUNC_RETURN(card->ctx, SC_LOG_DEBUG_VERBOSE, SC_ERROR_INVALID_ARGUMENTS);
 		}
 	}
 	sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL,
-		"got strange SWs: 0x%02X 0x%02X\n", apdu.sw1, apdu.sw2);
+		"got strange SWs: 0x%02X 0x%02X\n", apdu->sw1, apdu->sw2);
 	return dataLength;
+}
+
+static void msc_read_object_apdu(sc_card_t *card, sc_apdu_t *apdu, u8 *buffer,
+		msc_id objectId, int offset, u8 *data, size_t dataLength)
+{
+	sc_format_apdu(card, apdu, SC_APDU_CASE_4_SHORT, 0x56, 0x00, 0x00);
+	memcpy(buffer, objectId.id, 4);
+	ulong2bebytes(buffer + 4, offset);
+	buffer[8] = (u8)dataLength;
+	apdu->data = buffer;
+	apdu->datalen = 9;
+	apdu->lc = 9;
+	apdu->le = dataLength;
+	apdu->resplen = dataLength;
+	apdu->resp = data;
+}
+
+int msc_partial_read_object(sc_card_t *card, msc_id objectId, int offset, u8 *data, size_t dataLength)
+{
+	u8 buffer[9];
+	sc_apdu_t apdu;
+	int r;
 	
+	sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL,
+		"READ: Offset: %x\tLength: %i\n", offset, dataLength);
+	msc_read_object_apdu(card, &apdu, buffer, objectId, offset, data, dataLength);
+	r = sc_transmit_apdu(card, &apdu);
+	SC_TEST_RET(card->ctx, SC_LOG_DEBUG_NORMAL, r, "APDU transmit failed");
+	return msc_read_object_sw(card, &apdu, dataLength);
 }
 
+/*
+ * All the chunks of the object are sent back to back under one lock with
+ * sc_transmit_apdus(); a chunk that ends with an unexpected status word is
+ * checked like a single read, and the rest is sent again from there.
+ */
 int msc_read_object(sc_card_t *card, msc_id objectId, int offset, u8 *data, size_t dataLength)
 {
-	int r;
-	size_t i;
 	size_t max_read_unit = MSC_MAX_READ;
+	size_t count = (dataLength + max_read_unit - 1) / max_read_unit;
+	struct sc_apdu_list_entry *entries = NULL;
+	sc_apdu_t *apdus = NULL;
+	u8 *headers = NULL;
+	unsigned long long start;
+	unsigned long elapsed;
+	size_t i, first, done;
+	int r = SC_SUCCESS;
+
+	if (dataLength == 0)
+		return 0;
+	start = sc_get_time_us();
+	if (count == 1) {
+		r = msc_partial_read_object(card, objectId, offset, data, dataLength);
+		goto done;
+	}
+
+	entries = calloc(count, sizeof(*entries));
+	apdus = calloc(count, sizeof(*apdus));
+	headers = malloc(count * 9);
+	if (!entries || !apdus || !headers) {
+		r = SC_ERROR_OUT_OF_MEMORY;
+		goto err;
+	}
+	for (i = 0; i < count; i++) {
+		size_t pos = i * max_read_unit;
+
+		msc_read_object_apdu(card, &apdus[i], headers + 9 * i, objectId, offset + pos,
+			data + pos, MIN(dataLength - pos, max_read_unit));
+		entries[i].apdu = &apdus[i];
+		entries[i].sw = 0x9000;
+		entries[i].sw_mask = 0xFFFF;
+	}
 
-	for(i = 0; i < dataLength; i += max_read_unit) {
-		r = msc_partial_read_object(card, objectId, offset + i, data + i, MIN(dataLength - i, max_read_unit));
-		SC_TEST_RET(card->ctx, SC_LOG_DEBUG_NORMAL, r, "Error in partial object read");
+	for (first = 0; first < count; first += done) {
+		sc_apdu_t *failed;
+
+		r = sc_transmit_apdus(card, entries + first, count - first, &done);
+		if (r == SC_SUCCESS)
+			break;
+		/* no status word: the exchange itself failed */
+		if (done == 0)
+			goto err;
+		failed = &apdus[first + done - 1];
+		if (failed->sw1 == 0)
+			goto err;
+		r = msc_read_object_sw(card, failed, failed->le);
+		if (r < 0)
+			goto err;
+		r = SC_SUCCESS;
+	}
+done:
+	if (r >= 0) {
+		elapsed = (unsigned long)(sc_get_time_us() - start);
+		sc_log(card->ctx, "read %lu bytes in %lu chunk(s) of %lu: %lu us, %lu bytes/s",
+			(unsigned long)dataLength, (unsigned long)count,
+			(unsigned long)max_read_unit, elapsed,
+			elapsed ? (unsigned long)(dataLength * 1000000ULL / elapsed) : 0UL);
 	}
+err:
+	free(entries);
+	free(apdus);
+	free(headers);
+	SC_TEST_RET(card->ctx, SC_LOG_DEBUG_NORMAL, r, "Error in partial object read");
 	return dataLength;
 }
 
@@ -171,14 +281,15 @@ int msc_create_object(sc_card_t *card, msc_id objectId, size_t objectSize, unsig
 	return objectSize;
 }
 
-/* Update up to MSC_MAX_READ - 9 bytes */
+/* Update up to MSC_MAX_SEND - 9 bytes; a full chunk of MSC_MAX_CHUNK bytes
+ * makes Lc exceed 255, so let sc_transmit_apdu() pick an extended APDU */
 int msc_partial_update_object(sc_card_t *card, msc_id objectId, int offset, const u8 *data, size_t dataLength)
 {
 	u8 buffer[MSC_MAX_APDU];
 	sc_apdu_t apdu;
 	int r;
 
-	sc_format_apdu(card, &apdu, SC_APDU_CASE_3_SHORT, 0x54, 0x00, 0x00);
+	sc_format_apdu(card, &apdu, SC_APDU_CASE_3, 0x54, 0x00, 0x00);
 	apdu.lc = dataLength + 9;
 	if (card->ctx->debug >= 2)
 		sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "WRITE: Offset: %x\tLength: %i\n", offset, dataLength);
@@ -215,10 +326,17 @@ int msc_update_object(sc_card_t *card, msc_id objectId, int offset, const u8 *da
 	int r;
 	size_t i;
 	size_t max_write_unit = MSC_MAX_SEND - 9;
+
+	/* keep the chunks of one object together */
+	r = sc_lock(card);
+	SC_TEST_RET(card->ctx, SC_LOG_DEBUG_NORMAL, r, "sc_lock() failed");
 	for(i = 0; i < dataLength; i += max_write_unit) {
 		r = msc_partial_update_object(card, objectId, offset + i, data + i, MIN(dataLength - i, max_write_unit));
-		SC_TEST_RET(card->ctx, SC_LOG_DEBUG_NORMAL, r, "Error in partial object update");
+		if (r < 0)
+			break;
 	}
+	sc_unlock(card);
+	SC_TEST_RET(card->ctx, SC_LOG_DEBUG_NORMAL, r, "Error in partial object update");
 	return dataLength;
 }
 
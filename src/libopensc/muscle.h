@@ -31,11 +31,14 @@
 #define MSC_MAX_PIN_LENGTH 8
 #define MSC_MAX_PIN_COMMAND_LENGTH ((1 + MSC_MAX_PIN_LENGTH) * 2)
 
-/* Currently max size handled by muscle driver is 255 ... */
-#define MSC_MAX_READ (card->max_recv_size > 0 ? card->max_recv_size : 255)
-#define MSC_MAX_SEND (card->max_send_size > 0 ? card->max_send_size : 255)
+/* The chunk length of ReadObject and WriteObject is a single byte; the
+ * transfer units are negotiated by msc_negotiate_transfer_units() */
+#define MSC_MAX_CHUNK 255
+#define MSC_MAX_READ (card->max_recv_size > 0 ? MIN(card->max_recv_size, MSC_MAX_CHUNK) : MSC_MAX_CHUNK)
+#define MSC_MAX_SEND (card->max_send_size > 0 ? MIN(card->max_send_size, MSC_MAX_CHUNK + 9) : 255)
 
 int msc_list_objects(sc_card_t* card, u8 next, mscfs_file_t* file);
+int msc_negotiate_transfer_units(sc_card_t *card, const u8 *status, size_t statusLength);
 int msc_partial_read_object(sc_card_t *card, msc_id objectId, int offset, u8 *data, size_t dataLength);
 int msc_read_object(sc_card_t *card, msc_id objectId, int offset, u8 *data, size_t dataLength);
 int msc_create_object(sc_card_t *card, msc_id objectId, size_t objectSize, unsigned short read, unsigned short write, unsigned short deletion);
@@ -281,6 +281,34 @@ struct sc_reader_driver {
 #define SC_READER_CAP_PACE_DESTROY_CHANNEL 0x00000010
 #define SC_READER_CAP_PACE_GENERIC         0x00000020
 
+/* APDU statistics: status word classes */
+#define SC_APDU_STATS_SW_OK		0	/* 90 00 */
+#define SC_APDU_STATS_SW_MORE_DATA	1	/* 61 XX */
+#define SC_APDU_STATS_SW_WRONG_LE	2	/* 6C XX */
+#define SC_APDU_STATS_SW_WARNING	3	/* 62 XX, 63 XX */
+#define SC_APDU_STATS_SW_ERROR		4	/* other 6X XX */
+#define SC_APDU_STATS_SW_OTHER		5	/* proprietary status words */
+#define SC_APDU_STATS_SW_FAILED		6	/* no status: transmission failed */
+#define SC_APDU_STATS_SW_CLASSES	7
+/* number of log2 latency buckets: bucket i counts [2^i, 2^(i+1)) us,
+ * the last bucket counts everything above */
+#define SC_APDU_STATS_HIST_SIZE		24
+
+/* APDU statistics of one CLA/INS pair. The CLA is reduced to its
+ * proprietary bit (0x00 or 0x80): channel and SM bits are not split. */
+struct sc_apdu_stats {
+	unsigned char cla, ins;
+
+	unsigned long count;		/* commands sent with sc_transmit_apdu() */
+	unsigned long round_trips;	/* exchanges with the reader, including retransmissions */
+	unsigned long sm_wrapped;	/* exchanges wrapped by secure messaging */
+	unsigned long long bytes_sent, bytes_received;	/* on the wire, SW included */
+	unsigned long long time_us, max_time_us;
+
+	unsigned long sw[SC_APDU_STATS_SW_CLASSES];
+	unsigned long hist[SC_APDU_STATS_HIST_SIZE];
+};
+
 typedef struct sc_reader {
 	struct sc_context *ctx;
 	const struct sc_reader_driver *driver;
@@ -298,6 +326,14 @@ typedef struct sc_reader {
 		int Fi, f, Di, N;
 		u8 FI, DI;
 	} atr_info;
+
+	/* Scratch buffers for the transmit path, see sc_reader_get_buffers() */
+	void *buf_mutex;
+	u8 *buf;
+	size_t buf_send_len, buf_recv_len;
+
+	/* APDU totals of all cards connected with this reader (cla == ins == 0) */
+	struct sc_apdu_stats apdu_stats;
 } sc_reader_t;
 
 /* This will be the new interface for handling PIN commands.
@@ -435,6 +471,9 @@ struct sc_reader_operations {
 	int (*detect_card_presence)(struct sc_reader *reader);
 	int (*connect)(struct sc_reader *reader);
 	int (*disconnect)(struct sc_reader *reader);
+	/* Drivers should encode the APDU with sc_apdu_get_octets_buf()
+	 * into the buffers from sc_reader_get_buffers() rather than
+	 * allocating them for each APDU. */
 	int (*transmit)(struct sc_reader *reader, sc_apdu_t *apdu);
 	int (*lock)(struct sc_reader *reader);
 	int (*unlock)(struct sc_reader *reader);
@@ -534,6 +573,13 @@ typedef struct sc_card {
 	struct sm_context sm_ctx;
 #endif
 
+	/* APDU statistics indexed by CLA proprietary bit and INS, allocated on first use */
+	struct sc_apdu_stats **apdu_stats;
+
+	/* see sc_set_card_deadline() */
+	unsigned long long deadline;	/* sc_get_monotonic_time_us() value, 0: none */
+	unsigned int cancel_count;	/* value of ctx->cancel_count seen */
+
 	unsigned int magic;
 } sc_card_t;
 
@@ -687,6 +733,79 @@ typedef struct {
 	unsigned long (*thread_id)(void);
 } sc_thread_context_t;
 
+/**
+ * @struct sc_conf_snapshot
+ * Typed view of the configuration values used on the card detection and
+ * PKCS#15 bind paths, compiled once from the scconf tree. A snapshot is
+ * never modified: a configuration reload compiles a new one and replaces
+ * the current snapshot of the context. Get it with sc_ctx_get_conf() and
+ * release it with sc_ctx_put_conf().
+ */
+struct sc_conf_atr {
+	u8 atr[SC_MAX_ATR_SIZE];
+	u8 mask[SC_MAX_ATR_SIZE];
+	size_t len;
+
+	int pkcs11_enable_init_token;
+	/* the 'card_atr' block, for the less used options */
+	scconf_block *block;
+};
+
+struct sc_conf_application {
+	struct sc_aid aid;
+	char *type;
+};
+
+struct sc_conf_pkcs15 {
+	/* 'framework pkcs15' block found */
+	scconf_block *block;
+
+	int use_file_cache;
+	int use_pin_cache;
+	int pin_cache_counter;
+	int pin_cache_ignore_user_consent;
+
+	int enable_emulation;
+	int try_emulation_first;
+	int enable_builtin_emulation;
+	/* indexes of the 'builtin_emulators' list in the table of
+	 * the builtin emulators, -1 terminated; NULL if no list */
+	int *builtin_emulators;
+	/* 'emulate' blocks, NULL terminated; NULL if none */
+	scconf_block **emulate_blocks;
+
+	struct sc_conf_application *applications;
+	size_t application_count;
+};
+
+struct sc_conf_snapshot {
+	/* references, protected by the context mutex */
+	unsigned int refs;
+
+	/* scconf tree owned by this snapshot (NULL: the context one) */
+	scconf_context *conf;
+	char *path;
+	long mtime, size;
+
+	struct sc_conf_atr *atrs;
+	size_t atr_count;
+
+	struct sc_conf_pkcs15 pkcs15;
+};
+
+/* Startup timing of a context, in microseconds */
+struct sc_ctx_timing {
+	unsigned long config;		/* reading and compiling the configuration */
+	unsigned long reader_driver;	/* init of the reader driver */
+	unsigned long card_drivers;	/* card driver table, external modules excluded */
+	unsigned long create;		/* whole sc_context_create() */
+
+	/* deferred work, done on first use */
+	unsigned long card_atrs;	/* 'card_atr' tables, on the first card connect */
+	unsigned long detect_readers;	/* last reader detection */
+	unsigned long driver_loads;	/* external card driver modules, all together */
+};
+
 typedef struct sc_context {
 	scconf_context *conf;
 	scconf_block *conf_blocks[3];
@@ -710,6 +829,22 @@ typedef struct sc_context {
 	sc_thread_context_t	*thread_ctx;
 	void *mutex;
 
+	/* compiled configuration, see sc_ctx_get_conf() */
+	struct sc_conf_snapshot *conf_snapshot;
+	unsigned int conf_reload_interval;	/* seconds, 0: never */
+	long conf_checked;
+
+	/* work deferred from sc_context_create() to the first use */
+	int readers_detected;	/* set by a successful detection, under mutex */
+	int card_atrs_loaded;
+	struct sc_card_driver *driver_stubs;	/* external modules not loaded yet */
+	struct sc_ctx_timing timing;
+
+	/* private, see sc_ctx_set_driver_data() */
+	struct sc_ctx_driver_data *driver_data;
+
+	volatile unsigned int cancel_count;	/* incremented by sc_cancel() */
+
 	unsigned int magic;
 } sc_context_t;
 
@@ -722,6 +857,47 @@ typedef struct sc_context {
  */
 int sc_transmit_apdu(struct sc_card *, struct sc_apdu *);
 
+/** Sends an ordered list of APDUs to the card while holding the card lock
+ *  only once. The status words of every entry are checked according to its
+ *  expected SW policy; the first failing entry without the
+ *  SC_APDU_LIST_FLAG_NOT_FATAL flag aborts the rest of the list. A transmit
+ *  error always aborts it, whatever the flags.
+ *  @param  card     struct sc_card object to which the APDUs should be send
+ *  @param  entries  array of APDU list entries, the result of every
+ *                   transmitted entry is returned in its @c rv member
+ *  @param  count    number of entries
+ *  @param  done     (out, optional) number of entries actually transmitted
+ *  @return SC_SUCCESS if no fatal error occurred, the error code of the
+ *          first fatal entry otherwise
+ */
+int sc_transmit_apdus(struct sc_card *card, struct sc_apdu_list_entry *entries,
+		size_t count, size_t *done);
+
+/** Sends the APDUs of a @c sc_remote_data list (e.g. obtained from an SM
+ *  module) with sc_transmit_apdus(). The list ends with the first APDU
+ *  that has no INS byte. An APDU flagged SC_REMOTE_APDU_FLAG_NOT_FATAL
+ *  whose status words are an error does not stop the list.
+ *  @param  card   struct sc_card object to which the APDUs should be send
+ *  @param  rdata  list of the remote APDUs
+ *  @return SC_SUCCESS on success, the error of the first failing fatal
+ *          APDU, or the status error of the last APDU if it failed
+ */
+int sc_transmit_remote_data(struct sc_card *card, struct sc_remote_data *rdata);
+
+/** Returns the APDU statistics collected for a card, one entry per CLA/INS
+ *  pair that has been used, ordered by CLA and INS.
+ *  @param  card   struct sc_card object
+ *  @param  stats  (out) array of the entries, may be NULL to get the count
+ *  @param  count  in: number of entries in @a stats,
+ *                 out: number of entries available
+ *  @return SC_SUCCESS on success, SC_ERROR_BUFFER_TOO_SMALL if @a stats
+ *          cannot hold all entries, or another error code
+ */
+int sc_get_apdu_stats(struct sc_card *card, struct sc_apdu_stats *stats, size_t *count);
+
+/** Clears the APDU statistics of a card (and not the reader totals) */
+void sc_reset_apdu_stats(struct sc_card *card);
+
 void sc_format_apdu(struct sc_card *, struct sc_apdu *, int, int, int, int);
 
 int sc_check_apdu(struct sc_card *, const struct sc_apdu *);
@@ -924,8 +1100,9 @@ int sc_wait_for_event(sc_context_t *ctx, unsigned int event_mask,
 int sc_reset(struct sc_card *card, int do_cold_reset);
 
 /**
- * Cancel all pending PC/SC calls
- * NOTE: only PC/SC backend implements this function.
+ * Cancel all pending PC/SC calls, and the card operations in progress
+ * before their next APDU (see sc_set_card_deadline()).
+ * NOTE: only PC/SC backend implements cancelling of the PC/SC calls.
  * @param ctx pointer to application context
  * @retval SC_SUCCESS on success
  */
@@ -944,6 +1121,18 @@ int sc_lock(struct sc_card *card);
  */
 int sc_unlock(struct sc_card *card);
 
+/**
+ * Sets the deadline of the operations on the card. No further APDU is
+ * sent once it has passed, or once sc_cancel() has been called after
+ * the deadline was set or the card was locked; the transmission fails
+ * with SC_ERROR_OPERATION_TIMEOUT or SC_ERROR_OPERATION_CANCELLED.
+ * Clearing the deadline leaves a pending cancel in effect.
+ * An APDU already sent to the card is not interrupted.
+ * @param  card        The card
+ * @param  timeout_ms  Time from now in milliseconds, 0 to clear the deadline
+ */
+void sc_set_card_deadline(struct sc_card *card, unsigned long timeout_ms);
+
 
 /********************************************************************/
 /*                ISO 7816-4 related functions                      */
@@ -1227,6 +1416,34 @@ int sc_bin_to_hex(const u8 *, size_t, char *, size_t, int separator);
 size_t sc_right_trim(u8 *buf, size_t len);
 scconf_block *sc_get_conf_block(sc_context_t *ctx, const char *name1, const char *name2, int priority);
 
+/**
+ * Returns a reference to the current compiled configuration. When
+ * 'config_reload_interval' is set and the configuration file has changed,
+ * the file is compiled again first.
+ * @param  ctx  OpenSC context
+ * @return configuration snapshot (never NULL), to be released with sc_ctx_put_conf()
+ */
+struct sc_conf_snapshot *sc_ctx_get_conf(sc_context_t *ctx);
+/**
+ * Releases a reference obtained with sc_ctx_get_conf()
+ */
+void sc_ctx_put_conf(sc_context_t *ctx, struct sc_conf_snapshot *conf);
+/**
+ * Parses and compiles the configuration file again and makes the result
+ * the current snapshot. Only the values of the snapshot are reloaded:
+ * card and reader drivers keep the configuration of the context creation.
+ * @param  ctx  OpenSC context
+ * @return SC_SUCCESS on success and an error code otherwise (the current
+ *         snapshot is kept)
+ */
+int sc_ctx_reload_conf(sc_context_t *ctx);
+/**
+ * Finds the 'card_atr' entry of the snapshot matching an ATR
+ * @return the entry or NULL
+ */
+const struct sc_conf_atr *sc_conf_match_atr(const struct sc_conf_snapshot *conf,
+		const struct sc_atr *atr);
+
 /**
  * Initializes a given OID
  * @param  oid  sc_object_id object to be initialized
@@ -33,14 +33,69 @@
 #include "asn1.h"
 #include "pkcs15.h"
 
+/*
+ * Locate serialNumber, issuer, subject and subjectPublicKeyInfo in a DER
+ * encoded certificate. The returned TLVs point into 'buf', nothing is copied.
+ */
+static int
+x509_cert_views(const u8 *buf, size_t buflen, struct sc_pkcs15_der *serial,
+		struct sc_pkcs15_der *issuer, struct sc_pkcs15_der *subject,
+		struct sc_pkcs15_der *spki)
+{
+	/* tbsCertificate fields following the optional version */
+	struct sc_pkcs15_der *fields[] = { serial, NULL, issuer, NULL, subject, spki };
+	const u8 *p = buf, *tlv;
+	size_t left = buflen, len;
+	unsigned int cla, tag, i;
+	int r;
+
+	/* Certificate, then tbsCertificate */
+	for (i = 0; i < 2; i++) {
+		if (left < 2 || *p != (SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED))
+			return SC_ERROR_INVALID_ASN1_OBJECT;
+		r = sc_asn1_read_tag(&p, left, &cla, &tag, &len);
+		if (r < 0 || p == NULL)
+			return SC_ERROR_INVALID_ASN1_OBJECT;
+		left = len;
+	}
+
+	for (i = 0; i < sizeof(fields)/sizeof(fields[0]); ) {
+		tlv = p;
+		r = sc_asn1_read_tag(&p, left, &cla, &tag, &len);
+		if (r < 0 || p == NULL)
+			return SC_ERROR_INVALID_ASN1_OBJECT;
+		len += p - tlv;
+		p = tlv + len;
+		left -= len;
+
+		if (i == 0 && *tlv == (SC_ASN1_TAG_CONTEXT | SC_ASN1_TAG_CONSTRUCTED | 0))
+			continue;
+		if (fields[i]) {
+			fields[i]->value = (u8 *)tlv;
+			fields[i]->len = len;
+		}
+		i++;
+	}
+
+	return SC_SUCCESS;
+}
+
+
+/*
+ * With 'take_der' the certificate takes over the DER buffer, which is
+ * cleared in 'der', instead of keeping a copy of it.
+ * Serial number, issuer, subject and SPKI are views into the certificate
+ * data and are not freed separately.
+ */
 static int
-parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_cert *cert)
+parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_cert *cert, int take_der)
 {
 	int r;
 	struct sc_algorithm_id sig_alg;
 	struct sc_pkcs15_pubkey *pubkey = NULL;
-	unsigned char *serial = NULL, *issuer = NULL, *subject = NULL, *buf =  der->value;
-	size_t serial_len = 0, issuer_len = 0, subject_len = 0, data_len = 0, buflen = der->len;
+	struct sc_pkcs15_der serial, issuer, subject, spki;
+	unsigned char *buf =  der->value;
+	size_t data_len = 0, buflen = der->len;
 	struct sc_asn1_entry asn1_version[] = {
 		{ "version", SC_ASN1_INTEGER, SC_ASN1_TAG_INTEGER, 0, &cert->version, NULL },
 		{ NULL, 0, 0, 0, NULL, NULL }
@@ -59,11 +114,11 @@ parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_c
 	};
 	struct sc_asn1_entry asn1_tbscert[] = {
 		{ "version",		SC_ASN1_STRUCT,    SC_ASN1_CTX | 0 | SC_ASN1_CONS, SC_ASN1_OPTIONAL, asn1_version, NULL },
-		{ "serialNumber",	SC_ASN1_OCTET_STRING, SC_ASN1_TAG_INTEGER, SC_ASN1_ALLOC, &serial, &serial_len },
+		{ "serialNumber",	SC_ASN1_OCTET_STRING, SC_ASN1_TAG_INTEGER, 0, NULL, NULL },
 		{ "signature",		SC_ASN1_STRUCT,    SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, NULL, NULL },
-		{ "issuer",		SC_ASN1_OCTET_STRING, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, SC_ASN1_ALLOC, &issuer, &issuer_len },
+		{ "issuer",		SC_ASN1_OCTET_STRING, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, NULL, NULL },
 		{ "validity",		SC_ASN1_STRUCT,    SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, NULL, NULL },
-		{ "subject",		SC_ASN1_OCTET_STRING, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, SC_ASN1_ALLOC, &subject, &subject_len },
+		{ "subject",		SC_ASN1_OCTET_STRING, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, NULL, NULL },
 		/* Use a callback to get the algorithm, parameters and pubkey into sc_pkcs15_pubkey */
 		{ "subjectPublicKeyInfo",SC_ASN1_CALLBACK, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, 0, sc_pkcs15_pubkey_from_spki_fields,  &pubkey },
 		{ "extensions",		SC_ASN1_STRUCT,    SC_ASN1_CTX | 3 | SC_ASN1_CONS, SC_ASN1_OPTIONAL, asn1_extensions, NULL },
@@ -75,18 +130,6 @@ parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_c
 		{ "signatureValue",	SC_ASN1_BIT_STRING, SC_ASN1_TAG_BIT_STRING, 0, NULL, NULL },
 		{ NULL, 0, 0, 0, NULL, NULL }
 	};
-	struct sc_asn1_entry asn1_serial_number[] = {
-		{ "serialNumber", SC_ASN1_OCTET_STRING, SC_ASN1_TAG_INTEGER, SC_ASN1_ALLOC, NULL, NULL },
-		{ NULL, 0, 0, 0, NULL, NULL }
-	};
-	struct sc_asn1_entry asn1_subject[] = {
-		{ "subject", SC_ASN1_OCTET_STRING, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, SC_ASN1_ALLOC, NULL, NULL },
-		{ NULL, 0, 0, 0, NULL, NULL }
-	};
-	struct sc_asn1_entry asn1_issuer[] = {
-		{ "issuer", SC_ASN1_OCTET_STRING, SC_ASN1_TAG_SEQUENCE | SC_ASN1_CONS, SC_ASN1_ALLOC, NULL, NULL },
-		{ NULL, 0, 0, 0, NULL, NULL }
-	};
 
 	const u8 *obj;
 	size_t objlen;
@@ -97,11 +140,19 @@ parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_c
 		LOG_TEST_RET(ctx, SC_ERROR_INVALID_ASN1_OBJECT, "X.509 certificate not found");
 
 	data_len = objlen + (obj - buf);
-	cert->data.value = malloc(data_len);
-	if (!cert->data.value)
-		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
-	memcpy(cert->data.value, buf, data_len);
+	if (take_der) {
+		cert->data.value = der->value;
+		der->value = NULL;
+		der->len = 0;
+	}
+	else {
+		cert->data.value = malloc(data_len);
+		if (!cert->data.value)
+			LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+		memcpy(cert->data.value, buf, data_len);
+	}
 	cert->data.len = data_len;
+	obj = cert->data.value + (obj - buf);
 
 	r = sc_asn1_decode(ctx, asn1_cert, obj, objlen, NULL, NULL);
 	LOG_TEST_RET(ctx, r, "ASN.1 parsing of certificate failed");
@@ -114,52 +165,96 @@ parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_c
 
 	sc_asn1_clear_algorithm_id(&sig_alg);
 
-	if (serial && serial_len)   {
-		sc_format_asn1_entry(asn1_serial_number + 0, serial, &serial_len, 1);
-		r = sc_asn1_encode(ctx, asn1_serial_number, &cert->serial, &cert->serial_len);
-		free(serial);
-		LOG_TEST_RET(ctx, r, "ASN.1 encoding of serial failed");
-	}
-
-	if (subject && subject_len)   {
-		sc_format_asn1_entry(asn1_subject + 0, subject, &subject_len, 1);
-		r = sc_asn1_encode(ctx, asn1_subject, &cert->subject, &cert->subject_len);
-		free(subject);
-		LOG_TEST_RET(ctx, r, "ASN.1 encoding of subject");
-	}
+	r = x509_cert_views(cert->data.value, cert->data.len, &serial, &issuer, &subject, &spki);
+	LOG_TEST_RET(ctx, r, "Cannot locate certificate fields");
 
-	if (issuer && issuer_len)   {
-		sc_format_asn1_entry(asn1_issuer + 0, issuer, &issuer_len, 1);
-		r = sc_asn1_encode(ctx, asn1_issuer, &cert->issuer, &cert->issuer_len);
-		free(issuer);
-		LOG_TEST_RET(ctx, r, "ASN.1 encoding of issuer");
-	}
+	cert->serial = serial.value;
+	cert->serial_len = serial.len;
+	cert->issuer = issuer.value;
+	cert->issuer_len = issuer.len;
+	cert->subject = subject.value;
+	cert->subject_len = subject.len;
+	cert->spki = spki.value;
+	cert->spki_len = spki.len;
 
 	return SC_SUCCESS;
 }
 
 
+/* Only the subjectPublicKeyInfo is decoded, the certificate is not copied */
 int
 sc_pkcs15_pubkey_from_cert(struct sc_context *ctx,
 		struct sc_pkcs15_der *cert_blob, struct sc_pkcs15_pubkey **out)
 {
+	struct sc_pkcs15_der serial, issuer, subject, spki;
 	int rv;
-	struct sc_pkcs15_cert * cert;
-
-	cert =  calloc(1, sizeof(struct sc_pkcs15_cert));
-	if (cert == NULL)
-		return SC_ERROR_OUT_OF_MEMORY;
 
-	rv = parse_x509_cert(ctx, cert_blob, cert);
+	LOG_FUNC_CALLED(ctx);
+	if (!cert_blob || !cert_blob->value || !out)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
 
-	*out = cert->key;
-	cert->key = NULL;
-	sc_pkcs15_free_certificate(cert);
+	rv = x509_cert_views(cert_blob->value, cert_blob->len, &serial, &issuer, &subject, &spki);
+	LOG_TEST_RET(ctx, rv, "X.509 certificate not found");
 
+	rv = sc_pkcs15_pubkey_from_spki_sequence(ctx, spki.value, spki.len, out);
 	LOG_FUNC_RETURN(ctx, rv);
 }
 
 
+/*
+ * Read the certificate at 'path' without the padding of its EF: the
+ * length is taken from the header of the outer SEQUENCE, and the rest
+ * is read into a buffer of exactly that size. Returns 1 if the header
+ * cannot tell the length, for the caller to read the whole file.
+ */
+static int
+read_cert_file(struct sc_pkcs15_card *p15card, const struct sc_path *path,
+		struct sc_pkcs15_der *der)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	u8 head[6];
+	size_t hlen, len, got, i;
+	int r;
+
+	r = sc_pkcs15_read_file_part(p15card, path, 0, head, sizeof(head));
+	LOG_TEST_RET(ctx, r, "Unable to read certificate header");
+	got = r;
+	if (got < 2 || head[0] != (SC_ASN1_TAG_SEQUENCE | SC_ASN1_TAG_CONSTRUCTED))
+		return 1;
+
+	if (head[1] < 0x80) {
+		hlen = 2;
+		len = head[1];
+	}
+	else if (head[1] > 0x80 && head[1] <= 0x83 && got >= 2 + (size_t)(head[1] & 0x7F)) {
+		hlen = 2 + (head[1] & 0x7F);
+		for (i = 2, len = 0; i < hlen; i++)
+			len = (len << 8) | head[i];
+	}
+	else {
+		return 1;
+	}
+
+	der->len = hlen + len;
+	der->value = malloc(der->len);
+	if (der->value == NULL)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+	got = MIN(got, der->len);
+	memcpy(der->value, head, got);
+	if (got < der->len) {
+		r = sc_pkcs15_read_file_part(p15card, path, got, der->value + got, der->len - got);
+		if (r >= 0 && (size_t)r != der->len - got)
+			r = SC_ERROR_INVALID_ASN1_OBJECT;
+		if (r < 0) {
+			free(der->value);
+			der->value = NULL;
+			LOG_TEST_RET(ctx, r, "Unable to read certificate");
+		}
+	}
+	return SC_SUCCESS;
+}
+
+
 int
 sc_pkcs15_read_certificate(struct sc_pkcs15_card *p15card, const struct sc_pkcs15_cert_info *info,
 		struct sc_pkcs15_cert **cert_out)
@@ -177,7 +272,13 @@ sc_pkcs15_read_certificate(struct sc_pkcs15_card *p15card, const struct sc_pkcs1
 		sc_der_copy(&der, &info->value);
 	}
 	else if (info->path.len) {
-		r = sc_pkcs15_read_file(p15card, &info->path, &der.value, &der.len);
+		/* A cached file is read whole anyway, and reading it whole
+		 * is what puts it into the cache */
+		r = 1;
+		if (!p15card->opts.use_file_cache)
+			r = read_cert_file(p15card, &info->path, &der);
+		if (r > 0)
+			r = sc_pkcs15_read_file(p15card, &info->path, &der.value, &der.len);
 		LOG_TEST_RET(ctx, r, "Unable to read certificate file.");
 	}
 	else   {
@@ -190,7 +291,7 @@ sc_pkcs15_read_certificate(struct sc_pkcs15_card *p15card, const struct sc_pkcs1
 		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
 	}
 	memset(cert, 0, sizeof(struct sc_pkcs15_cert));
-	if (parse_x509_cert(ctx, &der, cert)) {
+	if (parse_x509_cert(ctx, &der, cert, 1)) {
 		free(der.value);
 		sc_pkcs15_free_certificate(cert);
 		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ASN1_OBJECT);
@@ -344,9 +445,6 @@ sc_pkcs15_free_certificate(struct sc_pkcs15_cert *cert)
 
 	if (cert->key)
 		sc_pkcs15_free_pubkey(cert->key);
-	free(cert->subject);
-	free(cert->issuer);
-	free(cert->serial);
 	free(cert->data.value);
 	free(cert->crl);
 	free(cert);
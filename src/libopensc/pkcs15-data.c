@@ -61,8 +61,11 @@ sc_pkcs15_read_data_object(struct sc_pkcs15_card *p15card,
 
 	sc_der_copy(&der, &info->data);
 	data_object = calloc(sizeof(struct sc_pkcs15_data), 1);
-	if (!data_object && !der.value)
+	if (!data_object || !der.value) {
+		free(data_object);
+		free(der.value);
 		LOG_TEST_RET(ctx, SC_ERROR_OUT_OF_MEMORY, "Cannot allocate memory for data object");
+	}
 
 	data_object->data = der.value;
 	data_object->data_len = der.len;
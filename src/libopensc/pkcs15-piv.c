@@ -96,6 +96,9 @@ typedef struct prdata_st {
 	int			user_consent; 
 } prdata;
 
+/* Bytes of each certificate object kept to check the key cache against */
+#define PIV_KEY_CACHE_HEAD_LEN	64
+
 typedef struct common_key_info_st {
 	int cert_found;
 	int pubkey_found;
@@ -104,8 +107,14 @@ typedef struct common_key_info_st {
 	unsigned int pubkey_len;
 	struct sc_pkcs15_pubkey *pubkey_from_cert;
 	int not_present;
+	int cached;
+	int cache_ok;
+	u8 head[PIV_KEY_CACHE_HEAD_LEN];
+	size_t head_len;
 } common_key_info;
 
+#define PIV_NUM_CERTS_AND_KEYS 24
+
 
 /*
  * The PIV applet has no serial number, and so the either the FASC-N
@@ -237,6 +246,159 @@ static int piv_detect_card(sc_pkcs15_card_t *p15card)
 }
 
 
+/*
+ * Learning the key algorithm and size needs the certificate, which is a
+ * multi-kilobyte, possibly compressed object. With file caching enabled
+ * the public key of each certificate slot is kept in one cache file,
+ * named after the FASC-N or GUID serial number, and the certificates are
+ * then only read when asked for.
+ *
+ * The serial number survives re-keying a slot or loading a new
+ * certificate, so each entry also records the first bytes of the
+ * certificate object: its length and the certificate serial number.
+ * These are fetched from the card on every bind, with one short
+ * GET DATA per slot, and an entry that does not match them is dropped.
+ *
+ * Layout: version (1), then per slot: index (1), key length in bits (2),
+ * object head length (1), object head, SPKI length (2), SPKI. An SPKI
+ * length of 0 with an empty head records an empty slot.
+ */
+#define PIV_KEY_CACHE_PATH	"3F00DFDF"	/* no such object on the card */
+#define PIV_KEY_CACHE_VERSION	2
+
+static int piv_key_cache_usable(sc_pkcs15_card_t *p15card)
+{
+	return p15card->opts.use_file_cache
+		&& p15card->tokeninfo->serial_number
+		&& strcmp(p15card->tokeninfo->serial_number, "00000000");
+}
+
+
+/* Returns 0 when the head is known (an empty one for no object), or an
+ * error when the card could not tell */
+static int piv_get_cert_head(sc_card_t *card, const sc_path_t *path, u8 *head, size_t *head_len)
+{
+	sc_cardctl_piv_object_head_t oh;
+	int r;
+
+	oh.path = path;
+	oh.buf = head;
+	oh.len = PIV_KEY_CACHE_HEAD_LEN;
+	r = sc_card_ctl(card, SC_CARDCTL_PIV_OBJECT_HEAD, &oh);
+	if (r == SC_ERROR_FILE_NOT_FOUND) {
+		*head_len = 0;
+		return SC_SUCCESS;
+	}
+	if (r < 0)
+		return r;
+	*head_len = oh.len;
+	return SC_SUCCESS;
+}
+
+
+static void piv_load_key_cache(sc_pkcs15_card_t *p15card, common_key_info *ckis)
+{
+	sc_context_t *ctx = p15card->card->ctx;
+	sc_path_t path;
+	u8 *buf = NULL, *p;
+	size_t buflen, left, len, head_len;
+	int i;
+
+	sc_format_path(PIV_KEY_CACHE_PATH, &path);
+	if (sc_pkcs15_read_cached_file(p15card, &path, &buf, &buflen) != SC_SUCCESS)
+		return;
+
+	if (buflen < 1 || buf[0] != PIV_KEY_CACHE_VERSION) {
+		free(buf);
+		return;
+	}
+
+	p = buf + 1;
+	left = buflen - 1;
+	while (left >= 6) {
+		i = p[0];
+		head_len = p[3];
+		if (i >= PIV_NUM_CERTS_AND_KEYS || head_len > PIV_KEY_CACHE_HEAD_LEN
+				|| head_len + 6 > left)
+			break;
+		len = (p[4 + head_len] << 8) | p[5 + head_len];
+		if (len > left - 6 - head_len)
+			break;
+
+		if (len > 0 && sc_pkcs15_pubkey_from_spki_sequence(ctx, p + 6 + head_len, len,
+				&ckis[i].pubkey_from_cert) < 0) {
+			sc_pkcs15_free_pubkey(ckis[i].pubkey_from_cert);
+			ckis[i].pubkey_from_cert = NULL;
+			break;
+		}
+		if (ckis[i].pubkey_from_cert) {
+			ckis[i].cert_found = 1;
+			ckis[i].key_alg = ckis[i].pubkey_from_cert->algorithm;
+			ckis[i].pubkey_len = (p[1] << 8) | p[2];
+		}
+		memcpy(ckis[i].head, p + 4, head_len);
+		ckis[i].head_len = head_len;
+		ckis[i].cached = 1;
+
+		p += 6 + head_len + len;
+		left -= 6 + head_len + len;
+	}
+	free(buf);
+}
+
+
+/* Only slots that were checked against the card, or read from it, are
+ * saved: a slot whose read failed is read again on the next bind */
+static void piv_save_key_cache(sc_pkcs15_card_t *p15card, common_key_info *ckis)
+{
+	sc_context_t *ctx = p15card->card->ctx;
+	sc_path_t path;
+	u8 *spki[PIV_NUM_CERTS_AND_KEYS];
+	size_t spki_len[PIV_NUM_CERTS_AND_KEYS];
+	u8 *buf, *p;
+	size_t buflen = 1;
+	int i;
+
+	for (i = 0; i < PIV_NUM_CERTS_AND_KEYS; i++) {
+		spki[i] = NULL;
+		spki_len[i] = 0;
+		if (ckis[i].not_present || !ckis[i].cache_ok)
+			continue;
+		if (ckis[i].pubkey_from_cert)
+			sc_pkcs15_encode_pubkey_as_spki(ctx, ckis[i].pubkey_from_cert, &spki[i], &spki_len[i]);
+		buflen += 6 + ckis[i].head_len + spki_len[i];
+	}
+
+	buf = malloc(buflen);
+	if (buf != NULL) {
+		buf[0] = PIV_KEY_CACHE_VERSION;
+		p = buf + 1;
+		for (i = 0; i < PIV_NUM_CERTS_AND_KEYS; i++) {
+			if (ckis[i].not_present || !ckis[i].cache_ok)
+				continue;
+			p[0] = i;
+			p[1] = (ckis[i].pubkey_len >> 8) & 0xFF;
+			p[2] = ckis[i].pubkey_len & 0xFF;
+			p[3] = (u8) ckis[i].head_len;
+			memcpy(p + 4, ckis[i].head, ckis[i].head_len);
+			p += 4 + ckis[i].head_len;
+			p[0] = (spki_len[i] >> 8) & 0xFF;
+			p[1] = spki_len[i] & 0xFF;
+			if (spki_len[i])
+				memcpy(p + 2, spki[i], spki_len[i]);
+			p += 2 + spki_len[i];
+		}
+
+		sc_format_path(PIV_KEY_CACHE_PATH, &path);
+		sc_pkcs15_cache_file(p15card, &path, buf, buflen);
+		free(buf);
+	}
+
+	for (i = 0; i < PIV_NUM_CERTS_AND_KEYS; i++)
+		free(spki[i]);
+}
+
+
 static int sc_pkcs15emu_piv_init(sc_pkcs15_card_t *p15card)
 {
 
@@ -323,7 +485,6 @@ static int sc_pkcs15emu_piv_init(sc_pkcs15_card_t *p15card)
 	/* certs will be pulled out from the cert objects */
 	/* the number of cert, pubkey and prkey triplets */
 
-#define PIV_NUM_CERTS_AND_KEYS 24
 
 	static const cdata certs[PIV_NUM_CERTS_AND_KEYS] = {
 		{"1", "Certificate for PIV Authentication", 0, "0101cece", 0},
@@ -606,6 +767,7 @@ static int sc_pkcs15emu_piv_init(sc_pkcs15_card_t *p15card)
 	sc_serial_number_t serial;
 	char buf[SC_MAX_SERIALNR * 2 + 1];
 	common_key_info ckis[PIV_NUM_CERTS_AND_KEYS];
+	int key_cache_modified = 0;
 
 
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
@@ -696,17 +858,27 @@ static int sc_pkcs15emu_piv_init(sc_pkcs15_card_t *p15card)
 	/* set certs */
 	sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "PIV-II adding certs...");
 	for (i = 0; i < PIV_NUM_CERTS_AND_KEYS; i++) {
-		struct sc_pkcs15_cert_info cert_info;
-		struct sc_pkcs15_object    cert_obj;
-		sc_pkcs15_der_t   cert_der;
-		sc_pkcs15_cert_t *cert_out;
-		
 		ckis[i].cert_found = 0;
 		ckis[i].key_alg = -1;
 		ckis[i].pubkey_found = 0;
 		ckis[i].pubkey_from_file = 0;
 		ckis[i].pubkey_len = 0;
 		ckis[i].pubkey_from_cert = NULL;
+		ckis[i].not_present = 0;
+		ckis[i].cached = 0;
+		ckis[i].cache_ok = 0;
+		ckis[i].head_len = 0;
+	}
+
+	if (piv_key_cache_usable(p15card))
+		piv_load_key_cache(p15card, ckis);
+
+	for (i = 0; i < PIV_NUM_CERTS_AND_KEYS; i++) {
+		struct sc_pkcs15_cert_info cert_info;
+		struct sc_pkcs15_object    cert_obj;
+		sc_pkcs15_der_t   cert_der;
+		sc_pkcs15_cert_t *cert_out;
+		int head_ok = 0, stale = 0;
 
 		memset(&cert_info, 0, sizeof(cert_info));
 		memset(&cert_obj,  0, sizeof(cert_obj));
@@ -722,13 +894,68 @@ static int sc_pkcs15emu_piv_init(sc_pkcs15_card_t *p15card)
 		r = (card->ops->card_ctl)(card, SC_CARDCTL_PIV_OBJECT_PRESENT, &cert_info.path);
 		if (r == 1) {
 			sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "Cert can not be present,i=%d", i);
+			ckis[i].not_present = 1;
+			if (ckis[i].pubkey_from_cert) {
+				sc_pkcs15_free_pubkey(ckis[i].pubkey_from_cert);
+				ckis[i].pubkey_from_cert = NULL;
+				ckis[i].cert_found = 0;
+				ckis[i].key_alg = -1;
+			}
 			continue;
 		}
 
+		/* Check a cached key against the certificate object on the card */
+		if (ckis[i].cached) {
+			u8 head[PIV_KEY_CACHE_HEAD_LEN];
+			size_t head_len = 0;
+
+			head_ok = piv_get_cert_head(card, &cert_info.path, head, &head_len) == SC_SUCCESS;
+			if (!head_ok || head_len != ckis[i].head_len
+					|| memcmp(head, ckis[i].head, head_len)) {
+				sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "Cached key does not match the card,i=%d", i);
+				sc_pkcs15_free_pubkey(ckis[i].pubkey_from_cert);
+				ckis[i].pubkey_from_cert = NULL;
+				ckis[i].cert_found = 0;
+				ckis[i].key_alg = -1;
+				ckis[i].pubkey_len = 0;
+				ckis[i].cached = 0;
+				stale = 1;
+			}
+			if (head_ok) {
+				memcpy(ckis[i].head, head, head_len);
+				ckis[i].head_len = head_len;
+			}
+		}
+
+		/* Key taken from the cache, the cert is read when needed */
+		if (ckis[i].cached) {
+			ckis[i].cache_ok = 1;
+			if (ckis[i].cert_found == 0)
+				continue;
+			r = sc_pkcs15emu_add_x509_cert(p15card, &cert_obj, &cert_info);
+			if (r < 0)
+				sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, " Failed to add cert obj r=%d",r);
+			continue;
+		}
+		key_cache_modified = 1;
+
+		/* a cached copy of the certificate would be as outdated as the key */
+		if (stale)
+			p15card->opts.use_file_cache = 0;
 		r = sc_pkcs15_read_file(p15card, &cert_info.path, &cert_der.value, &cert_der.len);
+		if (stale)
+			p15card->opts.use_file_cache = 1;
+
+		/* after a read from the card this comes from the driver's
+		 * object cache */
+		if (!stale && piv_key_cache_usable(p15card))
+			head_ok = piv_get_cert_head(card, &cert_info.path,
+				ckis[i].head, &ckis[i].head_len) == SC_SUCCESS;
 
 		if (r) { 
 			sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "No cert found,i=%d", i);
+			/* an empty slot is worth caching, a failed read is not */
+			ckis[i].cache_ok = head_ok && ckis[i].head_len == 0;
 			continue;
 		}
 
@@ -762,6 +989,7 @@ static int sc_pkcs15emu_piv_init(sc_pkcs15_card_t *p15card)
 		ckis[i].pubkey_from_cert = cert_out->key;
 		cert_out->key = NULL;
 		sc_pkcs15_free_certificate(cert_out);
+		ckis[i].cache_ok = head_ok;
 
 		r = sc_pkcs15emu_add_x509_cert(p15card, &cert_obj, &cert_info);
 		if (r < 0) {
@@ -770,6 +998,9 @@ static int sc_pkcs15emu_piv_init(sc_pkcs15_card_t *p15card)
 		}
 	}
 
+	if (key_cache_modified && piv_key_cache_usable(p15card))
+		piv_save_key_cache(p15card, ckis);
+
 	/* set pins */
 	sc_debug(card->ctx, SC_LOG_DEBUG_NORMAL, "PIV-II adding pins...");
 	for (i = 0; pins[i].label; i++) {
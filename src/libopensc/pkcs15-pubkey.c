@@ -152,8 +152,6 @@ static const struct sc_asn1_entry c_asn1_pubkey[C_ASN1_PUBKEY_SIZE] = {
 		{ NULL, 0, 0, 0, NULL, NULL }
 };
 
-int sc_pkcs15_pubkey_from_spki_sequence(sc_context_t *ctx, const u8 *buf, size_t buflen, sc_pkcs15_pubkey_t ** outpubkey);
-
 int
 sc_pkcs15_decode_pubkey_direct_value(struct sc_pkcs15_card *p15card, struct sc_pkcs15_object *obj)
 {
@@ -1106,11 +1104,31 @@ sc_pkcs15_dup_pubkey(struct sc_context *ctx, struct sc_pkcs15_pubkey *key, struc
 }
 
 
+/*
+ * Take another reference on the key instead of copying it; the key is
+ * released by the last sc_pkcs15_free_pubkey(). The owners have to
+ * serialize access to the key themselves.
+ */
+struct sc_pkcs15_pubkey *
+sc_pkcs15_share_pubkey(struct sc_pkcs15_pubkey *key)
+{
+	if (key)
+		key->extra_refs++;
+	return key;
+}
+
+
 
+/*
+ * A shared key is left untouched, the other owners still use it;
+ * such a key is only released by sc_pkcs15_free_pubkey().
+ */
 void
 sc_pkcs15_erase_pubkey(struct sc_pkcs15_pubkey *key)
 {
 	assert(key != NULL);
+	if (key->extra_refs)
+		return;
 	if (key->alg_id) {
 		sc_asn1_clear_algorithm_id(key->alg_id);
 		free(key->alg_id);
@@ -1154,6 +1172,10 @@ sc_pkcs15_free_pubkey(struct sc_pkcs15_pubkey *key)
 {
 	if (!key)
 		return;
+	if (key->extra_refs) {
+		key->extra_refs--;
+		return;
+	}
 	sc_pkcs15_erase_pubkey(key);
 	free(key);
 }
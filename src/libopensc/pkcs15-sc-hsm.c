@@ -455,6 +455,210 @@ void sc_pkcs15emu_sc_hsm_free_cvc(sc_cvc_t *cvc)
 
 
 
+/*
+ * The emulator reads the PRKD, CD and DCOD EFs and the head of the EE
+ * certificate EFs only when the DF registered for them is first searched,
+ * and keeps what it read for the lifetime of the card handle. With file
+ * caching enabled the content is also stored in one cache file per device,
+ * tagged with a hash of the device's file list.
+ */
+#define DESCRIPTOR_CACHE_PATH	"3F00C400C400"	/* no such file on the card */
+#define DESCRIPTOR_MAX_SIZE	512
+#define CSR_MAX_SIZE		1024
+
+
+
+static struct sc_hsm_descriptor *sc_pkcs15emu_sc_hsm_find_descriptor(sc_hsm_private_data_t *priv, const u8 *fid)
+{
+	struct sc_hsm_descriptor *desc;
+
+	for (desc = priv->descriptors; desc != NULL; desc = desc->next) {
+		if (!memcmp(desc->fid, fid, 2))
+			return desc;
+	}
+	return NULL;
+}
+
+
+
+static struct sc_hsm_descriptor *sc_pkcs15emu_sc_hsm_store_descriptor(sc_hsm_private_data_t *priv, const u8 *fid,
+		const u8 *data, size_t len, int complete)
+{
+	struct sc_hsm_descriptor *desc;
+	u8 *copy;
+
+	copy = malloc(len ? len : 1);
+	if (copy == NULL)
+		return NULL;
+	memcpy(copy, data, len);
+
+	desc = sc_pkcs15emu_sc_hsm_find_descriptor(priv, fid);
+	if (desc == NULL) {
+		desc = calloc(1, sizeof(struct sc_hsm_descriptor));
+		if (desc == NULL) {
+			free(copy);
+			return NULL;
+		}
+		memcpy(desc->fid, fid, 2);
+		desc->next = priv->descriptors;
+		priv->descriptors = desc;
+	}
+	free(desc->data);
+	desc->data = copy;
+	desc->len = len;
+	desc->complete = complete;
+	return desc;
+}
+
+
+
+void sc_pkcs15emu_sc_hsm_free_descriptors(sc_hsm_private_data_t *priv)
+{
+	struct sc_hsm_descriptor *desc, *next;
+
+	for (desc = priv->descriptors; desc != NULL; desc = next) {
+		next = desc->next;
+		free(desc->data);
+		free(desc);
+	}
+	priv->descriptors = NULL;
+}
+
+
+
+/*
+ * Return up to count bytes from the start of the EF with the given prefix and id
+ */
+static int sc_pkcs15emu_sc_hsm_read_ef(sc_pkcs15_card_t * p15card, u8 prefix, u8 id, size_t count,
+		const u8 **data, size_t *len)
+{
+	sc_card_t *card = p15card->card;
+	sc_hsm_private_data_t *priv = (sc_hsm_private_data_t *) card->drv_data;
+	struct sc_hsm_descriptor *desc;
+	sc_path_t path;
+	u8 fid[2];
+	u8 *buf;
+	int r;
+
+	fid[0] = prefix;
+	fid[1] = id;
+
+	desc = sc_pkcs15emu_sc_hsm_find_descriptor(priv, fid);
+	if ((desc == NULL) || (!desc->complete && (desc->len < count))) {
+		sc_path_set(&path, SC_PATH_TYPE_FILE_ID, fid, sizeof(fid), 0, 0);
+		r = sc_select_file(card, &path, NULL);
+		LOG_TEST_RET(card->ctx, r, "Could not select EF");
+
+		buf = malloc(count);
+		if (buf == NULL)
+			LOG_FUNC_RETURN(card->ctx, SC_ERROR_OUT_OF_MEMORY);
+
+		r = sc_read_binary(card, 0, buf, count, 0);
+		if (r < 0) {
+			free(buf);
+			LOG_TEST_RET(card->ctx, r, "Could not read EF");
+		}
+
+		desc = sc_pkcs15emu_sc_hsm_store_descriptor(priv, fid, buf, r, (size_t)r < count);
+		free(buf);
+		if (desc == NULL)
+			LOG_FUNC_RETURN(card->ctx, SC_ERROR_OUT_OF_MEMORY);
+		priv->descriptors_modified = 1;
+	}
+
+	*data = desc->data;
+	*len = desc->len < count ? desc->len : count;
+	return SC_SUCCESS;
+}
+
+
+
+static void sc_pkcs15emu_sc_hsm_hash_filelist(const u8 *filelist, size_t len, u8 *hash)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;		/* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= filelist[i];
+		h *= 0x100000001b3ULL;
+	}
+	for (i = 0; i < 8; i++) {
+		hash[i] = (u8)(h >> (56 - 8 * i));
+	}
+}
+
+
+
+/*
+ * Cache file layout: file list hash (8), then per EF: FID (2), complete (1), length (2), content
+ */
+static void sc_pkcs15emu_sc_hsm_load_descriptors(sc_pkcs15_card_t * p15card)
+{
+	sc_hsm_private_data_t *priv = (sc_hsm_private_data_t *) p15card->card->drv_data;
+	sc_path_t path;
+	u8 *buf = NULL, *p;
+	size_t buflen, len, left;
+
+	sc_format_path(DESCRIPTOR_CACHE_PATH, &path);
+	if (sc_pkcs15_read_cached_file(p15card, &path, &buf, &buflen) != SC_SUCCESS)
+		return;
+
+	if ((buflen < 8) || memcmp(buf, priv->filelist_hash, 8)) {
+		sc_log(p15card->card->ctx, "File list changed, cached descriptors discarded");
+		free(buf);
+		return;
+	}
+
+	p = buf + 8;
+	left = buflen - 8;
+	while (left >= 5) {
+		len = (p[3] << 8) | p[4];
+		if (len > left - 5)
+			break;
+		if (sc_pkcs15emu_sc_hsm_store_descriptor(priv, p, p + 5, len, p[2]) == NULL)
+			break;
+		p += 5 + len;
+		left -= 5 + len;
+	}
+	free(buf);
+}
+
+
+
+static void sc_pkcs15emu_sc_hsm_save_descriptors(sc_pkcs15_card_t * p15card)
+{
+	sc_hsm_private_data_t *priv = (sc_hsm_private_data_t *) p15card->card->drv_data;
+	struct sc_hsm_descriptor *desc;
+	sc_path_t path;
+	u8 *buf, *p;
+	size_t buflen = 8;
+
+	for (desc = priv->descriptors; desc != NULL; desc = desc->next) {
+		buflen += 5 + desc->len;
+	}
+
+	buf = malloc(buflen);
+	if (buf == NULL)
+		return;
+
+	memcpy(buf, priv->filelist_hash, 8);
+	p = buf + 8;
+	for (desc = priv->descriptors; desc != NULL; desc = desc->next) {
+		memcpy(p, desc->fid, 2);
+		p[2] = desc->complete ? 1 : 0;
+		p[3] = (desc->len >> 8) & 0xFF;
+		p[4] = desc->len & 0xFF;
+		memcpy(p + 5, desc->data, desc->len);
+		p += 5 + desc->len;
+	}
+
+	sc_format_path(DESCRIPTOR_CACHE_PATH, &path);
+	sc_pkcs15_cache_file(p15card, &path, buf, buflen);
+	free(buf);
+}
+
+
+
 static int sc_pkcs15emu_sc_hsm_add_pubkey(sc_pkcs15_card_t *p15card, sc_pkcs15_prkey_info_t *key_info, char *label)
 {
 	struct sc_context *ctx = p15card->card->ctx;
@@ -462,21 +666,16 @@ static int sc_pkcs15emu_sc_hsm_add_pubkey(sc_pkcs15_card_t *p15card, sc_pkcs15_p
 	sc_pkcs15_pubkey_info_t pubkey_info;
 	sc_pkcs15_object_t pubkey_obj;
 	struct sc_pkcs15_pubkey pubkey;
-	u8 efbin[1024];
 	sc_cvc_t cvc;
-	u8 *cvcpo;
+	const u8 *cvcpo;
 	size_t cvclen;
 	int r;
 
-	/* EF.CERT is selected */
-	r = sc_read_binary(p15card->card, 0, efbin, sizeof(efbin), 0);
+	r = sc_pkcs15emu_sc_hsm_read_ef(p15card, EE_CERTIFICATE_PREFIX, key_info->key_reference, CSR_MAX_SIZE, &cvcpo, &cvclen);
 	LOG_TEST_RET(ctx, r, "Could not read CSR from EF");
 
-	cvcpo = efbin;
-	cvclen = r;
-
 	memset(&cvc, 0, sizeof(cvc));
-	r = sc_pkcs15emu_sc_hsm_decode_cvc(p15card, (const u8 **)&cvcpo, &cvclen, &cvc);
+	r = sc_pkcs15emu_sc_hsm_decode_cvc(p15card, &cvcpo, &cvclen, &cvc);
 	LOG_TEST_RET(ctx, r, "Could decode certificate signing request");
 
 	memset(&pubkey, 0, sizeof(pubkey));
@@ -511,101 +710,119 @@ static int sc_pkcs15emu_sc_hsm_add_pubkey(sc_pkcs15_card_t *p15card, sc_pkcs15_p
 
 
 /*
- * Add a key and the key description in PKCS#15 format to the framework
+ * Decode the PKCS#15 description of a key
  */
-static int sc_pkcs15emu_sc_hsm_add_prkd(sc_pkcs15_card_t * p15card, u8 keyid) {
+static int sc_pkcs15emu_sc_hsm_decode_prkd(sc_pkcs15_card_t * p15card, u8 keyid, struct sc_pkcs15_object *prkd) {
 
 	sc_card_t *card = p15card->card;
-	sc_pkcs15_cert_info_t cert_info;
-	sc_pkcs15_object_t cert_obj;
-	struct sc_pkcs15_object prkd;
 	sc_pkcs15_prkey_info_t *key_info;
-	sc_file_t *file = NULL;
-	sc_path_t path;
-	u8 fid[2];
-	u8 efbin[512];
-	u8 *ptr;
+	const u8 *ptr;
 	size_t len;
 	int r;
 
-	fid[0] = PRKD_PREFIX;
-	fid[1] = keyid;
-
-	/* Try to select a related EF containing the PKCS#15 description of the key */
-	sc_path_set(&path, SC_PATH_TYPE_FILE_ID, fid, sizeof(fid), 0, 0);
-	r = sc_select_file(card, &path, &file);
-
-	if (r != SC_SUCCESS) {
-		return SC_SUCCESS;
-	}
-
-	sc_file_free(file);
-	r = sc_read_binary(p15card->card, 0, efbin, sizeof(efbin), 0);
+	r = sc_pkcs15emu_sc_hsm_read_ef(p15card, PRKD_PREFIX, keyid, DESCRIPTOR_MAX_SIZE, &ptr, &len);
 	LOG_TEST_RET(card->ctx, r, "Could not read EF.PRKD");
 
-	memset(&prkd, 0, sizeof(prkd));
-	ptr = efbin;
-	len = r;
+	memset(prkd, 0, sizeof(*prkd));
 
-	r = sc_pkcs15_decode_prkdf_entry(p15card, &prkd, (const u8 **)&ptr, &len);
+	r = sc_pkcs15_decode_prkdf_entry(p15card, prkd, &ptr, &len);
 	LOG_TEST_RET(card->ctx, r, "Could not decode EF.PRKD");
 
 	/* All keys require user PIN authentication */
-	prkd.auth_id.len = 1;
-	prkd.auth_id.value[0] = 1;
+	prkd->auth_id.len = 1;
+	prkd->auth_id.value[0] = 1;
 
 	/*
 	 * Set private key flag as all keys are private anyway
 	 */
-	prkd.flags |= SC_PKCS15_CO_FLAG_PRIVATE;
+	prkd->flags |= SC_PKCS15_CO_FLAG_PRIVATE;
 
-	key_info = (sc_pkcs15_prkey_info_t *)prkd.data;
+	key_info = (sc_pkcs15_prkey_info_t *)prkd->data;
 	key_info->key_reference = keyid;
 
+	return SC_SUCCESS;
+}
+
+
+
+/*
+ * Add a key and the key description in PKCS#15 format to the framework
+ */
+static int sc_pkcs15emu_sc_hsm_add_prkd(sc_pkcs15_card_t * p15card, u8 keyid) {
+
+	sc_card_t *card = p15card->card;
+	struct sc_pkcs15_object prkd;
+	sc_pkcs15_prkey_info_t *key_info;
+	int r;
+
+	r = sc_pkcs15emu_sc_hsm_decode_prkd(p15card, keyid, &prkd);
+	LOG_TEST_RET(card->ctx, r, "Could not decode EF.PRKD");
+
+	key_info = (sc_pkcs15_prkey_info_t *)prkd.data;
+
 	if (prkd.type == SC_PKCS15_TYPE_PRKEY_RSA) {
 		r = sc_pkcs15emu_add_rsa_prkey(p15card, &prkd, key_info);
 	} else {
 		r = sc_pkcs15emu_add_ec_prkey(p15card, &prkd, key_info);
 	}
 
+	/* The framework keeps a shallow copy of the key info */
+	free(key_info);
+
 	LOG_TEST_RET(card->ctx, r, "Could not add private key to framework");
 
-	/* Check if we also have a certificate for the private key */
-	fid[0] = EE_CERTIFICATE_PREFIX;
+	return SC_SUCCESS;
+}
 
-	sc_path_set(&path, SC_PATH_TYPE_FILE_ID, fid, sizeof(fid), 0, 0);
-	r = sc_select_file(card, &path, &file);
 
-	if (r != SC_SUCCESS) {
-		return SC_SUCCESS;
-	}
 
-	sc_file_free(file);
+/*
+ * Add the certificate or, for a certificate signing request, the public key
+ * stored in the EE certificate EF of a key
+ */
+static int sc_pkcs15emu_sc_hsm_add_ee(sc_pkcs15_card_t * p15card, u8 keyid) {
+
+	sc_card_t *card = p15card->card;
+	sc_pkcs15_cert_info_t cert_info;
+	sc_pkcs15_object_t cert_obj;
+	struct sc_pkcs15_object prkd;
+	sc_pkcs15_prkey_info_t *key_info;
+	const u8 *head;
+	size_t len;
+	u8 fid[2];
+	int r;
 
 	/* Check if the certificate is a X.509 certificate */
-	r = sc_read_binary(p15card->card, 0, efbin, 1, 0);
+	r = sc_pkcs15emu_sc_hsm_read_ef(p15card, EE_CERTIFICATE_PREFIX, keyid, 1, &head, &len);
 
-	if (r < 0) {
+	if ((r < 0) || (len < 1) || ((head[0] != 0x67) && (head[0] != 0x30))) {
 		return SC_SUCCESS;
 	}
 
-	if (efbin[0] == 0x67) {		/* Decode CSR and create public key object */
+	/* Label and ID are taken from the key */
+	r = sc_pkcs15emu_sc_hsm_decode_prkd(p15card, keyid, &prkd);
+	LOG_TEST_RET(card->ctx, r, "Could not decode EF.PRKD");
+
+	key_info = (sc_pkcs15_prkey_info_t *)prkd.data;
+
+	if (head[0] == 0x67) {		/* Decode CSR and create public key object */
 		sc_pkcs15emu_sc_hsm_add_pubkey(p15card, key_info, prkd.label);
+		sc_pkcs15_free_prkey_info(key_info);
 		return SC_SUCCESS;		/* Ignore any errors */
 	}
 
-	if (efbin[0] != 0x30) {
-		return SC_SUCCESS;
-	}
-
 	memset(&cert_info, 0, sizeof(cert_info));
 	memset(&cert_obj, 0, sizeof(cert_obj));
 
+	fid[0] = EE_CERTIFICATE_PREFIX;
+	fid[1] = keyid;
+
 	cert_info.id = key_info->id;
-	cert_info.path = path;
-	cert_info.path.count = -1;
+	sc_path_set(&cert_info.path, SC_PATH_TYPE_FILE_ID, fid, sizeof(fid), 0, -1);
 
 	strlcpy(cert_obj.label, prkd.label, sizeof(cert_obj.label));
+	sc_pkcs15_free_prkey_info(key_info);
+
 	r = sc_pkcs15emu_add_x509_cert(p15card, &cert_obj, &cert_info);
 	LOG_TEST_RET(card->ctx, r, "Could not add certificate");
 
@@ -622,32 +839,14 @@ static int sc_pkcs15emu_sc_hsm_add_dcod(sc_pkcs15_card_t * p15card, u8 id) {
 	sc_card_t *card = p15card->card;
 	sc_pkcs15_data_info_t *data_info;
 	sc_pkcs15_object_t data_obj;
-	sc_file_t *file = NULL;
-	sc_path_t path;
-	u8 fid[2];
-	u8 efbin[512];
 	const u8 *ptr;
 	size_t len;
 	int r;
 
-	fid[0] = DCOD_PREFIX;
-	fid[1] = id;
-
-	/* Try to select a related EF containing the PKCS#15 description of the data */
-	sc_path_set(&path, SC_PATH_TYPE_FILE_ID, fid, sizeof(fid), 0, 0);
-	r = sc_select_file(card, &path, &file);
-
-	if (r != SC_SUCCESS) {
-		return SC_SUCCESS;
-	}
-
-	sc_file_free(file);
-	r = sc_read_binary(p15card->card, 0, efbin, sizeof(efbin), 0);
+	r = sc_pkcs15emu_sc_hsm_read_ef(p15card, DCOD_PREFIX, id, DESCRIPTOR_MAX_SIZE, &ptr, &len);
 	LOG_TEST_RET(card->ctx, r, "Could not read EF.DCOD");
 
 	memset(&data_obj, 0, sizeof(data_obj));
-	ptr = efbin;
-	len = r;
 
 	r = sc_pkcs15_decode_dodf_entry(p15card, &data_obj, &ptr, &len);
 	LOG_TEST_RET(card->ctx, r, "Could not decode EF.DCOD");
@@ -656,6 +855,8 @@ static int sc_pkcs15emu_sc_hsm_add_dcod(sc_pkcs15_card_t * p15card, u8 id) {
 
 	r = sc_pkcs15emu_add_data_object(p15card, &data_obj, data_info);
 
+	free(data_info);
+
 	LOG_TEST_RET(card->ctx, r, "Could not add data object to framework");
 
 	return SC_SUCCESS;
@@ -671,32 +872,14 @@ static int sc_pkcs15emu_sc_hsm_add_cd(sc_pkcs15_card_t * p15card, u8 id) {
 	sc_card_t *card = p15card->card;
 	sc_pkcs15_cert_info_t *cert_info;
 	sc_pkcs15_object_t obj;
-	sc_file_t *file = NULL;
-	sc_path_t path;
-	u8 fid[2];
-	u8 efbin[512];
 	const u8 *ptr;
 	size_t len;
 	int r;
 
-	fid[0] = CD_PREFIX;
-	fid[1] = id;
-
-	/* Try to select a related EF containing the PKCS#15 description of the data */
-	sc_path_set(&path, SC_PATH_TYPE_FILE_ID, fid, sizeof(fid), 0, 0);
-	r = sc_select_file(card, &path, &file);
-
-	if (r != SC_SUCCESS) {
-		return SC_SUCCESS;
-	}
-
-	sc_file_free(file);
-	r = sc_read_binary(p15card->card, 0, efbin, sizeof(efbin), 0);
-	LOG_TEST_RET(card->ctx, r, "Could not read EF.DCOD");
+	r = sc_pkcs15emu_sc_hsm_read_ef(p15card, CD_PREFIX, id, DESCRIPTOR_MAX_SIZE, &ptr, &len);
+	LOG_TEST_RET(card->ctx, r, "Could not read EF.CD");
 
 	memset(&obj, 0, sizeof(obj));
-	ptr = efbin;
-	len = r;
 
 	r = sc_pkcs15_decode_cdf_entry(p15card, &obj, &ptr, &len);
 	LOG_TEST_RET(card->ctx, r, "Could not decode EF.CD");
@@ -705,6 +888,8 @@ static int sc_pkcs15emu_sc_hsm_add_cd(sc_pkcs15_card_t * p15card, u8 id) {
 
 	r = sc_pkcs15emu_add_x509_cert(p15card, &obj, cert_info);
 
+	free(cert_info);
+
 	LOG_TEST_RET(card->ctx, r, "Could not add data object to framework");
 
 	return SC_SUCCESS;
@@ -712,6 +897,130 @@ static int sc_pkcs15emu_sc_hsm_add_cd(sc_pkcs15_card_t * p15card, u8 id) {
 
 
 
+/*
+ * Load the objects behind a DF registered by sc_pkcs15emu_sc_hsm_add_dfs()
+ */
+static int sc_pkcs15emu_sc_hsm_parse_df(sc_pkcs15_card_t * p15card, sc_pkcs15_df_t *df)
+{
+	sc_card_t *card = p15card->card;
+	sc_pkcs15_df_t *sibling;
+	u8 prefix, id;
+	int r = SC_SUCCESS;
+
+	LOG_FUNC_CALLED(card->ctx);
+
+	if (df->enumerated)
+		LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+
+	/* Objects are only ever loaded once, whatever the outcome */
+	df->enumerated = 1;
+
+	if ((df->path.type != SC_PATH_TYPE_FILE_ID) || (df->path.len != 2))
+		LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+
+	prefix = df->path.value[0];
+	id = df->path.value[1];
+
+	switch(prefix) {
+	case PRKD_PREFIX:
+		r = sc_pkcs15emu_sc_hsm_add_prkd(p15card, id);
+		break;
+	case EE_CERTIFICATE_PREFIX:
+		/* Registered as CDF and PUKDF: one read serves both */
+		for (sibling = p15card->df_list; sibling != NULL; sibling = sibling->next) {
+			if (sc_compare_path(&sibling->path, &df->path))
+				sibling->enumerated = 1;
+		}
+		r = sc_pkcs15emu_sc_hsm_add_ee(p15card, id);
+		break;
+	case DCOD_PREFIX:
+		r = sc_pkcs15emu_sc_hsm_add_dcod(p15card, id);
+		break;
+	case CD_PREFIX:
+		r = sc_pkcs15emu_sc_hsm_add_cd(p15card, id);
+		break;
+	}
+	if (r != SC_SUCCESS) {
+		sc_log(card->ctx, "Error %d adding elements to framework", r);
+	}
+
+	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+}
+
+
+
+static void sc_pkcs15emu_sc_hsm_clear(sc_pkcs15_card_t * p15card)
+{
+	sc_hsm_private_data_t *priv = (sc_hsm_private_data_t *) p15card->card->drv_data;
+
+	if (p15card->opts.use_file_cache && priv->descriptors_modified) {
+		sc_pkcs15emu_sc_hsm_save_descriptors(p15card);
+	}
+	priv->descriptors_modified = 0;
+}
+
+
+
+static int sc_pkcs15emu_sc_hsm_in_filelist(const u8 *filelist, int filelistlength, u8 prefix, u8 id)
+{
+	int i;
+
+	for (i = 0; i < filelistlength; i += 2) {
+		if ((filelist[i] == prefix) && (filelist[i + 1] == id))
+			return 1;
+	}
+	return 0;
+}
+
+
+
+/*
+ * Register a DF for each key, certificate and data object description in the file list.
+ * The descriptions are read by sc_pkcs15emu_sc_hsm_parse_df() when a search needs them.
+ */
+static int sc_pkcs15emu_sc_hsm_add_dfs(sc_pkcs15_card_t * p15card, const u8 *filelist, int filelistlength)
+{
+	sc_path_t path;
+	u8 fid[2];
+	int i, r;
+
+	for (i = 0; i < filelistlength; i += 2) {
+		fid[0] = filelist[i];
+		fid[1] = filelist[i + 1];
+		sc_path_set(&path, SC_PATH_TYPE_FILE_ID, fid, sizeof(fid), 0, -1);
+
+		switch(fid[0]) {
+		case KEY_PREFIX:
+			if (!sc_pkcs15emu_sc_hsm_in_filelist(filelist, filelistlength, PRKD_PREFIX, fid[1]))
+				break;
+			path.value[0] = PRKD_PREFIX;
+			r = sc_pkcs15_add_df(p15card, SC_PKCS15_PRKDF, &path);
+			LOG_TEST_RET(p15card->card->ctx, r, "Could not add PRKDF");
+
+			if (!sc_pkcs15emu_sc_hsm_in_filelist(filelist, filelistlength, EE_CERTIFICATE_PREFIX, fid[1]))
+				break;
+			path.value[0] = EE_CERTIFICATE_PREFIX;
+			r = sc_pkcs15_add_df(p15card, SC_PKCS15_CDF, &path);
+			LOG_TEST_RET(p15card->card->ctx, r, "Could not add CDF");
+			r = sc_pkcs15_add_df(p15card, SC_PKCS15_PUKDF, &path);
+			LOG_TEST_RET(p15card->card->ctx, r, "Could not add PUKDF");
+			break;
+		case DCOD_PREFIX:
+			r = sc_pkcs15_add_df(p15card, SC_PKCS15_DODF, &path);
+			LOG_TEST_RET(p15card->card->ctx, r, "Could not add DODF");
+			break;
+		case CD_PREFIX:
+			r = sc_pkcs15_add_df(p15card, SC_PKCS15_CDF, &path);
+			LOG_TEST_RET(p15card->card->ctx, r, "Could not add CDF");
+			break;
+		}
+	}
+
+	return SC_SUCCESS;
+}
+
+
+
 static int sc_pkcs15emu_sc_hsm_read_tokeninfo (sc_pkcs15_card_t * p15card)
 {
 	sc_card_t *card = p15card->card;
@@ -746,11 +1055,12 @@ static int sc_pkcs15emu_sc_hsm_read_tokeninfo (sc_pkcs15_card_t * p15card)
 static int sc_pkcs15emu_sc_hsm_init (sc_pkcs15_card_t * p15card)
 {
 	sc_card_t *card = p15card->card;
+	sc_hsm_private_data_t *priv = (sc_hsm_private_data_t *) card->drv_data;
 	sc_file_t *file = NULL;
 	sc_path_t path;
 	u8 filelist[MAX_EXT_APDU_LENGTH];
 	int filelistlength;
-	int r, i;
+	int r;
 	sc_cvc_t devcert;
 	struct sc_app_info *appinfo;
 	struct sc_pkcs15_auth_info pin_info;
@@ -888,23 +1198,18 @@ static int sc_pkcs15emu_sc_hsm_init (sc_pkcs15_card_t * p15card)
 	filelistlength = sc_list_files(card, filelist, sizeof(filelist));
 	LOG_TEST_RET(card->ctx, filelistlength, "Could not enumerate file and key identifier");
 
-	for (i = 0; i < filelistlength; i += 2) {
-		switch(filelist[i]) {
-		case KEY_PREFIX:
-			r = sc_pkcs15emu_sc_hsm_add_prkd(p15card, filelist[i + 1]);
-			break;
-		case DCOD_PREFIX:
-			r = sc_pkcs15emu_sc_hsm_add_dcod(p15card, filelist[i + 1]);
-			break;
-		case CD_PREFIX:
-			r = sc_pkcs15emu_sc_hsm_add_cd(p15card, filelist[i + 1]);
-			break;
-		}
-		if (r != SC_SUCCESS) {
-			sc_log(card->ctx, "Error %d adding elements to framework", r);
-		}
+	sc_pkcs15emu_sc_hsm_hash_filelist(filelist, filelistlength, priv->filelist_hash);
+
+	if (p15card->opts.use_file_cache) {
+		sc_pkcs15emu_sc_hsm_load_descriptors(p15card);
 	}
 
+	r = sc_pkcs15emu_sc_hsm_add_dfs(p15card, filelist, filelistlength);
+	LOG_TEST_RET(card->ctx, r, "Could not register PKCS#15 directories");
+
+	p15card->ops.parse_df = sc_pkcs15emu_sc_hsm_parse_df;
+	p15card->ops.clear = sc_pkcs15emu_sc_hsm_clear;
+
 	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
 }
 
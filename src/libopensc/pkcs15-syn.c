@@ -127,21 +127,33 @@ int sc_pkcs15_is_emulation_only(sc_card_t *card)
 	}
 }
 
+int
+sc_pkcs15emu_get_builtin_index(const char *name)
+{
+	int i;
+
+	for (i = 0; builtin_emulators[i].name; i++)
+		if (!strcmp(builtin_emulators[i].name, name))
+			return i;
+	return -1;
+}
+
 int
 sc_pkcs15_bind_synthetic(sc_pkcs15_card_t *p15card)
 {
 	sc_context_t		*ctx = p15card->card->ctx;
-	scconf_block		*conf_block, **blocks, *blk;
+	struct sc_conf_snapshot	*conf;
+	scconf_block		*blk;
 	sc_pkcs15emu_opt_t	opts;
 	int			i, r = SC_ERROR_WRONG_CARD;
 
 	SC_FUNC_CALLED(ctx, SC_LOG_DEBUG_VERBOSE);
 	memset(&opts, 0, sizeof(opts));
-	conf_block = NULL;
 
-	conf_block = sc_get_conf_block(ctx, "framework", "pkcs15", 1);
+	/* the snapshot is held until the end: 'emulate' blocks belong to it */
+	conf = sc_ctx_get_conf(ctx);
 
-	if (!conf_block) {
+	if (!conf->pkcs15.block) {
 		/* no conf file found => try bultin drivers  */
 		sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "no conf file (or section), trying all builtin emulators\n");
 		for (i = 0; builtin_emulators[i].name; i++) {
@@ -153,29 +165,19 @@ sc_pkcs15_bind_synthetic(sc_pkcs15_card_t *p15card)
 		}
 	} else {
 		/* we have a conf file => let's use it */
-		int builtin_enabled; 
-		const scconf_list *list, *item;
-
-		builtin_enabled = scconf_get_bool(conf_block, "enable_builtin_emulation", 1);
-		list = scconf_find_list(conf_block, "builtin_emulators"); /* FIXME: rename to enabled_emulators */
-
-		if (builtin_enabled && list) {
-			/* get the list of enabled emulation drivers */
-			for (item = list; item; item = item->next) {
-				/* go through the list of builtin drivers */
-				const char *name = item->data;
-
-				sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "trying %s\n", name);
-				for (i = 0; builtin_emulators[i].name; i++)
-					if (!strcmp(builtin_emulators[i].name, name)) {
-						r = builtin_emulators[i].handler(p15card, &opts);
-						if (r == SC_SUCCESS)
-							/* we got a hit */
-							goto out;
-					}
+		const int *list = conf->pkcs15.builtin_emulators;
+
+		if (conf->pkcs15.enable_builtin_emulation && list) {
+			/* the list of enabled emulation drivers, compiled into table indexes */
+			for (; *list >= 0; list++) {
+				sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "trying %s\n", builtin_emulators[*list].name);
+				r = builtin_emulators[*list].handler(p15card, &opts);
+				if (r == SC_SUCCESS)
+					/* we got a hit */
+					goto out;
 			}
 		}
-		else if (builtin_enabled) {
+		else if (conf->pkcs15.enable_builtin_emulation) {
 			sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "no emulator list in config file, trying all builtin emulators\n");
 			for (i = 0; builtin_emulators[i].name; i++) {
 				sc_debug(ctx, SC_LOG_DEBUG_NORMAL, "trying %s\n", builtin_emulators[i].name);
@@ -186,27 +188,22 @@ sc_pkcs15_bind_synthetic(sc_pkcs15_card_t *p15card)
 			}
 		}
 
-		/* search for 'emulate foo { ... }' entries in the conf file */
-		sc_log(ctx, "searching for 'emulate foo { ... }' blocks\n");
-		blocks = scconf_find_blocks(ctx->conf, conf_block, "emulate", NULL);
-		sc_log(ctx, "Blocks: %p", blocks);
-		for (i = 0; blocks && (blk = blocks[i]) != NULL; i++) {
+		/* 'emulate foo { ... }' entries in the conf file */
+		for (i = 0; conf->pkcs15.emulate_blocks && (blk = conf->pkcs15.emulate_blocks[i]) != NULL; i++) {
 			const char *name = blk->name->data;
 			sc_log(ctx, "trying %s", name);
 			r = parse_emu_block(p15card, blk);
-			if (r == SC_SUCCESS) {
-				free(blocks);
+			if (r == SC_SUCCESS)
 				goto out;
-			}
 		}
-		if (blocks)
-			free(blocks);
 	}
 
 	/* Total failure */
+	sc_ctx_put_conf(ctx, conf);
 	LOG_FUNC_RETURN(ctx, SC_ERROR_WRONG_CARD);
 
-out:	if (r == SC_SUCCESS) {
+out:	sc_ctx_put_conf(ctx, conf);
+	if (r == SC_SUCCESS) {
 		p15card->magic  = SC_PKCS15_CARD_MAGIC;
 		p15card->flags |= SC_PKCS15_CARD_FLAG_EMULATED;
 	}
@@ -929,8 +929,9 @@ struct sc_app_info *
 sc_pkcs15_get_application_by_type(struct sc_card * card, char *app_type)
 {
 	struct sc_app_info *out = NULL;
-	scconf_block *conf_block = NULL;
+	struct sc_conf_snapshot *conf;
 	int i, rv;
+	size_t j;
 
 	if (!card)
 		return NULL;
@@ -941,28 +942,22 @@ sc_pkcs15_get_application_by_type(struct sc_card * card, char *app_type)
 			return NULL;
 	}
 
-	conf_block = sc_get_conf_block(card->ctx, "framework", "pkcs15", 1);
-	if (!conf_block)
-		return NULL;
-
-	for (i = 0; i < card->app_count; i++)   {
+	conf = sc_ctx_get_conf(card->ctx);
+	for (i = 0; i < card->app_count && !out; i++)   {
 		struct sc_app_info *app_info = card->app[i];
-		scconf_block **blocks = NULL;
-		char str_path[SC_MAX_AID_STRING_SIZE];
-
-		sc_bin_to_hex(app_info->aid.value, app_info->aid.len, str_path, sizeof(str_path), 0);
-		blocks = scconf_find_blocks(card->ctx->conf, conf_block, "application", str_path);
-		if (blocks)   {
-			if (blocks[0])   {
-				char *type = (char *)scconf_get_str(blocks[0], "type", app_type);
-				if (!strcmp(type, app_type))   {
-					out = app_info;
-					break;
-				}
-			}
-			free(blocks);
+
+		/* the first 'application' block of the AID decides */
+		for (j = 0; j < conf->pkcs15.application_count; j++)   {
+			const struct sc_conf_application *app = &conf->pkcs15.applications[j];
+
+			if (app->aid.len != app_info->aid.len || memcmp(app->aid.value, app_info->aid.value, app->aid.len))
+				continue;
+			if (!app->type || !strcmp(app->type, app_type))
+				out = app_info;
+			break;
 		}
 	}
+	sc_ctx_put_conf(card->ctx, conf);
 
 	return out;
 }
@@ -1174,7 +1169,7 @@ sc_pkcs15_bind(struct sc_card *card, struct sc_aid *aid,
 {
 	struct sc_pkcs15_card *p15card = NULL;
 	struct sc_context *ctx = card->ctx;
-	scconf_block *conf_block = NULL;
+	struct sc_conf_snapshot *conf;
 	int r, emu_first, enable_emu;
 
 	LOG_FUNC_CALLED(ctx);
@@ -1186,20 +1181,15 @@ sc_pkcs15_bind(struct sc_card *card, struct sc_aid *aid,
 		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
 
 	p15card->card = card;
-	p15card->opts.use_file_cache = 0;
-	p15card->opts.use_pin_cache = 1;
-	p15card->opts.pin_cache_counter = 10;
-	p15card->opts.pin_cache_ignore_user_consent = 0;
-
-	conf_block = sc_get_conf_block(ctx, "framework", "pkcs15", 1);
 
-	if (conf_block) {
-		p15card->opts.use_file_cache = scconf_get_bool(conf_block, "use_file_caching", p15card->opts.use_file_cache);
-		p15card->opts.use_pin_cache = scconf_get_bool(conf_block, "use_pin_caching", p15card->opts.use_pin_cache);
-		p15card->opts.pin_cache_counter = scconf_get_int(conf_block, "pin_cache_counter", p15card->opts.pin_cache_counter);
-		p15card->opts.pin_cache_ignore_user_consent =  scconf_get_bool(conf_block, "pin_cache_ignore_user_consent",
-				p15card->opts.pin_cache_ignore_user_consent);
-	}
+	conf = sc_ctx_get_conf(ctx);
+	p15card->opts.use_file_cache = conf->pkcs15.use_file_cache;
+	p15card->opts.use_pin_cache = conf->pkcs15.use_pin_cache;
+	p15card->opts.pin_cache_counter = conf->pkcs15.pin_cache_counter;
+	p15card->opts.pin_cache_ignore_user_consent = conf->pkcs15.pin_cache_ignore_user_consent;
+	enable_emu = conf->pkcs15.enable_emulation;
+	emu_first = conf->pkcs15.try_emulation_first;
+	sc_ctx_put_conf(ctx, conf);
 	sc_log(ctx, "PKCS#15 options: use_file_cache=%d use_pin_cache=%d pin_cache_counter=%d pin_cache_ignore_user_consent=%d",
 	         p15card->opts.use_file_cache, p15card->opts.use_pin_cache,
 		 p15card->opts.pin_cache_counter, p15card->opts.pin_cache_ignore_user_consent);
@@ -1211,10 +1201,8 @@ sc_pkcs15_bind(struct sc_card *card, struct sc_aid *aid,
 		LOG_FUNC_RETURN(ctx, r);
 	}
 
-	enable_emu = scconf_get_bool(conf_block, "enable_pkcs15_emulation", 1);
 	if (enable_emu) {
 		sc_log(ctx, "PKCS#15 emulation enabled");
-		emu_first = scconf_get_bool(conf_block, "try_emulation_first", 0);
 		if (emu_first || sc_pkcs15_is_emulation_only(card)) {
 			r = sc_pkcs15_bind_synthetic(p15card);
 			if (r == SC_SUCCESS)
@@ -1931,6 +1919,8 @@ sc_pkcs15_remove_dfs(struct sc_pkcs15_card *p15card)
 
 	for (cur = p15card->df_list; cur; cur = next)   {
 		next = cur->next;
+		if (cur->image)
+			free(cur->image);
 		free(cur);
 	}
 
@@ -2009,7 +1999,7 @@ sc_pkcs15_parse_df(struct sc_pkcs15_card *p15card, struct sc_pkcs15_df *df)
 	struct sc_context *ctx = p15card->card->ctx;
 	unsigned char *buf;
 	const unsigned char *p;
-	size_t bufsize;
+	size_t bufsize, image_len;
 	int r;
 	struct sc_pkcs15_object *obj = NULL;
 	int (* func)(struct sc_pkcs15_card *, struct sc_pkcs15_object *,
@@ -2054,6 +2044,7 @@ sc_pkcs15_parse_df(struct sc_pkcs15_card *p15card, struct sc_pkcs15_df *df)
 	r = sc_pkcs15_read_file(p15card, &df->path, &buf, &bufsize);
 	LOG_TEST_RET(ctx, r, "pkcs15 read file failed");
 
+	image_len = bufsize;
 	p = buf;
 	while (bufsize && *p != 0x00) {
 
@@ -2088,7 +2079,18 @@ sc_pkcs15_parse_df(struct sc_pkcs15_card *p15card, struct sc_pkcs15_df *df)
 		r = 0;
 ret:
 	df->enumerated = 1;
-	free(buf);
+	/* Keep the raw DF content for differential updates, but only when
+	 * it was read from the card itself and starts at offset zero:
+	 * a stale file cache must never serve as the reference image. */
+	if (r == 0 && !p15card->opts.use_file_cache && (df->path.count < 0 || df->path.index == 0))   {
+		if (df->image)
+			free(df->image);
+		df->image = buf;
+		df->image_len = image_len;
+	}
+	else   {
+		free(buf);
+	}
 	LOG_FUNC_RETURN(ctx, r);
 }
 
@@ -2292,6 +2294,79 @@ sc_pkcs15_parse_unusedspace(const unsigned char *buf, size_t buflen, struct sc_p
 }
 
 
+/* Initial allocation and upper limit used when the size of an EF is unknown */
+#define PKCS15_READ_CHUNK	1024
+#define PKCS15_READ_MAX		0x10000
+
+/*
+ * When the size of the EF is not known, reading past its end is how we
+ * find out where it stops: accept the errors cards use to report that.
+ */
+static int
+pkcs15_is_end_of_file(int r)
+{
+	return r == SC_ERROR_FILE_END_REACHED
+		|| r == SC_ERROR_INCORRECT_PARAMETERS
+		|| r == SC_ERROR_OFFSET_TOO_LARGE;
+}
+
+
+/*
+ * Read a transparent EF of unknown size starting at 'offset'.
+ * The buffer doubles until the card returns a short read or reports
+ * the end of the file, and is trimmed to the length actually read.
+ * The file is read one response at a time: sc_read_binary() drops
+ * what it has read when a later part of a larger request fails.
+ */
+static int
+pkcs15_read_binary_grow(struct sc_card *card, size_t offset,
+		unsigned char **out, size_t *outlen)
+{
+	struct sc_context *ctx = card->ctx;
+	unsigned char *data = NULL, *p;
+	size_t size = 0, len = 0, chunk;
+	size_t max_le = card->max_recv_size > 0 ? card->max_recv_size : 256;
+	int r;
+
+	for (;;) {
+		if (len == size) {
+			if (size >= PKCS15_READ_MAX) {
+				sc_log(ctx, "file exceeds %i bytes, truncated", PKCS15_READ_MAX);
+				break;
+			}
+			size = size ? size * 2 : PKCS15_READ_CHUNK;
+			p = realloc(data, size);
+			if (p == NULL) {
+				free(data);
+				return SC_ERROR_OUT_OF_MEMORY;
+			}
+			data = p;
+		}
+
+		chunk = MIN(size - len, max_le);
+		r = sc_read_binary(card, offset + len, data + len, chunk, 0);
+		if (r < 0 && len && pkcs15_is_end_of_file(r))
+			break;
+		if (r < 0) {
+			free(data);
+			return r;
+		}
+		len += r;
+		if ((size_t)r < chunk)
+			break;
+	}
+
+	if (len && len < size) {
+		p = realloc(data, len);
+		if (p)
+			data = p;
+	}
+	*out = data;
+	*outlen = len;
+	return SC_SUCCESS;
+}
+
+
 int
 sc_pkcs15_read_file(struct sc_pkcs15_card *p15card, const struct sc_path *in_path,
 		unsigned char **buf, size_t *buflen)
@@ -2321,31 +2396,32 @@ sc_pkcs15_read_file(struct sc_pkcs15_card *p15card, const struct sc_path *in_pat
 		/* Handle the case where the ASN.1 Path object specified
 		 * index and length values */
 		if (in_path->count < 0) {
-			if (file->size)
-				len = file->size;
-			else
-				len = 1024;
+			len = file->size;
 			offset = 0;
 		}
 		else {
 			offset = in_path->index;
 			len = in_path->count;
 			/* Make sure we're within proper bounds */
-			if (offset >= file->size || offset + len > file->size) {
+			if (file->size && (offset >= file->size || offset + len > file->size)) {
 				r = SC_ERROR_INVALID_ASN1_OBJECT;
 				goto fail_unlock;
 			}
 		}
-		data = malloc(len);
-		if (data == NULL) {
-			r = SC_ERROR_OUT_OF_MEMORY;
-			goto fail_unlock;
-		}
 
 		if (file->ef_structure == SC_FILE_EF_LINEAR_VARIABLE_TLV) {
 			int i;
 			size_t l, record_len;
-			unsigned char *head = data;
+			unsigned char *head;
+
+			if (!len)
+				len = PKCS15_READ_CHUNK;
+			data = malloc(len);
+			if (data == NULL) {
+				r = SC_ERROR_OUT_OF_MEMORY;
+				goto fail_unlock;
+			}
+			head = data;
 
 			for (i=1;  ; i++) {
 				l = len - (head - data);
@@ -2373,7 +2449,18 @@ sc_pkcs15_read_file(struct sc_pkcs15_card *p15card, const struct sc_path *in_pat
 			}
 			len = head-data;
 		}
+		else if (!len) {
+			/* Size unknown: grow the buffer while the card has more */
+			r = pkcs15_read_binary_grow(p15card->card, offset, &data, &len);
+			if (r < 0)
+				goto fail_unlock;
+		}
 		else {
+			data = malloc(len);
+			if (data == NULL) {
+				r = SC_ERROR_OUT_OF_MEMORY;
+				goto fail_unlock;
+			}
 			r = sc_read_binary(p15card->card, offset, data, len, 0);
 			if (r < 0) {
 				free(data);
@@ -2398,6 +2485,101 @@ fail_unlock:
 }
 
 
+/*
+ * Read 'count' bytes at 'offset' of the object designated by 'in_path'
+ * directly into the caller's buffer. 'offset' is relative to the
+ * path index, if any. Returns the number of bytes read, which is less
+ * than 'count' at the end of the object.
+ */
+int
+sc_pkcs15_read_file_part(struct sc_pkcs15_card *p15card, const struct sc_path *in_path,
+		size_t offset, unsigned char *buf, size_t count)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	struct sc_file *file = NULL;
+	unsigned char *data = NULL;
+	size_t	base = 0, limit, len = 0, done, chunk, max_le;
+	int	r;
+
+	assert(p15card != NULL && in_path != NULL);
+
+	LOG_FUNC_CALLED(ctx);
+	sc_log(ctx, "path=%s, offset=%lu, count=%lu", sc_print_path(in_path),
+			(unsigned long)offset, (unsigned long)count);
+	if (buf == NULL && count)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
+
+	r = -1; /* file state: not in cache */
+	if (p15card->opts.use_file_cache)
+		r = sc_pkcs15_read_cached_file(p15card, in_path, &data, &len);
+	if (r == 0)
+		goto copy_out;
+
+	r = sc_lock(p15card->card);
+	LOG_TEST_RET(ctx, r, "sc_lock() failed");
+	r = sc_select_file(p15card->card, in_path, &file);
+	if (r)
+		goto out;
+
+	if (file->ef_structure == SC_FILE_EF_LINEAR_VARIABLE_TLV) {
+		/* Records are unwrapped on read: no random access */
+		sc_file_free(file);
+		sc_unlock(p15card->card);
+		r = sc_pkcs15_read_file(p15card, in_path, &data, &len);
+		LOG_TEST_RET(ctx, r, "Cannot read record based file");
+		goto copy_out;
+	}
+
+	limit = file->size;
+	if (in_path->count >= 0) {
+		base = in_path->index;
+		limit = in_path->count;
+		if (file->size && base + limit > file->size) {
+			r = SC_ERROR_INVALID_ASN1_OBJECT;
+			goto out;
+		}
+	}
+	if (limit) {
+		if (offset >= limit)
+			count = 0;
+		else if (count > limit - offset)
+			count = limit - offset;
+	}
+
+	/* One response at a time, to keep what was read before the end of
+	 * a file of unknown size */
+	max_le = p15card->card->max_recv_size > 0 ? p15card->card->max_recv_size : 256;
+	for (done = 0; done < count; done += r) {
+		chunk = MIN(count - done, max_le);
+		r = sc_read_binary(p15card->card, base + offset + done, buf + done, chunk, 0);
+		if (r < 0 && !limit && pkcs15_is_end_of_file(r))
+			break;
+		if (r < 0)
+			goto out;
+		if ((size_t)r < chunk) {
+			done += r;
+			break;
+		}
+	}
+	r = (int)done;
+out:
+	if (file)
+		sc_file_free(file);
+	sc_unlock(p15card->card);
+	LOG_FUNC_RETURN(ctx, r);
+
+copy_out:
+	if (offset >= len)
+		count = 0;
+	else if (count > len - offset)
+		count = len - offset;
+	if (count)
+		memcpy(buf, data + offset, count);
+	free(data);
+	LOG_FUNC_RETURN(ctx, (int)count);
+}
+
+
 int
 sc_pkcs15_compare_id(const struct sc_pkcs15_id *id1, const struct sc_pkcs15_id *id2)
 {
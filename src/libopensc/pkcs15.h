@@ -251,6 +251,12 @@ struct sc_pkcs15_pubkey {
 		struct sc_pkcs15_pubkey_ec ec;
 		struct sc_pkcs15_pubkey_gostr3410 gostr3410;
 	} u;
+
+	/* Owners besides the allocating one, see sc_pkcs15_share_pubkey().
+	 * Not atomic: the owners serialize sharing and freeing themselves.
+	 * A shared key must not be erased in place, sc_pkcs15_erase_pubkey()
+	 * leaves it as is. */
+	unsigned int extra_refs;
 };
 typedef struct sc_pkcs15_pubkey sc_pkcs15_pubkey_t;
 
@@ -282,6 +288,7 @@ struct sc_pkcs15_enveloped_data {
 
 struct sc_pkcs15_cert {
 	int version;
+	/* serial, issuer, subject and spki point into 'data' */
 	u8 *serial;
 	size_t serial_len;
 	u8 *issuer;
@@ -295,6 +302,9 @@ struct sc_pkcs15_cert {
 
 	/* DER encoded raw cert */
 	struct sc_pkcs15_der data;
+
+	u8 *spki;
+	size_t spki_len;
 };
 typedef struct sc_pkcs15_cert sc_pkcs15_cert_t;
 
@@ -577,6 +587,11 @@ struct sc_pkcs15_df {
 	unsigned int type;
 	int enumerated;
 
+	/* Last known on-card content of the DF, starting at offset 0.
+	 * Used by pkcs15init to write back only the changed bytes. */
+	unsigned char *image;
+	size_t image_len;
+
 	struct sc_pkcs15_df *next, *prev;
 };
 typedef struct sc_pkcs15_df sc_pkcs15_df_t;
@@ -741,12 +756,15 @@ int sc_pkcs15_pubkey_from_prvkey(struct sc_context *, struct sc_pkcs15_prkey *,
 		struct sc_pkcs15_pubkey **);
 int sc_pkcs15_dup_pubkey(struct sc_context *, struct sc_pkcs15_pubkey *,
 		struct sc_pkcs15_pubkey **);
+struct sc_pkcs15_pubkey *sc_pkcs15_share_pubkey(struct sc_pkcs15_pubkey *);
 int sc_pkcs15_pubkey_from_cert(struct sc_context *, struct sc_pkcs15_der *,
 		struct sc_pkcs15_pubkey **);
 int sc_pkcs15_pubkey_from_spki_file(struct sc_context *,
 		char *, struct sc_pkcs15_pubkey ** );
 int sc_pkcs15_pubkey_from_spki_fields(struct sc_context *,
 		struct sc_pkcs15_pubkey **, u8 *, size_t, int);
+int sc_pkcs15_pubkey_from_spki_sequence(struct sc_context *,
+		const u8 *, size_t, struct sc_pkcs15_pubkey **);
 int sc_pkcs15_encode_prkey(struct sc_context *,
 		struct sc_pkcs15_prkey *, u8 **, size_t *);
 void sc_pkcs15_free_prkey(struct sc_pkcs15_prkey *prkey);
@@ -923,6 +941,9 @@ void sc_pkcs15_free_object(struct sc_pkcs15_object *obj);
 int sc_pkcs15_read_file(struct sc_pkcs15_card *p15card,
 			const struct sc_path *path,
 			u8 **buf, size_t *buflen);
+int sc_pkcs15_read_file_part(struct sc_pkcs15_card *p15card,
+			const struct sc_path *path, size_t offset,
+			u8 *buf, size_t count);
 
 /* Caching functions */
 int sc_pkcs15_read_cached_file(struct sc_pkcs15_card *p15card,
@@ -276,40 +276,35 @@ openct_reader_internal_transmit(sc_reader_t *reader,
 
 static int openct_reader_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 {
-	size_t       ssize, rsize, rbuflen = 0;
+	size_t       ssize = 0, sbuflen, rsize, rbuflen;
 	u8           *sbuf = NULL, *rbuf = NULL;
 	int          r;
 
 	rsize = rbuflen = apdu->resplen + 2;
-	rbuf     = malloc(rbuflen);
-	if (rbuf == NULL) {
-		r = SC_ERROR_OUT_OF_MEMORY;
-		goto out;
-	}
-	/* encode and log the APDU */
-	r = sc_apdu_get_octets(reader->ctx, apdu, &sbuf, &ssize, SC_PROTO_RAW);
+	sbuflen = sc_apdu_get_length(apdu, SC_PROTO_RAW);
+	r = sc_reader_get_buffers(reader, sbuflen, rbuflen, &sbuf, &rbuf);
 	if (r != SC_SUCCESS)
+		return r;
+	/* encode and log the APDU */
+	r = sc_apdu_get_octets_buf(reader->ctx, apdu, sbuf, sbuflen, &ssize, SC_PROTO_RAW);
+	if (r != SC_SUCCESS) {
+		rsize = 0;
 		goto out;
+	}
 	sc_apdu_log(reader->ctx, SC_LOG_DEBUG_NORMAL, sbuf, ssize, 1);
 	r = openct_reader_internal_transmit(reader, sbuf, ssize,
 				rbuf, &rsize, apdu->control);
 	if (r < 0) {
 		/* unable to transmit ... most likely a reader problem */
 		sc_debug(reader->ctx, SC_LOG_DEBUG_NORMAL, "unable to transmit");
+		rsize = rbuflen;
 		goto out;
 	}
 	sc_apdu_log(reader->ctx, SC_LOG_DEBUG_NORMAL, rbuf, rsize, 0);
 	/* set response */
 	r = sc_apdu_set_resp(reader->ctx, apdu, rbuf, rsize);
 out:
-	if (sbuf != NULL) {
-		sc_mem_clear(sbuf, ssize);
-		free(sbuf);
-	}
-	if (rbuf != NULL) {
-		sc_mem_clear(rbuf, rbuflen);
-		free(rbuf);
-	}
+	sc_reader_put_buffers(reader, ssize, rsize);
 	
 	return r;
 }
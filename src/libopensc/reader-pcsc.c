@@ -31,6 +31,10 @@
 #include <winsock2.h>
 #else
 #include <arpa/inet.h>
+#include <sys/time.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
 #endif
 
 #include "common/libscdl.h"
@@ -74,6 +78,23 @@ struct pcsc_global_private_data {
 	SCardTransmit_t SCardTransmit;
 	SCardListReaders_t SCardListReaders;
 	SCardGetAttrib_t SCardGetAttrib;
+
+	/* Milliseconds a transaction is kept after the last unlock, 0 to disable */
+	unsigned int linger_time;
+	unsigned long transactions, transactions_saved;
+	/* Milliseconds a card presence check is answered from the last
+	 * reader state, 0 to disable */
+	unsigned int presence_cache_time;
+	unsigned long status_queries, status_queries_saved;
+#ifdef HAVE_PTHREAD
+	/* Protects the fields below and the linger fields of the readers */
+	pthread_mutex_t linger_lock;
+	pthread_cond_t linger_cond;
+	pthread_t linger_thread;
+	int linger_thread_running, linger_stop;
+	/* Readers holding a transaction nobody uses */
+	struct pcsc_private_data *lingering;
+#endif
 };
 
 struct pcsc_private_data {
@@ -94,10 +115,25 @@ struct pcsc_private_data {
 
 	DWORD get_tlv_properties;
 
+	/* Written by the linger thread without card->mutex, but only under
+	 * linger_lock while the reader is on the lingering list: the owner
+	 * takes it off with pcsc_linger_resume() or pcsc_linger_end(), which
+	 * take linger_lock too, before it reads or writes 'locked' again */
 	int locked;
+	/* Reader state fetched for all the readers at state_time (us) and
+	 * not yet applied to this one, see refresh_all_readers() */
+	SCARD_READERSTATE pending_state;
+	LONG pending_rv;
+	int state_pending;
+	unsigned long long state_time;
+	/* The transaction is kept after unlock until linger_deadline */
+	int lingering;
+	struct timeval linger_deadline;
+	struct pcsc_private_data *linger_next;
 };
 
 static int pcsc_detect_card_presence(sc_reader_t *reader);
+static int refresh_attributes(sc_reader_t *reader);
 
 static DWORD pcsc_reset_action(const char *str)
 {
@@ -210,9 +246,10 @@ static int pcsc_internal_transmit(sc_reader_t *reader,
 		case SCARD_W_REMOVED_CARD:
 			return SC_ERROR_CARD_REMOVED;
 		default:
-			/* Translate strange errors from card removal to a proper return code */
-			pcsc_detect_card_presence(reader);
-			if (!(pcsc_detect_card_presence(reader) & SC_READER_CARD_PRESENT))
+			/* Translate strange errors from card removal to a proper return code;
+			 * ask PC/SC directly, the cached presence state may predate the removal */
+			if (refresh_attributes(reader) == SC_SUCCESS
+					&& !(reader->flags & SC_READER_CARD_PRESENT))
 				return SC_ERROR_CARD_REMOVED;
 			return SC_ERROR_TRANSMIT_FAILED;
 		}
@@ -226,7 +263,7 @@ static int pcsc_internal_transmit(sc_reader_t *reader,
 
 static int pcsc_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 {
-	size_t       ssize, rsize, rbuflen = 0;
+	size_t       ssize = 0, sbuflen, rsize, rbuflen;
 	u8           *sbuf = NULL, *rbuf = NULL;
 	int          r;
 
@@ -236,15 +273,16 @@ static int pcsc_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 	 * The buffer for the returned data needs to be at least 2 bytes
 	 * larger than the expected data length to store SW1 and SW2. */
 	rsize = rbuflen = apdu->resplen <= 256 ? 258 : apdu->resplen + 2;
-	rbuf     = malloc(rbuflen);
-	if (rbuf == NULL) {
-		r = SC_ERROR_OUT_OF_MEMORY;
-		goto out;
-	}
-	/* encode and log the APDU */
-	r = sc_apdu_get_octets(reader->ctx, apdu, &sbuf, &ssize, reader->active_protocol);
+	sbuflen = sc_apdu_get_length(apdu, reader->active_protocol);
+	r = sc_reader_get_buffers(reader, sbuflen, rbuflen, &sbuf, &rbuf);
 	if (r != SC_SUCCESS)
+		return r;
+	/* encode and log the APDU */
+	r = sc_apdu_get_octets_buf(reader->ctx, apdu, sbuf, sbuflen, &ssize, reader->active_protocol);
+	if (r != SC_SUCCESS) {
+		rsize = 0;
 		goto out;
+	}
 	if (reader->name)
 		sc_debug(reader->ctx, SC_LOG_DEBUG_NORMAL, "reader '%s'", reader->name);
 	sc_apdu_log(reader->ctx, SC_LOG_DEBUG_NORMAL, sbuf, ssize, 1);
@@ -254,33 +292,22 @@ static int pcsc_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 	if (r < 0) {
 		/* unable to transmit ... most likely a reader problem */
 		sc_debug(reader->ctx, SC_LOG_DEBUG_NORMAL, "unable to transmit");
+		/* the reader may have written anything into the buffer */
+		rsize = rbuflen;
 		goto out;
 	}
 	sc_apdu_log(reader->ctx, SC_LOG_DEBUG_NORMAL, rbuf, rsize, 0);
 	/* set response */
 	r = sc_apdu_set_resp(reader->ctx, apdu, rbuf, rsize);
 out:
-	if (sbuf != NULL) {
-		sc_mem_clear(sbuf, ssize);
-		free(sbuf);
-	}
-	if (rbuf != NULL) {
-		sc_mem_clear(rbuf, rbuflen);
-		free(rbuf);
-	}
+	sc_reader_put_buffers(reader, ssize, rsize);
 
 	return r;
 }
 
-/* Calls SCardGetStatusChange on the reader to set ATR and associated flags (card present/changed) */
-static int refresh_attributes(sc_reader_t *reader)
+static void prepare_reader_state(sc_reader_t *reader)
 {
 	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
-	int old_flags = reader->flags;
-	DWORD state, prev_state;
-	LONG rv;
-
-	sc_debug(reader->ctx, SC_LOG_DEBUG_NORMAL, "%s check", reader->name);
 
 	if (priv->reader_state.szReader == NULL) {
 		priv->reader_state.szReader = reader->name;
@@ -289,8 +316,34 @@ static int refresh_attributes(sc_reader_t *reader)
 	} else {
 		priv->reader_state.dwCurrentState = priv->reader_state.dwEventState;
 	}
+}
+
+static int apply_reader_state(sc_reader_t *reader, LONG rv);
+
+/* Calls SCardGetStatusChange on the reader to set ATR and associated flags (card present/changed) */
+static int refresh_attributes(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+	LONG rv;
+
+	sc_debug(reader->ctx, SC_LOG_DEBUG_NORMAL, "%s check", reader->name);
 
+	prepare_reader_state(reader);
 	rv = priv->gpriv->SCardGetStatusChange(priv->gpriv->pcsc_ctx, 0, &priv->reader_state, 1);
+	priv->gpriv->status_queries++;
+	priv->state_time = sc_get_time_us();
+	priv->state_pending = 0;
+
+	return apply_reader_state(reader, rv);
+}
+
+/* Sets the ATR and the flags of the reader from priv->reader_state,
+ * filled by a SCardGetStatusChange call that returned 'rv' */
+static int apply_reader_state(sc_reader_t *reader, LONG rv)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+	int old_flags = reader->flags;
+	DWORD state, prev_state;
 
 	if (rv != SCARD_S_SUCCESS) {
 		if (rv == (LONG)SCARD_E_TIMEOUT) {
@@ -364,12 +417,109 @@ static int refresh_attributes(sc_reader_t *reader)
 	return SC_SUCCESS;
 }
 
+/* Queries the state of all the readers with a single SCardGetStatusChange
+ * call. Each reader applies its result on its next presence check.
+ * Called with ctx->mutex held: the reader list is walked directly */
+static int refresh_all_readers(sc_context_t *ctx, struct pcsc_global_private_data *gpriv)
+{
+	unsigned int i, count = list_size(&ctx->readers);
+	SCARD_READERSTATE *states;
+	unsigned long long now;
+	LONG rv;
+
+	if (count == 0)
+		return SC_ERROR_NO_READERS_FOUND;
+	states = calloc(count, sizeof(SCARD_READERSTATE));
+	if (states == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	for (i = 0; i < count; i++) {
+		sc_reader_t *reader = list_get_at(&ctx->readers, i);
+		struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+
+		states[i].szReader = reader->name;
+		/* compared with the state last applied, so that a result
+		 * not applied yet is returned again */
+		if (priv->reader_state.szReader != NULL)
+			states[i].dwCurrentState = priv->reader_state.dwEventState;
+		else
+			states[i].dwCurrentState = SCARD_STATE_UNAWARE;
+	}
+
+	rv = gpriv->SCardGetStatusChange(gpriv->pcsc_ctx, 0, states, count);
+	gpriv->status_queries++;
+	if (rv != SCARD_S_SUCCESS && rv != (LONG)SCARD_E_TIMEOUT) {
+		/* e.g. a reader is gone: the readers are checked one by one */
+		free(states);
+		return pcsc_to_opensc_error(rv);
+	}
+
+	now = sc_get_time_us();
+	for (i = 0; i < count; i++) {
+		struct pcsc_private_data *priv = GET_PRIV_DATA((sc_reader_t *) list_get_at(&ctx->readers, i));
+
+		priv->pending_state = states[i];
+		priv->pending_rv = rv;
+		priv->state_pending = 1;
+		priv->state_time = now;
+	}
+	free(states);
+	return SC_SUCCESS;
+}
+
+static int apply_pending_state(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+
+	prepare_reader_state(reader);
+	if (priv->pending_rv == SCARD_S_SUCCESS) {
+		priv->reader_state.dwEventState = priv->pending_state.dwEventState;
+		priv->reader_state.cbAtr = priv->pending_state.cbAtr;
+		memcpy(priv->reader_state.rgbAtr, priv->pending_state.rgbAtr,
+			sizeof(priv->reader_state.rgbAtr));
+	}
+	priv->state_pending = 0;
+
+	return apply_reader_state(reader, priv->pending_rv);
+}
+
+/* With 'presence_cache_time' set, browsers and the like polling the slots
+ * are answered from memory; the state of all the readers is queried at
+ * most once per period, with one call to pcscd */
+static int pcsc_detect_card_presence_cached(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+	struct pcsc_global_private_data *gpriv = priv->gpriv;
+	int rv = SC_SUCCESS;
+
+	sc_mutex_lock(reader->ctx, reader->ctx->mutex);
+	if (sc_get_time_us() - priv->state_time >= gpriv->presence_cache_time * 1000ULL) {
+		rv = refresh_all_readers(reader->ctx, gpriv);
+	}
+	else if (!priv->state_pending) {
+		/* a change has been reported already */
+		reader->flags &= ~SC_READER_CARD_CHANGED;
+		gpriv->status_queries_saved++;
+	}
+
+	if (rv != SC_SUCCESS)
+		rv = refresh_attributes(reader);
+	else if (priv->state_pending)
+		rv = apply_pending_state(reader);
+	sc_mutex_unlock(reader->ctx, reader->ctx->mutex);
+
+	return rv;
+}
+
 static int pcsc_detect_card_presence(sc_reader_t *reader)
 {
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
 	int rv;
 	SC_FUNC_CALLED(reader->ctx, SC_LOG_DEBUG_NORMAL);
 
-	rv = refresh_attributes(reader);
+	if (priv->gpriv->presence_cache_time)
+		rv = pcsc_detect_card_presence_cached(reader);
+	else
+		rv = refresh_attributes(reader);
 	if (rv != SC_SUCCESS)
 		SC_FUNC_RETURN(reader->ctx, SC_LOG_DEBUG_VERBOSE, rv);
 	SC_FUNC_RETURN(reader->ctx, SC_LOG_DEBUG_VERBOSE, reader->flags);
@@ -402,6 +552,166 @@ static int check_forced_protocol(sc_context_t *ctx, struct sc_atr *atr, DWORD *p
 }
 
 
+#ifdef HAVE_PTHREAD
+/* Removes the reader from the list of lingering transactions, linger_lock held */
+static void pcsc_linger_unlink(struct pcsc_private_data *priv)
+{
+	struct pcsc_private_data **pp;
+
+	for (pp = &priv->gpriv->lingering; *pp; pp = &(*pp)->linger_next) {
+		if (*pp == priv) {
+			*pp = priv->linger_next;
+			break;
+		}
+	}
+	priv->linger_next = NULL;
+	priv->lingering = 0;
+}
+
+/* Ends the transactions whose grace period is over */
+static void *pcsc_linger_thread(void *arg)
+{
+	struct pcsc_global_private_data *gpriv = arg;
+
+	pthread_mutex_lock(&gpriv->linger_lock);
+	while (!gpriv->linger_stop) {
+		struct pcsc_private_data **pp = &gpriv->lingering;
+		struct timeval now, next;
+		struct timespec wake;
+		int have_next = 0;
+
+		gettimeofday(&now, NULL);
+		while (*pp) {
+			struct pcsc_private_data *priv = *pp;
+
+			if (!timercmp(&priv->linger_deadline, &now, >)) {
+				gpriv->SCardEndTransaction(priv->pcsc_card, gpriv->transaction_end_action);
+				priv->locked = 0;
+				priv->lingering = 0;
+				*pp = priv->linger_next;
+				priv->linger_next = NULL;
+				continue;
+			}
+			if (!have_next || timercmp(&priv->linger_deadline, &next, <))
+				next = priv->linger_deadline;
+			have_next = 1;
+			pp = &priv->linger_next;
+		}
+
+		if (have_next) {
+			wake.tv_sec = next.tv_sec;
+			wake.tv_nsec = next.tv_usec * 1000;
+			pthread_cond_timedwait(&gpriv->linger_cond, &gpriv->linger_lock, &wake);
+		} else {
+			pthread_cond_wait(&gpriv->linger_cond, &gpriv->linger_lock);
+		}
+	}
+	pthread_mutex_unlock(&gpriv->linger_lock);
+	return NULL;
+}
+
+/* Keeps the transaction of the reader after its last unlock. Returns 0 if
+ * the transaction is lingering, an error if it has to be ended now */
+static int pcsc_linger_start(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+	struct pcsc_global_private_data *gpriv = priv->gpriv;
+	struct timeval now, grace;
+
+	pthread_mutex_lock(&gpriv->linger_lock);
+	if (!gpriv->linger_thread_running) {
+		if (pthread_create(&gpriv->linger_thread, NULL, pcsc_linger_thread, gpriv)) {
+			pthread_mutex_unlock(&gpriv->linger_lock);
+			sc_log(reader->ctx, "cannot start the transaction linger thread, linger disabled");
+			gpriv->linger_time = 0;
+			return SC_ERROR_INTERNAL;
+		}
+		gpriv->linger_thread_running = 1;
+	}
+
+	gettimeofday(&now, NULL);
+	grace.tv_sec = gpriv->linger_time / 1000;
+	grace.tv_usec = (gpriv->linger_time % 1000) * 1000;
+	timeradd(&now, &grace, &priv->linger_deadline);
+	if (!priv->lingering) {
+		priv->linger_next = gpriv->lingering;
+		gpriv->lingering = priv;
+		priv->lingering = 1;
+	}
+	pthread_cond_signal(&gpriv->linger_cond);
+	pthread_mutex_unlock(&gpriv->linger_lock);
+	return SC_SUCCESS;
+}
+
+/* Takes over a lingering transaction. Returns 1 if there was one */
+static int pcsc_linger_resume(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+	struct pcsc_global_private_data *gpriv = priv->gpriv;
+	int resumed = 0;
+
+	pthread_mutex_lock(&gpriv->linger_lock);
+	if (priv->lingering) {
+		pcsc_linger_unlink(priv);
+		gpriv->transactions_saved++;
+		resumed = 1;
+	}
+	pthread_mutex_unlock(&gpriv->linger_lock);
+	return resumed;
+}
+
+/* Ends a lingering transaction of the reader right away */
+static void pcsc_linger_end(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
+	struct pcsc_global_private_data *gpriv = priv->gpriv;
+
+	if (gpriv->linger_time == 0 && !priv->lingering)
+		return;
+	pthread_mutex_lock(&gpriv->linger_lock);
+	if (priv->lingering) {
+		pcsc_linger_unlink(priv);
+		gpriv->SCardEndTransaction(priv->pcsc_card, gpriv->transaction_end_action);
+		priv->locked = 0;
+	}
+	pthread_mutex_unlock(&gpriv->linger_lock);
+}
+
+/* Ends all lingering transactions, e.g. when the application goes idle */
+static void pcsc_linger_end_all(struct pcsc_global_private_data *gpriv)
+{
+	if (gpriv->linger_time == 0)
+		return;
+	pthread_mutex_lock(&gpriv->linger_lock);
+	while (gpriv->lingering) {
+		struct pcsc_private_data *priv = gpriv->lingering;
+
+		pcsc_linger_unlink(priv);
+		gpriv->SCardEndTransaction(priv->pcsc_card, gpriv->transaction_end_action);
+		priv->locked = 0;
+	}
+	pthread_mutex_unlock(&gpriv->linger_lock);
+}
+#else
+static int pcsc_linger_start(sc_reader_t *reader)
+{
+	return SC_ERROR_NOT_SUPPORTED;
+}
+
+static int pcsc_linger_resume(sc_reader_t *reader)
+{
+	return 0;
+}
+
+static void pcsc_linger_end(sc_reader_t *reader)
+{
+}
+
+static void pcsc_linger_end_all(struct pcsc_global_private_data *gpriv)
+{
+}
+#endif
+
 static int pcsc_reconnect(sc_reader_t * reader, DWORD action)
 {
 	DWORD active_proto = opensc_proto_to_pcsc(reader->active_protocol),
@@ -424,6 +734,7 @@ static int pcsc_reconnect(sc_reader_t * reader, DWORD action)
 		protocol = tmp;
 
 	/* reconnect always unlocks transaction */
+	pcsc_linger_end(reader);
 	priv->locked = 0;
 
 	rv = priv->gpriv->SCardReconnect(priv->pcsc_card,
@@ -503,8 +814,11 @@ static int pcsc_disconnect(sc_reader_t * reader)
 
 	SC_FUNC_CALLED(reader->ctx, SC_LOG_DEBUG_NORMAL);
 
+	pcsc_linger_end(reader);
 	priv->gpriv->SCardDisconnect(priv->pcsc_card, priv->gpriv->disconnect_action);
 	reader->flags = 0;
+	/* the flags are gone: the next presence check asks pcscd */
+	priv->state_time = 0;
 	return SC_SUCCESS;
 }
 
@@ -516,6 +830,11 @@ static int pcsc_lock(sc_reader_t *reader)
 
 	SC_FUNC_CALLED(reader->ctx, SC_LOG_DEBUG_NORMAL);
 
+	/* The transaction was kept since the last unlock, nobody else
+	 * could have used or reset the card in between */
+	if (pcsc_linger_resume(reader))
+		return SC_SUCCESS;
+
 	rv = priv->gpriv->SCardBeginTransaction(priv->pcsc_card);
 
 	switch (rv) {
@@ -539,6 +858,7 @@ static int pcsc_lock(sc_reader_t *reader)
 			return SC_ERROR_CARD_RESET;
 		case SCARD_S_SUCCESS:
 			priv->locked = 1;
+			priv->gpriv->transactions++;
 			return SC_SUCCESS;
 		default:
 			PCSC_TRACE(reader, "SCardBeginTransaction failed", rv);
@@ -553,6 +873,10 @@ static int pcsc_unlock(sc_reader_t *reader)
 
 	SC_FUNC_CALLED(reader->ctx, SC_LOG_DEBUG_NORMAL);
 
+	if (priv->gpriv->linger_time && priv->locked
+			&& pcsc_linger_start(reader) == SC_SUCCESS)
+		return SC_SUCCESS;
+
 	rv = priv->gpriv->SCardEndTransaction(priv->pcsc_card, priv->gpriv->transaction_end_action);
 
 	priv->locked = 0;
@@ -567,6 +891,7 @@ static int pcsc_release(sc_reader_t *reader)
 {
 	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
 
+	pcsc_linger_end(reader);
 	free(priv);
 	return SC_SUCCESS;
 }
@@ -575,7 +900,11 @@ static int pcsc_reset(sc_reader_t *reader, int do_cold_reset)
 {
 	struct pcsc_private_data *priv = GET_PRIV_DATA(reader);
 	int r;
-	int old_locked = priv->locked;
+	int old_locked;
+
+	/* a lingering transaction is not held by anybody */
+	pcsc_linger_end(reader);
+	old_locked = priv->locked;
 
 	r = pcsc_reconnect(reader, do_cold_reset ? SCARD_UNPOWER_CARD : SCARD_RESET_CARD);
 	if(r != SC_SUCCESS)
@@ -598,9 +927,11 @@ static int pcsc_cancel(sc_context_t *ctx)
 #ifndef _WIN32
 	if (gpriv->pcsc_wait_ctx != -1) {
 		rv = gpriv->SCardCancel(gpriv->pcsc_wait_ctx);
-		if (rv == SCARD_S_SUCCESS)
-			 /* Also close and clear the waiting context */
-			 rv = gpriv->SCardReleaseContext(gpriv->pcsc_wait_ctx);
+		if (rv == SCARD_S_SUCCESS) {
+			/* Also close and clear the waiting context */
+			rv = gpriv->SCardReleaseContext(gpriv->pcsc_wait_ctx);
+			gpriv->pcsc_wait_ctx = -1;
+		}
 	}
 #else
 	rv = gpriv->SCardCancel(gpriv->pcsc_ctx);
@@ -661,9 +992,16 @@ static int pcsc_init(sc_context_t *ctx)
 		    scconf_get_bool(conf_block, "enable_pace", gpriv->enable_pace);
 		gpriv->provider_library =
 		    scconf_get_str(conf_block, "provider_library", gpriv->provider_library);
+		gpriv->linger_time =
+		    scconf_get_int(conf_block, "transaction_linger_time", gpriv->linger_time);
+		gpriv->presence_cache_time =
+		    scconf_get_int(conf_block, "presence_cache_time", gpriv->presence_cache_time);
 	}
-	sc_log(ctx, "PC/SC options: connect_exclusive=%d disconnect_action=%d transaction_end_action=%d reconnect_action=%d enable_pinpad=%d enable_pace=%d",
-		gpriv->connect_exclusive, gpriv->disconnect_action, gpriv->transaction_end_action, gpriv->reconnect_action, gpriv->enable_pinpad, gpriv->enable_pace);
+#ifndef HAVE_PTHREAD
+	gpriv->linger_time = 0;
+#endif
+	sc_log(ctx, "PC/SC options: connect_exclusive=%d disconnect_action=%d transaction_end_action=%d reconnect_action=%d enable_pinpad=%d enable_pace=%d transaction_linger_time=%u presence_cache_time=%u",
+		gpriv->connect_exclusive, gpriv->disconnect_action, gpriv->transaction_end_action, gpriv->reconnect_action, gpriv->enable_pinpad, gpriv->enable_pace, gpriv->linger_time, gpriv->presence_cache_time);
 
 	gpriv->dlhandle = sc_dlopen(gpriv->provider_library);
 	if (gpriv->dlhandle == NULL) {
@@ -724,6 +1062,11 @@ static int pcsc_init(sc_context_t *ctx)
 		goto out;
 	}
 
+#ifdef HAVE_PTHREAD
+	/* destroyed by pcsc_finish() */
+	pthread_mutex_init(&gpriv->linger_lock, NULL);
+	pthread_cond_init(&gpriv->linger_cond, NULL);
+#endif
 	ctx->reader_drv_data = gpriv;
 	gpriv = NULL;
 	ret = SC_SUCCESS;
@@ -745,6 +1088,24 @@ static int pcsc_finish(sc_context_t *ctx)
 	SC_FUNC_CALLED(ctx, SC_LOG_DEBUG_NORMAL);
 
 	if (gpriv) {
+		pcsc_linger_end_all(gpriv);
+#ifdef HAVE_PTHREAD
+		if (gpriv->linger_thread_running) {
+			pthread_mutex_lock(&gpriv->linger_lock);
+			gpriv->linger_stop = 1;
+			pthread_cond_signal(&gpriv->linger_cond);
+			pthread_mutex_unlock(&gpriv->linger_lock);
+			pthread_join(gpriv->linger_thread, NULL);
+		}
+		pthread_cond_destroy(&gpriv->linger_cond);
+		pthread_mutex_destroy(&gpriv->linger_lock);
+#endif
+		if (gpriv->linger_time)
+			sc_log(ctx, "PC/SC transactions: %lu begun, %lu saved by lingering",
+				gpriv->transactions, gpriv->transactions_saved);
+		if (gpriv->presence_cache_time)
+			sc_log(ctx, "PC/SC reader state queries: %lu sent, %lu answered from the cache",
+				gpriv->status_queries, gpriv->status_queries_saved);
 		if (gpriv->pcsc_ctx != -1)
 			gpriv->SCardReleaseContext(gpriv->pcsc_ctx);
 		if (gpriv->dlhandle != NULL)
@@ -1007,8 +1368,9 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 		unsigned int i;
 		int found = 0;
 
-		for (i=0;i < sc_ctx_get_reader_count(ctx) && !found;i++) {
-			sc_reader_t *reader2 = sc_ctx_get_reader(ctx, i);
+		/* called with ctx->mutex held: the list is walked directly */
+		for (i=0;i < list_size(&ctx->readers) && !found;i++) {
+			sc_reader_t *reader2 = list_get_at(&ctx->readers, i);
 			if (reader2 == NULL) {
 				ret = SC_ERROR_INTERNAL;
 				goto err1;
@@ -1117,6 +1479,9 @@ static int pcsc_wait_for_event(sc_context_t *ctx, unsigned int event_mask, sc_re
 
 	SC_FUNC_CALLED(ctx, SC_LOG_DEBUG_NORMAL);
 
+	/* the application waits for events, so it is not going to use the cards */
+	pcsc_linger_end_all(gpriv);
+
 	if (!event_reader && !event && reader_states)   {
 		sc_log(ctx, "free allocated reader states");
 		free(*reader_states);
@@ -28,6 +28,10 @@
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
+#ifndef _WIN32
+#include <sys/time.h>
+#include <time.h>
+#endif
 #ifdef ENABLE_OPENSSL
 #include <openssl/crypto.h>     /* for OPENSSL_cleanse */
 #endif
@@ -40,6 +44,37 @@ static const char *sc_version = PACKAGE_VERSION;
 static const char *sc_version = "(undef)";
 #endif
 
+unsigned long long
+sc_get_time_us(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, cnt;
+
+	if (!QueryPerformanceFrequency(&freq) || !QueryPerformanceCounter(&cnt) || !freq.QuadPart)
+		return (unsigned long long)GetTickCount() * 1000;
+	return (unsigned long long)(cnt.QuadPart / freq.QuadPart) * 1000000
+		+ (unsigned long long)(cnt.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+unsigned long long
+sc_get_monotonic_time_us(void)
+{
+#if !defined(_WIN32) && defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	/* QueryPerformanceCounter() is monotonic already */
+	return sc_get_time_us();
+}
+
 const char *sc_get_version(void)
 {
     return sc_version;
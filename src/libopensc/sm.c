@@ -139,6 +139,7 @@ sc_sm_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 		/* SM wrap of this APDU is ignored by card driver.
 		 * Send plain APDU to the reader driver */
 		rv = card->reader->ops->transmit(card->reader, apdu);
+		sc_apdu_stats_round_trip(card, apdu, NULL, rv);
 		LOG_FUNC_RETURN(ctx, rv);
 	}
 	LOG_TEST_RET(ctx, rv, "get SM APDU error");
@@ -152,6 +153,7 @@ sc_sm_single_transmit(struct sc_card *card, struct sc_apdu *apdu)
 
 	/* send APDU to the reader driver */
 	rv = card->reader->ops->transmit(card->reader, sm_apdu);
+	sc_apdu_stats_round_trip(card, apdu, sm_apdu, rv);
 	LOG_TEST_RET(ctx, rv, "unable to transmit APDU");
 
 	/* decode SM answer and free temporary SM related data */
@@ -298,6 +298,19 @@ typedef struct sc_apdu {
 	struct sc_apdu *next;
 } sc_apdu_t;
 
+/* Entry of the APDU list submitted with sc_transmit_apdus() */
+#define SC_APDU_LIST_FLAG_NOT_FATAL	0x01	/* continue with the next entry if this one fails */
+#define SC_APDU_LIST_FLAG_NO_SW_CHECK	0x02	/* status words are not checked */
+struct sc_apdu_list_entry {
+	struct sc_apdu *apdu;
+	/* expected status: success if (SW1SW2 & sw_mask) == (sw & sw_mask);
+	 * when sw_mask is zero the status words are checked with sc_check_sw() */
+	unsigned int sw, sw_mask;
+	unsigned long flags;
+
+	int rv;				/* out: result of this entry */
+};
+
 /* Card manager Production Life Cycle data (CPLC) 
  * (from the Open Platform specification) */
 #define SC_CPLC_TAG		0x9F7F
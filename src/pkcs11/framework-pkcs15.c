@@ -54,10 +54,17 @@ struct pkcs15_slot_data {
 	attr->ulValueLen = size;
 
 #define MAX_OBJECTS	64
+#define INDEX_SIZE	64	/* power of two */
 struct pkcs15_fw_data {
 	struct sc_pkcs15_card *		p15_card;
 	struct pkcs15_any_object *	objects[MAX_OBJECTS];
 	unsigned int			num_objects;
+	/* Hash indexes over the objects: by ID, and certificates by
+	 * subject and by issuer DN. Rebuilt when 'objects' changes. */
+	struct pkcs15_any_object *	id_index[INDEX_SIZE];
+	struct pkcs15_cert_object *	subject_index[INDEX_SIZE];
+	struct pkcs15_cert_object *	issuer_index[INDEX_SIZE];
+	unsigned int			index_valid;
 	unsigned int			locked;
 	unsigned char user_puk[64];
 	unsigned int user_puk_len;
@@ -71,6 +78,7 @@ struct pkcs15_any_object {
 	struct pkcs15_pubkey_object *	related_pubkey;
 	struct pkcs15_cert_object *	related_cert;
 	struct pkcs15_prkey_object *	related_privkey;
+	struct pkcs15_any_object *	id_next;
 };
 
 struct pkcs15_cert_object {
@@ -78,6 +86,8 @@ struct pkcs15_cert_object {
 
 	struct sc_pkcs15_cert_info *	cert_info;
 	struct sc_pkcs15_cert *		cert_data;
+	struct pkcs15_cert_object *	subject_next;
+	struct pkcs15_cert_object *	issuer_next;
 };
 #define cert_flags		base.base.flags
 #define cert_p15obj		base.p15_object
@@ -414,6 +424,7 @@ __pkcs15_create_object(struct pkcs15_fw_data *fw_data,
 		return SC_ERROR_OUT_OF_MEMORY;
 
 	fw_data->objects[fw_data->num_objects++] = obj;
+	fw_data->index_valid = 0;
 
 	obj->base.ops = ops;
 	obj->p15_object = p15_object;
@@ -448,6 +459,7 @@ __pkcs15_delete_object(struct pkcs15_fw_data *fw_data, struct pkcs15_any_object
 	for (i = 0; i < fw_data->num_objects; ++i)   {
 		if (fw_data->objects[i] == obj) {
 			fw_data->objects[i] = fw_data->objects[--fw_data->num_objects];
+			fw_data->index_valid = 0;
 			if (__pkcs15_release_object(obj) > 0)
 				return SC_ERROR_INTERNAL;
 			return SC_SUCCESS;
@@ -591,7 +603,7 @@ __pkcs15_create_cert_object(struct pkcs15_fw_data *fw_data, struct sc_pkcs15_obj
 	if (p15_cert) {
 		 /* make a copy of public key from the cert */
 		if (!obj2->pub_data)
-			rv = sc_pkcs15_pubkey_from_cert(context, &p15_cert->data, &obj2->pub_data);
+			rv = sc_pkcs15_pubkey_from_spki_sequence(context, p15_cert->spki, p15_cert->spki_len, &obj2->pub_data);
 		if (rv < 0)
 			return rv;
 	}
@@ -734,17 +746,98 @@ pkcs15_create_pkcs11_objects(struct pkcs15_fw_data *fw_data, int p15_type, const
 }
 
 
+static unsigned int
+__pkcs15_index_hash(const unsigned char *data, size_t len)
+{
+	unsigned int h = 2166136261U;		/* FNV-1a */
+
+	while (len--)
+		h = (h ^ *data++) * 16777619U;
+	return h & (INDEX_SIZE - 1);
+}
+
+
+static struct sc_pkcs15_id *
+__pkcs15_object_id(struct pkcs15_any_object *obj)
+{
+	if (is_privkey(obj))
+		return &((struct pkcs15_prkey_object *) obj)->prv_info->id;
+	if (is_pubkey(obj) && ((struct pkcs15_pubkey_object *) obj)->pub_info)
+		return &((struct pkcs15_pubkey_object *) obj)->pub_info->id;
+	if (is_cert(obj))
+		return &((struct pkcs15_cert_object *) obj)->cert_info->id;
+	return NULL;
+}
+
+
+/* Add the subject and issuer of a certificate that has been read */
 static void
-__pkcs15_prkey_bind_related(struct pkcs15_fw_data *fw_data, struct pkcs15_prkey_object *pk)
+__pkcs15_index_add_cert(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *cert)
+{
+	struct sc_pkcs15_cert *c = cert->cert_data;
+	unsigned int h;
+
+	if (!c)
+		return;
+	if (c->subject_len) {
+		h = __pkcs15_index_hash(c->subject, c->subject_len);
+		cert->subject_next = fw_data->subject_index[h];
+		fw_data->subject_index[h] = cert;
+	}
+	if (c->issuer_len) {
+		h = __pkcs15_index_hash(c->issuer, c->issuer_len);
+		cert->issuer_next = fw_data->issuer_index[h];
+		fw_data->issuer_index[h] = cert;
+	}
+}
+
+
+static void
+__pkcs15_index_build(struct pkcs15_fw_data *fw_data)
 {
-	struct sc_pkcs15_id *id = &pk->prv_info->id;
 	unsigned int i;
 
-	sc_log(context, "Object is a private key and has id %s", sc_pkcs15_print_id(id));
+	if (fw_data->index_valid)
+		return;
 
-	for (i = 0; i < fw_data->num_objects; i++) {
+	memset(fw_data->id_index, 0, sizeof(fw_data->id_index));
+	memset(fw_data->subject_index, 0, sizeof(fw_data->subject_index));
+	memset(fw_data->issuer_index, 0, sizeof(fw_data->issuer_index));
+
+	/* Backwards, so that the chains keep the order of 'objects' */
+	for (i = fw_data->num_objects; i-- > 0; ) {
 		struct pkcs15_any_object *obj = fw_data->objects[i];
+		struct sc_pkcs15_id *id = __pkcs15_object_id(obj);
+
+		obj->id_next = NULL;
+		if (id) {
+			unsigned int h = __pkcs15_index_hash(id->value, id->len);
+
+			obj->id_next = fw_data->id_index[h];
+			fw_data->id_index[h] = obj;
+		}
+		if (is_cert(obj)) {
+			struct pkcs15_cert_object *cert = (struct pkcs15_cert_object *) obj;
+
+			cert->subject_next = cert->issuer_next = NULL;
+			__pkcs15_index_add_cert(fw_data, cert);
+		}
+	}
+
+	fw_data->index_valid = 1;
+}
 
+
+static void
+__pkcs15_prkey_bind_related(struct pkcs15_fw_data *fw_data, struct pkcs15_prkey_object *pk)
+{
+	struct sc_pkcs15_id *id = &pk->prv_info->id;
+	struct pkcs15_any_object *obj;
+
+	sc_log(context, "Object is a private key and has id %s", sc_pkcs15_print_id(id));
+
+	/* Only the objects with the same ID hash are looked at */
+	for (obj = fw_data->id_index[__pkcs15_index_hash(id->value, id->len)]; obj; obj = obj->id_next) {
 		if (obj->base.flags & SC_PKCS11_OBJECT_HIDDEN)
 			continue;
 		if (is_privkey(obj) && obj != (struct pkcs15_any_object *) pk) {
@@ -765,9 +858,12 @@ __pkcs15_prkey_bind_related(struct pkcs15_fw_data *fw_data, struct pkcs15_prkey_
 
 			pubkey = (struct pkcs15_pubkey_object *) obj;
 			if (sc_pkcs15_compare_id(&pubkey->pub_info->id, id)) {
-				sc_log(context, "Associating object %d as public key", i);
+				sc_log(context, "Associating object %p as public key", obj);
 				pk->prv_pubkey = pubkey;
-				sc_pkcs15_dup_pubkey(context, pubkey->pub_data, &pk->pub_data);
+				if (pubkey->pub_data) {
+					sc_pkcs15_free_pubkey(pk->pub_data);
+					pk->pub_data = sc_pkcs15_share_pubkey(pubkey->pub_data);
+				}
 				if (pk->prv_info->modulus_length == 0)
 					pk->prv_info->modulus_length = pubkey->pub_info->modulus_length;
 			}
@@ -781,49 +877,81 @@ __pkcs15_cert_bind_related(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_ob
 {
 	struct sc_pkcs15_cert *c1 = cert->cert_data;
 	struct sc_pkcs15_id *id = &cert->cert_info->id;
-	unsigned int i;
+	struct pkcs15_cert_object *cert2;
+	struct pkcs15_any_object *obj;
 
 	sc_log(context, "Object is a certificate and has id %s", sc_pkcs15_print_id(id));
 
-	/* Loop over all objects to see if we find the certificate of
-	 * the issuer and the associated private key */
-	for (i = 0; i < fw_data->num_objects; i++) {
-		struct pkcs15_any_object *obj = fw_data->objects[i];
-
-		if (is_cert(obj) && obj != (struct pkcs15_any_object *) cert) {
-			struct pkcs15_cert_object *cert2;
-			struct sc_pkcs15_cert *c2;
-
-			cert2 = (struct pkcs15_cert_object *) obj;
-			c2 = cert2->cert_data;
+	/* Look up the certificate of the issuer ... */
+	if (c1 && c1->issuer_len) {
+		cert2 = fw_data->subject_index[__pkcs15_index_hash(c1->issuer, c1->issuer_len)];
+		for (; cert2; cert2 = cert2->subject_next) {
+			struct sc_pkcs15_cert *c2 = cert2->cert_data;
 
-			if (!c1 || !c2 || !c1->issuer_len || !c2->subject_len)
+			if (cert2 == cert || c1->issuer_len != c2->subject_len
+					|| memcmp(c1->issuer, c2->subject, c1->issuer_len))
 				continue;
-			if (c1->issuer_len == c2->subject_len
-			 && !memcmp(c1->issuer, c2->subject, c1->issuer_len)) {
-				sc_log(context, "Associating object %d (id %s) as issuer",
-				         i, sc_pkcs15_print_id(&cert2->cert_info->id));
-				cert->cert_issuer = (struct pkcs15_cert_object *) obj;
-				return;
-			}
-		} else
-		if (is_privkey(obj) && !cert->cert_prvkey) {
-			struct pkcs15_prkey_object *pk;
-
-			pk = (struct pkcs15_prkey_object *) obj;
-			if (sc_pkcs15_compare_id(&pk->prv_info->id, id)) {
-				sc_log(context, "Associating object %d as private key", i);
-				cert->cert_prvkey = pk;
-			}
+			sc_log(context, "Associating object (id %s) as issuer",
+					sc_pkcs15_print_id(&cert2->cert_info->id));
+			cert->cert_issuer = cert2;
+			break;
+		}
+	}
+
+	/* ... and the associated private key */
+	if (cert->cert_prvkey)
+		return;
+	for (obj = fw_data->id_index[__pkcs15_index_hash(id->value, id->len)]; obj; obj = obj->id_next) {
+		if (is_privkey(obj) && sc_pkcs15_compare_id(&((struct pkcs15_prkey_object *) obj)->prv_info->id, id)) {
+			sc_log(context, "Associating object %p as private key", obj);
+			cert->cert_prvkey = (struct pkcs15_prkey_object *) obj;
+			break;
 		}
 	}
 }
 
+
+/* Index a certificate read after the objects were bound, and bind it
+ * and the certificates it has issued */
+static void
+__pkcs15_cert_bind_read(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *cert)
+{
+	struct sc_pkcs15_cert *c1 = cert->cert_data;
+	struct pkcs15_cert_object *cert2;
+
+	if (!fw_data->index_valid)
+		__pkcs15_index_build(fw_data);
+	else
+		__pkcs15_index_add_cert(fw_data, cert);
+
+	if (cert->base.base.flags & SC_PKCS11_OBJECT_HIDDEN)
+		return;
+	__pkcs15_cert_bind_related(fw_data, cert);
+
+	if (!c1 || !c1->subject_len)
+		return;
+	cert2 = fw_data->issuer_index[__pkcs15_index_hash(c1->subject, c1->subject_len)];
+	for (; cert2; cert2 = cert2->issuer_next) {
+		struct sc_pkcs15_cert *c2 = cert2->cert_data;
+
+		if (cert2 == cert || cert2->cert_issuer
+				|| (cert2->base.base.flags & SC_PKCS11_OBJECT_HIDDEN)
+				|| c2->issuer_len != c1->subject_len
+				|| memcmp(c2->issuer, c1->subject, c1->subject_len))
+			continue;
+		sc_log(context, "Associating object (id %s) as issuer",
+				sc_pkcs15_print_id(&cert->cert_info->id));
+		cert2->cert_issuer = cert;
+	}
+}
+
 static void
 pkcs15_bind_related_objects(struct pkcs15_fw_data *fw_data)
 {
 	unsigned int i;
 
+	__pkcs15_index_build(fw_data);
+
 	/* Loop over all private keys and attached related certificate
 	 * and/or public key
 	 */
@@ -862,10 +990,11 @@ check_cert_data_read(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *
 	obj2 = cert->cert_pubkey;
 	/* make a copy of public key from the cert data */
 	if (!obj2->pub_data)
-		rv = sc_pkcs15_pubkey_from_cert(context, &cert->cert_data->data, &obj2->pub_data);
+		rv = sc_pkcs15_pubkey_from_spki_sequence(context, cert->cert_data->spki, cert->cert_data->spki_len,
+				&obj2->pub_data);
 
 	/* now that we have the cert and pub key, lets see if we can bind anything else */
-	pkcs15_bind_related_objects(fw_data);
+	__pkcs15_cert_bind_read(fw_data, cert);
 
 	return 0;
 }
@@ -875,8 +1004,9 @@ static void
 pkcs15_add_object(struct sc_pkcs11_slot *slot, struct pkcs15_any_object *obj,
 		  CK_OBJECT_HANDLE_PTR pHandle)
 {
-	unsigned int i;
 	struct pkcs15_fw_data *card_fw_data;
+	struct pkcs15_any_object *obj2;
+	struct sc_pkcs15_id *id;
 
 	if (obj == NULL || slot == NULL)
 		return;
@@ -907,8 +1037,10 @@ pkcs15_add_object(struct sc_pkcs11_slot *slot, struct pkcs15_any_object *obj,
 	case SC_PKCS15_TYPE_PRKEY_EC:
 		pkcs15_add_object(slot, (struct pkcs15_any_object *) obj->related_pubkey, NULL);
 		card_fw_data = (struct pkcs15_fw_data *) slot->card->fws_data[slot->fw_data_idx];
-		for (i = 0; i < card_fw_data->num_objects; i++) {
-			struct pkcs15_any_object *obj2 = card_fw_data->objects[i];
+		__pkcs15_index_build(card_fw_data);
+		id = __pkcs15_object_id(obj);
+		obj2 = card_fw_data->id_index[__pkcs15_index_hash(id->value, id->len)];
+		for (; obj2; obj2 = obj2->id_next) {
 			struct pkcs15_cert_object *cert;
 
 			if (!is_cert(obj2))
@@ -1194,6 +1326,8 @@ _add_pin_related_objects(struct sc_pkcs11_slot *slot, struct sc_pkcs15_object *p
 				memcpy(&fw_data->objects[i], &fw_data->objects[i + 1], sizeof(fw_data->objects[0]) * tail);
 			i--;
 			fw_data->num_objects--;
+			fw_data->index_valid = 0;
+			move_to_fw->index_valid = 0;
 		}
 	}
 }
@@ -1235,6 +1369,8 @@ _add_public_objects(struct sc_pkcs11_slot *slot, struct pkcs15_fw_data *fw_data,
 				memcpy(&fw_data->objects[i], &fw_data->objects[i + 1], sizeof(fw_data->objects[0]) * tail);
 			i--;
 			fw_data->num_objects--;
+			fw_data->index_valid = 0;
+			move_to_fw->index_valid = 0;
 		}
 	}
 }
@@ -2826,8 +2962,8 @@ pkcs15_gen_keypair(struct sc_pkcs11_slot *slot, CK_MECHANISM_PTR pMechanism,
 
 	priv_prk_obj->prv_pubkey = (struct pkcs15_pubkey_object *)pub_any_obj;
 
-	/* Duplicate public key so that parameters can be retrieved even if public key object is deleted */
-	rv = sc_pkcs15_dup_pubkey(context, ((struct pkcs15_pubkey_object *)pub_any_obj)->pub_data, &priv_prk_obj->pub_data);
+	/* Share public key so that parameters can be retrieved even if public key object is deleted */
+	priv_prk_obj->pub_data = sc_pkcs15_share_pubkey(((struct pkcs15_pubkey_object *)pub_any_obj)->pub_data);
 
 kpgen_done:
 	sc_pkcs15init_unbind(profile);
@@ -4010,14 +4146,19 @@ pkcs15_dobj_set_attribute(struct sc_pkcs11_session *session,
 }
 
 
+/*
+ * The value is read once into the object info and copied from there
+ * straight into the attribute, without an intermediate data object.
+ */
 static int
 pkcs15_dobj_get_value(struct sc_pkcs11_session *session,
 		struct pkcs15_data_object *dobj,
-		struct sc_pkcs15_data **out_data)
+		const struct sc_pkcs15_der **out_data)
 {
 	struct sc_pkcs11_card *p11card = session->slot->card;
 	struct pkcs15_fw_data *fw_data = NULL;
 	struct sc_card *card = session->slot->card->card;
+	struct sc_pkcs15_data_info *info = dobj->info;
 	int rv;
 
 	if (!out_data)
@@ -4026,30 +4167,33 @@ pkcs15_dobj_get_value(struct sc_pkcs11_session *session,
 	if (!fw_data)
 		return sc_to_cryptoki_error(SC_ERROR_INTERNAL, "C_GetAttributeValue");
 
-	rv = sc_lock(card);
-	if (rv < 0)
-		return sc_to_cryptoki_error(rv, "C_GetAttributeValue");
+	if (!info->data.value) {
+		rv = sc_lock(card);
+		if (rv < 0)
+			return sc_to_cryptoki_error(rv, "C_GetAttributeValue");
 
-	rv = sc_pkcs15_read_data_object(fw_data->p15_card, dobj->info, out_data);
+		rv = sc_pkcs15_read_file(fw_data->p15_card, &info->path, &info->data.value, &info->data.len);
 
-	sc_unlock(card);
-	if (rv < 0)
-		return sc_to_cryptoki_error(rv, "C_GetAttributeValue");
+		sc_unlock(card);
+		if (rv < 0)
+			return sc_to_cryptoki_error(rv, "C_GetAttributeValue");
+	}
 
-	return rv;
+	*out_data = &info->data;
+	return CKR_OK;
 }
 
 
 static CK_RV
-data_value_to_attr(CK_ATTRIBUTE_PTR attr, struct sc_pkcs15_data *data)
+data_value_to_attr(CK_ATTRIBUTE_PTR attr, const struct sc_pkcs15_der *data)
 {
 	if (!attr || !data)
 		return CKR_ATTRIBUTE_VALUE_INVALID;
 
-	sc_log(context, "data_value_to_attr(): data(%p,len:%i)", data, data->data_len);
+	sc_log(context, "data_value_to_attr(): data(%p,len:%i)", data, data->len);
 
-	check_attribute_buffer(attr, data->data_len);
-	memcpy(attr->pValue, data->data, data->data_len);
+	check_attribute_buffer(attr, data->len);
+	memcpy(attr->pValue, data->value, data->len);
 	return CKR_OK;
 }
 
@@ -4058,7 +4202,7 @@ static CK_RV
 pkcs15_dobj_get_attribute(struct sc_pkcs11_session *session, void *object, CK_ATTRIBUTE_PTR attr)
 {
 	struct pkcs15_data_object *dobj = (struct pkcs15_data_object*) object;
-	struct sc_pkcs15_data *data = NULL;
+	const struct sc_pkcs15_der *data = NULL;
 	CK_RV rv;
 	size_t len;
 	int r;
@@ -4124,10 +4268,6 @@ pkcs15_dobj_get_attribute(struct sc_pkcs11_session *session, void *object, CK_AT
 		rv = pkcs15_dobj_get_value(session, dobj, &data);
 		if (rv == CKR_OK)
 			rv = data_value_to_attr(attr, data);
-		if (data) {
-			free(data->data);
-			free(data);
-		}
 		if (rv != CKR_OK)
 			return rv;
 		break;
@@ -217,6 +217,41 @@ sc_pkcs11_md_final(struct sc_pkcs11_session *session,
 	LOG_FUNC_RETURN(context, rv);
 }
 
+/*
+ * Single-part digest. The length is checked before any data is hashed,
+ * so that a length query or a too small buffer leaves the operation
+ * untouched.
+ */
+CK_RV
+sc_pkcs11_md_digest(struct sc_pkcs11_session *session,
+			CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+			CK_BYTE_PTR pDigest, CK_ULONG_PTR pulDigestLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_ULONG len = 0;
+	CK_RV rv;
+
+	LOG_FUNC_CALLED(context);
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_DIGEST, &op);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, rv);
+
+	rv = op->type->md_final(op, NULL, &len);
+	if (rv == CKR_BUFFER_TOO_SMALL) {
+		if (pDigest == NULL || *pulDigestLen < len) {
+			*pulDigestLen = len;
+			LOG_FUNC_RETURN(context, pDigest == NULL ? CKR_OK : CKR_BUFFER_TOO_SMALL);
+		}
+
+		rv = op->type->md_update(op, pData, ulDataLen);
+		if (rv == CKR_OK)
+			rv = op->type->md_final(op, pDigest, pulDigestLen);
+	}
+
+	session_stop_operation(session, SC_PKCS11_OPERATION_DIGEST);
+	LOG_FUNC_RETURN(context, rv);
+}
+
 /*
  * Initialize a signing context. When we get here, we know
  * the key object is capable of signing _something_
@@ -500,6 +535,47 @@ sc_pkcs11_signature_release(sc_pkcs11_operation_t *operation)
 	free(data);
 }
 
+/*
+ * Single-part signature. Mechanisms that sign the raw data are given
+ * the caller's buffer rather than a copy of it; everything else takes
+ * the update/final path, which hashes straight from the caller's buffer.
+ */
+CK_RV
+sc_pkcs11_sign_data(struct sc_pkcs11_session *session,
+		CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pSignature, CK_ULONG_PTR pulSignatureLen)
+{
+	sc_pkcs11_operation_t *op;
+	struct signature_data *data;
+	CK_RV rv;
+
+	LOG_FUNC_CALLED(context);
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_SIGN, &op);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, rv);
+
+	data = (struct signature_data *) op->priv_data;
+	if (op->type->sign_update != sc_pkcs11_signature_update || data == NULL
+			|| data->md != NULL || data->buffer_len != 0) {
+		rv = sc_pkcs11_sign_update(session, pData, ulDataLen);
+		if (rv == CKR_OK)
+			rv = sc_pkcs11_sign_final(session, pSignature, pulSignatureLen);
+		LOG_FUNC_RETURN(context, rv);
+	}
+
+	sc_log(context, "%li bytes to sign", ulDataLen);
+	if (ulDataLen > sizeof(data->buffer))
+		rv = CKR_DATA_LEN_RANGE;
+	else
+		rv = data->key->ops->sign(op->session, data->key, &op->mechanism,
+				pData, ulDataLen, pSignature, pulSignatureLen);
+
+	if (rv != CKR_BUFFER_TOO_SMALL && pSignature != NULL)
+		session_stop_operation(session, SC_PKCS11_OPERATION_SIGN);
+
+	LOG_FUNC_RETURN(context, rv);
+}
+
 #ifdef ENABLE_OPENSSL
 /*
  * Initialize a verify context. When we get here, we know
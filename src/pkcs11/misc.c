@@ -84,7 +84,10 @@ static CK_RV sc_to_cryptoki_error_common(int rc)
 		return CKR_PIN_LEN_RANGE;
 	case SC_ERROR_KEYPAD_CANCELLED:
 	case SC_ERROR_KEYPAD_TIMEOUT:
+	case SC_ERROR_OPERATION_CANCELLED:
 		return CKR_FUNCTION_CANCELED;
+	case SC_ERROR_OPERATION_TIMEOUT:
+		return CKR_DEVICE_ERROR;
 	case SC_ERROR_CARD_REMOVED:
 		return CKR_DEVICE_REMOVED;
 	case SC_ERROR_SECURITY_STATUS_NOT_SATISFIED:
@@ -184,6 +187,21 @@ CK_RV session_stop_operation(struct sc_pkcs11_session * session, int type)
 	return CKR_OK;
 }
 
+/* Release the operations left active in a session that is being
+ * closed, and the digest contexts it keeps */
+void session_release(struct sc_pkcs11_session * session)
+{
+	int i;
+
+	for (i = 0; i < SC_PKCS11_OPERATION_MAX; i++)
+		if (session->operation[i])
+			sc_pkcs11_release_operation(&session->operation[i]);
+#ifdef ENABLE_OPENSSL
+	sc_pkcs11_openssl_md_cache_free(session);
+#endif
+	free(session);
+}
+
 CK_RV attr_extract(CK_ATTRIBUTE_PTR pAttr, void *ptr, size_t * sizep)
 {
 	unsigned int size;
@@ -304,6 +322,7 @@ void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 	conf->create_puk_slot = 0;
 	conf->zero_ckaid_for_ca_certs = 0;
 	conf->create_slots_flags = SC_PKCS11_SLOT_CREATE_ALL;
+	conf->operation_timeout = 0;
 
 	conf_block = sc_get_conf_block(ctx, "pkcs11", NULL, 1);
 	if (!conf_block)
@@ -326,6 +345,7 @@ void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 
 	conf->create_puk_slot = scconf_get_bool(conf_block, "create_puk_slot", conf->create_puk_slot);
 	conf->zero_ckaid_for_ca_certs = scconf_get_bool(conf_block, "zero_ckaid_for_ca_certs", conf->zero_ckaid_for_ca_certs);
+	conf->operation_timeout = scconf_get_int(conf_block, "operation_timeout", conf->operation_timeout);
 
 	create_slots_for_pins = (char *)scconf_get_str(conf_block, "create_slots_for_pins", "all");
 	conf->create_slots_flags = 0;
@@ -346,8 +366,8 @@ void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 
 	sc_log(ctx, "PKCS#11 options: plug_and_play=%d max_virtual_slots=%d slots_per_card=%d "
 		 "hide_empty_tokens=%d lock_login=%d pin_unblock_style=%d "
-		 "zero_ckaid_for_ca_certs=%d create_slots_flags=0x%X",
+		 "zero_ckaid_for_ca_certs=%d create_slots_flags=0x%X operation_timeout=%u",
 		 conf->plug_and_play, conf->max_virtual_slots, conf->slots_per_card,
 		 conf->hide_empty_tokens, conf->lock_login, conf->pin_unblock_style,
-		 conf->zero_ckaid_for_ca_certs, conf->create_slots_flags);
+		 conf->zero_ckaid_for_ca_certs, conf->create_slots_flags, conf->operation_timeout);
 }
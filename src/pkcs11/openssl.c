@@ -221,15 +221,27 @@ sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *card)
 static CK_RV sc_pkcs11_openssl_md_init(sc_pkcs11_operation_t *op)
 {
 	sc_pkcs11_mechanism_type_t *mt;
-	EVP_MD_CTX	*md_ctx;
+	struct sc_pkcs11_session *session;
+	EVP_MD_CTX	*md_ctx = NULL;
 	EVP_MD		*md;
+	int		i;
 
 	if (!op || !(mt = op->type) || !(md = (EVP_MD *) mt->mech_data))
 		return CKR_ARGUMENTS_BAD;
 
-	if (!(md_ctx = calloc(1, sizeof(*md_ctx))))
+	/* Take a context cached by the session, if any */
+	session = op->session;
+	for (i = 0; session && i < SC_PKCS11_MD_CACHE_SIZE && md_ctx == NULL; i++) {
+		md_ctx = (EVP_MD_CTX *) session->md_cache[i];
+		session->md_cache[i] = NULL;
+	}
+	if (md_ctx == NULL && !(md_ctx = EVP_MD_CTX_create()))
 		return CKR_HOST_MEMORY;
-	EVP_DigestInit(md_ctx, md);
+
+	if (!EVP_DigestInit_ex(md_ctx, md, NULL)) {
+		EVP_MD_CTX_destroy(md_ctx);
+		return CKR_GENERAL_ERROR;
+	}
 	op->priv_data = md_ctx;
 	return CKR_OK;
 }
@@ -245,15 +257,18 @@ static CK_RV sc_pkcs11_openssl_md_final(sc_pkcs11_operation_t *op,
 				CK_BYTE_PTR pDigest, CK_ULONG_PTR pulDigestLen)
 {
 	EVP_MD_CTX *md_ctx = DIGEST_CTX(op);
+	unsigned int len;
 
 	if (*pulDigestLen < (unsigned) EVP_MD_CTX_size(md_ctx)) {
-		sc_log(context, "Provided buffer too small: %ul < %d",
+		sc_log(context, "Provided buffer too small: %lu < %d",
 			*pulDigestLen, EVP_MD_CTX_size(md_ctx));
 		*pulDigestLen = EVP_MD_CTX_size(md_ctx);
 		return CKR_BUFFER_TOO_SMALL;
 	}
 
-	EVP_DigestFinal(md_ctx, pDigest, (unsigned *) pulDigestLen);
+	/* Keep the context set up for the digest so that it can be reused */
+	EVP_DigestFinal_ex(md_ctx, pDigest, &len);
+	*pulDigestLen = len;
 
 	return CKR_OK;
 }
@@ -261,12 +276,32 @@ static CK_RV sc_pkcs11_openssl_md_final(sc_pkcs11_operation_t *op,
 static void sc_pkcs11_openssl_md_release(sc_pkcs11_operation_t *op)
 {
 	EVP_MD_CTX	*md_ctx = DIGEST_CTX(op);
-
+	struct sc_pkcs11_session *session = op->session;
+	int		i;
+
+	/* Return the context to the session cache, free it if that is full */
+	for (i = 0; md_ctx && session && i < SC_PKCS11_MD_CACHE_SIZE; i++) {
+		if (session->md_cache[i] == NULL) {
+			session->md_cache[i] = md_ctx;
+			md_ctx = NULL;
+		}
+	}
 	if (md_ctx)
-		free(md_ctx);
+		EVP_MD_CTX_destroy(md_ctx);
 	op->priv_data = NULL;
 }
 
+void sc_pkcs11_openssl_md_cache_free(struct sc_pkcs11_session *session)
+{
+	int	i;
+
+	for (i = 0; i < SC_PKCS11_MD_CACHE_SIZE; i++) {
+		if (session->md_cache[i])
+			EVP_MD_CTX_destroy((EVP_MD_CTX *) session->md_cache[i]);
+		session->md_cache[i] = NULL;
+	}
+}
+
 #if OPENSSL_VERSION_NUMBER >= 0x10000000L && !defined(OPENSSL_NO_EC)
 
 static void reverse(unsigned char *buf, size_t len)
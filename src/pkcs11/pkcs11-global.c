@@ -284,21 +284,22 @@ CK_RV C_Finalize(CK_VOID_PTR pReserved)
 	if (context == NULL)
 		return CKR_CRYPTOKI_NOT_INITIALIZED;
 
+	/* cancel pending calls, before waiting for the call holding the lock */
+	in_finalize = 1;
+	sc_cancel(context);
+
 	rv = sc_pkcs11_lock();
 	if (rv != CKR_OK)
 		return rv;
 
 	sc_log(context, "C_Finalize()");
 
-	/* cancel pending calls */
-	in_finalize = 1;
-	sc_cancel(context);
 	/* remove all cards from readers */
 	for (i=0; i < (int)sc_ctx_get_reader_count(context); i++)
 		card_removed(sc_ctx_get_reader(context, i));
 
 	while ((p = list_fetch(&sessions)))
-		free(p);
+		session_release(p);
 	list_destroy(&sessions);
 
 	while ((slot = list_fetch(&virtual_slots))) {
@@ -517,6 +518,77 @@ CK_RV C_GetSlotInfo(CK_SLOT_ID slotID, CK_SLOT_INFO_PTR pInfo)
 	return rv;
 }
 
+CK_RV C_OpenSC_GetSlotAPDUStats(CK_SLOT_ID slotID,
+		CK_OPENSC_APDU_STATS_PTR pStats, CK_ULONG_PTR pulCount)
+{
+	struct sc_pkcs11_slot *slot;
+	struct sc_apdu_stats *stats = NULL;
+	size_t count = 0, ii, jj;
+	CK_RV rv;
+	int r;
+
+	if (pulCount == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	sc_log(context, "C_OpenSC_GetSlotAPDUStats(0x%lx)", slotID);
+	/* no card detection here: report what has been sent so far,
+	 * also for a card that was not recognized */
+	rv = slot_get_slot(slotID, &slot);
+	if (rv == CKR_OK && (slot->card == NULL || slot->card->card == NULL))
+		rv = CKR_TOKEN_NOT_PRESENT;
+	if (rv != CKR_OK)
+		goto out;
+
+	r = sc_get_apdu_stats(slot->card->card, NULL, &count);
+	if (r == SC_SUCCESS && pStats != NULL_PTR && count)   {
+		if (*pulCount < count)   {
+			*pulCount = count;
+			rv = CKR_BUFFER_TOO_SMALL;
+			goto out;
+		}
+		stats = calloc(count, sizeof(struct sc_apdu_stats));
+		if (stats == NULL)   {
+			rv = CKR_HOST_MEMORY;
+			goto out;
+		}
+		r = sc_get_apdu_stats(slot->card->card, stats, &count);
+	}
+	if (r != SC_SUCCESS)   {
+		rv = sc_to_cryptoki_error(r, "C_OpenSC_GetSlotAPDUStats");
+		goto out;
+	}
+
+	for (ii = 0; pStats != NULL_PTR && ii < count; ii++)   {
+		CK_OPENSC_APDU_STATS *out = &pStats[ii];
+
+		memset(out, 0, sizeof(*out));
+		out->cla = stats[ii].cla;
+		out->ins = stats[ii].ins;
+		out->count = stats[ii].count;
+		out->roundTrips = stats[ii].round_trips;
+		out->smWrapped = stats[ii].sm_wrapped;
+		out->bytesSent = (CK_ULONG)stats[ii].bytes_sent;
+		out->bytesReceived = (CK_ULONG)stats[ii].bytes_received;
+		out->timeUs = (CK_ULONG)stats[ii].time_us;
+		out->maxTimeUs = (CK_ULONG)stats[ii].max_time_us;
+		for (jj = 0; jj < CK_OPENSC_APDU_STATS_SW_CLASSES && jj < SC_APDU_STATS_SW_CLASSES; jj++)
+			out->sw[jj] = stats[ii].sw[jj];
+		for (jj = 0; jj < CK_OPENSC_APDU_STATS_HIST_SIZE && jj < SC_APDU_STATS_HIST_SIZE; jj++)
+			out->hist[jj] = stats[ii].hist[jj];
+	}
+	*pulCount = count;
+
+out:
+	free(stats);
+	sc_log(context, "C_OpenSC_GetSlotAPDUStats(0x%lx) = %s", slotID, lookup_enum(RV_T, rv));
+	sc_pkcs11_unlock();
+	return rv;
+}
+
 CK_RV C_GetMechanismList(CK_SLOT_ID slotID,
 			 CK_MECHANISM_TYPE_PTR pMechanismList,
                          CK_ULONG_PTR pulCount)
@@ -749,18 +821,33 @@ sc_pkcs11_init_lock(CK_C_INITIALIZE_ARGS_PTR args)
 	return rv;
 }
 
+/* Bound the card operations of the call holding the global lock */
+static void
+sc_pkcs11_set_deadlines(unsigned long timeout_ms)
+{
+	unsigned int i;
+
+	for (i = 0; i < list_size(&virtual_slots); i++) {
+		struct sc_pkcs11_slot *slot = (struct sc_pkcs11_slot *) list_get_at(&virtual_slots, i);
+
+		if (slot && slot->card && slot->card->card)
+			sc_set_card_deadline(slot->card->card, timeout_ms);
+	}
+}
+
 CK_RV sc_pkcs11_lock(void)
 {
 	if (context == NULL)
 		return CKR_CRYPTOKI_NOT_INITIALIZED;
 
-	if (!global_lock)
-		return CKR_OK;
-	if (global_locking)  {
+	if (global_lock && global_locking)  {
 		while (global_locking->LockMutex(global_lock) != CKR_OK)
 			;
 	}
 
+	if (sc_pkcs11_conf.operation_timeout)
+		sc_pkcs11_set_deadlines(sc_pkcs11_conf.operation_timeout);
+
 	return CKR_OK;
 }
 
@@ -777,6 +864,8 @@ __sc_pkcs11_unlock(void *lock)
 
 void sc_pkcs11_unlock(void)
 {
+	if (context && sc_pkcs11_conf.operation_timeout)
+		sc_pkcs11_set_deadlines(0);
 	__sc_pkcs11_unlock(global_lock);
 }
 
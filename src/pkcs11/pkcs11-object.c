@@ -521,9 +521,7 @@ C_Digest(CK_SESSION_HANDLE hSession,		/* the session's handle */
 	if (rv != CKR_OK)
 		goto out;
 
-	rv = sc_pkcs11_md_update(session, pData, ulDataLen);
-	if (rv == CKR_OK)
-		rv = sc_pkcs11_md_final(session, pDigest, pulDigestLen);
+	rv = sc_pkcs11_md_digest(session, pData, ulDataLen, pDigest, pulDigestLen);
 
 out:	sc_log(context, "C_Digest() = %s", lookup_enum ( RV_T, rv ));
 	sc_pkcs11_unlock();
@@ -668,9 +666,7 @@ C_Sign(CK_SESSION_HANDLE hSession,		/* the session's handle */
 		goto out;
 	}
 
-	rv = sc_pkcs11_sign_update(session, pData, ulDataLen);
-	if (rv == CKR_OK)
-		rv = sc_pkcs11_sign_final(session, pSignature, pulSignatureLen);
+	rv = sc_pkcs11_sign_data(session, pData, ulDataLen, pSignature, pulSignatureLen);
 
 out:
 	sc_log(context, "C_Sign() = %s", lookup_enum ( RV_T, rv ));
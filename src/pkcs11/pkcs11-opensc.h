@@ -9,4 +9,34 @@
  */
 #define CKA_OPENSC_NON_REPUDIATION      (CKA_VENDOR_DEFINED | 1UL)
 
+/*
+ * Vendor extension to the slot information: APDU statistics of the card
+ * in a slot, one entry per CLA/INS pair (see sc_get_apdu_stats() in libopensc).
+ * Get the entry point with dlsym()/GetProcAddress(); called with pStats
+ * NULL_PTR it returns the number of entries in *pulCount.
+ */
+#define CK_OPENSC_APDU_STATS_SW_CLASSES	7	/* 9000, 61XX, 6CXX, warning, error, other, failed */
+#define CK_OPENSC_APDU_STATS_HIST_SIZE	24	/* log2 buckets of the latency in microseconds */
+
+typedef struct CK_OPENSC_APDU_STATS {
+	CK_BYTE cla;		/* 0x00 or 0x80 */
+	CK_BYTE ins;
+	CK_ULONG count;
+	CK_ULONG roundTrips;
+	CK_ULONG smWrapped;
+	CK_ULONG bytesSent;
+	CK_ULONG bytesReceived;
+	CK_ULONG timeUs;
+	CK_ULONG maxTimeUs;
+	CK_ULONG sw[CK_OPENSC_APDU_STATS_SW_CLASSES];
+	CK_ULONG hist[CK_OPENSC_APDU_STATS_HIST_SIZE];
+} CK_OPENSC_APDU_STATS;
+
+typedef CK_OPENSC_APDU_STATS * CK_OPENSC_APDU_STATS_PTR;
+
+extern CK_RV C_OpenSC_GetSlotAPDUStats(CK_SLOT_ID slotID,
+		CK_OPENSC_APDU_STATS_PTR pStats, CK_ULONG_PTR pulCount);
+typedef CK_RV (*CK_OPENSC_GET_SLOT_APDU_STATS)(CK_SLOT_ID slotID,
+		CK_OPENSC_APDU_STATS_PTR pStats, CK_ULONG_PTR pulCount);
+
 #endif
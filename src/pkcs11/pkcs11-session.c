@@ -112,7 +112,7 @@ static CK_RV sc_pkcs11_close_session(CK_SESSION_HANDLE hSession)
 
 	if (list_delete(&sessions, session) != 0)
 		sc_log(context, "Could not delete session from list!");
-	free(session);
+	session_release(session);
 	return CKR_OK;
 }
 
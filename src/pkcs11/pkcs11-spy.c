@@ -21,6 +21,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -29,6 +31,10 @@
 #else
 #include <sys/time.h>
 #include <time.h>
+#include <signal.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #endif
 
 #define CRYPTOKI_EXPORTS
@@ -50,6 +56,8 @@ static void *modhandle = NULL;
 /* Spy module output */
 static FILE *spy_output = NULL;
 
+static void spy_stats_init(void);
+
 /* Inits the spy. If successfull, po != NULL */
 static CK_RV
 init_spy(void)
@@ -184,6 +192,7 @@ init_spy(void)
 		spy_output = stderr;
 
 	fprintf(spy_output, "\n\n*************** OpenSC PKCS#11 spy *****************\n");
+	spy_stats_init();
 
 	module = getenv("PKCS11SPY");
 #ifdef _WIN32
@@ -338,6 +347,410 @@ print_ptr_in(const char *name, CK_VOID_PTR ptr)
  	fprintf(spy_output, "[in] %s = %p\n", name, ptr);
 }
 
+/*
+ * Statistics mode, selected with PKCS11SPY_STATS=1. Calls are not
+ * logged one by one. Instead each thread accumulates call counts,
+ * latency histograms and return code breakdowns per function and per
+ * mechanism in its own buffer. The merged summary is written to the
+ * spy output at C_Finalize, or on the first call after the signal
+ * given in PKCS11SPY_STATS_SIGNAL (a signal number) was received.
+ */
+#define SPY_NUM_FUNCTIONS	((sizeof(CK_FUNCTION_LIST) - offsetof(CK_FUNCTION_LIST, C_Initialize)) \
+				/ sizeof(CK_VOID_PTR))
+#define SPY_FUNCTION_INDEX(name) ((offsetof(CK_FUNCTION_LIST, name) - offsetof(CK_FUNCTION_LIST, C_Initialize)) \
+				/ sizeof(CK_VOID_PTR))
+#define SPY_HIST_BUCKETS	24	/* log2 buckets of microseconds */
+#define SPY_RV_SLOTS		6
+#define SPY_MAX_MECHANISMS	32
+#define SPY_SESSION_SLOTS	64
+
+/* Mechanism argument of SPY_STATS for calls without a mechanism */
+#define SPY_MECH_NONE		((CK_MECHANISM_TYPE) -1)
+/* ... and for calls using the mechanism of the last *Init on the session */
+#define SPY_MECH_SESSION	((CK_MECHANISM_TYPE) -2)
+
+struct spy_histogram {
+	unsigned long		calls;
+	unsigned long long	total_us, max_us;
+	unsigned long		buckets[SPY_HIST_BUCKETS];
+	struct {
+		CK_RV		rv;
+		unsigned long	count;
+	} rvs[SPY_RV_SLOTS];
+	unsigned long		rv_other;
+};
+
+struct spy_mech_stats {
+	CK_MECHANISM_TYPE	mechanism;
+	struct spy_histogram	hist;
+};
+
+struct spy_thread_stats {
+	struct spy_histogram	functions[SPY_NUM_FUNCTIONS];
+	struct spy_mech_stats	mechanisms[SPY_MAX_MECHANISMS];
+	unsigned int		num_mechanisms;
+	/* Mechanism of the last *Init, by session handle */
+	struct {
+		CK_SESSION_HANDLE	session;
+		CK_MECHANISM_TYPE	mechanism;
+	} sessions[SPY_SESSION_SLOTS];
+	struct spy_thread_stats	*next;
+};
+
+struct spy_call {
+	struct spy_thread_stats	*stats;
+	unsigned int		function;
+	CK_MECHANISM_TYPE	mechanism;
+	unsigned long long	start;
+};
+
+static int spy_stats = 0;
+static const char *spy_function_names[SPY_NUM_FUNCTIONS];
+/* All thread buffers, they live until the process exits */
+static struct spy_thread_stats *spy_stats_list = NULL;
+#ifdef _WIN32
+static DWORD spy_stats_key;
+static CRITICAL_SECTION spy_stats_lock;
+#else
+#ifdef HAVE_PTHREAD
+static pthread_key_t spy_stats_key;
+static pthread_mutex_t spy_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static struct spy_thread_stats *spy_stats_single = NULL;
+#endif
+static volatile sig_atomic_t spy_stats_signaled = 0;
+#endif
+
+static unsigned long long
+spy_now_us(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (unsigned long long) (now.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static void
+spy_stats_lock_acquire(void)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&spy_stats_lock);
+#elif defined(HAVE_PTHREAD)
+	pthread_mutex_lock(&spy_stats_lock);
+#endif
+}
+
+static void
+spy_stats_lock_release(void)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&spy_stats_lock);
+#elif defined(HAVE_PTHREAD)
+	pthread_mutex_unlock(&spy_stats_lock);
+#endif
+}
+
+#ifndef _WIN32
+static void
+spy_stats_signal_handler(int sig)
+{
+	spy_stats_signaled = 1;
+}
+#endif
+
+static void
+spy_stats_init(void)
+{
+	const char *env;
+
+	env = getenv("PKCS11SPY_STATS");
+	if (env == NULL || !atoi(env))
+		return;
+
+#ifdef _WIN32
+	spy_stats_key = TlsAlloc();
+	if (spy_stats_key == TLS_OUT_OF_INDEXES)
+		return;
+	InitializeCriticalSection(&spy_stats_lock);
+#else
+#ifdef HAVE_PTHREAD
+	if (pthread_key_create(&spy_stats_key, NULL))
+		return;
+#endif
+	env = getenv("PKCS11SPY_STATS_SIGNAL");
+	if (env && atoi(env) > 0)
+		signal(atoi(env), spy_stats_signal_handler);
+#endif
+	spy_stats = 1;
+	fprintf(spy_output, "Statistics mode, the summary is written at C_Finalize\n");
+	fflush(spy_output);
+}
+
+/* Returns the buffer of the calling thread, allocating it on first use */
+static struct spy_thread_stats *
+spy_thread_stats(void)
+{
+	struct spy_thread_stats *ts;
+
+#ifdef _WIN32
+	ts = TlsGetValue(spy_stats_key);
+#elif defined(HAVE_PTHREAD)
+	ts = pthread_getspecific(spy_stats_key);
+#else
+	ts = spy_stats_single;
+#endif
+	if (ts)
+		return ts;
+
+	ts = calloc(1, sizeof(*ts));
+	if (ts == NULL)
+		return NULL;
+	spy_stats_lock_acquire();
+	ts->next = spy_stats_list;
+	spy_stats_list = ts;
+	spy_stats_lock_release();
+#ifdef _WIN32
+	TlsSetValue(spy_stats_key, ts);
+#elif defined(HAVE_PTHREAD)
+	pthread_setspecific(spy_stats_key, ts);
+#else
+	spy_stats_single = ts;
+#endif
+	return ts;
+}
+
+static void
+spy_histogram_add(struct spy_histogram *h, unsigned long long us, CK_RV rv)
+{
+	unsigned long long v = us;
+	unsigned int i;
+
+	h->calls++;
+	h->total_us += us;
+	if (us > h->max_us)
+		h->max_us = us;
+	for (i = 0; v > 1 && i < SPY_HIST_BUCKETS - 1; i++)
+		v >>= 1;
+	h->buckets[i]++;
+
+	for (i = 0; i < SPY_RV_SLOTS; i++) {
+		if (h->rvs[i].count == 0)
+			h->rvs[i].rv = rv;
+		if (h->rvs[i].rv == rv) {
+			h->rvs[i].count++;
+			return;
+		}
+	}
+	h->rv_other++;
+}
+
+static void
+spy_histogram_merge(struct spy_histogram *to, const struct spy_histogram *from)
+{
+	unsigned int i, j;
+
+	to->calls += from->calls;
+	to->total_us += from->total_us;
+	if (from->max_us > to->max_us)
+		to->max_us = from->max_us;
+	for (i = 0; i < SPY_HIST_BUCKETS; i++)
+		to->buckets[i] += from->buckets[i];
+	to->rv_other += from->rv_other;
+	for (i = 0; i < SPY_RV_SLOTS && from->rvs[i].count; i++) {
+		for (j = 0; j < SPY_RV_SLOTS; j++) {
+			if (to->rvs[j].count == 0)
+				to->rvs[j].rv = from->rvs[i].rv;
+			if (to->rvs[j].rv == from->rvs[i].rv) {
+				to->rvs[j].count += from->rvs[i].count;
+				break;
+			}
+		}
+		if (j == SPY_RV_SLOTS)
+			to->rv_other += from->rvs[i].count;
+	}
+}
+
+/* Upper bound in microseconds of the bucket holding the given percentile */
+static unsigned long long
+spy_histogram_percentile(const struct spy_histogram *h, unsigned int percent)
+{
+	unsigned long long seen = 0, wanted = ((unsigned long long) h->calls * percent + 99) / 100;
+	unsigned int i;
+
+	for (i = 0; i < SPY_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= wanted)
+			break;
+	}
+	if (i == SPY_HIST_BUCKETS - 1 || (2ULL << i) - 1 > h->max_us)
+		return h->max_us;
+	return (2ULL << i) - 1;
+}
+
+static void
+spy_histogram_print(const char *name, const struct spy_histogram *h)
+{
+	unsigned int i;
+
+	fprintf(spy_output, "%-28s %8lu %10llu %8llu %8llu %8llu %10llu\n", name, h->calls,
+			h->total_us / h->calls,
+			spy_histogram_percentile(h, 50), spy_histogram_percentile(h, 95),
+			spy_histogram_percentile(h, 99), h->max_us);
+	for (i = 0; i < SPY_RV_SLOTS && h->rvs[i].count; i++) {
+		const char *rv_name = lookup_enum(RV_T, h->rvs[i].rv);
+
+		if (rv_name)
+			fprintf(spy_output, "    %-32s %lu\n", rv_name, h->rvs[i].count);
+		else
+			fprintf(spy_output, "    0x%-30lx %lu\n", (unsigned long) h->rvs[i].rv, h->rvs[i].count);
+	}
+	if (h->rv_other)
+		fprintf(spy_output, "    %-32s %lu\n", "(other)", h->rv_other);
+}
+
+/* Merges all thread buffers and writes the summary, optionally resetting them */
+static void
+spy_stats_dump(const char *reason, int reset)
+{
+	struct spy_histogram *functions;
+	struct spy_mech_stats *mechanisms;
+	struct spy_thread_stats *ts;
+	unsigned int i, j, num_mechanisms = 0, threads = 0;
+
+	functions = calloc(SPY_NUM_FUNCTIONS, sizeof(*functions));
+	mechanisms = calloc(SPY_MAX_MECHANISMS, sizeof(*mechanisms));
+	if (functions == NULL || mechanisms == NULL) {
+		free(functions);
+		free(mechanisms);
+		return;
+	}
+
+	spy_stats_lock_acquire();
+	for (ts = spy_stats_list; ts; ts = ts->next) {
+		threads++;
+		for (i = 0; i < SPY_NUM_FUNCTIONS; i++)
+			spy_histogram_merge(&functions[i], &ts->functions[i]);
+		for (i = 0; i < ts->num_mechanisms; i++) {
+			for (j = 0; j < num_mechanisms; j++)
+				if (mechanisms[j].mechanism == ts->mechanisms[i].mechanism)
+					break;
+			if (j == num_mechanisms) {
+				if (num_mechanisms == SPY_MAX_MECHANISMS)
+					continue;
+				mechanisms[num_mechanisms++].mechanism = ts->mechanisms[i].mechanism;
+			}
+			spy_histogram_merge(&mechanisms[j].hist, &ts->mechanisms[i].hist);
+		}
+		if (reset) {
+			memset(ts->functions, 0, sizeof(ts->functions));
+			memset(ts->mechanisms, 0, sizeof(ts->mechanisms));
+			ts->num_mechanisms = 0;
+		}
+	}
+	spy_stats_lock_release();
+
+	fprintf(spy_output, "\n*************** PKCS#11 spy statistics (%s, %u threads) ***************\n",
+			reason, threads);
+	fprintf(spy_output, "%-28s %8s %10s %8s %8s %8s %10s\n",
+			"Function", "Calls", "Avg [us]", "p50 <=", "p95 <=", "p99 <=", "Max [us]");
+	for (i = 0; i < SPY_NUM_FUNCTIONS; i++)
+		if (functions[i].calls)
+			spy_histogram_print(spy_function_names[i], &functions[i]);
+
+	if (num_mechanisms) {
+		fprintf(spy_output, "\n%-28s %8s %10s %8s %8s %8s %10s\n",
+				"Mechanism", "Calls", "Avg [us]", "p50 <=", "p95 <=", "p99 <=", "Max [us]");
+		for (i = 0; i < num_mechanisms; i++) {
+			const char *name = lookup_enum(MEC_T, mechanisms[i].mechanism);
+			char buf[32];
+
+			if (name == NULL) {
+				snprintf(buf, sizeof(buf), "0x%08lx", (unsigned long) mechanisms[i].mechanism);
+				name = buf;
+			}
+			spy_histogram_print(name, &mechanisms[i].hist);
+		}
+	}
+	fflush(spy_output);
+
+	free(functions);
+	free(mechanisms);
+}
+
+static void
+spy_stats_enter(struct spy_call *call, unsigned int function, const char *name,
+		CK_SESSION_HANDLE session, CK_MECHANISM_TYPE mechanism)
+{
+	struct spy_thread_stats *ts;
+	unsigned int slot = (unsigned int) (session % SPY_SESSION_SLOTS);
+
+#ifndef _WIN32
+	if (spy_stats_signaled) {
+		spy_stats_signaled = 0;
+		spy_stats_dump("signal", 0);
+	}
+#endif
+	ts = spy_thread_stats();
+	call->stats = ts;
+	call->function = function;
+	call->mechanism = SPY_MECH_NONE;
+	if (ts) {
+		spy_function_names[function] = name;
+		if (mechanism == SPY_MECH_SESSION) {
+			if (ts->sessions[slot].session == session)
+				call->mechanism = ts->sessions[slot].mechanism;
+		}
+		else if (mechanism != SPY_MECH_NONE) {
+			ts->sessions[slot].session = session;
+			ts->sessions[slot].mechanism = mechanism;
+			call->mechanism = mechanism;
+		}
+	}
+	call->start = spy_now_us();
+}
+
+static CK_RV
+spy_stats_leave(struct spy_call *call, CK_RV rv)
+{
+	unsigned long long us = spy_now_us() - call->start;
+	struct spy_thread_stats *ts = call->stats;
+	unsigned int i;
+
+	if (ts == NULL)
+		return rv;
+	spy_histogram_add(&ts->functions[call->function], us, rv);
+	if (call->mechanism == SPY_MECH_NONE)
+		return rv;
+
+	for (i = 0; i < ts->num_mechanisms; i++)
+		if (ts->mechanisms[i].mechanism == call->mechanism)
+			break;
+	if (i == ts->num_mechanisms) {
+		if (i == SPY_MAX_MECHANISMS)
+			return rv;
+		ts->mechanisms[i].mechanism = call->mechanism;
+		ts->num_mechanisms++;
+	}
+	spy_histogram_add(&ts->mechanisms[i].hist, us, rv);
+	return rv;
+}
+
+/* In statistics mode, forwards the call with only its timing recorded */
+#define SPY_STATS(name, session, mechanism, args) \
+	if (spy_stats) { \
+		struct spy_call call; \
+		spy_stats_enter(&call, SPY_FUNCTION_INDEX(name), #name, session, mechanism); \
+		return spy_stats_leave(&call, po->name args); \
+	}
+
 CK_RV C_GetFunctionList
 (CK_FUNCTION_LIST_PTR_PTR ppFunctionList)
 {
@@ -347,6 +760,11 @@ CK_RV C_GetFunctionList
 			return rv;
 	}
 
+	if (spy_stats) {
+		*ppFunctionList = pkcs11_spy;
+		return CKR_OK;
+	}
+
 	enter("C_GetFunctionList");
 	*ppFunctionList = pkcs11_spy;
 	return retne(CKR_OK);
@@ -363,6 +781,7 @@ C_Initialize(CK_VOID_PTR pInitArgs)
 			return rv;
 	}
 
+	SPY_STATS(C_Initialize, CK_INVALID_HANDLE, SPY_MECH_NONE, (pInitArgs));
 	enter("C_Initialize");
 	print_ptr_in("pInitArgs", pInitArgs);
 
@@ -384,6 +803,16 @@ C_Finalize(CK_VOID_PTR pReserved)
 {
 	CK_RV rv;
 
+	if (spy_stats) {
+		struct spy_call call;
+
+		spy_stats_enter(&call, SPY_FUNCTION_INDEX(C_Finalize), "C_Finalize",
+				CK_INVALID_HANDLE, SPY_MECH_NONE);
+		rv = spy_stats_leave(&call, po->C_Finalize(pReserved));
+		spy_stats_dump("C_Finalize", 1);
+		return rv;
+	}
+
 	enter("C_Finalize");
 	rv = po->C_Finalize(pReserved);
 	return retne(rv);
@@ -394,6 +823,7 @@ C_GetInfo(CK_INFO_PTR pInfo)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetInfo, CK_INVALID_HANDLE, SPY_MECH_NONE, (pInfo));
 	enter("C_GetInfo");
 	rv = po->C_GetInfo(pInfo);
 	if(rv == CKR_OK) {
@@ -409,6 +839,8 @@ C_GetSlotList(CK_BBOOL tokenPresent, CK_SLOT_ID_PTR pSlotList,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetSlotList, CK_INVALID_HANDLE, SPY_MECH_NONE,
+			(tokenPresent, pSlotList, pulCount));
 	enter("C_GetSlotList");
 	spy_dump_ulong_in("tokenPresent", tokenPresent);
 	rv = po->C_GetSlotList(tokenPresent, pSlotList, pulCount);
@@ -425,6 +857,7 @@ C_GetSlotInfo(CK_SLOT_ID slotID, CK_SLOT_INFO_PTR pInfo)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetSlotInfo, CK_INVALID_HANDLE, SPY_MECH_NONE, (slotID, pInfo));
 	enter("C_GetSlotInfo");
 	spy_dump_ulong_in("slotID", slotID);
 	rv = po->C_GetSlotInfo(slotID, pInfo);
@@ -441,6 +874,7 @@ C_GetTokenInfo(CK_SLOT_ID slotID,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetTokenInfo, CK_INVALID_HANDLE, SPY_MECH_NONE, (slotID, pInfo));
 	enter("C_GetTokenInfo");
 	spy_dump_ulong_in("slotID", slotID);
 	rv = po->C_GetTokenInfo(slotID, pInfo);
@@ -457,6 +891,8 @@ C_GetMechanismList(CK_SLOT_ID  slotID, CK_MECHANISM_TYPE_PTR pMechanismList,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetMechanismList, CK_INVALID_HANDLE, SPY_MECH_NONE,
+			(slotID, pMechanismList, pulCount));
 	enter("C_GetMechanismList");
 	spy_dump_ulong_in("slotID", slotID);
 	rv = po->C_GetMechanismList(slotID, pMechanismList, pulCount);
@@ -474,6 +910,7 @@ C_GetMechanismInfo(CK_SLOT_ID  slotID, CK_MECHANISM_TYPE type,
 	CK_RV rv;
 	const char *name = lookup_enum(MEC_T, type);
 
+	SPY_STATS(C_GetMechanismInfo, CK_INVALID_HANDLE, SPY_MECH_NONE, (slotID, type, pInfo));
 	enter("C_GetMechanismInfo");
 	spy_dump_ulong_in("slotID", slotID);
 	if (name)
@@ -495,6 +932,7 @@ C_InitToken (CK_SLOT_ID slotID, CK_UTF8CHAR_PTR pPin, CK_ULONG ulPinLen,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_InitToken, CK_INVALID_HANDLE, SPY_MECH_NONE, (slotID, pPin, ulPinLen, pLabel));
 	enter("C_InitToken");
 	spy_dump_ulong_in("slotID", slotID);
 	spy_dump_string_in("pPin[ulPinLen]", pPin, ulPinLen);
@@ -508,6 +946,7 @@ C_InitPIN(CK_SESSION_HANDLE hSession, CK_UTF8CHAR_PTR pPin, CK_ULONG  ulPinLen)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_InitPIN, hSession, SPY_MECH_NONE, (hSession, pPin, ulPinLen));
 	enter("C_InitPIN");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pPin[ulPinLen]", pPin, ulPinLen);
@@ -521,6 +960,8 @@ C_SetPIN(CK_SESSION_HANDLE hSession, CK_UTF8CHAR_PTR pOldPin, CK_ULONG  ulOldLen
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SetPIN, hSession, SPY_MECH_NONE,
+			(hSession, pOldPin, ulOldLen, pNewPin, ulNewLen));
 	enter("C_SetPIN");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pOldPin[ulOldLen]", pOldPin, ulOldLen);
@@ -535,6 +976,8 @@ C_OpenSession(CK_SLOT_ID  slotID, CK_FLAGS  flags, CK_VOID_PTR  pApplication,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_OpenSession, CK_INVALID_HANDLE, SPY_MECH_NONE,
+			(slotID, flags, pApplication, Notify, phSession));
 	enter("C_OpenSession");
 	spy_dump_ulong_in("slotID", slotID);
 	spy_dump_ulong_in("flags", flags);
@@ -550,6 +993,7 @@ C_CloseSession(CK_SESSION_HANDLE hSession)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_CloseSession, hSession, SPY_MECH_NONE, (hSession));
 	enter("C_CloseSession");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_CloseSession(hSession);
@@ -560,6 +1004,7 @@ CK_RV
 C_CloseAllSessions(CK_SLOT_ID slotID)
 {
 	CK_RV rv;
+	SPY_STATS(C_CloseAllSessions, CK_INVALID_HANDLE, SPY_MECH_NONE, (slotID));
 	enter("C_CloseAllSessions");
 	spy_dump_ulong_in("slotID", slotID);
 	rv = po->C_CloseAllSessions(slotID);
@@ -571,6 +1016,7 @@ C_GetSessionInfo(CK_SESSION_HANDLE hSession, CK_SESSION_INFO_PTR pInfo)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetSessionInfo, hSession, SPY_MECH_NONE, (hSession, pInfo));
 	enter("C_GetSessionInfo");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_GetSessionInfo(hSession, pInfo);
@@ -587,6 +1033,8 @@ C_GetOperationState(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pOperationState,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetOperationState, hSession, SPY_MECH_NONE,
+			(hSession, pOperationState, pulOperationStateLen));
 	enter("C_GetOperationState");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_GetOperationState(hSession, pOperationState, pulOperationStateLen);
@@ -601,6 +1049,8 @@ C_SetOperationState(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pOperationState, CK_
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SetOperationState, hSession, SPY_MECH_NONE,
+			(hSession, pOperationState, ulOperationStateLen, hEncryptionKey, hAuthenticationKey));
 	enter("SetOperationState");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pOperationState[ulOperationStateLen]", pOperationState, ulOperationStateLen);
@@ -617,6 +1067,7 @@ C_Login(CK_SESSION_HANDLE hSession, CK_USER_TYPE userType,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_Login, hSession, SPY_MECH_NONE, (hSession, userType, pPin, ulPinLen));
 	enter("C_Login");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "[in] userType = %s\n",
@@ -630,6 +1081,7 @@ CK_RV
 C_Logout(CK_SESSION_HANDLE hSession)
 {
 	CK_RV rv;
+	SPY_STATS(C_Logout, hSession, SPY_MECH_NONE, (hSession));
 	enter("C_Logout");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_Logout(hSession);
@@ -642,6 +1094,8 @@ C_CreateObject(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG
 {
 	CK_RV rv;
 
+	SPY_STATS(C_CreateObject, hSession, SPY_MECH_NONE,
+			(hSession, pTemplate, ulCount, phObject));
 	enter("C_CreateObject");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_attribute_list_in("pTemplate", pTemplate, ulCount);
@@ -660,6 +1114,8 @@ C_CopyObject(CK_SESSION_HANDLE hSession,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_CopyObject, hSession, SPY_MECH_NONE,
+			(hSession, hObject, pTemplate, ulCount, phNewObject));
 	enter("C_CopyObject");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_ulong_in("hObject", hObject);
@@ -676,6 +1132,7 @@ C_DestroyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DestroyObject, hSession, SPY_MECH_NONE, (hSession, hObject));
 	enter("C_DestroyObject");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_ulong_in("hObject", hObject);
@@ -688,6 +1145,7 @@ C_GetObjectSize(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject, CK_ULONG_P
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetObjectSize, hSession, SPY_MECH_NONE, (hSession, hObject, pulSize));
 	enter("C_GetObjectSize");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_ulong_in("hObject", hObject);
@@ -704,6 +1162,8 @@ C_GetAttributeValue(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetAttributeValue, hSession, SPY_MECH_NONE,
+			(hSession, hObject, pTemplate, ulCount));
 	enter("C_GetAttributeValue");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_ulong_in("hObject", hObject);
@@ -728,6 +1188,8 @@ C_SetAttributeValue(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SetAttributeValue, hSession, SPY_MECH_NONE,
+			(hSession, hObject, pTemplate, ulCount));
 	enter("C_SetAttributeValue");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_ulong_in("hObject", hObject);
@@ -741,6 +1203,7 @@ C_FindObjectsInit(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemplate, CK_ULO
 {
 	CK_RV rv;
 
+	SPY_STATS(C_FindObjectsInit, hSession, SPY_MECH_NONE, (hSession, pTemplate, ulCount));
 	enter("C_FindObjectsInit");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_attribute_list_in("pTemplate", pTemplate, ulCount);
@@ -754,6 +1217,8 @@ C_FindObjects(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE_PTR phObject, CK_ULON
 {
 	CK_RV rv;
 
+	SPY_STATS(C_FindObjects, hSession, SPY_MECH_NONE,
+			(hSession, phObject, ulMaxObjectCount, pulObjectCount));
 	enter("C_FindObjects");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_ulong_in("ulMaxObjectCount", ulMaxObjectCount);
@@ -772,6 +1237,7 @@ C_FindObjectsFinal(CK_SESSION_HANDLE hSession)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_FindObjectsFinal, hSession, SPY_MECH_NONE, (hSession));
 	enter("C_FindObjectsFinal");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_FindObjectsFinal(hSession);
@@ -783,6 +1249,7 @@ C_EncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT
 {
 	CK_RV rv;
 
+	SPY_STATS(C_EncryptInit, hSession, pMechanism->mechanism, (hSession, pMechanism, hKey));
 	enter("C_EncryptInit");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -797,6 +1264,8 @@ C_Encrypt(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG  ulDataLen,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_Encrypt, hSession, SPY_MECH_SESSION,
+			(hSession, pData, ulDataLen, pEncryptedData, pulEncryptedDataLen));
 	enter("C_Encrypt");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pData[ulDataLen]", pData, ulDataLen);
@@ -812,6 +1281,8 @@ C_EncryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG  ulPartL
 {
 	CK_RV rv;
 
+	SPY_STATS(C_EncryptUpdate, hSession, SPY_MECH_SESSION,
+			(hSession, pPart, ulPartLen, pEncryptedPart, pulEncryptedPartLen));
 	enter("C_EncryptUpdate");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pPart[ulPartLen]", pPart, ulPartLen);
@@ -826,6 +1297,8 @@ C_EncryptFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pLastEncryptedPart, CK_UL
 {
 	CK_RV rv;
 
+	SPY_STATS(C_EncryptFinal, hSession, SPY_MECH_SESSION,
+			(hSession, pLastEncryptedPart, pulLastEncryptedPartLen));
 	enter("C_EncryptFinal");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_EncryptFinal(hSession, pLastEncryptedPart, pulLastEncryptedPartLen);
@@ -841,6 +1314,7 @@ C_DecryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DecryptInit, hSession, pMechanism->mechanism, (hSession, pMechanism, hKey));
 	enter("C_DecryptInit");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -855,6 +1329,8 @@ C_Decrypt(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedData, CK_ULONG  ulEn
 {
 	CK_RV rv;
 
+	SPY_STATS(C_Decrypt, hSession, SPY_MECH_SESSION,
+			(hSession, pEncryptedData, ulEncryptedDataLen, pData, pulDataLen));
 	enter("C_Decrypt");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pEncryptedData[ulEncryptedDataLen]", pEncryptedData, ulEncryptedDataLen);
@@ -871,6 +1347,8 @@ C_DecryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedPart, CK_ULONG
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DecryptUpdate, hSession, SPY_MECH_SESSION,
+			(hSession, pEncryptedPart, ulEncryptedPartLen, pPart, pulPartLen));
 	enter("C_DecryptUpdate");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pEncryptedPart[ulEncryptedPartLen]", pEncryptedPart, ulEncryptedPartLen);
@@ -886,6 +1364,8 @@ C_DecryptFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pLastPart, CK_ULONG_PTR p
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DecryptFinal, hSession, SPY_MECH_SESSION,
+			(hSession, pLastPart, pulLastPartLen));
 	enter("C_DecryptFinal");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_DecryptFinal(hSession, pLastPart, pulLastPartLen);
@@ -900,6 +1380,7 @@ C_DigestInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DigestInit, hSession, pMechanism->mechanism, (hSession, pMechanism));
 	enter("C_DigestInit");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -913,6 +1394,8 @@ C_Digest(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG  ulDataLen,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_Digest, hSession, SPY_MECH_SESSION,
+			(hSession, pData, ulDataLen, pDigest, pulDigestLen));
 	enter("C_Digest");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pData[ulDataLen]", pData, ulDataLen);
@@ -928,6 +1411,7 @@ C_DigestUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG  ulPartLe
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DigestUpdate, hSession, SPY_MECH_SESSION, (hSession, pPart, ulPartLen));
 	enter("C_DigestUpdate");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pPart[ulPartLen]", pPart, ulPartLen);
@@ -940,6 +1424,7 @@ C_DigestKey(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DigestKey, hSession, SPY_MECH_SESSION, (hSession, hKey));
 	enter("C_DigestKey");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_ulong_in("hKey", hKey);
@@ -952,6 +1437,7 @@ C_DigestFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pDigest, CK_ULONG_PTR pulD
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DigestFinal, hSession, SPY_MECH_SESSION, (hSession, pDigest, pulDigestLen));
 	enter("C_DigestFinal");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_DigestFinal(hSession, pDigest, pulDigestLen);
@@ -966,6 +1452,7 @@ C_SignInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HA
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SignInit, hSession, pMechanism->mechanism, (hSession, pMechanism, hKey));
 	enter("C_SignInit");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -980,6 +1467,8 @@ C_Sign(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG  ulDataLen,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_Sign, hSession, SPY_MECH_SESSION,
+			(hSession, pData, ulDataLen, pSignature, pulSignatureLen));
 	enter("C_Sign");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pData[ulDataLen]", pData, ulDataLen);
@@ -995,6 +1484,7 @@ C_SignUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG  ulPartLen)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SignUpdate, hSession, SPY_MECH_SESSION, (hSession, pPart, ulPartLen));
 	enter("C_SignUpdate");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pPart[ulPartLen]", pPart, ulPartLen);
@@ -1007,6 +1497,7 @@ C_SignFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pSignature, CK_ULONG_PTR pul
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SignFinal, hSession, SPY_MECH_SESSION, (hSession, pSignature, pulSignatureLen));
 	enter("C_SignFinal");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_SignFinal(hSession, pSignature, pulSignatureLen);
@@ -1021,6 +1512,7 @@ C_SignRecoverInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OB
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SignRecoverInit, hSession, pMechanism->mechanism, (hSession, pMechanism, hKey));
 	enter("C_SignRecoverInit");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n",
@@ -1036,6 +1528,8 @@ C_SignRecover(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG  ulDataLen
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SignRecover, hSession, SPY_MECH_SESSION,
+			(hSession, pData, ulDataLen, pSignature, pulSignatureLen));
 	enter("C_SignRecover");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pData[ulDataLen]", pData, ulDataLen);
@@ -1050,6 +1544,7 @@ C_VerifyInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_
 {
 	CK_RV rv;
 
+	SPY_STATS(C_VerifyInit, hSession, pMechanism->mechanism, (hSession, pMechanism, hKey));
 	enter("C_VerifyInit");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -1064,6 +1559,8 @@ C_Verify(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG  ulDataLen,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_Verify, hSession, SPY_MECH_SESSION,
+			(hSession, pData, ulDataLen, pSignature, ulSignatureLen));
 	enter("C_Verify");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pData[ulDataLen]", pData, ulDataLen);
@@ -1077,6 +1574,7 @@ C_VerifyUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG  ulPartLe
 {
 	CK_RV rv;
 
+	SPY_STATS(C_VerifyUpdate, hSession, SPY_MECH_SESSION, (hSession, pPart, ulPartLen));
 	enter("C_VerifyUpdate");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pPart[ulPartLen]", pPart, ulPartLen);
@@ -1089,6 +1587,8 @@ C_VerifyFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pSignature, CK_ULONG  ulSi
 {
 	CK_RV rv;
 
+	SPY_STATS(C_VerifyFinal, hSession, SPY_MECH_SESSION,
+			(hSession, pSignature, ulSignatureLen));
 	enter("C_VerifyFinal");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pSignature[ulSignatureLen]", pSignature, ulSignatureLen);
@@ -1103,6 +1603,8 @@ C_VerifyRecoverInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_VerifyRecoverInit, hSession, pMechanism->mechanism,
+			(hSession, pMechanism, hKey));
 	enter("C_VerifyRecoverInit");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -1117,6 +1619,8 @@ C_VerifyRecover(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pSignature, CK_ULONG  ul
 {
 	CK_RV rv;
 
+	SPY_STATS(C_VerifyRecover, hSession, SPY_MECH_SESSION,
+			(hSession, pSignature, ulSignatureLen, pData, pulDataLen));
 	enter("C_VerifyRecover");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pSignature[ulSignatureLen]", pSignature, ulSignatureLen);
@@ -1132,6 +1636,8 @@ C_DigestEncryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG  u
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DigestEncryptUpdate, hSession, SPY_MECH_NONE,
+			(hSession, pPart, ulPartLen, pEncryptedPart, pulEncryptedPartLen));
 	enter("C_DigestEncryptUpdate");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pPart[ulPartLen]", pPart, ulPartLen);
@@ -1148,6 +1654,8 @@ C_DecryptDigestUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedPart,CK_
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DecryptDigestUpdate, hSession, SPY_MECH_NONE,
+			(hSession, pEncryptedPart, ulEncryptedPartLen, pPart, pulPartLen));
 	enter("C_DecryptDigestUpdate");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pEncryptedPart[ulEncryptedPartLen]", pEncryptedPart, ulEncryptedPartLen);
@@ -1163,6 +1671,8 @@ C_SignEncryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG  ulP
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SignEncryptUpdate, hSession, SPY_MECH_NONE,
+			(hSession, pPart, ulPartLen, pEncryptedPart, pulEncryptedPartLen));
 	enter("C_SignEncryptUpdate");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pPart[ulPartLen]", pPart, ulPartLen);
@@ -1179,6 +1689,8 @@ C_DecryptVerifyUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedPart, CK
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DecryptVerifyUpdate, hSession, SPY_MECH_NONE,
+			(hSession, pEncryptedPart, ulEncryptedPartLen, pPart, pulPartLen));
 	enter("C_DecryptVerifyUpdate");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pEncryptedPart[ulEncryptedPartLen]", pEncryptedPart, ulEncryptedPartLen);
@@ -1196,6 +1708,8 @@ C_GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GenerateKey, hSession, pMechanism->mechanism,
+			(hSession, pMechanism, pTemplate, ulCount, phKey));
 	enter("C_GenerateKey");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -1215,6 +1729,8 @@ C_GenerateKeyPair(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GenerateKeyPair, hSession, pMechanism->mechanism,
+			(hSession, pMechanism, pPublicKeyTemplate, ulPublicKeyAttributeCount, pPrivateKeyTemplate, ulPrivateKeyAttributeCount, phPublicKey, phPrivateKey));
 	enter("C_GenerateKeyPair");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -1238,6 +1754,8 @@ C_WrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_WrapKey, hSession, pMechanism->mechanism,
+			(hSession, pMechanism, hWrappingKey, hKey, pWrappedKey, pulWrappedKeyLen));
 	enter("C_WrapKey");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -1258,6 +1776,8 @@ C_UnwrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
 {
 	CK_RV rv;
 
+	SPY_STATS(C_UnwrapKey, hSession, pMechanism->mechanism,
+			(hSession, pMechanism, hUnwrappingKey, pWrappedKey, ulWrappedKeyLen, pTemplate, ulAttributeCount, phKey));
 	enter("C_UnwrapKey");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -1277,6 +1797,8 @@ C_DeriveKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_H
 {
 	CK_RV rv;
 
+	SPY_STATS(C_DeriveKey, hSession, pMechanism->mechanism,
+			(hSession, pMechanism, hBaseKey, pTemplate, ulAttributeCount, phKey));
 	enter("C_DeriveKey");
 	spy_dump_ulong_in("hSession", hSession);
 	fprintf(spy_output, "pMechanism->type=%s\n", lookup_enum(MEC_T, pMechanism->mechanism));
@@ -1294,6 +1816,7 @@ C_SeedRandom(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pSeed, CK_ULONG  ulSeedLen)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_SeedRandom, hSession, SPY_MECH_NONE, (hSession, pSeed, ulSeedLen));
 	enter("C_SeedRandom");
 	spy_dump_ulong_in("hSession", hSession);
 	spy_dump_string_in("pSeed[ulSeedLen]", pSeed, ulSeedLen);
@@ -1306,6 +1829,7 @@ C_GenerateRandom(CK_SESSION_HANDLE hSession, CK_BYTE_PTR RandomData, CK_ULONG  u
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GenerateRandom, hSession, SPY_MECH_NONE, (hSession, RandomData, ulRandomLen));
 	enter("C_GenerateRandom");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_GenerateRandom(hSession, RandomData, ulRandomLen);
@@ -1319,6 +1843,7 @@ C_GetFunctionStatus(CK_SESSION_HANDLE hSession)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_GetFunctionStatus, hSession, SPY_MECH_NONE, (hSession));
 	enter("C_GetFunctionStatus");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_GetFunctionStatus(hSession);
@@ -1330,6 +1855,7 @@ C_CancelFunction(CK_SESSION_HANDLE hSession)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_CancelFunction, hSession, SPY_MECH_NONE, (hSession));
 	enter("C_CancelFunction");
 	spy_dump_ulong_in("hSession", hSession);
 	rv = po->C_CancelFunction(hSession);
@@ -1341,6 +1867,7 @@ C_WaitForSlotEvent(CK_FLAGS flags, CK_SLOT_ID_PTR pSlot, CK_VOID_PTR pRserved)
 {
 	CK_RV rv;
 
+	SPY_STATS(C_WaitForSlotEvent, CK_INVALID_HANDLE, SPY_MECH_NONE, (flags, pSlot, pRserved));
 	enter("C_WaitForSlotEvent");
 	spy_dump_ulong_in("flags", flags);
 	rv = po->C_WaitForSlotEvent(flags, pSlot, pRserved);
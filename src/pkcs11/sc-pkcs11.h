@@ -83,6 +83,7 @@ struct sc_pkcs11_config {
 	unsigned int zero_ckaid_for_ca_certs;
 	unsigned int create_slots_flags;
 	unsigned char ignore_pin_length;
+	unsigned int operation_timeout;	/* milliseconds per call, 0: none */
 };
 
 /*
@@ -234,6 +235,10 @@ enum {
 	SC_PKCS11_OPERATION_MAX
 };
 
+/* Digest contexts a session keeps for reuse: enough for a digest and
+ * a sign-with-hash operation running side by side */
+#define SC_PKCS11_MD_CACHE_SIZE	2
+
 /* This describes a PKCS11 mechanism */
 struct sc_pkcs11_mechanism_type {
 	CK_MECHANISM_TYPE mech;		/* algorithm: md5, sha1, ... */
@@ -311,6 +316,8 @@ struct sc_pkcs11_session {
 	CK_VOID_PTR notify_data;
 	/* Active operations - one per type */
 	struct sc_pkcs11_operation *operation[SC_PKCS11_OPERATION_MAX];
+	/* Digest contexts released by finished operations, kept for reuse */
+	void *md_cache[SC_PKCS11_MD_CACHE_SIZE];
 };
 typedef struct sc_pkcs11_session sc_pkcs11_session_t;
 
@@ -353,6 +360,7 @@ CK_RV session_start_operation(struct sc_pkcs11_session *,
 CK_RV session_get_operation(struct sc_pkcs11_session *, int,
 			struct sc_pkcs11_operation **);
 CK_RV session_stop_operation(struct sc_pkcs11_session *, int);
+void session_release(struct sc_pkcs11_session *);
 CK_RV sc_pkcs11_close_all_sessions(CK_SLOT_ID);
 
 /* Generic secret key stuff */
@@ -382,11 +390,15 @@ CK_RV sc_pkcs11_get_mechanism_info(struct sc_pkcs11_card *, CK_MECHANISM_TYPE,
 CK_RV sc_pkcs11_md_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR);
 CK_RV sc_pkcs11_md_update(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG);
 CK_RV sc_pkcs11_md_final(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_md_digest(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG,
+				CK_BYTE_PTR, CK_ULONG_PTR);
 CK_RV sc_pkcs11_sign_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR,
 				struct sc_pkcs11_object *, CK_MECHANISM_TYPE);
 CK_RV sc_pkcs11_sign_update(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG);
 CK_RV sc_pkcs11_sign_final(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG_PTR);
 CK_RV sc_pkcs11_sign_size(struct sc_pkcs11_session *, CK_ULONG_PTR);
+CK_RV sc_pkcs11_sign_data(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG,
+				CK_BYTE_PTR, CK_ULONG_PTR);
 #ifdef ENABLE_OPENSSL
 CK_RV sc_pkcs11_verif_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR,
 				struct sc_pkcs11_object *, CK_MECHANISM_TYPE);
@@ -409,6 +421,7 @@ void sc_pkcs11_release_operation(sc_pkcs11_operation_t **);
 CK_RV sc_pkcs11_register_generic_mechanisms(struct sc_pkcs11_card *);
 #ifdef ENABLE_OPENSSL
 void sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *);
+void sc_pkcs11_openssl_md_cache_free(struct sc_pkcs11_session *);
 #endif
 CK_RV sc_pkcs11_register_sign_and_hash_mechanism(struct sc_pkcs11_card *,
 				CK_MECHANISM_TYPE, CK_MECHANISM_TYPE,
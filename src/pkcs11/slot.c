@@ -151,8 +151,14 @@ CK_RV card_removed(sc_reader_t * reader)
 		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
 		if (slot->reader == reader) {
 			/* Save the "card" object */
-			if (slot->card)
+			if (slot->card && card == NULL) {
 				card = slot->card;
+				/* Let the logout and unbind APDUs through, even after
+				 * sc_cancel() in C_Finalize(): with lock_login the card
+				 * lock is never released to refresh the cancel count */
+				card->card->cancel_count = context->cancel_count;
+				sc_set_card_deadline(card->card, 0);
+			}
 			slot_token_removed(slot->id);
 		}
 	}
@@ -266,12 +272,11 @@ again:
 		sc_log(context, "%s: Detected framework %d. Creating tokens.", reader->name, i);
 		/* Bind 'generic' application or (emulated?) card without applications */
 		if (app_generic || !p11card->card->app_count)   {
-			scconf_block *atrblock = NULL;
-			int enable_InitToken = 0;
+			struct sc_conf_snapshot *conf = sc_ctx_get_conf(context);
+			const struct sc_conf_atr *atr_conf = sc_conf_match_atr(conf, &p11card->reader->atr);
+			int enable_InitToken = atr_conf ? atr_conf->pkcs11_enable_init_token : 0;
 
-			atrblock = sc_match_atr_block(p11card->card->ctx, NULL, &p11card->reader->atr);
-			if (atrblock)
-				enable_InitToken = scconf_get_bool(atrblock, "pkcs11_enable_InitToken", 0);
+			sc_ctx_put_conf(context, conf);
 
 			sc_log(context, "%s: Try to bind 'generic' token.", reader->name);
 			rv = frameworks[i]->bind(p11card, app_generic);
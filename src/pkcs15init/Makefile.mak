@@ -1,7 +1,7 @@
 TOPDIR = ..\..
 
 TARGET = pkcs15init.lib
-OBJECTS = pkcs15-lib.obj profile.obj \
+OBJECTS = pkcs15-lib.obj profile.obj profile-cache.obj \
           pkcs15-gpk.obj pkcs15-miocos.obj pkcs15-cflex.obj \
           pkcs15-cardos.obj pkcs15-jcop.obj pkcs15-starcos.obj \
           pkcs15-oberthur.obj pkcs15-oberthur-awp.obj \
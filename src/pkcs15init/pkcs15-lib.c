@@ -83,6 +83,10 @@
 /* Maximal number of access conditions that can be defined for one card operation. */
 #define SC_MAX_OP_ACS                   16
 
+/* Unchanged gaps shorter than this are rewritten rather than
+ * splitting a differential DF update into one more APDU */
+#define DF_DIFF_MERGE_GAP		16
+
 /* Handle encoding of PKCS15 on the card */
 typedef int	(*pkcs15_encoder)(struct sc_context *,
 			struct sc_pkcs15_card *, u8 **, size_t *);
@@ -101,6 +105,8 @@ static int	sc_pkcs15init_update_lastupdate(struct sc_pkcs15_card *,
 			struct sc_profile *profile);
 static int	sc_pkcs15init_update_odf(struct sc_pkcs15_card *,
 			struct sc_profile *profile);
+static int	sc_pkcs15init_update_df_file(struct sc_profile *, struct sc_pkcs15_card *,
+			struct sc_pkcs15_df *, struct sc_file *, unsigned char *, size_t);
 static int	sc_pkcs15init_map_usage(unsigned long, int);
 static int	do_select_parent(struct sc_profile *, struct sc_pkcs15_card *,
 			struct sc_file *, struct sc_file **);
@@ -2678,7 +2684,7 @@ sc_pkcs15init_update_any_df(struct sc_pkcs15_card *p15card,
 
 	r = sc_pkcs15_encode_df(card->ctx, p15card, df, &buf, &bufsize);
 	if (r >= 0) {
-		r = sc_pkcs15init_update_file(profile, p15card, file, buf, bufsize);
+		r = sc_pkcs15init_update_df_file(profile, p15card, df, file, buf, bufsize);
 
 		/* For better performance and robustness, we want
 		 * to note which portion of the file actually
@@ -2709,6 +2715,136 @@ sc_pkcs15init_update_any_df(struct sc_pkcs15_card *p15card,
 	LOG_FUNC_RETURN(ctx, r > 0 ? SC_SUCCESS : r);
 }
 
+/*
+ * Write back an encoded DF.
+ *
+ * When the last on-card content of the DF is known (see sc_pkcs15_parse_df),
+ * only the byte ranges that differ from it are written. Otherwise, or if
+ * the DF is not a transparent EF, the whole file is updated.
+ */
+static int
+sc_pkcs15init_update_df_file(struct sc_profile *profile, struct sc_pkcs15_card *p15card,
+		struct sc_pkcs15_df *df, struct sc_file *file,
+		unsigned char *buf, size_t bufsize)
+{
+	struct sc_context *ctx = p15card->card->ctx;
+	struct sc_card	*card = p15card->card;
+	struct sc_file	*selected_file = NULL;
+	unsigned char	*image = NULL;
+	size_t		max_lc = card->max_send_size > 0 ? card->max_send_size : 255;
+	size_t		image_len, offs, written = 0;
+	unsigned int	apdus = 0, full_apdus;
+	int		r;
+
+	LOG_FUNC_CALLED(ctx);
+	if (!file)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
+
+	profile->df_stats.updates++;
+
+	if (df->image == NULL)
+		goto full_update;
+
+	r = sc_select_file(card, &file->path, &selected_file);
+	if (r < 0 || selected_file->ef_structure != SC_FILE_EF_TRANSPARENT
+			|| selected_file->size < bufsize || selected_file->size == 0)
+		goto full_update;
+
+	/* Expected on-card content after the update: encoded DF
+	 * zero-padded to the file size, as sc_pkcs15init_update_file() does */
+	image_len = selected_file->size;
+	image = calloc(1, image_len);
+	if (image == NULL)   {
+		sc_file_free(selected_file);
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+	}
+	memcpy(image, buf, bufsize);
+
+	r = sc_pkcs15init_authenticate(profile, p15card, file, SC_AC_OP_UPDATE);
+	if (r < 0)
+		goto done;
+
+	for (offs = 0; offs < image_len; )   {
+		size_t start, end, gap;
+
+		/* Bytes beyond the known image have to be written anyway */
+		if (offs < df->image_len && image[offs] == df->image[offs])   {
+			offs++;
+			continue;
+		}
+
+		start = offs;
+		for (end = start + 1, gap = 0; end < image_len && gap < DF_DIFF_MERGE_GAP; end++)   {
+			if (end < df->image_len && image[end] == df->image[end])
+				gap++;
+			else
+				gap = 0;
+		}
+		end -= gap;
+
+		r = sc_update_binary(card, start, image + start, end - start, 0);
+		if (r < 0)
+			goto done;
+
+		written += end - start;
+		apdus += (end - start + max_lc - 1) / max_lc;
+		offs = end;
+	}
+
+	full_apdus = (image_len + max_lc - 1) / max_lc;
+	profile->df_stats.diff_updates++;
+	profile->df_stats.bytes_written += written;
+	profile->df_stats.bytes_skipped += image_len - written;
+	profile->df_stats.apdus += apdus;
+	if (full_apdus > apdus)
+		profile->df_stats.apdus_saved += full_apdus - apdus;
+
+	sc_log(ctx, "DF %s: %lu of %lu bytes written in %u APDUs",
+			sc_print_path(&file->path), (unsigned long)written,
+			(unsigned long)image_len, apdus);
+
+	free(df->image);
+	df->image = image;
+	df->image_len = image_len;
+	image = NULL;
+	r = 0;
+
+done:
+	if (r < 0)   {
+		/* On-card content is unknown now */
+		free(df->image);
+		df->image = NULL;
+		df->image_len = 0;
+	}
+	if (image)
+		free(image);
+	sc_file_free(selected_file);
+	LOG_FUNC_RETURN(ctx, r);
+
+full_update:
+	if (selected_file)
+		sc_file_free(selected_file);
+
+	r = sc_pkcs15init_update_file(profile, p15card, file, buf, bufsize);
+	if (df->image)
+		free(df->image);
+	df->image = NULL;
+	df->image_len = 0;
+	if (r >= 0)   {
+		profile->df_stats.bytes_written += bufsize;
+		profile->df_stats.apdus += (bufsize + max_lc - 1) / max_lc;
+
+		/* The tail of the file beyond bufsize is not accounted in the image,
+		 * the next differential update will rewrite it */
+		df->image = malloc(bufsize);
+		if (df->image)   {
+			memcpy(df->image, buf, bufsize);
+			df->image_len = bufsize;
+		}
+	}
+	LOG_FUNC_RETURN(ctx, r);
+}
+
 /*
  * Add an object to one of the pkcs15 directory files.
  */
@@ -2882,7 +3018,7 @@ sc_pkcs15init_change_attrib(struct sc_pkcs15_card *p15card, struct sc_profile *p
 			r = sc_profile_get_file_by_path(profile, &df->path, &file);
 			LOG_TEST_RET(ctx, r, "Cannot instantiate file by path");
 
-			r = sc_pkcs15init_update_file(profile, p15card, file, buf, bufsize);
+			r = sc_pkcs15init_update_df_file(profile, p15card, df, file, buf, bufsize);
 			free(buf);
 			sc_file_free(file);
 		}
@@ -0,0 +1,506 @@
+/*
+ * profile-cache.c: Cache of the parsed pkcs15init profiles
+ *
+ * The scconf tree of a profile file is stored in a compact binary form
+ * in the OpenSC cache directory. On the next load the cache file is
+ * memory-mapped and the tree is rebuilt without running the lexer, as
+ * long as the profile file has the same modification time, size and
+ * content hash as when the cache entry was written.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_IO_H
+#include <io.h>
+#endif
+#ifdef _WIN32
+#include <process.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "libopensc/opensc.h"
+#include "libopensc/log.h"
+#include "scconf/scconf.h"
+#include "profile.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define PROFILE_CACHE_MAGIC	"SCPF"
+/* Bump whenever the layout below changes */
+#define PROFILE_CACHE_VERSION	1
+
+/*
+ * Layout (all integers are 32 bit big endian, 64 bit values as two of them):
+ *	magic[4] version mtime[8] size[8] hash[8]
+ *	block:	name-list item-count item*
+ *	item:	type key-string (block | list)
+ *	list:	count string*
+ *	string:	length bytes
+ * Comments are not stored, the profile parser does not use them.
+ */
+#define PROFILE_CACHE_HEADER_LEN	(4 + 4 + 8 + 8 + 8)
+
+struct cache_buf {
+	unsigned char *data;
+	size_t len, size;
+	int error;
+};
+
+struct cache_reader {
+	const unsigned char *p, *end;
+};
+
+/* FNV-1a, good enough to detect a changed profile */
+static unsigned long long
+profile_cache_hash(const unsigned char *data, size_t len)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	size_t ii;
+
+	for (ii = 0; ii < len; ii++) {
+		hash ^= data[ii];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static void
+put_bytes(struct cache_buf *buf, const void *data, size_t len)
+{
+	if (buf->error || len == 0)
+		return;
+	if (buf->len + len > buf->size) {
+		size_t size = buf->size ? buf->size * 2 : 4096;
+		unsigned char *p;
+
+		while (size < buf->len + len)
+			size *= 2;
+		p = realloc(buf->data, size);
+		if (p == NULL) {
+			buf->error = 1;
+			return;
+		}
+		buf->data = p;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void
+put_u32(struct cache_buf *buf, unsigned long val)
+{
+	unsigned char b[4];
+
+	b[0] = (val >> 24) & 0xFF;
+	b[1] = (val >> 16) & 0xFF;
+	b[2] = (val >> 8) & 0xFF;
+	b[3] = val & 0xFF;
+	put_bytes(buf, b, 4);
+}
+
+static void
+put_u64(struct cache_buf *buf, unsigned long long val)
+{
+	put_u32(buf, (unsigned long) (val >> 32));
+	put_u32(buf, (unsigned long) (val & 0xFFFFFFFFUL));
+}
+
+static void
+put_string(struct cache_buf *buf, const char *str)
+{
+	size_t len = str ? strlen(str) : 0;
+
+	put_u32(buf, len);
+	put_bytes(buf, str, len);
+}
+
+static void
+put_list(struct cache_buf *buf, const scconf_list *list)
+{
+	const scconf_list *lp;
+	unsigned long count = 0;
+
+	for (lp = list; lp; lp = lp->next)
+		count++;
+	put_u32(buf, count);
+	for (lp = list; lp; lp = lp->next)
+		put_string(buf, lp->data);
+}
+
+static void
+put_block(struct cache_buf *buf, const scconf_block *block)
+{
+	const scconf_item *item;
+	unsigned long count = 0;
+
+	put_list(buf, block->name);
+	for (item = block->items; item; item = item->next)
+		if (item->type != SCCONF_ITEM_TYPE_COMMENT)
+			count++;
+	put_u32(buf, count);
+
+	for (item = block->items; item; item = item->next) {
+		if (item->type == SCCONF_ITEM_TYPE_COMMENT)
+			continue;
+		put_u32(buf, item->type);
+		put_string(buf, item->key);
+		if (item->type == SCCONF_ITEM_TYPE_BLOCK)
+			put_block(buf, item->value.block);
+		else
+			put_list(buf, item->value.list);
+	}
+}
+
+static int
+get_u32(struct cache_reader *rd, unsigned long *val)
+{
+	if (rd->end - rd->p < 4)
+		return -1;
+	*val = ((unsigned long) rd->p[0] << 24) | ((unsigned long) rd->p[1] << 16)
+		| ((unsigned long) rd->p[2] << 8) | rd->p[3];
+	rd->p += 4;
+	return 0;
+}
+
+static int
+get_u64(struct cache_reader *rd, unsigned long long *val)
+{
+	unsigned long hi, lo;
+
+	if (get_u32(rd, &hi) || get_u32(rd, &lo))
+		return -1;
+	*val = ((unsigned long long) hi << 32) | lo;
+	return 0;
+}
+
+static char *
+get_string(struct cache_reader *rd)
+{
+	unsigned long len;
+	char *str;
+
+	if (get_u32(rd, &len) || (unsigned long) (rd->end - rd->p) < len)
+		return NULL;
+	str = malloc(len + 1);
+	if (str == NULL)
+		return NULL;
+	memcpy(str, rd->p, len);
+	str[len] = '\0';
+	rd->p += len;
+	return str;
+}
+
+static int
+get_list(struct cache_reader *rd, scconf_list **list)
+{
+	scconf_list **tail = list;
+	unsigned long count;
+
+	if (get_u32(rd, &count))
+		return -1;
+	while (count--) {
+		scconf_list *lp = calloc(1, sizeof(scconf_list));
+
+		if (lp == NULL)
+			return -1;
+		*tail = lp;
+		tail = &lp->next;
+		lp->data = get_string(rd);
+		if (lp->data == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+get_block(struct cache_reader *rd, scconf_block *block, int depth)
+{
+	scconf_item **tail = &block->items;
+	unsigned long count, type;
+
+	/* Profiles are not nested that deep; a corrupt cache could be */
+	if (depth > 64)
+		return -1;
+	if (get_list(rd, &block->name) || get_u32(rd, &count))
+		return -1;
+
+	while (count--) {
+		scconf_item *item = calloc(1, sizeof(scconf_item));
+
+		if (item == NULL)
+			return -1;
+		*tail = item;
+		tail = &item->next;
+
+		if (get_u32(rd, &type))
+			return -1;
+		item->type = type;
+		item->key = get_string(rd);
+		if (item->key == NULL)
+			return -1;
+
+		if (type == SCCONF_ITEM_TYPE_BLOCK) {
+			item->value.block = calloc(1, sizeof(scconf_block));
+			if (item->value.block == NULL)
+				return -1;
+			item->value.block->parent = block;
+			if (get_block(rd, item->value.block, depth + 1))
+				return -1;
+		}
+		else if (type == SCCONF_ITEM_TYPE_VALUE) {
+			if (get_list(rd, &item->value.list))
+				return -1;
+		}
+		else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+profile_cache_filename(struct sc_context *ctx, const char *path, char *buf, size_t bufsize)
+{
+	char dir[PATH_MAX];
+	int r;
+
+	r = sc_get_cache_dir(ctx, dir, sizeof(dir));
+	if (r)
+		return r;
+	r = snprintf(buf, bufsize, "%s/profile_%016llx", dir,
+			profile_cache_hash((const unsigned char *) path, strlen(path)));
+	if (r < 0 || (size_t) r >= bufsize)
+		return SC_ERROR_BUFFER_TOO_SMALL;
+	return SC_SUCCESS;
+}
+
+/*
+ * Read the profile file itself, to get the key the cache entry is checked against.
+ */
+static int
+profile_source_key(const char *path, unsigned long long *mtime,
+		unsigned long long *size, unsigned long long *hash)
+{
+	struct stat st;
+	unsigned char *data;
+	FILE *f;
+	int r = SC_SUCCESS;
+
+	f = fopen(path, "rb");
+	if (f == NULL)
+		return SC_ERROR_FILE_NOT_FOUND;
+	if (fstat(fileno(f), &st)) {
+		fclose(f);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+
+	data = malloc(st.st_size ? st.st_size : 1);
+	if (data == NULL) {
+		fclose(f);
+		return SC_ERROR_OUT_OF_MEMORY;
+	}
+	if (fread(data, 1, st.st_size, f) != (size_t) st.st_size)
+		r = SC_ERROR_FILE_NOT_FOUND;
+	fclose(f);
+
+	*mtime = st.st_mtime;
+	*size = st.st_size;
+	*hash = profile_cache_hash(data, st.st_size);
+	free(data);
+	return r;
+}
+
+static int
+profile_cache_load(struct sc_context *ctx, const char *cache_path,
+		unsigned long long mtime, unsigned long long size, unsigned long long hash,
+		scconf_context *conf)
+{
+	struct cache_reader rd;
+	struct stat st;
+	unsigned char *map;
+	unsigned long version;
+	unsigned long long c_mtime, c_size, c_hash;
+	int fd, r = SC_ERROR_FILE_NOT_FOUND;
+
+	fd = open(cache_path, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return SC_ERROR_FILE_NOT_FOUND;
+	if (fstat(fd, &st) || st.st_size < PROFILE_CACHE_HEADER_LEN) {
+		close(fd);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+#else
+	map = malloc(st.st_size);
+	if (map == NULL || read(fd, map, st.st_size) != st.st_size) {
+		free(map);
+		close(fd);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+#endif
+	close(fd);
+
+	rd.p = map;
+	rd.end = map + st.st_size;
+	if (memcmp(rd.p, PROFILE_CACHE_MAGIC, 4))
+		goto out;
+	rd.p += 4;
+	if (get_u32(&rd, &version) || version != PROFILE_CACHE_VERSION)
+		goto out;
+	if (get_u64(&rd, &c_mtime) || get_u64(&rd, &c_size) || get_u64(&rd, &c_hash))
+		goto out;
+	if (c_mtime != mtime || c_size != size || c_hash != hash) {
+		sc_log(ctx, "profile cache %s is stale", cache_path);
+		goto out;
+	}
+
+	if (get_block(&rd, conf->root, 0) || rd.p != rd.end) {
+		sc_log(ctx, "profile cache %s is corrupted", cache_path);
+		r = SC_ERROR_CORRUPTED_DATA;
+		goto out;
+	}
+	r = SC_SUCCESS;
+
+out:
+#ifdef HAVE_SYS_MMAN_H
+	munmap(map, st.st_size);
+#else
+	free(map);
+#endif
+	return r;
+}
+
+static int
+profile_cache_store(struct sc_context *ctx, const char *cache_path,
+		unsigned long long mtime, unsigned long long size, unsigned long long hash,
+		const scconf_context *conf)
+{
+	struct cache_buf buf;
+	char tmp_path[PATH_MAX];
+	FILE *f;
+	int r;
+
+	memset(&buf, 0, sizeof(buf));
+	put_bytes(&buf, PROFILE_CACHE_MAGIC, 4);
+	put_u32(&buf, PROFILE_CACHE_VERSION);
+	put_u64(&buf, mtime);
+	put_u64(&buf, size);
+	put_u64(&buf, hash);
+	put_block(&buf, conf->root);
+	if (buf.error) {
+		free(buf.data);
+		return SC_ERROR_OUT_OF_MEMORY;
+	}
+
+	/* Write to a temporary file and rename it, so that concurrent
+	 * loaders never see a partially written entry */
+	r = snprintf(tmp_path, sizeof(tmp_path), "%s.%lu", cache_path, (unsigned long) getpid());
+	if (r < 0 || (size_t) r >= sizeof(tmp_path)) {
+		free(buf.data);
+		return SC_ERROR_BUFFER_TOO_SMALL;
+	}
+
+	r = SC_SUCCESS;
+	f = fopen(tmp_path, "wb");
+	/* Create the cache directory if it does not exist yet */
+	if (f == NULL && errno == ENOENT && sc_make_cache_dir(ctx) == SC_SUCCESS)
+		f = fopen(tmp_path, "wb");
+	if (f == NULL) {
+		free(buf.data);
+		return SC_ERROR_INTERNAL;
+	}
+	if (fwrite(buf.data, 1, buf.len, f) != buf.len)
+		r = SC_ERROR_INTERNAL;
+	if (fclose(f))
+		r = SC_ERROR_INTERNAL;
+	free(buf.data);
+
+	if (r == SC_SUCCESS && rename(tmp_path, cache_path))
+		r = SC_ERROR_INTERNAL;
+	if (r != SC_SUCCESS)
+		unlink(tmp_path);
+	return r;
+}
+
+/*
+ * Parse a profile file, using the binary cache when it is up to date.
+ * Cache errors are never fatal: the text profile is parsed instead.
+ */
+int
+sc_profile_parse_cached(struct sc_context *ctx, const char *path, scconf_context **out)
+{
+	scconf_context *conf;
+	char cache_path[PATH_MAX];
+	unsigned long long mtime, size, hash;
+	int r, use_cache;
+
+	LOG_FUNC_CALLED(ctx);
+	r = profile_source_key(path, &mtime, &size, &hash);
+	LOG_TEST_RET(ctx, r, "Cannot read profile");
+
+	use_cache = profile_cache_filename(ctx, path, cache_path, sizeof(cache_path)) == SC_SUCCESS;
+	if (use_cache) {
+		conf = scconf_new(path);
+		if (conf == NULL)
+			LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+
+		r = profile_cache_load(ctx, cache_path, mtime, size, hash, conf);
+		if (r == SC_SUCCESS) {
+			sc_log(ctx, "profile %s loaded from cache %s", path, cache_path);
+			*out = conf;
+			LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+		}
+		scconf_free(conf);
+	}
+
+	conf = scconf_new(path);
+	if (conf == NULL)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+	r = scconf_parse(conf);
+	if (r <= 0) {
+		scconf_free(conf);
+		LOG_FUNC_RETURN(ctx, r < 0 ? SC_ERROR_FILE_NOT_FOUND : SC_ERROR_SYNTAX_ERROR);
+	}
+
+	if (use_cache && profile_cache_store(ctx, cache_path, mtime, size, hash, conf) != SC_SUCCESS)
+		sc_log(ctx, "Cannot write profile cache %s", cache_path);
+
+	*out = conf;
+	LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+}
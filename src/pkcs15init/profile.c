@@ -327,7 +327,7 @@ sc_profile_load(struct sc_profile *profile, const char *filename)
 	scconf_context	*conf;
 	const char *profile_dir = NULL;
 	char path[PATH_MAX];
-	int             res = 0, i;
+	int             res = 0, i, use_cache = 0;
 #ifdef _WIN32
 	char temp_path[PATH_MAX];
 	DWORD temp_len;
@@ -337,6 +337,7 @@ sc_profile_load(struct sc_profile *profile, const char *filename)
 
 	LOG_FUNC_CALLED(ctx);
 	for (i = 0; ctx->conf_blocks[i]; i++) {
+		use_cache = scconf_get_bool(ctx->conf_blocks[i], "use_profile_cache", use_cache);
 		profile_dir = scconf_get_str(ctx->conf_blocks[i], "profile_dir", NULL);
 		if (profile_dir)
 			break;
@@ -375,16 +376,22 @@ sc_profile_load(struct sc_profile *profile, const char *filename)
 
 	sc_log(ctx, "Trying profile file %s", path);
 
-	conf = scconf_new(path);
-	res = scconf_parse(conf);
+	if (use_cache)   {
+		res = sc_profile_parse_cached(ctx, path, &conf);
+		LOG_TEST_RET(ctx, res, "Cannot load profile");
+	}
+	else   {
+		conf = scconf_new(path);
+		res = scconf_parse(conf);
 
-	sc_log(ctx, "profile %s loaded ok", path);
+		if (res < 0)
+			LOG_FUNC_RETURN(ctx, SC_ERROR_FILE_NOT_FOUND);
 
-	if (res < 0)
-		LOG_FUNC_RETURN(ctx, SC_ERROR_FILE_NOT_FOUND);
+		if (res == 0)
+			LOG_FUNC_RETURN(ctx, SC_ERROR_SYNTAX_ERROR);
+	}
 
-	if (res == 0)
-		LOG_FUNC_RETURN(ctx, SC_ERROR_SYNTAX_ERROR);
+	sc_log(ctx, "profile %s loaded ok", path);
 
 	res = process_conf(profile, conf);
 	scconf_free(conf);
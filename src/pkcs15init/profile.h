@@ -122,6 +122,16 @@ struct sc_profile {
 	 * has been changed) */
 	int			dirty;
 
+	/* Statistics of the PKCS15 DF write-backs */
+	struct {
+		unsigned int	updates;
+		unsigned int	diff_updates;
+		size_t		bytes_written;
+		size_t		bytes_skipped;
+		unsigned int	apdus;
+		unsigned int	apdus_saved;
+	} df_stats;
+
 	/* PKCS15 object ID style */
 	unsigned int id_style;
 
@@ -131,6 +141,7 @@ struct sc_profile {
 
 struct sc_profile *sc_profile_new(void);
 int	sc_profile_load(struct sc_profile *, const char *);
+int	sc_profile_parse_cached(struct sc_context *, const char *, scconf_context **);
 int	sc_profile_finish(struct sc_profile *, const struct sc_app_info *);
 void	sc_profile_free(struct sc_profile *);
 int	sc_profile_build_pkcs15(struct sc_profile *);
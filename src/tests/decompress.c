@@ -0,0 +1,225 @@
+/*
+ * decompress.c: micro-benchmark of the decompression routines
+ *
+ * Compresses a file (typically a certificate) with zlib and gzip framing
+ * and times decompressing it: with the buffer growing algorithm that
+ * sc_decompress_alloc() used before taking a size hint, with
+ * sc_decompress_alloc(), and with sc_decompress_alloc_ex() given the
+ * uncompressed size and a context to keep the inflate state in.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "libopensc/opensc.h"
+#include "libopensc/compression.h"
+
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+
+#define DEFAULT_ROUNDS	10000
+
+/* Growing buffer algorithm of sc_decompress_alloc() before the size hint */
+static int legacy_decompress_alloc(u8** out, size_t* outLen, const u8* in, size_t inLen, int gzip)
+{
+	z_stream gz;
+	int err;
+	int window_size = 15;
+	const int startSize = inLen < 1024 ? 2048 : inLen * 2;
+	const int blockSize = inLen < 1024 ? 512 : inLen / 2;
+	int bufferSize = startSize;
+	if(gzip)
+		window_size += 0x20;
+	memset(&gz, 0, sizeof(gz));
+
+	gz.next_in = (u8*)in;
+	gz.avail_in = inLen;
+
+	err = inflateInit2(&gz, window_size);
+	if(err != Z_OK) return -1;
+
+	*outLen = 0;
+
+	while(1) {
+		int num;
+		u8* buf = realloc(*out, bufferSize);
+		if(!buf) {
+			free(*out);
+			*out = NULL;
+			return -1;
+		}
+		*out = buf;
+		gz.next_out = buf + *outLen;
+		gz.avail_out = bufferSize - *outLen;
+
+		err = inflate(&gz, Z_FULL_FLUSH);
+		if(err != Z_STREAM_END && err != Z_OK) {
+			free(*out);
+			*out = NULL;
+			break;
+		}
+		num = bufferSize - *outLen - gz.avail_out;
+		if(num > 0) {
+			*outLen += num;
+			bufferSize += num + blockSize;
+		}
+		if(err == Z_STREAM_END) {
+			buf = realloc(buf, *outLen);
+			if(buf) {
+				*out = buf;
+			}
+			break;
+		}
+	}
+	inflateEnd(&gz);
+	return err == Z_STREAM_END ? 0 : -1;
+}
+
+static int compress_data(const u8 *in, size_t inLen, u8 **out, size_t *outLen, int gzip)
+{
+	z_stream gz;
+	size_t bound = compressBound(inLen) + 32;
+
+	memset(&gz, 0, sizeof(gz));
+	if (deflateInit2(&gz, Z_BEST_COMPRESSION, Z_DEFLATED, gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+	*out = malloc(bound);
+	if (*out == NULL) {
+		deflateEnd(&gz);
+		return -1;
+	}
+	gz.next_in = (u8 *)in;
+	gz.avail_in = inLen;
+	gz.next_out = *out;
+	gz.avail_out = bound;
+	if (deflate(&gz, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&gz);
+		free(*out);
+		return -1;
+	}
+	*outLen = gz.total_out;
+	deflateEnd(&gz);
+	return 0;
+}
+
+static double elapsed_us(struct timeval *tv1, struct timeval *tv2)
+{
+	return (tv2->tv_sec - tv1->tv_sec) * 1000000.0 + (tv2->tv_usec - tv1->tv_usec);
+}
+
+static int run(sc_context_t *ctx, const char *name, int variant, const u8 *comp, size_t compLen,
+		int gzip, const u8 *orig, size_t origLen, int rounds)
+{
+	struct timeval tv1, tv2;
+	int i, r = 0;
+
+	gettimeofday(&tv1, NULL);
+	for (i = 0; i < rounds && r == 0; i++) {
+		u8 *out = NULL;
+		size_t outLen = 0;
+
+		switch (variant) {
+		case 0:
+			r = legacy_decompress_alloc(&out, &outLen, comp, compLen, gzip);
+			break;
+		case 1:
+			r = sc_decompress_alloc(&out, &outLen, comp, compLen,
+					gzip ? COMPRESSION_GZIP : COMPRESSION_ZLIB);
+			break;
+		default:
+			r = sc_decompress_alloc_ex(ctx, &out, &outLen, comp, compLen,
+					gzip ? COMPRESSION_GZIP : COMPRESSION_ZLIB, origLen);
+			break;
+		}
+		if (r == 0 && (outLen != origLen || memcmp(out, orig, origLen) != 0))
+			r = -1;
+		free(out);
+	}
+	gettimeofday(&tv2, NULL);
+
+	if (r != 0) {
+		fprintf(stderr, "%s: decompression failed\n", name);
+		return 1;
+	}
+	printf("%-8s %-32s %8.2f us\n", gzip ? "gzip" : "zlib", name, elapsed_us(&tv1, &tv2) / rounds);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	sc_context_t *ctx = NULL;
+	FILE *inf;
+	u8 *orig = NULL, *comp = NULL;
+	size_t origLen = 0, compLen = 0;
+	long size;
+	int gzip, rounds = DEFAULT_ROUNDS, r = 1;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: decompress <file> [rounds]\n");
+		return 1;
+	}
+	if (argc == 3)
+		rounds = atoi(argv[2]);
+	if (rounds <= 0)
+		rounds = DEFAULT_ROUNDS;
+
+	inf = fopen(argv[1], "rb");
+	if (inf == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	fseek(inf, 0, SEEK_END);
+	size = ftell(inf);
+	fseek(inf, 0, SEEK_SET);
+	if (size <= 0 || (orig = malloc(size)) == NULL
+			|| fread(orig, 1, size, inf) != (size_t)size) {
+		fprintf(stderr, "Cannot read %s\n", argv[1]);
+		goto err;
+	}
+	origLen = size;
+
+	r = sc_establish_context(&ctx, "decompress");
+	if (r != SC_SUCCESS) {
+		fprintf(stderr, "Failed to establish context: %s\n", sc_strerror(r));
+		goto err;
+	}
+
+	r = 0;
+	for (gzip = 0; gzip <= 1 && r == 0; gzip++) {
+		if (compress_data(orig, origLen, &comp, &compLen, gzip) != 0) {
+			fprintf(stderr, "Compression failed\n");
+			r = 1;
+			break;
+		}
+		printf("%-8s %lu -> %lu bytes, %d rounds\n", gzip ? "gzip" : "zlib",
+				(unsigned long)origLen, (unsigned long)compLen, rounds);
+		r = run(ctx, "growing buffer (previous)", 0, comp, compLen, gzip, orig, origLen, rounds)
+			|| run(ctx, "sc_decompress_alloc", 1, comp, compLen, gzip, orig, origLen, rounds)
+			|| run(ctx, "sc_decompress_alloc_ex, hint", 2, comp, compLen, gzip, orig, origLen, rounds);
+		free(comp);
+		comp = NULL;
+	}
+
+err:
+	if (ctx)
+		sc_release_context(ctx);
+	free(orig);
+	fclose(inf);
+	return r;
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+	fprintf(stderr, "decompress: OpenSC built without zlib\n");
+	return 1;
+}
+
+#endif /* ENABLE_ZLIB */
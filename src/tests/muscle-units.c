@@ -0,0 +1,126 @@
+/*
+ * muscle-units.c: check the MuscleCard WriteObject APDUs at the chunk size
+ * boundary
+ *
+ * Runs msc_negotiate_transfer_units() and msc_update_object() against a
+ * reader that only records the APDUs it is given. With extended APDU
+ * support a full 255 byte chunk makes Lc 264, which has to go out as an
+ * extended APDU; without it the chunks must stay within a short APDU.
+ * The context is built by hand, so no reader driver library is needed.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libopensc/internal.h"
+#include "libopensc/muscle.h"
+
+#define MAX_APDUS	16
+
+static struct {
+	int cse;
+	size_t lc;
+} sent[MAX_APDUS];
+static int nsent;
+
+static int record_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
+{
+	if (nsent < MAX_APDUS) {
+		sent[nsent].cse = apdu->cse;
+		sent[nsent].lc = apdu->lc;
+	}
+	nsent++;
+	apdu->sw1 = 0x90;
+	apdu->sw2 = 0x00;
+	apdu->resplen = 0;
+	return SC_SUCCESS;
+}
+
+static struct sc_reader_operations record_ops;
+static struct sc_reader_driver record_driver = {
+	"Recording reader", "record", &record_ops, 0, 0, NULL
+};
+
+static int check(sc_card_t *card, unsigned long caps, size_t length,
+		size_t chunk, int extended)
+{
+	msc_id id = { { 'c', 'h', 'k', 0 } };
+	u8 data[1024];
+	int i, r, expected = (length + chunk - 1) / chunk;
+
+	card->caps = caps;
+	card->max_send_size = 0;
+	card->max_recv_size = 0;
+	r = msc_negotiate_transfer_units(card, NULL, 0);
+	if (r != SC_SUCCESS) {
+		fprintf(stderr, "caps 0x%lx: negotiation failed: %s\n", caps, sc_strerror(r));
+		return 1;
+	}
+	if (card->max_send_size - 9 != chunk) {
+		fprintf(stderr, "caps 0x%lx: write unit %lu, expected %lu\n", caps,
+			(unsigned long)(card->max_send_size - 9), (unsigned long)chunk);
+		return 1;
+	}
+
+	memset(data, 0x5A, sizeof(data));
+	nsent = 0;
+	r = msc_update_object(card, id, 0, data, length);
+	if (r != (int)length) {
+		fprintf(stderr, "caps 0x%lx: writing %lu bytes failed: %s\n", caps,
+			(unsigned long)length, r < 0 ? sc_strerror(r) : "short write");
+		return 1;
+	}
+	if (nsent != expected) {
+		fprintf(stderr, "caps 0x%lx: %d APDUs sent, expected %d\n", caps, nsent, expected);
+		return 1;
+	}
+	for (i = 0; i < nsent; i++) {
+		size_t part = MIN(length - i * chunk, chunk);
+		int ext = (sent[i].cse & SC_APDU_EXT) != 0;
+
+		if (sent[i].lc != part + 9 || ext != (extended && part + 9 > 255)) {
+			fprintf(stderr, "caps 0x%lx: APDU %d: Lc %lu, %s, expected Lc %lu\n",
+				caps, i, (unsigned long)sent[i].lc,
+				ext ? "extended" : "short", (unsigned long)(part + 9));
+			return 1;
+		}
+	}
+	printf("caps 0x%lx: %lu bytes in %d APDU(s) of up to %lu bytes: ok\n",
+		caps, (unsigned long)length, nsent, (unsigned long)chunk);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	sc_context_t context;
+	sc_context_t *ctx = &context;
+	sc_reader_t reader;
+	sc_card_t card;
+	int r;
+
+	memset(&context, 0, sizeof(context));
+
+	record_ops.transmit = record_transmit;
+	memset(&reader, 0, sizeof(reader));
+	reader.ctx = ctx;
+	reader.driver = &record_driver;
+	reader.ops = &record_ops;
+	reader.name = "Recording reader";
+	reader.active_protocol = SC_PROTO_T1;
+
+	memset(&card, 0, sizeof(card));
+	card.ctx = ctx;
+	card.reader = &reader;
+	card.ops = sc_get_iso7816_driver()->ops;
+	card.cla = 0xB0;
+
+	r = check(&card, SC_CARD_CAP_APDU_EXT, MSC_MAX_CHUNK, MSC_MAX_CHUNK, 1)
+		|| check(&card, SC_CARD_CAP_APDU_EXT, 2 * MSC_MAX_CHUNK + 10, MSC_MAX_CHUNK, 1)
+		|| check(&card, 0, 255 - 9, 255 - 9, 0)
+		|| check(&card, 0, 2 * MSC_MAX_CHUNK + 10, 255 - 9, 0);
+
+	return r;
+}
@@ -0,0 +1,202 @@
+/*
+ * p11digest.c: micro-benchmark of small-message digests through PKCS#11
+ *
+ * Loads a PKCS#11 module, opens a session on the first slot with a token
+ * and times digesting short messages with C_Digest and with the
+ * C_DigestUpdate/C_DigestFinal pair. When a PIN is given, it also logs
+ * in and times signing the same messages with CKM_SHA1_RSA_PKCS and
+ * CKM_SHA256_RSA_PKCS on the first RSA signing key; that is dominated
+ * by the card, so it runs a hundredth of the rounds.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "pkcs11/pkcs11.h"
+#include "common/libpkcs11.h"
+
+#define DEFAULT_ROUNDS	10000
+
+static CK_FUNCTION_LIST_PTR p11 = NULL;
+
+static const struct {
+	CK_MECHANISM_TYPE digest, sign;
+	const char *name;
+} mechs[] = {
+	{ CKM_SHA_1, CKM_SHA1_RSA_PKCS, "SHA-1" },
+	{ CKM_SHA256, CKM_SHA256_RSA_PKCS, "SHA-256" },
+};
+
+static const CK_ULONG sizes[] = { 16, 64, 256, 1024 };
+
+static double elapsed_us(struct timeval *tv1, struct timeval *tv2)
+{
+	return (tv2->tv_sec - tv1->tv_sec) * 1000000.0 + (tv2->tv_usec - tv1->tv_usec);
+}
+
+static CK_RV digest(CK_SESSION_HANDLE session, CK_MECHANISM_TYPE type, int multipart,
+		CK_BYTE_PTR data, CK_ULONG len)
+{
+	CK_MECHANISM mech = { type, NULL, 0 };
+	CK_BYTE out[64];
+	CK_ULONG out_len = sizeof(out);
+	CK_RV rv;
+
+	rv = p11->C_DigestInit(session, &mech);
+	if (rv != CKR_OK)
+		return rv;
+	if (!multipart)
+		return p11->C_Digest(session, data, len, out, &out_len);
+	rv = p11->C_DigestUpdate(session, data, len);
+	if (rv == CKR_OK)
+		rv = p11->C_DigestFinal(session, out, &out_len);
+	return rv;
+}
+
+static CK_RV sign(CK_SESSION_HANDLE session, CK_MECHANISM_TYPE type, CK_OBJECT_HANDLE key,
+		CK_BYTE_PTR data, CK_ULONG len)
+{
+	CK_MECHANISM mech = { type, NULL, 0 };
+	CK_BYTE out[1024];
+	CK_ULONG out_len = sizeof(out);
+	CK_RV rv;
+
+	rv = p11->C_SignInit(session, &mech, key);
+	if (rv == CKR_OK)
+		rv = p11->C_Sign(session, data, len, out, &out_len);
+	return rv;
+}
+
+static int run(CK_SESSION_HANDLE session, const char *name, int mech, int variant,
+		CK_OBJECT_HANDLE key, CK_BYTE_PTR data, CK_ULONG len, int rounds)
+{
+	struct timeval tv1, tv2;
+	CK_RV rv = CKR_OK;
+	int i;
+
+	gettimeofday(&tv1, NULL);
+	for (i = 0; i < rounds && rv == CKR_OK; i++) {
+		if (variant < 2)
+			rv = digest(session, mechs[mech].digest, variant, data, len);
+		else
+			rv = sign(session, mechs[mech].sign, key, data, len);
+	}
+	gettimeofday(&tv2, NULL);
+
+	if (rv == CKR_MECHANISM_INVALID) {
+		printf("%-8s %-24s %5lu bytes  not supported\n", mechs[mech].name, name, len);
+		return 0;
+	}
+	if (rv != CKR_OK) {
+		fprintf(stderr, "%s %s: failed, rv 0x%lx\n", mechs[mech].name, name, rv);
+		return 1;
+	}
+	printf("%-8s %-24s %5lu bytes %10.2f us\n", mechs[mech].name, name, len,
+			elapsed_us(&tv1, &tv2) / rounds);
+	return 0;
+}
+
+static CK_RV find_sign_key(CK_SESSION_HANDLE session, CK_OBJECT_HANDLE_PTR key)
+{
+	CK_OBJECT_CLASS class = CKO_PRIVATE_KEY;
+	CK_KEY_TYPE key_type = CKK_RSA;
+	CK_BBOOL true_val = TRUE;
+	CK_ATTRIBUTE templ[] = {
+		{ CKA_CLASS, &class, sizeof(class) },
+		{ CKA_KEY_TYPE, &key_type, sizeof(key_type) },
+		{ CKA_SIGN, &true_val, sizeof(true_val) },
+	};
+	CK_ULONG count = 0;
+	CK_RV rv;
+
+	rv = p11->C_FindObjectsInit(session, templ, sizeof(templ) / sizeof(templ[0]));
+	if (rv != CKR_OK)
+		return rv;
+	rv = p11->C_FindObjects(session, key, 1, &count);
+	p11->C_FindObjectsFinal(session);
+	if (rv == CKR_OK && count == 0)
+		rv = CKR_KEY_HANDLE_INVALID;
+	return rv;
+}
+
+int main(int argc, char *argv[])
+{
+	void *module;
+	CK_SLOT_ID slots[16];
+	CK_ULONG nslots = sizeof(slots) / sizeof(slots[0]);
+	CK_SESSION_HANDLE session;
+	CK_OBJECT_HANDLE key = CK_INVALID_HANDLE;
+	CK_BYTE data[1024];
+	const char *pin = NULL;
+	int rounds = DEFAULT_ROUNDS, r = 1;
+	unsigned int m, s;
+	CK_RV rv;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "Usage: p11digest <module> [rounds [pin]]\n");
+		return 1;
+	}
+	if (argc >= 3)
+		rounds = atoi(argv[2]);
+	if (rounds <= 0)
+		rounds = DEFAULT_ROUNDS;
+	if (argc == 4)
+		pin = argv[3];
+
+	module = C_LoadModule(argv[1], &p11);
+	if (module == NULL) {
+		fprintf(stderr, "Failed to load %s\n", argv[1]);
+		return 1;
+	}
+	rv = p11->C_Initialize(NULL);
+	if (rv != CKR_OK) {
+		fprintf(stderr, "C_Initialize failed, rv 0x%lx\n", rv);
+		goto err;
+	}
+	rv = p11->C_GetSlotList(TRUE, slots, &nslots);
+	if (rv != CKR_OK || nslots == 0) {
+		fprintf(stderr, "No token present\n");
+		goto fin;
+	}
+	rv = p11->C_OpenSession(slots[0], CKF_SERIAL_SESSION, NULL, NULL, &session);
+	if (rv != CKR_OK) {
+		fprintf(stderr, "C_OpenSession failed, rv 0x%lx\n", rv);
+		goto fin;
+	}
+
+	if (pin != NULL) {
+		rv = p11->C_Login(session, CKU_USER, (CK_UTF8CHAR_PTR) pin, strlen(pin));
+		if (rv == CKR_OK)
+			rv = find_sign_key(session, &key);
+		if (rv != CKR_OK) {
+			fprintf(stderr, "No RSA signing key available, rv 0x%lx\n", rv);
+			goto fin;
+		}
+	}
+
+	for (s = 0; s < sizeof(data); s++)
+		data[s] = (CK_BYTE) s;
+
+	printf("%d rounds\n", rounds);
+	r = 0;
+	for (m = 0; m < sizeof(mechs) / sizeof(mechs[0]) && r == 0; m++) {
+		for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && r == 0; s++) {
+			r = run(session, "C_Digest", m, 0, key, data, sizes[s], rounds)
+				|| run(session, "C_DigestUpdate/Final", m, 1, key, data, sizes[s], rounds);
+			if (r == 0 && key != CK_INVALID_HANDLE)
+				r = run(session, "C_Sign", m, 2, key, data, sizes[s], rounds / 100 + 1);
+		}
+	}
+
+fin:
+	p11->C_Finalize(NULL);
+err:
+	C_UnloadModule(module);
+	return r;
+}
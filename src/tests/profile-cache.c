@@ -0,0 +1,123 @@
+/*
+ * profile-cache.c: micro-benchmark of the pkcs15init profile cache
+ *
+ * Times loading a profile file with scconf_parse(), as sc_profile_load()
+ * does without 'use_profile_cache', and with sc_profile_parse_cached()
+ * once the cache entry has been written by the first call.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "libopensc/opensc.h"
+#include "scconf/scconf.h"
+#include "pkcs15init/profile.h"
+
+#define DEFAULT_ROUNDS	1000
+
+static double elapsed_us(struct timeval *tv1, struct timeval *tv2)
+{
+	return (tv2->tv_sec - tv1->tv_sec) * 1000000.0 + (tv2->tv_usec - tv1->tv_usec);
+}
+
+/* Number of items in the tree, to check both loaders return the same */
+static unsigned long count_items(const scconf_block *block)
+{
+	const scconf_item *item;
+	unsigned long count = 0;
+
+	for (item = block->items; item; item = item->next) {
+		if (item->type == SCCONF_ITEM_TYPE_COMMENT)
+			continue;
+		count++;
+		if (item->type == SCCONF_ITEM_TYPE_BLOCK)
+			count += count_items(item->value.block);
+	}
+	return count;
+}
+
+static int load(sc_context_t *ctx, const char *path, int cached, unsigned long *items)
+{
+	scconf_context *conf;
+	int r;
+
+	if (cached) {
+		r = sc_profile_parse_cached(ctx, path, &conf);
+		if (r != SC_SUCCESS)
+			return -1;
+	}
+	else {
+		conf = scconf_new(path);
+		if (conf == NULL)
+			return -1;
+		if (scconf_parse(conf) <= 0) {
+			scconf_free(conf);
+			return -1;
+		}
+	}
+	*items = count_items(conf->root);
+	scconf_free(conf);
+	return 0;
+}
+
+static int run(sc_context_t *ctx, const char *name, int cached, const char *path,
+		int rounds, unsigned long *items)
+{
+	struct timeval tv1, tv2;
+	unsigned long count = 0;
+	int i, r = 0;
+
+	gettimeofday(&tv1, NULL);
+	for (i = 0; i < rounds && r == 0; i++)
+		r = load(ctx, path, cached, &count);
+	gettimeofday(&tv2, NULL);
+
+	if (r != 0) {
+		fprintf(stderr, "%s: loading %s failed\n", name, path);
+		return 1;
+	}
+	if (*items && count != *items) {
+		fprintf(stderr, "%s: %lu items, expected %lu\n", name, count, *items);
+		return 1;
+	}
+	*items = count;
+	printf("%-32s %8.2f us\n", name, elapsed_us(&tv1, &tv2) / rounds);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	sc_context_t *ctx = NULL;
+	unsigned long items = 0;
+	int rounds = DEFAULT_ROUNDS, r;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: profile-cache <profile file> [rounds]\n");
+		return 1;
+	}
+	if (argc == 3)
+		rounds = atoi(argv[2]);
+	if (rounds <= 0)
+		rounds = DEFAULT_ROUNDS;
+
+	r = sc_establish_context(&ctx, "profile-cache");
+	if (r != SC_SUCCESS) {
+		fprintf(stderr, "Failed to establish context: %s\n", sc_strerror(r));
+		return 1;
+	}
+
+	printf("%s, %d rounds\n", argv[1], rounds);
+	/* the first cached load parses the profile and writes the cache entry */
+	r = run(ctx, "scconf_parse", 0, argv[1], rounds, &items)
+		|| run(ctx, "sc_profile_parse_cached, first", 1, argv[1], 1, &items)
+		|| run(ctx, "sc_profile_parse_cached", 1, argv[1], rounds, &items);
+
+	sc_release_context(ctx);
+	return r;
+}
@@ -50,7 +50,8 @@ static int	verbose = 0;
 
 enum {
 	OPT_SERIAL = 0x100,
-	OPT_LIST_ALG
+	OPT_LIST_ALG,
+	OPT_STATS
 };
 
 static const struct option options[] = {
@@ -67,6 +68,7 @@ static const struct option options[] = {
 	{ "reader",		1, NULL,		'r' },
 	{ "card-driver",	1, NULL,		'c' },
 	{ "list-algorithms",    0, NULL,	OPT_LIST_ALG },
+	{ "stats",		0, NULL,	OPT_STATS },
 	{ "wait",		0, NULL,		'w' },
 	{ "verbose",		0, NULL,		'v' },
 	{ NULL, 0, NULL, 0 }
@@ -86,6 +88,7 @@ static const char *option_help[] = {
 	"Uses reader number <arg> [0]",
 	"Forces the use of driver <arg> [auto-detect]",
 	"Lists algorithms supported by card",
+	"Prints the APDU statistics of the other operations",
 	"Wait for a card to be inserted",
 	"Verbose operation. Use several times to enable debug output.",
 };
@@ -639,6 +642,74 @@ static int list_algorithms(void)
 	return 0;
 }
 
+static void print_apdu_stats_line(const char *label, const struct sc_apdu_stats *st)
+{
+	printf("%-8s %7lu %7lu %9llu %9llu %9.1f %8.2f %8.2f %6lu %5lu %5lu %5lu %5lu %5lu %5lu\n",
+		label, st->count, st->round_trips, st->bytes_sent, st->bytes_received,
+		st->time_us / 1000.0, st->count ? st->time_us / 1000.0 / st->count : 0.0,
+		st->max_time_us / 1000.0,
+		st->sw[SC_APDU_STATS_SW_OK], st->sw[SC_APDU_STATS_SW_MORE_DATA],
+		st->sw[SC_APDU_STATS_SW_WRONG_LE], st->sw[SC_APDU_STATS_SW_WARNING],
+		st->sw[SC_APDU_STATS_SW_ERROR], st->sw[SC_APDU_STATS_SW_OTHER],
+		st->sw[SC_APDU_STATS_SW_FAILED]);
+
+	if (verbose && st->count) {
+		int i, last = 0;
+
+		for (i = 0; i < SC_APDU_STATS_HIST_SIZE; i++)
+			if (st->hist[i])
+				last = i;
+		printf("%8s latency (us, log2 buckets):", "");
+		for (i = 0; i <= last; i++)
+			printf(" <%lu:%lu", 2UL << i, st->hist[i]);
+		printf("\n");
+	}
+}
+
+static int print_apdu_stats(void)
+{
+	struct sc_apdu_stats *stats = NULL;
+	size_t i, count = 0;
+	char label[16];
+	int r;
+
+	r = sc_get_apdu_stats(card, NULL, &count);
+	if (r == SC_SUCCESS && count) {
+		stats = calloc(count, sizeof(struct sc_apdu_stats));
+		if (stats == NULL)
+			return 1;
+		r = sc_get_apdu_stats(card, stats, &count);
+	}
+	if (r) {
+		fprintf(stderr, "Failed to get APDU statistics: %s\n", sc_strerror(r));
+		free(stats);
+		return 1;
+	}
+
+	printf("%-8s %7s %7s %9s %9s %9s %8s %8s %6s %5s %5s %5s %5s %5s %5s\n",
+		"CLA/INS", "count", "trips", "sent", "received", "total ms", "avg ms", "max ms",
+		"90XX", "61XX", "6CXX", "warn", "err", "other", "fail");
+	for (i = 0; i < count; i++) {
+		snprintf(label, sizeof(label), "%02X/%02X", stats[i].cla, stats[i].ins);
+		print_apdu_stats_line(label, &stats[i]);
+	}
+	print_apdu_stats_line("reader", &card->reader->apdu_stats);
+
+	if (verbose) {
+		const struct sc_ctx_timing *t = &ctx->timing;
+
+		printf("\nContext created in %.3f ms (config %.3f, reader driver %.3f, card drivers %.3f)\n",
+			t->create / 1000.0, t->config / 1000.0,
+			t->reader_driver / 1000.0, t->card_drivers / 1000.0);
+		printf("Deferred: readers detected in %.3f ms, ATR tables %.3f ms, driver modules %.3f ms\n",
+			t->detect_readers / 1000.0, t->card_atrs / 1000.0,
+			t->driver_loads / 1000.0);
+	}
+
+	free(stats);
+	return 0;
+}
+
 int main(int argc, char * const argv[])
 {
 	int err = 0, r, c, long_optind = 0;
@@ -653,6 +724,7 @@ int main(int argc, char * const argv[])
 	int do_print_serial = 0;
 	int do_print_name = 0;
 	int do_list_algorithms = 0;
+	int do_print_stats = 0;
 	int action_count = 0;
 	const char *opt_driver = NULL;
 	const char *opt_conf_entry = NULL;
@@ -738,6 +810,10 @@ int main(int argc, char * const argv[])
 			do_list_algorithms = 1;
 			action_count++;
 			break;
+		case OPT_STATS:
+			do_print_stats = 1;
+			action_count++;
+			break;
 		}
 	}
 	if (action_count == 0)
@@ -841,6 +917,12 @@ int main(int argc, char * const argv[])
 			goto end;
 		action_count--;
 	}
+
+	if (do_print_stats) {
+		if ((err = print_apdu_stats()))
+			goto end;
+		action_count--;
+	}
 end:
 	if (card) {
 		sc_unlock(card);
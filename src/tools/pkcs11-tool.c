@@ -24,6 +24,14 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #ifdef ENABLE_OPENSSL
 #include <openssl/opensslv.h>
 #if OPENSSL_VERSION_NUMBER >= 0x10000000L
@@ -102,7 +110,13 @@ enum {
 	OPT_NEW_PIN,
 	OPT_LOGIN_TYPE,
 	OPT_TEST_EC,
-	OPT_DERIVE
+	OPT_DERIVE,
+	OPT_BENCHMARK,
+	OPT_BENCHMARK_THREADS,
+	OPT_BENCHMARK_SESSIONS,
+	OPT_BENCHMARK_DURATION,
+	OPT_BENCHMARK_COUNT,
+	OPT_BENCHMARK_ALL_SLOTS
 };
 
 static const struct option options[] = {
@@ -158,6 +172,12 @@ static const struct option options[] = {
 	{ "verbose",		0, NULL,		'v' },
 	{ "private",		0, NULL,		OPT_PRIVATE },
 	{ "test-ec",		0, NULL,		OPT_TEST_EC },
+	{ "benchmark",		1, NULL,		OPT_BENCHMARK },
+	{ "benchmark-threads",	1, NULL,		OPT_BENCHMARK_THREADS },
+	{ "benchmark-sessions",	1, NULL,		OPT_BENCHMARK_SESSIONS },
+	{ "benchmark-duration",	1, NULL,		OPT_BENCHMARK_DURATION },
+	{ "benchmark-count",	1, NULL,		OPT_BENCHMARK_COUNT },
+	{ "benchmark-all-slots", 0, NULL,		OPT_BENCHMARK_ALL_SLOTS },
 
 	{ NULL, 0, NULL, 0 }
 };
@@ -214,7 +234,13 @@ static const char *option_help[] = {
 	"Test Mozilla-like keypair gen and cert req, <arg>=certfile",
 	"Verbose operation. (Set OPENSC_DEBUG to enable OpenSC specific debugging)",
 	"Set the CKA_PRIVATE attribute (object is only viewable after a login)",
-	"Test EC (best used with the --login or --pin option)"
+	"Test EC (best used with the --login or --pin option)",
+	"Benchmark <arg>: sign, decrypt, digest, random or find-objects (JSON output)",
+	"Number of benchmark threads (default 1)",
+	"Number of sessions each benchmark thread rotates over (default 1)",
+	"Benchmark duration in seconds (default 10)",
+	"Number of operations per benchmark thread, instead of a duration",
+	"Spread the benchmark threads over all slots with a token"
 };
 
 static const char *	app_name = "pkcs11-tool"; /* for utils.c */
@@ -261,6 +287,55 @@ static CK_SLOT_ID_PTR p11_slots = NULL;
 static CK_ULONG p11_num_slots = 0;
 static int suppress_warn = 0;
 
+/*
+ * Benchmark mode: run one kind of operation in a loop from several
+ * threads, each with its own sessions, and report throughput and
+ * latency distribution as JSON.
+ */
+#define BENCH_MAX_THREADS	64
+#define BENCH_MAX_SESSIONS	16
+#define BENCH_DATA_LEN		32
+#define BENCH_HIST_BUCKETS	32	/* log2 buckets of microseconds */
+
+enum {
+	BENCH_SIGN = 1,
+	BENCH_DECRYPT,
+	BENCH_DIGEST,
+	BENCH_RANDOM,
+	BENCH_FIND_OBJECTS
+};
+
+static const char *bench_names[] = {
+	NULL, "sign", "decrypt", "digest", "random", "find-objects"
+};
+
+/* Per slot state, set up before the worker threads are started */
+struct bench_slot {
+	CK_SLOT_ID		slot;
+	CK_SESSION_HANDLE	session;	/* keeps the token logged in */
+	CK_OBJECT_HANDLE	key;
+	CK_MECHANISM_TYPE	mechanism;
+	unsigned char		input[512];
+	CK_ULONG		input_len;
+};
+
+struct bench_thread {
+	struct bench_slot	*slot;
+	CK_SESSION_HANDLE	sessions[BENCH_MAX_SESSIONS];
+	unsigned long		*latencies;	/* in microseconds */
+	unsigned long		count, size;
+	unsigned long		errors;
+	CK_RV			first_error;
+};
+
+static int		bench_workload;
+static unsigned int	bench_threads = 1;
+static unsigned int	bench_sessions = 1;
+static unsigned int	bench_duration;
+static unsigned long	bench_count;
+static int		bench_all_slots;
+static unsigned long long bench_deadline;
+
 struct flag_info {
 	CK_FLAGS	value;
 	const char *	name;
@@ -350,6 +425,8 @@ static int test_card_detection(int);
 static int		hex_to_bin(const char *in, CK_BYTE *out, size_t *outlen);
 static void		test_kpgen_certwrite(CK_SLOT_ID slot, CK_SESSION_HANDLE session);
 static void		test_ec(CK_SLOT_ID slot, CK_SESSION_HANDLE session);
+static void		benchmark(CK_SESSION_HANDLE session);
+static int		bench_workload_by_name(const char *name);
 static CK_RV		find_object_with_attributes(CK_SESSION_HANDLE session, CK_OBJECT_HANDLE *out,
 				CK_ATTRIBUTE *attrs, CK_ULONG attrsLen, CK_ULONG obj_index);
 static CK_ULONG		get_private_key_length(CK_SESSION_HANDLE sess, CK_OBJECT_HANDLE prkey);
@@ -380,6 +457,7 @@ int main(int argc, char * argv[])
 	int do_test = 0;
 	int do_test_kpgen_certwrite = 0;
 	int do_test_ec = 0;
+	int do_benchmark = 0;
 	int need_session = 0;
 	int opt_login = 0;
 	int do_init_token = 0;
@@ -645,6 +723,31 @@ int main(int argc, char * argv[])
 			do_derive = 1;
 			action_count++;
 			break;
+		case OPT_BENCHMARK:
+			need_session |= NEED_SESSION_RO;
+			do_benchmark = 1;
+			bench_workload = bench_workload_by_name(optarg);
+			if (!bench_workload) {
+				fprintf(stderr, "Unsupported benchmark workload \"%s\"\n", optarg);
+				util_print_usage_and_die(app_name, options, option_help, NULL);
+			}
+			action_count++;
+			break;
+		case OPT_BENCHMARK_THREADS:
+			bench_threads = (unsigned int) strtoul(optarg, NULL, 0);
+			break;
+		case OPT_BENCHMARK_SESSIONS:
+			bench_sessions = (unsigned int) strtoul(optarg, NULL, 0);
+			break;
+		case OPT_BENCHMARK_DURATION:
+			bench_duration = (unsigned int) strtoul(optarg, NULL, 0);
+			break;
+		case OPT_BENCHMARK_COUNT:
+			bench_count = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_BENCHMARK_ALL_SLOTS:
+			bench_all_slots = 1;
+			break;
 		default:
 			util_print_usage_and_die(app_name, options, option_help, NULL);
 		}
@@ -660,7 +763,16 @@ int main(int argc, char * argv[])
 	if (module == NULL)
 		util_fatal("Failed to load pkcs11 module");
 
-	rv = p11->C_Initialize(NULL);
+	if (do_benchmark && bench_threads > 1) {
+		CK_C_INITIALIZE_ARGS	init_args;
+
+		/* The module will be called from several threads */
+		memset(&init_args, 0, sizeof(init_args));
+		init_args.flags = CKF_OS_LOCKING_OK;
+		rv = p11->C_Initialize(&init_args);
+	} else {
+		rv = p11->C_Initialize(NULL);
+	}
 	if (rv == CKR_CRYPTOKI_ALREADY_INITIALIZED)
 		printf("\n*** Cryptoki library has already been initialized ***\n");
 	else if (rv != CKR_OK)
@@ -736,7 +848,7 @@ int main(int argc, char * argv[])
 	if (do_list_mechs)
 		list_mechs(opt_slot);
 
-	if (do_sign) {
+	if (do_sign || (do_benchmark && (bench_workload == BENCH_SIGN || bench_workload == BENCH_DECRYPT))) {
 		CK_TOKEN_INFO	info;
 
 		get_token_info(opt_slot, &info);
@@ -861,6 +973,9 @@ int main(int argc, char * argv[])
 
 	if (do_test_ec)
 		test_ec(opt_slot, session);
+
+	if (do_benchmark)
+		benchmark(session);
 end:
 	if (session != CK_INVALID_HANDLE) {
 		rv = p11->C_CloseSession(session);
@@ -4139,6 +4254,324 @@ static int test_card_detection(int wait_for_event)
 	return 0;
 }
 
+static unsigned long long bench_now_us(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER	freq, now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (unsigned long long) (now.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static int bench_workload_by_name(const char *name)
+{
+	int	i;
+
+	for (i = BENCH_SIGN; i <= BENCH_FIND_OBJECTS; i++)
+		if (!strcmp(name, bench_names[i]))
+			return i;
+	return 0;
+}
+
+static CK_RV bench_one_op(struct bench_thread *bt, CK_SESSION_HANDLE sess)
+{
+	struct bench_slot	*bs = bt->slot;
+	CK_MECHANISM		mech = { bs->mechanism, NULL, 0 };
+	unsigned char		data[BENCH_DATA_LEN], out[1024];
+	CK_OBJECT_HANDLE	objects[16];
+	CK_ULONG		out_len = sizeof(out), count;
+	CK_RV			rv;
+
+	switch (bench_workload) {
+	case BENCH_SIGN:
+		memset(data, 0x5A, sizeof(data));
+		rv = p11->C_SignInit(sess, &mech, bs->key);
+		if (rv == CKR_OK)
+			rv = p11->C_Sign(sess, data, sizeof(data), out, &out_len);
+		return rv;
+	case BENCH_DECRYPT:
+		rv = p11->C_DecryptInit(sess, &mech, bs->key);
+		if (rv == CKR_OK)
+			rv = p11->C_Decrypt(sess, bs->input, bs->input_len, out, &out_len);
+		return rv;
+	case BENCH_DIGEST:
+		memset(data, 0x5A, sizeof(data));
+		rv = p11->C_DigestInit(sess, &mech);
+		if (rv == CKR_OK)
+			rv = p11->C_Digest(sess, data, sizeof(data), out, &out_len);
+		return rv;
+	case BENCH_RANDOM:
+		return p11->C_GenerateRandom(sess, out, BENCH_DATA_LEN);
+	case BENCH_FIND_OBJECTS:
+		rv = p11->C_FindObjectsInit(sess, NULL, 0);
+		if (rv != CKR_OK)
+			return rv;
+		do {
+			rv = p11->C_FindObjects(sess, objects, sizeof(objects)/sizeof(objects[0]), &count);
+		} while (rv == CKR_OK && count);
+		p11->C_FindObjectsFinal(sess);
+		return rv;
+	}
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+static void *bench_worker(void *arg)
+{
+	struct bench_thread	*bt = (struct bench_thread *) arg;
+	unsigned long		n;
+
+	for (n = 0; ; n++) {
+		CK_SESSION_HANDLE	*sess = &bt->sessions[n % bench_sessions];
+		unsigned long long	start, end;
+		CK_RV			rv;
+
+		if (bench_count && n >= bench_count)
+			break;
+		start = bench_now_us();
+		if (bench_deadline && start >= bench_deadline)
+			break;
+
+		rv = bench_one_op(bt, *sess);
+		end = bench_now_us();
+
+		if (rv != CKR_OK) {
+			if (!bt->errors++)
+				bt->first_error = rv;
+			/* The failed operation may still be active in the session,
+			 * and every later Init would fail: closing the session ends it */
+			p11->C_CloseSession(*sess);
+			rv = p11->C_OpenSession(bt->slot->slot, CKF_SERIAL_SESSION, NULL, NULL, sess);
+			if (rv != CKR_OK) {
+				*sess = CK_INVALID_HANDLE;
+				break;
+			}
+			continue;
+		}
+		if (bt->count == bt->size) {
+			unsigned long	*tmp;
+
+			bt->size = bt->size ? bt->size * 2 : 1024;
+			tmp = realloc(bt->latencies, bt->size * sizeof(*tmp));
+			if (tmp == NULL)
+				util_fatal("Not enough memory for the benchmark results");
+			bt->latencies = tmp;
+		}
+		bt->latencies[bt->count++] = (unsigned long) (end - start);
+	}
+	return NULL;
+}
+
+static int bench_cmp_ulong(const void *a, const void *b)
+{
+	unsigned long	x = *(const unsigned long *) a, y = *(const unsigned long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Find the key and mechanism a slot is benchmarked with */
+static void bench_prepare_slot(struct bench_slot *bs, CK_SESSION_HANDLE sess)
+{
+	CK_OBJECT_HANDLE	pubkey;
+	CK_MECHANISM		mech;
+	CK_ULONG		len;
+	CK_RV			rv;
+
+	bs->mechanism = opt_mechanism;
+	switch (bench_workload) {
+	case BENCH_SIGN:
+		if (!opt_mechanism_used
+				&& !find_mechanism(bs->slot, CKF_SIGN|CKF_HW, NULL, 0, &bs->mechanism))
+			util_fatal("Sign mechanism not supported\n");
+		if (!find_object(sess, CKO_PRIVATE_KEY, &bs->key,
+				opt_object_id_len ? opt_object_id : NULL, opt_object_id_len, 0))
+			util_fatal("Private key not found in slot 0x%lx", bs->slot);
+		break;
+	case BENCH_DECRYPT:
+		if (!opt_mechanism_used)
+			bs->mechanism = CKM_RSA_PKCS;
+		if (!find_object(sess, CKO_PRIVATE_KEY, &bs->key,
+				opt_object_id_len ? opt_object_id : NULL, opt_object_id_len, 0))
+			util_fatal("Private key not found in slot 0x%lx", bs->slot);
+		if (!find_object(sess, CKO_PUBLIC_KEY, &pubkey,
+				opt_object_id_len ? opt_object_id : NULL, opt_object_id_len, 0))
+			util_fatal("Public key not found in slot 0x%lx", bs->slot);
+
+		/* One cipher text is decrypted over and over again */
+		memset(&mech, 0, sizeof(mech));
+		mech.mechanism = bs->mechanism;
+		len = sizeof(bs->input);
+		rv = p11->C_EncryptInit(sess, &mech, pubkey);
+		if (rv == CKR_OK)
+			rv = p11->C_Encrypt(sess, (CK_BYTE_PTR) "OpenSC benchmark", 16, bs->input, &len);
+		if (rv != CKR_OK)
+			p11_fatal("C_Encrypt (needed to prepare the decrypt benchmark)", rv);
+		bs->input_len = len;
+		break;
+	case BENCH_DIGEST:
+		if (!opt_mechanism_used)
+			bs->mechanism = CKM_SHA_1;
+		break;
+	}
+}
+
+static void benchmark(CK_SESSION_HANDLE session)
+{
+	struct bench_slot	slots[BENCH_MAX_THREADS];
+	struct bench_thread	threads[BENCH_MAX_THREADS];
+	unsigned int		nslots = 0, i, j;
+	unsigned long		total = 0, errors = 0, hist[BENCH_HIST_BUCKETS], *all, *p;
+	unsigned long long	start, elapsed;
+	CK_RV			rv;
+#ifdef HAVE_PTHREAD
+	pthread_t		tids[BENCH_MAX_THREADS];
+#endif
+
+	if (bench_threads < 1 || bench_threads > BENCH_MAX_THREADS)
+		util_fatal("The number of benchmark threads must be between 1 and %d", BENCH_MAX_THREADS);
+	if (bench_sessions < 1 || bench_sessions > BENCH_MAX_SESSIONS)
+		util_fatal("The number of benchmark sessions must be between 1 and %d", BENCH_MAX_SESSIONS);
+	if (!bench_duration && !bench_count)
+		bench_duration = 10;
+#ifndef HAVE_PTHREAD
+	if (bench_threads > 1)
+		util_fatal("Multi-threaded benchmark is not supported on this platform");
+#endif
+
+	memset(slots, 0, sizeof(slots));
+	memset(threads, 0, sizeof(threads));
+
+	/* The slot selected as usual comes first, it is already logged in */
+	slots[nslots].slot = opt_slot;
+	slots[nslots++].session = CK_INVALID_HANDLE;
+	bench_prepare_slot(&slots[0], session);
+	if (bench_all_slots) {
+		for (i = 0; i < p11_num_slots && nslots < bench_threads; i++) {
+			CK_SLOT_INFO		info;
+			CK_SESSION_HANDLE	sess;
+
+			if (p11_slots[i] == opt_slot)
+				continue;
+			rv = p11->C_GetSlotInfo(p11_slots[i], &info);
+			if (rv != CKR_OK || !(info.flags & CKF_TOKEN_PRESENT))
+				continue;
+
+			slots[nslots].slot = p11_slots[i];
+			rv = p11->C_OpenSession(p11_slots[i], CKF_SERIAL_SESSION, NULL, NULL, &sess);
+			if (rv != CKR_OK)
+				p11_fatal("C_OpenSession", rv);
+			if (opt_pin) {
+				/* Login state is kept per token, not per session */
+				rv = p11->C_Login(sess, CKU_USER, (CK_UTF8CHAR *) opt_pin, strlen(opt_pin));
+				if (rv != CKR_OK && rv != CKR_USER_ALREADY_LOGGED_IN)
+					p11_fatal("C_Login", rv);
+			}
+			slots[nslots].session = sess;
+			bench_prepare_slot(&slots[nslots], sess);
+			nslots++;
+		}
+	}
+
+	/* Threads are spread over the slots round-robin */
+	for (i = 0; i < bench_threads; i++) {
+		threads[i].slot = &slots[i % nslots];
+		for (j = 0; j < bench_sessions; j++) {
+			rv = p11->C_OpenSession(threads[i].slot->slot, CKF_SERIAL_SESSION,
+					NULL, NULL, &threads[i].sessions[j]);
+			if (rv != CKR_OK)
+				p11_fatal("C_OpenSession", rv);
+		}
+	}
+
+	start = bench_now_us();
+	bench_deadline = bench_duration ? start + bench_duration * 1000000ULL : 0;
+#ifdef HAVE_PTHREAD
+	for (i = 0; i < bench_threads; i++)
+		if (pthread_create(&tids[i], NULL, bench_worker, &threads[i]))
+			util_fatal("Cannot start benchmark thread");
+	for (i = 0; i < bench_threads; i++)
+		pthread_join(tids[i], NULL);
+#else
+	bench_worker(&threads[0]);
+#endif
+	elapsed = bench_now_us() - start;
+
+	for (i = 0; i < bench_threads; i++) {
+		total += threads[i].count;
+		errors += threads[i].errors;
+		for (j = 0; j < bench_sessions; j++)
+			if (threads[i].sessions[j] != CK_INVALID_HANDLE)
+				p11->C_CloseSession(threads[i].sessions[j]);
+	}
+	for (i = 0; i < nslots; i++)
+		if (slots[i].session != CK_INVALID_HANDLE)
+			p11->C_CloseSession(slots[i].session);
+
+	/* Merge the samples for the percentiles */
+	all = malloc((total ? total : 1) * sizeof(*all));
+	if (all == NULL)
+		util_fatal("Not enough memory for the benchmark results");
+	for (i = 0, p = all; i < bench_threads; i++) {
+		if (threads[i].count)
+			memcpy(p, threads[i].latencies, threads[i].count * sizeof(*all));
+		p += threads[i].count;
+		free(threads[i].latencies);
+	}
+	qsort(all, total, sizeof(*all), bench_cmp_ulong);
+
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < total; i++) {
+		unsigned long	v = all[i];
+
+		for (j = 0; v > 1 && j < BENCH_HIST_BUCKETS - 1; j++)
+			v >>= 1;
+		hist[j]++;
+	}
+
+	printf("{\n");
+	printf("  \"workload\": \"%s\",\n", bench_names[bench_workload]);
+	if (bench_workload != BENCH_RANDOM && bench_workload != BENCH_FIND_OBJECTS)
+		printf("  \"mechanism\": \"%s\",\n", p11_mechanism_to_name(slots[0].mechanism));
+	printf("  \"threads\": %u,\n", bench_threads);
+	printf("  \"sessions_per_thread\": %u,\n", bench_sessions);
+	printf("  \"slots\": [");
+	for (i = 0; i < nslots; i++)
+		printf("%s%lu", i ? ", " : "", slots[i].slot);
+	printf("],\n");
+	printf("  \"elapsed_s\": %.6f,\n", elapsed / 1000000.0);
+	printf("  \"operations\": %lu,\n", total);
+	printf("  \"errors\": %lu,\n", errors);
+	for (i = 0; i < bench_threads; i++)
+		if (threads[i].errors) {
+			printf("  \"first_error\": \"%s\",\n", CKR2Str(threads[i].first_error));
+			break;
+		}
+	printf("  \"ops_per_s\": %.2f,\n", elapsed ? total * 1000000.0 / elapsed : 0.0);
+	printf("  \"latency_us\": {\n");
+	if (total) {
+		printf("    \"min\": %lu,\n", all[0]);
+		printf("    \"p50\": %lu,\n", all[(total - 1) * 50 / 100]);
+		printf("    \"p95\": %lu,\n", all[(total - 1) * 95 / 100]);
+		printf("    \"p99\": %lu,\n", all[(total - 1) * 99 / 100]);
+		printf("    \"max\": %lu,\n", all[total - 1]);
+	}
+	/* Bucket i holds the samples in [2^i, 2^(i+1)) microseconds */
+	printf("    \"histogram_log2\": [");
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+		printf("%s%lu", i ? ", " : "", hist[i]);
+	printf("]\n");
+	printf("  }\n");
+	printf("}\n");
+
+	free(all);
+}
+
 static int p11_test(CK_SESSION_HANDLE session)
 {
 	int errors = 0;
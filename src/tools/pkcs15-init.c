@@ -35,9 +35,16 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <errno.h>
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
 #include <openssl/opensslv.h>
 #if OPENSSL_VERSION_NUMBER >= 0x00907000L
 #include <openssl/conf.h>
@@ -116,6 +123,7 @@ static void	parse_commandline(int argc, char **argv);
 static void	read_options_file(const char *);
 static void	ossl_print_errors(void);
 static int	verify_pin(struct sc_pkcs15_card *, char *);
+static void	run_parallel_jobs(char *);
 
 enum {
 	OPT_OPTIONS = 0x100,
@@ -138,6 +146,7 @@ enum {
 	OPT_UPDATE_LAST_UPDATE,
 	OPT_ERASE_APPLICATION,
 	OPT_IGNORE_CA_CERTIFICATES,
+	OPT_PARALLEL_READERS,
 
 	OPT_PIN1     = 0x10000,	/* don't touch these values */
 	OPT_PUK1     = 0x10001,
@@ -164,6 +173,7 @@ const struct option	options[] = {
 	{ "erase-application",	required_argument, NULL,	OPT_ERASE_APPLICATION},
 
 	{ "reader",		required_argument, NULL,	'r' },
+	{ "parallel-readers",	required_argument, NULL,	OPT_PARALLEL_READERS },
 	{ "pin",		required_argument, NULL,	OPT_PIN1 },
 	{ "puk",		required_argument, NULL,	OPT_PUK1 },
 	{ "so-pin",		required_argument, NULL,	OPT_PIN2 },
@@ -224,6 +234,7 @@ static const char *		option_help[] = {
 	"Erase application with AID <arg>",
 
 	"Specify which reader to use",
+	"Run the same actions on the cards in a comma separated list of readers at once",
 	"Specify PIN",
 	"Specify unblock PIN",
 	"Specify security officer (SO) PIN",
@@ -328,6 +339,7 @@ static sc_context_t *	ctx = NULL;
 static sc_card_t *		card = NULL;
 static struct sc_pkcs15_card *	p15card = NULL;
 static char *			opt_reader = NULL;
+static char *			opt_parallel_readers = NULL;
 static unsigned int		opt_actions;
 static int			opt_extractable = 0,
 				opt_insecure = 0,
@@ -445,6 +457,10 @@ main(int argc, char **argv)
 		util_print_usage_and_die(app_name, options, option_help, NULL);
 	}
 
+	/* In the parallel mode only the per-reader child processes get here */
+	if (opt_parallel_readers)
+		run_parallel_jobs(opt_parallel_readers);
+
 	/* Connect to the card */
 	if (!open_reader_and_card(opt_reader))
 		return 1;
@@ -579,6 +595,13 @@ main(int argc, char **argv)
 
 out:
 	if (profile) {
+		if (verbose && profile->df_stats.updates)
+			printf("PKCS#15 DF updates: %u (%u differential), %lu bytes written, "
+				"%lu bytes unchanged, %u write APDUs (%u saved)\n",
+				profile->df_stats.updates, profile->df_stats.diff_updates,
+				(unsigned long) profile->df_stats.bytes_written,
+				(unsigned long) profile->df_stats.bytes_skipped,
+				profile->df_stats.apdus, profile->df_stats.apdus_saved);
 		sc_pkcs15init_unbind(profile);
 	}
 	if (p15card) {
@@ -619,6 +642,111 @@ open_reader_and_card(char *reader)
 	return 1;
 }
 
+/*
+ * Personalize the cards of several readers concurrently.
+ *
+ * Every reader gets its own child process, which goes on with the
+ * usual single card flow (with its own context and card handle) and
+ * returns from here. The parent waits for all of them, reports the
+ * outcome and timing of each card and exits.
+ */
+#define MAX_PARALLEL_READERS	16
+
+static void
+run_parallel_jobs(char *readers)
+{
+#ifndef _WIN32
+	struct {
+		char *		reader;
+		pid_t		pid;
+		int		status;
+		struct timeval	start, end;
+	} jobs[MAX_PARALLEL_READERS];
+	struct timeval	start, end;
+	unsigned int	njobs = 0, running = 0, failed = 0, ii;
+	char		*reader;
+	pid_t		pid;
+	int		status;
+
+	for (reader = strtok(readers, ","); reader; reader = strtok(NULL, ",")) {
+		if (njobs == MAX_PARALLEL_READERS)
+			util_fatal("Too many readers, at most %d are supported", MAX_PARALLEL_READERS);
+		jobs[njobs].reader = reader;
+		jobs[njobs].pid = -1;
+		jobs[njobs].status = -1;
+		njobs++;
+	}
+	if (!njobs)
+		util_fatal("No readers specified");
+	if (!opt_no_prompt && !opt_pins[OPT_PIN1 & 3] && !opt_pins[OPT_PIN2 & 3]
+			&& !(opt_actions & (1 << ACTION_ERASE)))
+		fprintf(stderr, "Warning: PINs are not given on the command line; "
+				"concurrent PIN prompts will be interleaved\n");
+
+	/* Flush before fork, or buffered output is duplicated in the children */
+	fflush(stdout);
+	fflush(stderr);
+
+	gettimeofday(&start, NULL);
+	for (ii = 0; ii < njobs; ii++) {
+		gettimeofday(&jobs[ii].start, NULL);
+		pid = fork();
+		if (pid == 0) {
+			opt_reader = jobs[ii].reader;
+			return;
+		}
+		if (pid < 0) {
+			fprintf(stderr, "Cannot start job for reader %s: %s\n",
+					jobs[ii].reader, strerror(errno));
+			continue;
+		}
+		jobs[ii].pid = pid;
+		running++;
+	}
+
+	while (running && (pid = wait(&status)) > 0) {
+		for (ii = 0; ii < njobs; ii++) {
+			if (jobs[ii].pid != pid)
+				continue;
+			gettimeofday(&jobs[ii].end, NULL);
+			jobs[ii].status = status;
+			running--;
+			break;
+		}
+	}
+	gettimeofday(&end, NULL);
+
+	for (ii = 0; ii < njobs; ii++) {
+		double	secs = (jobs[ii].end.tv_sec - jobs[ii].start.tv_sec)
+				+ (jobs[ii].end.tv_usec - jobs[ii].start.tv_usec) / 1000000.0;
+
+		if (jobs[ii].pid < 0) {
+			printf("Reader %s: not started\n", jobs[ii].reader);
+			failed++;
+		}
+		else if (WIFEXITED(jobs[ii].status) && WEXITSTATUS(jobs[ii].status) == 0) {
+			printf("Reader %s: done in %.3f s\n", jobs[ii].reader, secs);
+		}
+		else if (WIFEXITED(jobs[ii].status)) {
+			printf("Reader %s: failed (exit status %d) after %.3f s\n", jobs[ii].reader,
+					WEXITSTATUS(jobs[ii].status), secs);
+			failed++;
+		}
+		else {
+			printf("Reader %s: terminated by signal %d after %.3f s\n", jobs[ii].reader,
+					WIFSIGNALED(jobs[ii].status) ? WTERMSIG(jobs[ii].status) : -1, secs);
+			failed++;
+		}
+	}
+	printf("%u of %u cards personalized in %.3f s\n", njobs - failed, njobs,
+			(end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0);
+
+	exit(failed ? 1 : 0);
+#else
+	util_fatal("Parallel personalization is not supported on this platform");
+#endif
+}
+
 /*
  * Make sure there's no pkcs15 structure on the card
  */
@@ -2435,6 +2563,9 @@ handle_option(const struct option *opt)
 	case 'r':
 		opt_reader = optarg;
 		break;
+	case OPT_PARALLEL_READERS:
+		opt_parallel_readers = optarg;
+		break;
 	case 'u':
 		parse_x509_usage(optarg, &opt_x509_usage);
 		break;